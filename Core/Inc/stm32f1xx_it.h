@@ -59,7 +59,8 @@ void DMA1_Channel7_IRQHandler(void);
 void USART2_IRQHandler(void);
 void EXTI15_10_IRQHandler(void);
 /* USER CODE BEGIN EFP */
-
+void TIM4_IRQHandler(void);
+void DMA1_Channel2_IRQHandler(void);
 /* USER CODE END EFP */
 
 #ifdef __cplusplus
@@ -0,0 +1,26 @@
+// Module: blockdev.h
+//
+// Minimal block device interface (512 byte sectors), no HAL dependencies
+// Implemented by sd_spi.c on the target, and by a file backed stand-in on the host (Tools/logsd.c).
+#ifndef BLOCKDEV_H
+#define BLOCKDEV_H
+
+#include <stdint.h>
+
+#define BLOCKDEV_SECTOR_SIZE  512
+
+typedef struct blockdev {
+	// All functions return 0 on success
+	int (*read)(struct blockdev *dev, uint32_t sector, uint8_t *buf, uint32_t count);
+	int (*write)(struct blockdev *dev, uint32_t sector, const uint8_t *buf, uint32_t count);
+	// Optional hint that the next write is count sectors long (SD: ACMD23 pre-erase), may be NULL
+	int (*pre_erase)(struct blockdev *dev, uint32_t count);
+	// Optional non-blocking write, may be NULL (write() is used): write_start() begins the write (buf must
+	// stay untouched until it's done), write_poll() moves it along, returns 1 while busy, 0 when done
+	int (*write_start)(struct blockdev *dev, uint32_t sector, const uint8_t *buf, uint32_t count);
+	int (*write_poll)(struct blockdev *dev);
+	uint32_t sectors;     // device size
+	void *ctx;            // driver private data
+} blockdev_t;
+
+#endif // BLOCKDEV_H
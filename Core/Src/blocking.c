@@ -0,0 +1,91 @@
+// Module: blocking.c
+//
+// Blocking call detector: call site list and report (see blocking.h)
+
+#include <stdint.h>
+#include <string.h>
+#include "log.h"
+#include "blocking.h"
+
+static block_site_t *_block_sites;      // sites that ran, newest first
+static uint32_t _block_interval = BLOCK_REPORT_MS;
+static uint32_t _block_last_tick;       // poll interval
+static uint32_t _block_report_tick;     // last report, any caller
+
+//=============================================================================
+// A wrapped call returned: charge its wait to the call site
+void block_end(block_site_t *site, uint32_t start_cycles) {
+//=============================================================================
+	uint32_t cycles = dwt_cycles() - start_cycles;
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	if(!site->listed) {
+		site->listed = 1;
+		site->next = _block_sites;
+		_block_sites = site;
+	}
+	site->calls++;
+	site->total_cycles += cycles;
+	if(cycles > site->max_cycles) site->max_cycles = cycles;
+	if(__get_IPSR()) site->in_isr = 1;
+	__set_PRIMASK(primask);
+}
+
+//=============================================================================
+void block_set_interval(uint32_t ms) {
+//=============================================================================
+	_block_interval = ms;
+}
+
+//=============================================================================
+// One line per site, most time blocked first: calls, total ms, longest call (us), % of the time since the
+// previous report.  All sites are cleared, listed or not.
+void block_report(void) {
+//=============================================================================
+	block_site_t top[BLOCK_REPORT_TOP];
+	uint8_t count = 0;
+	uint32_t now = HAL_GetTick();
+	uint32_t elapsed_ms = now - _block_report_tick;
+	_block_report_tick = now;
+
+	for(block_site_t *site = _block_sites; site; site = site->next) {
+		uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+		block_site_t snap = *site;
+		site->calls = 0;
+		site->max_cycles = 0;
+		site->total_cycles = 0;
+		site->in_isr = 0;
+		__set_PRIMASK(primask);
+		if(!snap.calls) continue;
+		// insertion into the top list, by total cycles, descending
+		uint8_t j = count < BLOCK_REPORT_TOP ? count++ : BLOCK_REPORT_TOP;
+		while(j > 0 && top[j-1].total_cycles < snap.total_cycles) {
+			if(j < BLOCK_REPORT_TOP) top[j] = top[j-1];
+			j--;
+		}
+		if(j < BLOCK_REPORT_TOP) top[j] = snap;
+	}
+	if(!count) return;
+
+	uint64_t interval_cycles = (uint64_t)(elapsed_ms ? elapsed_ms : 1) * DWT_CYCLES_PER_US * 1000;
+	logtag(LOG_TAG_STATS, "blocking calls, %lu ms: call site calls total(ms) max(us) blocked(%%)", elapsed_ms);
+	for(uint8_t i = 0; i < count; i++) {
+		const block_site_t *s = &top[i];
+		const char *file = strrchr(s->file, '/');
+		file = file ? file + 1 : s->file;
+		logtag(LOG_TAG_STATS, "%-18s %s:%u %lu %lu %lu %lu%s", s->call, file, s->line, s->calls,
+				(uint32_t)(s->total_cycles / (DWT_CYCLES_PER_US * 1000)), s->max_cycles / DWT_CYCLES_PER_US,
+				(uint32_t)(s->total_cycles * 100 / interval_cycles), s->in_isr ? " isr" : "");
+	}
+}
+
+//=============================================================================
+void block_poll(void) {
+//=============================================================================
+	if(!_block_interval) return;
+	uint32_t now = HAL_GetTick();
+	if(now - _block_last_tick < _block_interval) return;
+	_block_last_tick = now;
+	block_report();
+}
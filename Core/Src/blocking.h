@@ -0,0 +1,76 @@
+// Module: blocking.h
+//
+// Blocking call detector
+// Included by a source file (after its other includes), the HAL calls that wait by polling become macros
+// timing each call with the DWT cycle counter, against its call site:
+//   HAL_Delay(), HAL_UART_Transmit(), HAL_UART_Receive(), HAL_DMA_PollForTransfer(),
+//   HAL_SPI_Transmit(), HAL_SPI_Receive(), HAL_SPI_TransmitReceive() (with HAL_SPI_MODULE_ENABLED)
+// Each call site gets a counter block in RAM (file, line, calls, total and longest wait in cycles), linked
+// into a list by its first call.  Interrupts taken during the call are counted in its wait, the caller
+// is blocked all the same.  A call from an interrupt handler marks its site "isr".
+// block_report() logs the sites that waited the most since the previous report, and clears them.
+//
+// Calls longer than the CYCCNT wrap (~59 s) are under-counted.  Only the including file is instrumented,
+// the HAL's own internal waits (ex: HAL_RCC_OscConfig()) are not.
+#ifndef BLOCKING_H
+#define BLOCKING_H
+
+#include <stdint.h>
+#include "main.h"  // the HAL prototypes, declared before the macros below replace the names
+#include "dwt.h"
+
+#ifndef BLOCK_DETECT
+#define BLOCK_DETECT  1                // 0: the HAL calls are left alone
+#endif
+#define BLOCK_REPORT_MS   60000        // default interval of the periodic report
+#define BLOCK_REPORT_TOP  8            // sites listed per report
+
+typedef struct block_site {
+	const char *call;
+	const char *file;
+	uint16_t line;
+	uint8_t listed;                    // on the list of sites that ran
+	uint8_t in_isr;                    // called from an interrupt handler
+	struct block_site *next;
+	uint32_t calls;
+	uint32_t max_cycles;
+	uint64_t total_cycles;
+} block_site_t;
+
+void block_end(block_site_t *site, uint32_t start_cycles);
+void block_set_interval(uint32_t ms);  // 0 disables the periodic report
+void block_poll(void);                 // call from main loop
+void block_report(void);               // log the worst sites now, and clear them all
+
+#if BLOCK_DETECT
+#define BLOCK_SITE(name)  static block_site_t _block_site = { #name, __FILE__, __LINE__, 0, 0, 0, 0, 0, 0 }
+
+// A call returning a value (statement expression: the value is the HAL call's)
+#define BLOCK_CALL(name, call) ({ \
+	BLOCK_SITE(name); \
+	uint32_t _block_start = dwt_cycles(); \
+	__typeof__(call) _block_result = (call); \
+	block_end(&_block_site, _block_start); \
+	_block_result; })
+
+#define BLOCK_CALL_VOID(name, call) do { \
+	BLOCK_SITE(name); \
+	uint32_t _block_start = dwt_cycles(); \
+	call; \
+	block_end(&_block_site, _block_start); \
+	} while(0)
+
+// The names inside the expansions aren't expanded again: they call the HAL functions
+#define HAL_Delay(ms)                                   BLOCK_CALL_VOID(HAL_Delay, HAL_Delay(ms))
+#define HAL_UART_Transmit(huart, data, size, timeout)   BLOCK_CALL(HAL_UART_Transmit, HAL_UART_Transmit(huart, data, size, timeout))
+#define HAL_UART_Receive(huart, data, size, timeout)    BLOCK_CALL(HAL_UART_Receive, HAL_UART_Receive(huart, data, size, timeout))
+#define HAL_DMA_PollForTransfer(hdma, level, timeout)   BLOCK_CALL(HAL_DMA_PollForTransfer, HAL_DMA_PollForTransfer(hdma, level, timeout))
+#ifdef HAL_SPI_MODULE_ENABLED
+#define HAL_SPI_Transmit(hspi, data, size, timeout)     BLOCK_CALL(HAL_SPI_Transmit, HAL_SPI_Transmit(hspi, data, size, timeout))
+#define HAL_SPI_Receive(hspi, data, size, timeout)      BLOCK_CALL(HAL_SPI_Receive, HAL_SPI_Receive(hspi, data, size, timeout))
+#define HAL_SPI_TransmitReceive(hspi, tx, rx, size, timeout) \
+		BLOCK_CALL(HAL_SPI_TransmitReceive, HAL_SPI_TransmitReceive(hspi, tx, rx, size, timeout))
+#endif
+#endif
+
+#endif // BLOCKING_H
@@ -0,0 +1,25 @@
+// Module: dwt.h
+//
+// Cortex-M3 DWT (Data Watchpoint and Trace) cycle counter helpers
+// CYCCNT counts CPU clocks (72 MHz), and wraps every ~59 seconds.
+// Unsigned subtraction of two readings gives the correct delta across a single wrap.
+#ifndef DWT_H
+#define DWT_H
+
+#include <main.h>
+
+#define DWT_CYCLES_PER_US  (72)   // SystemClock_Config() runs the core at 72 MHz
+
+static inline void dwt_init(void)
+{
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk; // enable DWT / ITM blocks
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+static inline uint32_t dwt_cycles(void)
+{
+	return DWT->CYCCNT;
+}
+
+#endif // DWT_H
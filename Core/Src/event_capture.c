@@ -0,0 +1,214 @@
+// Module: event_capture.c
+//
+// TIM4 input capture with DMA (see event_capture.h)
+// LOG_FRAME_EVENTS payload : input, us32 of the first edge, { varint (us since previous edge << 1 | rising) }...
+//                            (the first edge has a delta of 0)
+//
+// 16 to 32 bit extension: captures are converted in the TIM4 interrupt, at most half a counter period
+// after they were taken.  With "now" known as 32-bit microseconds there, a capture c is the most recent
+// time not after now whose low 16 bits are c: now - (uint16_t)(now - c).
+
+#include <stdint.h>
+#include <string.h>
+#include <main.h>
+#include "log.h"
+#include "metrics.h"
+#include "event_capture.h"
+
+#if EVENT_CAPTURE
+
+event_capture_stats_t event_capture_stats;
+
+typedef struct {
+	uint32_t us;
+	uint8_t rising;
+} event_t;
+
+static volatile uint16_t _rise_dma[EVENT_CAPTURE_DMA_ENTRIES];  // DMA1 channel 4 <- TIM4->CCR2
+static volatile uint16_t _fall_dma[EVENT_CAPTURE_DMA_ENTRIES];  // DMA1 channel 1 <- TIM4->CCR1
+static uint16_t _rise_read, _fall_read;                          // next DMA ring entry to convert
+static volatile uint16_t _overflows;                             // upper 16 bits of the microsecond time
+
+static event_t _events[EVENT_CAPTURE_RING];
+static volatile uint16_t _event_head, _event_tail;               // written in the ISR, read by poll
+
+//=============================================================================
+static void dma_ring_start(DMA_Channel_TypeDef *ch, volatile uint32_t *ccr, volatile uint16_t *ring) {
+//=============================================================================
+	ch->CCR = 0;
+	ch->CPAR = (uint32_t)ccr;
+	ch->CMAR = (uint32_t)ring;
+	ch->CNDTR = EVENT_CAPTURE_DMA_ENTRIES;
+	// peripheral to memory, 16 bit both sides, memory increment, circular
+	ch->CCR = DMA_CCR_MINC | DMA_CCR_CIRC | DMA_CCR_PSIZE_0 | DMA_CCR_MSIZE_0 | DMA_CCR_EN;
+}
+
+//=============================================================================
+void event_capture_init(void) {
+//=============================================================================
+	__HAL_RCC_GPIOB_CLK_ENABLE();
+	__HAL_RCC_DMA1_CLK_ENABLE();
+	// PB7 floating input (TIM4_CH2, no remap)
+	GPIOB->CRL = (GPIOB->CRL & ~(GPIO_CRL_MODE7 | GPIO_CRL_CNF7)) | GPIO_CRL_CNF7_0;
+
+	_rise_read = _fall_read = 0;
+	_event_head = _event_tail = 0;
+	dma_ring_start(DMA1_Channel4, &TIM4->CCR2, _rise_dma);
+	dma_ring_start(DMA1_Channel1, &TIM4->CCR1, _fall_dma);
+
+	// CH1 (configured for PWM by CubeMX, never started) becomes IC1 on TI2, CH2 IC2 on TI2
+	TIM4->CCER &= ~(TIM_CCER_CC1E | TIM_CCER_CC2E);
+	TIM4->CCMR1 = (2 << TIM_CCMR1_CC1S_Pos) | (EVENT_CAPTURE_FILTER << TIM_CCMR1_IC1F_Pos) |
+			(1 << TIM_CCMR1_CC2S_Pos) | (EVENT_CAPTURE_FILTER << TIM_CCMR1_IC2F_Pos);
+	TIM4->CCER = (TIM4->CCER & ~(TIM_CCER_CC1P | TIM_CCER_CC2P)) | TIM_CCER_CC1P |  // CH1 falling, CH2 rising
+			TIM_CCER_CC1E | TIM_CCER_CC2E;
+	// CH3: compare only (frozen output), interrupt half way through the counter period
+	TIM4->CCR3 = 0x8000;
+	TIM4->SR = 0;
+	TIM4->DIER |= TIM_DIER_CC1DE | TIM_DIER_CC2DE | TIM_DIER_UIE | TIM_DIER_CC3IE;
+	HAL_NVIC_SetPriority(TIM4_IRQn, 0, 0);
+	HAL_NVIC_EnableIRQ(TIM4_IRQn);
+}
+
+//=============================================================================
+// DMA ring position the next capture will be written to
+static uint16_t dma_ring_write(DMA_Channel_TypeDef *ch) {
+//=============================================================================
+	uint16_t write = EVENT_CAPTURE_DMA_ENTRIES - ch->CNDTR;
+	return write == EVENT_CAPTURE_DMA_ENTRIES ? 0 : write;
+}
+
+//=============================================================================
+// Did the DMA pass ring position boundary on its way from read to write (read excluded, write included)?
+static inline int dma_ring_passed(uint16_t read, uint16_t write, uint16_t boundary) {
+//=============================================================================
+	uint16_t n = EVENT_CAPTURE_DMA_ENTRIES;
+	return read != write && (uint16_t)((boundary - read - 1 + n) % n) < (uint16_t)((write - read + n) % n);
+}
+
+//=============================================================================
+// Half transfer / transfer complete flags of a ring (read and cleared), against the boundaries the DMA
+// should have passed since the last conversion: a flag nothing explains means the ring was lapped.
+static int dma_ring_lapped(uint32_t flags, uint16_t read, uint16_t write) {
+//=============================================================================
+	return ((flags & (DMA_ISR_HTIF1 | DMA_ISR_HTIF4)) && !dma_ring_passed(read, write, EVENT_CAPTURE_DMA_ENTRIES / 2)) ||
+			((flags & (DMA_ISR_TCIF1 | DMA_ISR_TCIF4)) && !dma_ring_passed(read, write, 0));
+}
+
+//=============================================================================
+// Convert the ring entries from *read up to write into 32-bit times, returns the number converted
+static uint16_t dma_ring_take(volatile uint16_t *ring, uint16_t *read, uint16_t write, uint32_t now, uint32_t *out) {
+//=============================================================================
+	uint16_t n = 0;
+	while(*read != write) {
+		out[n++] = now - (uint16_t)((uint16_t)now - ring[*read]);
+		if(++*read == EVENT_CAPTURE_DMA_ENTRIES) *read = 0;
+	}
+	return n;
+}
+
+//=============================================================================
+static void event_put(uint32_t us, uint8_t rising) {
+//=============================================================================
+	uint16_t next = (_event_tail + 1) % EVENT_CAPTURE_RING;
+	event_capture_stats.events++;
+	if(next == _event_head) {
+		event_capture_stats.lost++;
+		return;
+	}
+	_events[_event_tail].us = us;
+	_events[_event_tail].rising = rising;
+	_event_tail = next;
+}
+
+//=============================================================================
+// Convert both DMA rings, merge the edges in time order
+static void drain(void) {
+//=============================================================================
+	uint32_t rise[EVENT_CAPTURE_DMA_ENTRIES], fall[EVENT_CAPTURE_DMA_ENTRIES];
+	// Flags first: a boundary passed after this is seen in the positions below, or next time
+	uint32_t dma_flags = DMA1->ISR & (DMA_ISR_HTIF1 | DMA_ISR_TCIF1 | DMA_ISR_HTIF4 | DMA_ISR_TCIF4);
+	DMA1->IFCR = dma_flags;
+	uint32_t overcapture = TIM4->SR & (TIM_SR_CC1OF | TIM_SR_CC2OF);
+	if(overcapture) {
+		TIM4->SR = ~overcapture;
+		event_capture_stats.overruns++;
+	}
+	// "now" is read after the DMA positions, so it is not older than any capture taken
+	uint16_t rise_write = dma_ring_write(DMA1_Channel4);
+	uint16_t fall_write = dma_ring_write(DMA1_Channel1);
+	uint16_t cnt = TIM4->CNT;
+	uint16_t high = _overflows;
+	if((TIM4->SR & TIM_SR_UIF) && cnt < 0x8000) high++; // wrapped, update interrupt not handled yet
+	uint32_t now = ((uint32_t)high << 16) | cnt;
+	if(dma_ring_lapped(dma_flags & (DMA_ISR_HTIF4 | DMA_ISR_TCIF4), _rise_read, rise_write)) event_capture_stats.overruns++;
+	if(dma_ring_lapped(dma_flags & (DMA_ISR_HTIF1 | DMA_ISR_TCIF1), _fall_read, fall_write)) event_capture_stats.overruns++;
+
+	uint16_t nr = dma_ring_take(_rise_dma, &_rise_read, rise_write, now, rise);
+	uint16_t nf = dma_ring_take(_fall_dma, &_fall_read, fall_write, now, fall);
+	uint16_t r = 0, f = 0;
+	while(r < nr || f < nf) {
+		if(f == nf || (r < nr && (int32_t)(rise[r] - fall[f]) <= 0)) event_put(rise[r++], 1);
+		else event_put(fall[f++], 0);
+	}
+}
+
+//=============================================================================
+void event_capture_irq(void) {
+//=============================================================================
+	uint32_t sr = TIM4->SR;
+	if(sr & TIM_SR_UIF) {
+		TIM4->SR = (uint32_t)~TIM_SR_UIF;
+		_overflows++;
+		drain();
+	}
+	if(sr & TIM_SR_CC3IF) {
+		TIM4->SR = (uint32_t)~TIM_SR_CC3IF;
+		drain();
+	}
+}
+
+//=============================================================================
+void event_capture_poll(void) {
+//=============================================================================
+	uint8_t payload[LOG_ITEM_MAX_SIZE - LOG_FRAME_HEADER_SIZE];
+	uint32_t prev = 0;
+	uint8_t len = 0;
+	uint16_t head = _event_head; // events leave the ring once their frame is queued
+
+	METRIC_SET(EVENT_EDGES, event_capture_stats.events);
+	METRIC_SET(EVENT_LOST, event_capture_stats.lost);
+	METRIC_SET(EVENT_OVERRUNS, event_capture_stats.overruns);
+
+	while(head != _event_tail) {
+		const event_t *e = &_events[head];
+		if(!len) {
+			payload[0] = EVENT_CAPTURE_INPUT;
+			log_put_u32(&payload[1], e->us);
+			len = 5;
+			prev = e->us;
+		}
+		uint8_t bytes[5];
+		uint8_t n = log_put_varint(bytes, ((e->us - prev) << 1) | e->rising);
+		if(len + n > sizeof(payload)) {
+			// Frame full, the next one starts with this edge
+			if(log_frame(LOG_FRAME_EVENTS, payload, len) < 0) return; // queue full, retry next poll
+			_event_head = head;
+			len = 0;
+			continue;
+		}
+		memcpy(&payload[len], bytes, n);
+		len += n;
+		prev = e->us;
+		head = (head + 1) % EVENT_CAPTURE_RING;
+	}
+	if(len && log_frame(LOG_FRAME_EVENTS, payload, len) >= 0) _event_head = head;
+}
+
+#else // EVENT_CAPTURE
+
+void event_capture_init(void) { }
+void event_capture_irq(void) { }
+void event_capture_poll(void) { }
+
+#endif // EVENT_CAPTURE
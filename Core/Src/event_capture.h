@@ -0,0 +1,52 @@
+// Module: event_capture.h
+//
+// Hardware timestamped edge capture on PB7 (TIM4_CH2 pin), merged into the log as LOG_FRAME_EVENTS
+// TIM4 runs at 1 MHz.  Both input capture channels watch TI2 (PB7): CH2 latches rising edges and CH1
+// (indirect mode) falling edges.  Each capture is copied by DMA (DMA1 channel 4 / channel 1, circular)
+// into a small ring, with no interrupt per edge.  The TIM4 update interrupt (counter overflow, every
+// 65.536 ms) and the CH3 compare interrupt (half way) extend the 16-bit captures to 32-bit microseconds
+// and merge both channels in time order.  event_capture_poll() sends them from the main loop, at least
+// every EVENT_CAPTURE_POLL_MS while it waits: one frame holds the first timestamp, then a varint delta
+// per edge (typically 1-3 bytes).
+// Timestamps are TIM4 microseconds since event_capture_init(), wrapping after 71 minutes.
+//
+// Rate limits: a DMA ring holds EVENT_CAPTURE_DMA_ENTRIES edges per half period (32.768 ms) per edge
+// direction: ~975 edges/s each way, ~1950 edges/s sustained for a square wave, bursts up to 32 edges
+// each way within 32 ms.  The event ring is sized for EVENT_CAPTURE_RATE edges/s over the longest gap
+// between two polls (EVENT_CAPTURE_GAP_MS), twice over.  At ~2 bytes per edge, 1950 edges/s take ~35%
+// of the 115200 baud link, shared with the other traffic: while the queue is full, the edges wait in the
+// event ring, and edges beyond it are counted one by one (lost).  A DMA ring lapped between two
+// conversions is detected from the DMA half / complete flags, and a capture the DMA didn't read in time
+// from the TIM4 overcapture flags: both count an overrun, the number of edges lost then isn't known (up
+// to EVENT_CAPTURE_DMA_ENTRIES per lap).
+// event_capture_poll() copies the counts to the events.* metrics.
+// Nucleo-F103RB: to time the B1 button, add a jumper from PC13 (B1) to PB7.
+#ifndef EVENT_CAPTURE_H
+#define EVENT_CAPTURE_H
+
+#include <stdint.h>
+
+#ifndef EVENT_CAPTURE
+#define EVENT_CAPTURE  1             // 0: TIM4 stays a free running benchmark timer only
+#endif
+#define EVENT_CAPTURE_DMA_ENTRIES  32  // per channel DMA ring (16-bit captures)
+#define EVENT_CAPTURE_POLL_MS      10  // main loop wait slice, event_capture_poll() after each
+#define EVENT_CAPTURE_GAP_MS       40  // longest time between polls: a wait slice plus a main loop pass
+#define EVENT_CAPTURE_RATE         1950 // edges/s the event ring is sized for (the DMA rings' ceiling)
+#define EVENT_CAPTURE_RING  (2 * EVENT_CAPTURE_RATE * EVENT_CAPTURE_GAP_MS / 1000) // events waiting for a poll
+#define EVENT_CAPTURE_FILTER       3   // TIMx_CCMR1 ICxF input filter (3: 8 samples at 72 MHz)
+#define EVENT_CAPTURE_INPUT        0   // input id in the frames (only PB7 for now)
+
+typedef struct {
+	uint32_t events;     // edges captured
+	uint32_t lost;       // event ring full
+	uint32_t overruns;   // DMA ring lapped, or capture overwritten before the DMA read it
+} event_capture_stats_t;
+
+extern event_capture_stats_t event_capture_stats;
+
+void event_capture_init(void);  // after MX_TIM4_Init(), TIM4 keeps counting for the benchmarks
+void event_capture_irq(void);   // from TIM4_IRQHandler()
+void event_capture_poll(void);  // call from main loop
+
+#endif // EVENT_CAPTURE_H
@@ -0,0 +1,66 @@
+// Module: gpio_trace.c
+//
+// GPIO trace channel (see gpio_trace.h)
+// Wire format of a LOG_FRAME_TRACE_SYNC payload:
+//   tick (uint32), DWT cycles at the rising edge (uint32), sequence number (uint8)
+// The bus carries the low 4 bits of the sequence number while the sync pin is high.
+
+#include <stdint.h>
+#include "log.h"
+#include "gpio_trace.h"
+#include "dwt.h"
+
+#if GPIO_TRACE
+static uint8_t _sync_seq;
+static uint32_t _sync_last_tick;
+#endif
+
+//=============================================================================
+void gpio_trace_init(void) {
+//=============================================================================
+#if GPIO_TRACE
+	uint32_t pins = (1u << GPIO_TRACE_SYNC_PIN) | (1u << GPIO_TRACE_ISR_PIN) |
+			(GPIO_TRACE_BUS_MASK << GPIO_TRACE_BUS_PIN);
+	__HAL_RCC_GPIOC_CLK_ENABLE();
+	GPIO_TRACE_PORT->BSRR = pins << 16;
+	// Push-pull outputs, 50 MHz (MODE 11, CNF 00), PC0 - PC7 are in CRL
+	for(uint8_t pin = 0; pin < 8; pin++) {
+		if(!(pins & (1u << pin))) continue;
+		GPIO_TRACE_PORT->CRL = (GPIO_TRACE_PORT->CRL & ~(0xFu << (pin * 4))) | (0x3u << (pin * 4));
+	}
+	_sync_seq = 0;
+	gpio_trace_sync();
+#endif
+}
+
+//=============================================================================
+// Sync pulse, bus showing the sequence number, then the frame telling the host when it happened
+void gpio_trace_sync(void) {
+//=============================================================================
+#if GPIO_TRACE
+	uint8_t payload[9];
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq(); // a fixed pulse width, and no ISR marker during the pulse
+	uint32_t cycles = dwt_cycles();
+	GPIO_TRACE_PORT->BSRR = GPIO_TRACE_BSRR(_sync_seq) | (1u << GPIO_TRACE_SYNC_PIN);
+	while(dwt_cycles() - cycles < GPIO_TRACE_SYNC_CYCLES) {
+	}
+	GPIO_TRACE_PORT->BSRR = GPIO_TRACE_BSRR(0) | (1u << (GPIO_TRACE_SYNC_PIN + 16));
+	__set_PRIMASK(primask);
+
+	_sync_last_tick = HAL_GetTick();
+	log_put_u32(payload, _sync_last_tick);
+	log_put_u32(&payload[4], cycles);
+	payload[8] = _sync_seq++;
+	log_frame(LOG_FRAME_TRACE_SYNC, payload, sizeof(payload)); // a pulse without frame is skipped by the host
+#endif
+}
+
+//=============================================================================
+void gpio_trace_poll(void) {
+//=============================================================================
+#if GPIO_TRACE
+	if(HAL_GetTick() - _sync_last_tick >= GPIO_TRACE_SYNC_MS)
+		gpio_trace_sync();
+#endif
+}
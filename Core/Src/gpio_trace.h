@@ -0,0 +1,56 @@
+// Module: gpio_trace.h
+//
+// GPIO trace channel for a logic analyzer / oscilloscope, no UART cost
+// Markers are single BSRR writes of a constant (one store, the pins change together):
+// * PC2-PC5, 4-bit bus : GPIO_TRACE_BEGIN(id) / GPIO_TRACE_EVENT(id) drive id (1-15), GPIO_TRACE_END()
+//     drives 0.  The bus shows the last marker, so a region is the time its id stays on the bus, and
+//     an event is a change to its id (the same id twice in a row is one change - END in between).
+//     Regions don't nest, the bus holds one code.
+// * PC1 : GPIO_TRACE_ISR_ENTER() / GPIO_TRACE_ISR_EXIT(), high while a traced interrupt runs
+// * PC0 : sync, gpio_trace_poll() pulses it every GPIO_TRACE_SYNC_MS with the low 4 bits of a sequence
+//     number on the bus, and queues a LOG_FRAME_TRACE_SYNC frame with the sequence number, tick and DWT
+//     cycles of the pulse.
+// Tools/la_align.c reads the analyzer export (CSV or VCD) with the log capture, matches the pulses to
+// the frames, and prints the pin activity on the log timeline (analyzer resolution, drift corrected).
+// Nucleo-F103RB: PC0 / PC1 are A5 / A4 on the Arduino header, PC2 - PC5 are on the morpho headers.
+#ifndef GPIO_TRACE_H
+#define GPIO_TRACE_H
+
+#include <stdint.h>
+#include <main.h>
+
+#ifndef GPIO_TRACE
+#define GPIO_TRACE  1              // 0: markers compile to nothing, pins left alone
+#endif
+#define GPIO_TRACE_PORT        GPIOC
+#define GPIO_TRACE_SYNC_PIN    0     // pin numbers on GPIO_TRACE_PORT
+#define GPIO_TRACE_ISR_PIN     1
+#define GPIO_TRACE_BUS_PIN     2     // first of GPIO_TRACE_BUS_BITS pins
+#define GPIO_TRACE_BUS_BITS    4
+#define GPIO_TRACE_SYNC_MS     1000  // sync pulse interval
+#define GPIO_TRACE_SYNC_CYCLES 72    // sync pulse width (1 us), wide enough for slow analyzers
+
+#define GPIO_TRACE_BUS_MASK  ((1u << GPIO_TRACE_BUS_BITS) - 1)
+// BSRR value driving code on the bus: set the one bits, reset the zero bits
+#define GPIO_TRACE_BSRR(code) \
+	((((uint32_t)(code) & GPIO_TRACE_BUS_MASK) << GPIO_TRACE_BUS_PIN) | \
+	 ((~(uint32_t)(code) & GPIO_TRACE_BUS_MASK) << (GPIO_TRACE_BUS_PIN + 16)))
+
+#if GPIO_TRACE
+#define GPIO_TRACE_CODE(code)   (GPIO_TRACE_PORT->BSRR = GPIO_TRACE_BSRR(code))
+#define GPIO_TRACE_ISR_ENTER()  (GPIO_TRACE_PORT->BSRR = 1u << GPIO_TRACE_ISR_PIN)
+#define GPIO_TRACE_ISR_EXIT()   (GPIO_TRACE_PORT->BSRR = 1u << (GPIO_TRACE_ISR_PIN + 16))
+#else
+#define GPIO_TRACE_CODE(code)   ((void)0)
+#define GPIO_TRACE_ISR_ENTER()  ((void)0)
+#define GPIO_TRACE_ISR_EXIT()   ((void)0)
+#endif
+#define GPIO_TRACE_BEGIN(id)    GPIO_TRACE_CODE(id)
+#define GPIO_TRACE_EVENT(id)    GPIO_TRACE_CODE(id)
+#define GPIO_TRACE_END()        GPIO_TRACE_CODE(0)
+
+void gpio_trace_init(void);   // pins as outputs, all low, first sync pulse
+void gpio_trace_sync(void);   // sync pulse now (leaves the bus at 0), with its LOG_FRAME_TRACE_SYNC frame
+void gpio_trace_poll(void);   // call from main loop, between regions
+
+#endif // GPIO_TRACE_H
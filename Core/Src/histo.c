@@ -0,0 +1,138 @@
+// Module: histo.c
+//
+// Log2 bucket histograms (see histo.h)
+// Wire format of a LOG_FRAME_HISTOGRAM payload:
+//   tick (uint32 little endian), id, varints: count, min, max, sum,
+//   then { bucket index, varint count } for each non-empty bucket
+// Worst case (all 33 buckets used) is 5 + 1 + 20 + 33*6 bytes, more than a log item holds, so
+// buckets that don't fit are sent in a continuation frame (same tick and id, count of zero).
+
+#include <stdint.h>
+#include <string.h>
+#include "log.h"
+#include "histo.h"
+
+const char * const histo_names[HISTO_COUNT] = {
+#define HISTO(id, name) name,
+#include "histo_def.h"
+#undef HISTO
+};
+
+histo_t histo_data[HISTO_COUNT];
+static uint32_t _histo_interval = HISTO_INTERVAL_MS;
+static uint32_t _histo_last_tick;
+
+#define HISTO_MAX_PAYLOAD  (LOG_ITEM_MAX_SIZE - LOG_FRAME_HEADER_SIZE)
+
+//=============================================================================
+static void histo_clear(histo_t *h) {
+//=============================================================================
+	memset(h, 0, sizeof(*h));
+	h->min = UINT32_MAX;
+}
+
+//=============================================================================
+// Clear all histograms, send the name table, one frame per histogram: id, name (not null terminated)
+void histo_init(void) {
+//=============================================================================
+	uint8_t payload[HISTO_MAX_PAYLOAD];
+	for(uint8_t id = 0; id < HISTO_COUNT; id++) {
+		uint16_t len = strlen(histo_names[id]);
+		if(len > HISTO_MAX_PAYLOAD - 1) len = HISTO_MAX_PAYLOAD - 1;
+		histo_clear(&histo_data[id]);
+		payload[0] = id;
+		memcpy(&payload[1], histo_names[id], len);
+		log_frame(LOG_FRAME_HISTO_DESC, payload, len + 1);
+	}
+	_histo_last_tick = HAL_GetTick();
+}
+
+//=============================================================================
+void histo_set_interval(uint32_t ms) {
+//=============================================================================
+	_histo_interval = ms;
+}
+
+//=============================================================================
+// Export one histogram and clear it.  Empty histograms aren't sent.
+// Returns number of frames sent, -1 if the log queue was full (histogram is kept for next time)
+// Histograms may be recorded from an ISR (LOG_QUEUE_US / LOG_TX_US, from the UART DMA completion), so the
+// copy and the subtraction run with interrupts disabled; the encoding doesn't.
+int histo_export(histo_id_t id) {
+//=============================================================================
+	histo_t *h = &histo_data[id];
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	histo_t snap = *h; // recording may continue while we encode
+	if(snap.count) {
+		// min / max start over with this window, samples recorded while encoding belong to the next one
+		h->min = UINT32_MAX;
+		h->max = 0;
+	}
+	__set_PRIMASK(primask);
+	uint8_t payload[HISTO_MAX_PAYLOAD];
+	uint16_t len;
+	uint8_t b = 0;
+	int frames = 0;
+
+	if(!snap.count) return 0;
+
+	// The first frame carries the summary, continuation frames carry a zero count
+	len = 5;
+	log_put_u32(payload, HAL_GetTick());
+	payload[4] = id;
+	len += log_put_varint(&payload[len], snap.count);
+	len += log_put_varint(&payload[len], snap.min);
+	len += log_put_varint(&payload[len], snap.max);
+	len += log_put_varint(&payload[len], snap.sum);
+
+	while(1) {
+		for(; b < HISTO_BUCKETS && len + 6 <= HISTO_MAX_PAYLOAD; b++) {
+			if(!snap.bucket[b]) continue;
+			payload[len++] = b;
+			len += log_put_varint(&payload[len], snap.bucket[b]);
+		}
+		if(log_frame(LOG_FRAME_HISTOGRAM, payload, len) < 0) {
+			if(frames) break; // summary went out, drop the remaining buckets rather than count them twice
+			// Nothing sent: put min / max back for the next export
+			primask = __get_PRIMASK();
+			__disable_irq();
+			if(snap.min < h->min) h->min = snap.min;
+			if(snap.max > h->max) h->max = snap.max;
+			__set_PRIMASK(primask);
+			return -1;
+		}
+		frames++;
+		while(b < HISTO_BUCKETS && !snap.bucket[b]) b++;
+		if(b >= HISTO_BUCKETS) break; // no bucket left for a continuation frame
+		len = 5;
+		payload[len++] = 0; // continuation: count of zero, no min/max/sum
+	}
+
+	// Subtract what was exported, keeping anything recorded while encoding
+	primask = __get_PRIMASK();
+	__disable_irq();
+	h->count -= snap.count;
+	h->sum -= snap.sum;
+	for(b = 0; b < HISTO_BUCKETS; b++) h->bucket[b] -= snap.bucket[b];
+	if(!h->count) histo_clear(h);
+	__set_PRIMASK(primask);
+	return frames;
+}
+
+//=============================================================================
+void histo_export_all(void) {
+//=============================================================================
+	for(uint8_t id = 0; id < HISTO_COUNT; id++)
+		histo_export(id);
+}
+
+//=============================================================================
+void histo_poll(void) {
+//=============================================================================
+	if(!_histo_interval) return;
+	uint32_t now = HAL_GetTick();
+	if(now - _histo_last_tick < _histo_interval) return;
+	_histo_last_tick = now;
+	histo_export_all();
+}
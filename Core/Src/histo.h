@@ -0,0 +1,62 @@
+// Module: histo.h
+//
+// Low overhead histograms with log2 buckets
+// HISTO_RECORD(id, value) costs a count-leading-zeros, a bucket increment, and min/max/sum updates.
+// Bucket b holds values with b significant bits: 0 | 1 | 2-3 | 4-7 | 8-15 | ... | 2^31 - 2^32-1
+// Histograms are exported as compact LOG_FRAME_HISTOGRAM frames (periodically by histo_poll(), or on
+// demand by histo_export()), and cleared after each export.  The host computes percentiles.
+#ifndef HISTO_H
+#define HISTO_H
+
+#include <stdint.h>
+#include <main.h> // __CLZ(), TIM4
+
+typedef enum {
+#define HISTO(id, name) HISTO_##id,
+#include "histo_def.h"
+#undef HISTO
+	HISTO_COUNT
+} histo_id_t;
+
+#define HISTO_BUCKETS       33
+#define HISTO_INTERVAL_MS   10000  // default export interval
+
+typedef struct {
+	uint32_t count;
+	uint32_t min;
+	uint32_t max;
+	uint32_t sum;     // cleared with each export, so 32 bits are plenty per interval
+	uint32_t bucket[HISTO_BUCKETS];
+} histo_t;
+
+extern const char * const histo_names[HISTO_COUNT];
+extern histo_t histo_data[HISTO_COUNT];
+
+// Not atomic - a histogram should be recorded from a single context (main loop or one ISR),
+// histo_export() copies and clears it with interrupts disabled
+static inline void histo_record(histo_id_t id, uint32_t value)
+{
+	histo_t *h = &histo_data[id];
+	h->bucket[32 - __CLZ(value)]++;
+	h->count++;
+	h->sum += value;
+	if(value < h->min) h->min = value;
+	if(value > h->max) h->max = value;
+}
+
+#define HISTO_RECORD(id, value)  histo_record(HISTO_##id, (value))
+
+// Scoped timer using the 1 MHz TIM4 counter (regions shorter than 65 ms), ex:
+//   HISTO_TIME(LOGMSG_US) { logmsg("hello"); }
+// Leaving the block with break / return / goto skips the measurement.
+#define HISTO_TIME(id) \
+	for(uint16_t _histo_t0 = TIM4->CNT, _histo_once = 1; _histo_once; \
+		_histo_once = 0, HISTO_RECORD(id, (uint16_t)(TIM4->CNT - _histo_t0)))
+
+void histo_init(void);                  // clear all histograms, send names to the host
+void histo_set_interval(uint32_t ms);   // 0 disables periodic export
+void histo_poll(void);                  // call from main loop, exports when the interval elapsed
+int histo_export(histo_id_t id);        // export and clear one histogram now
+void histo_export_all(void);
+
+#endif // HISTO_H
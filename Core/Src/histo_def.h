@@ -0,0 +1,8 @@
+// Module: histo_def.h
+//
+// Histogram list - add new latency / size histograms here (no include guard, included several times)
+// HISTO(id, name) : the id becomes HISTO_<id>, the name string stays in flash and is sent once to the host.
+
+HISTO(LOGMSG_US,    "logmsg_us")
+HISTO(LOG_QUEUE_US, "log_queue_us")  // log.c, LOG_LATENCY
+HISTO(LOG_TX_US,    "log_tx_us")
@@ -33,7 +33,21 @@
 #include <stdbool.h>
 #include <stdarg.h>
 #include <string.h>
+#include <stddef.h>
 #include <main.h> // HAL definitions
+#include "metrics.h"
+#include "log_tags.h"
+#include "dwt.h"
+#include "log_format.h"
+#include "histo.h"
+
+#if LOG_FAST_FORMAT
+#define LOG_SNPRINTF   log_snprintf
+#define LOG_VSNPRINTF  log_vsnprintf
+#else
+#define LOG_SNPRINTF   snprintf
+#define LOG_VSNPRINTF  vsnprintf
+#endif
 
 
 // Shared globals used by this logging library
@@ -42,6 +56,58 @@ static char _log_compose_buffer[LOG_ITEM_MAX_SIZE];
 static volatile uint16_t _queue_tail; // New messages are added to tail
 static volatile uint16_t _queue_head; // DMA is used to pull messages from the head
 static volatile uint16_t _last_dma_count; // count used with the previous DMA request
+#if LOG_ENGINE == LOG_ENGINE_CIRCULAR
+static log_reader_t _readers[LOG_READERS_MAX]; // [0] is the UART DMA, its cursor is _queue_head
+static uint8_t _reader_count;
+static volatile uint16_t _queue_write; // end of the reserved space, == _queue_tail unless a blob copy runs
+#if LOG_BLOB_DMA
+// Blob payload copy in flight on DMA1 channel 2 (memory to memory), one segment at a time: a segment
+// ends at the end of a frame's payload or at the end of the ring
+#define LOG_BLOB_DMA_CH  DMA1_Channel2
+#define LOG_BLOB_IRQ_CYCLES  30  // interrupt entry and exit, about 12 each plus flash wait states
+static volatile uint8_t _blob_pending;     // copy running, _queue_tail waits at the blob's first frame
+static const uint8_t *_blob_src;
+static uint16_t _blob_dst;                 // ring index the running segment writes to
+static uint16_t _blob_left;                // payload bytes not copied yet, running segment included
+static uint16_t _blob_chunk_left;          // of the current frame's payload
+static uint16_t _blob_segment;             // bytes in the running segment
+static uint16_t _blob_dma_min = LOG_BLOB_DMA_MIN;
+static volatile uint8_t _blob_benchmark;   // the DMA completion only records the time
+static volatile uint32_t _blob_isr_cycles;
+#endif
+#elif LOG_ENGINE == LOG_ENGINE_PINGPONG
+#define LOG_PP_HALF  (LOG_DMA_BUFFER_SIZE / 2)
+static volatile uint8_t _pp_fill;        // half being filled (0 / 1), the other one may be sent by the DMA
+static volatile uint16_t _pp_fill_len;   // bytes in the fill half
+#endif
+#if LOG_MEMO_ENTRIES
+typedef struct {
+	const char *format;     // NULL: empty
+	uint32_t hash;          // of the argument values
+	uint32_t cycles;        // vsnprintf() cycles when the entry was filled
+	uint8_t length;
+	char text[LOG_MEMO_TEXT];
+} log_memo_entry_t;
+static log_memo_entry_t _memo[LOG_MEMO_ENTRIES];
+#endif
+log_memo_stats_t log_memo_stats;
+#if LOG_LATENCY
+// Latency side table, positions count bytes since log_init() so they don't wrap with the queue
+typedef struct {
+	uint32_t begin;    // position of the first byte
+	uint32_t end;      // position after the last byte
+	uint32_t queued;   // DWT cycles at the logmsg() call
+	uint32_t sent;     // DWT cycles at the start of the DMA transfer holding the first byte
+} log_latency_t;
+#define LOG_LATENCY_MASK  (LOG_LATENCY_RECORDS - 1)
+static log_latency_t _latency[LOG_LATENCY_RECORDS];
+static volatile uint8_t _latency_tail;   // free running indexes: added by log_enqueue() ...
+static volatile uint8_t _latency_sent;   //   ... stamped by restart_dma() ...
+static volatile uint8_t _latency_head;   //   ... retired by the DMA completion
+static uint32_t _latency_queued_bytes;
+static volatile uint32_t _latency_sent_bytes;
+static uint32_t _latency_done_bytes;
+#endif
 
 // Initialize the logger
 int log_init(void)
@@ -50,6 +116,30 @@ int log_init(void)
 	_queue_tail = 0;
 	_queue_head = 0;
 	_last_dma_count = 0;
+#if LOG_ENGINE == LOG_ENGINE_CIRCULAR
+	memset(_readers, 0, sizeof(_readers));
+	_readers[0].name = "uart";
+	_reader_count = 1;
+	_queue_write = 0;
+#if LOG_BLOB_DMA
+	_blob_pending = 0;
+	__HAL_RCC_DMA1_CLK_ENABLE();
+	HAL_NVIC_SetPriority(DMA1_Channel2_IRQn, 0, 0); // same as the UART, so the two never nest
+	HAL_NVIC_EnableIRQ(DMA1_Channel2_IRQn);
+#endif
+#elif LOG_ENGINE == LOG_ENGINE_PINGPONG
+	_pp_fill = 0;
+	_pp_fill_len = 0;
+#endif
+#if LOG_MEMO_ENTRIES
+	memset(_memo, 0, sizeof(_memo));
+#endif
+	memset(&log_memo_stats, 0, sizeof(log_memo_stats));
+#if LOG_LATENCY
+	_latency_tail = _latency_sent = _latency_head = 0;
+	_latency_queued_bytes = _latency_sent_bytes = _latency_done_bytes = 0;
+#endif
+	dwt_init(); // cycle counter, used for logging cost accounting
 	return HAL_OK;
 }
 
@@ -66,6 +156,65 @@ int queue_space_available(int head, int tail)
 		return (tail - head) -1;
 }
 
+#if LOG_LATENCY
+//=============================================================================
+// Add an item to the latency table before its bytes are queued, so the DMA can't send them unseen.
+// Its position is past everything queued, so the DMA side leaves it alone until latency_commit().
+// Returns 0 if the table is full (item not measured)
+static uint8_t latency_open(uint16_t length, uint32_t call_cycles) {
+//=============================================================================
+	uint8_t tail = _latency_tail;
+	if((uint8_t)(tail - _latency_head) >= LOG_LATENCY_RECORDS) return 0;
+	log_latency_t *item = &_latency[tail & LOG_LATENCY_MASK];
+	item->begin = _latency_queued_bytes;
+	item->end = _latency_queued_bytes + length;
+	item->queued = call_cycles;
+	_latency_tail = tail + 1;
+	return 1;
+}
+
+//=============================================================================
+// The item was queued (ok) or dropped (take back its table entry)
+static void latency_commit(uint8_t opened, uint16_t length, uint8_t ok) {
+//=============================================================================
+	if(ok) _latency_queued_bytes += length;
+	else if(opened) _latency_tail--;
+}
+
+//=============================================================================
+// A DMA transfer of length bytes starts: stamp the items whose first byte it holds
+static void latency_sent(uint16_t length) {
+//=============================================================================
+	uint32_t now = dwt_cycles();
+	uint32_t sent_bytes = _latency_sent_bytes + length;
+	uint8_t i = _latency_sent;
+	for(; i != _latency_tail && (int32_t)(_latency[i & LOG_LATENCY_MASK].begin - sent_bytes) < 0; i++)
+		_latency[i & LOG_LATENCY_MASK].sent = now;
+	_latency_sent = i;
+	_latency_sent_bytes = sent_bytes;
+}
+
+//=============================================================================
+// A DMA transfer of length bytes completed (ISR): items whose last byte went out go to the histograms
+static void latency_done(uint16_t length) {
+//=============================================================================
+	uint32_t now = dwt_cycles();
+	_latency_done_bytes += length;
+	uint8_t i = _latency_head;
+	for(; i != _latency_sent && (int32_t)(_latency[i & LOG_LATENCY_MASK].end - _latency_done_bytes) <= 0; i++) {
+		log_latency_t *item = &_latency[i & LOG_LATENCY_MASK];
+		HISTO_RECORD(LOG_QUEUE_US, (item->sent - item->queued) / DWT_CYCLES_PER_US);
+		HISTO_RECORD(LOG_TX_US, (now - item->sent) / DWT_CYCLES_PER_US);
+	}
+	_latency_head = i;
+}
+#else
+static inline uint8_t latency_open(uint16_t length, uint32_t call_cycles) { (void)length; (void)call_cycles; return 0; }
+static inline void latency_commit(uint8_t opened, uint16_t length, uint8_t ok) { (void)opened; (void)length; (void)ok; }
+static inline void latency_sent(uint16_t length) { (void)length; }
+static inline void latency_done(uint16_t length) { (void)length; }
+#endif
+
 //=============================================================================
 // DMA register notes
 //=============================================================================
@@ -96,6 +245,29 @@ int queue_space_available(int head, int tail)
 //  Error_Handler();
 //}
 
+#if LOG_ENGINE == LOG_ENGINE_CIRCULAR
+//=============================================================================
+// Bytes between a read cursor and the tail
+static inline uint16_t queue_used(uint16_t head) {
+//=============================================================================
+	uint16_t tail = _queue_tail;
+	return (head <= tail) ? tail - head : LOG_DMA_BUFFER_SIZE - (head - tail);
+}
+
+//=============================================================================
+// Bytes between a read cursor and the end of the reserved space (blob copies still running included)
+static inline uint16_t queue_fill(uint16_t head) {
+//=============================================================================
+	uint16_t write = _queue_write;
+	return (head <= write) ? write - head : LOG_DMA_BUFFER_SIZE - (head - write);
+}
+
+//=============================================================================
+static inline uint16_t reader_head(uint8_t reader) {
+//=============================================================================
+	return reader ? _readers[reader].head : _queue_head;
+}
+
 //=============================================================================
 // If USART transmit DMA is stopped, restart it
 // The DMA buffer needs to be configured for "Linear", not "Circular".
@@ -116,6 +288,7 @@ uint16_t restart_dma(void) {
 			dma_bytes;
 
 	_last_dma_count = qty_to_send;
+	latency_sent(_last_dma_count);
 
 	// This function call checks for busy and returns error if busy
 	HAL_UART_Transmit_DMA(&huart2,(uint8_t *)&_usart2_tx_dma_buffer[_queue_head],_last_dma_count);
@@ -124,64 +297,754 @@ uint16_t restart_dma(void) {
 }
 
 //=============================================================================
-// This function is the ONLY method for writing to the UART TX DMA buffer
+// Make room for log_length bytes at _queue_write
+// Returns -1 if there isn't enough space
+static int queue_reserve(uint16_t log_length) {
+//=============================================================================
+	// Space is reclaimed behind the lossless reader furthest behind
+	uint16_t used = 0;
+	for(uint8_t r = 0; r < _reader_count; r++) {
+		if(_readers[r].lossy) continue;
+		uint16_t lag = queue_fill(reader_head(r));
+		if(lag > used) used = lag;
+	}
+	uint16_t log_space_available = LOG_DMA_BUFFER_SIZE - used - 1;
+	if(log_length > log_space_available) return -1; // not enough space for message
+
+	// Lossy readers this item would overrun give up their backlog, and continue with this item
+	for(uint8_t r = 1; r < _reader_count; r++) {
+		log_reader_t *reader = &_readers[r];
+		uint16_t lag = queue_fill(reader->head);
+		if(reader->lossy && lag + log_length > LOG_DMA_BUFFER_SIZE - 1) {
+			reader->bytes_skipped += queue_used(reader->head);
+			reader->head = _queue_tail;
+		}
+	}
+	return 0;
+}
+
+//=============================================================================
+// Copy into the ring at index pos, two memcpy() calls if it wraps the end of the buffer
+// Returns the index after the copy
+static uint16_t ring_copy(uint16_t pos, const void *data, uint16_t length) {
+//=============================================================================
+	if(pos + length >= LOG_DMA_BUFFER_SIZE) {
+		// two memcpy() calls needed -- wrapping end of buffer
+		uint16_t len_1 = LOG_DMA_BUFFER_SIZE - pos;
+		memcpy(&_usart2_tx_dma_buffer[pos],data,len_1); // copy first part
+		memcpy(&_usart2_tx_dma_buffer,(const char *)data + len_1,length-len_1); // copy second part
+		return length-len_1;
+	}
+	memcpy(&_usart2_tx_dma_buffer[pos],data,length); // copy the whole thing -- no wrap
+	return pos + length;
+}
+
+//=============================================================================
+// Readers may now see everything up to write (the blob copy completion commits it, if one is running)
+static void queue_publish(uint16_t write) {
+//=============================================================================
+	_queue_write = write;
+#if LOG_BLOB_DMA
+	if(!_blob_pending) _queue_tail = write; // _queue_write is stored first, the ISR commits it otherwise
+#else
+	_queue_tail = write;
+#endif
+	for(uint8_t r = 0; r < _reader_count; r++) {
+		uint16_t lag = queue_used(reader_head(r));
+		if(lag > _readers[r].max_lag) _readers[r].max_lag = lag;
+	}
+}
+
+//=============================================================================
+// Copy an item into the circular queue
+// Returns -1 if there isn't enough space
+static int queue_put(const char *data, uint16_t log_length) {
+//=============================================================================
+	if(queue_reserve(log_length)) return -1;
+	queue_publish(ring_copy(_queue_write, data, log_length));
+	return 0;
+}
+
+//=============================================================================
+// Register a reader, it starts with the next item queued
+int log_reader_add(const char *name, uint8_t lossy) {
+//=============================================================================
+	if(_reader_count >= LOG_READERS_MAX) return -1;
+	log_reader_t *reader = &_readers[_reader_count];
+	memset(reader, 0, sizeof(*reader));
+	reader->name = name;
+	reader->lossy = lossy;
+	reader->head = _queue_tail;
+	return _reader_count++;
+}
+
+//=============================================================================
+// Bytes waiting for the reader up to the end of the buffer (the wrapped part comes with the next call)
+uint16_t log_reader_peek(int reader, const char **data) {
+//=============================================================================
+	if(reader <= 0 || reader >= _reader_count) return 0;
+	uint16_t head = _readers[reader].head;
+	uint16_t tail = _queue_tail;
+	*data = &_usart2_tx_dma_buffer[head];
+	return (head <= tail) ? tail - head : LOG_DMA_BUFFER_SIZE - head;
+}
+
+//=============================================================================
+// Length of the record at the reader's cursor (see log_frame.h): a binary frame from its header, a text
+// line up to its '\n'.  Readers consuming whole records stay on record boundaries, as a lossy reader's
+// skip does.  A line longer than a frame without its '\n' is cut there, the queue's end is a boundary.
+uint16_t log_reader_record(int reader) {
+//=============================================================================
+	if(reader <= 0 || reader >= _reader_count) return 0;
+	uint16_t head = _readers[reader].head;
+	uint16_t lag = queue_used(head);
+	uint16_t max = LOG_FRAME_HEADER_SIZE + LOG_FRAME_MAX_PAYLOAD;
+	if(!lag) return 0;
+	if(_usart2_tx_dma_buffer[head] == LOG_FRAME_SYNC) {
+		if(lag < LOG_FRAME_HEADER_SIZE) return lag;
+		uint16_t at = head + 2;
+		if(at >= LOG_DMA_BUFFER_SIZE) at -= LOG_DMA_BUFFER_SIZE;
+		uint16_t length = LOG_FRAME_HEADER_SIZE + (uint8_t)_usart2_tx_dma_buffer[at];
+		return length < lag ? length : lag;
+	}
+	if(lag < max) max = lag;
+	for(uint16_t n = 1; n < max; n++) {
+		if(_usart2_tx_dma_buffer[head] == '\n') return n;
+		if(++head >= LOG_DMA_BUFFER_SIZE) head = 0;
+	}
+	return max;
+}
+
+//=============================================================================
+void log_reader_consume(int reader, uint16_t length) {
+//=============================================================================
+	if(reader <= 0 || reader >= _reader_count) return;
+	uint16_t head = _readers[reader].head + length;
+	if(head >= LOG_DMA_BUFFER_SIZE) head -= LOG_DMA_BUFFER_SIZE;
+	_readers[reader].head = head;
+	_readers[reader].bytes_read += length;
+}
+
+//=============================================================================
+uint16_t log_reader_lag(int reader) {
+//=============================================================================
+	if(reader < 0 || reader >= _reader_count) return 0;
+	return queue_used(reader_head(reader));
+}
+
+//=============================================================================
+// One line per reader, the maximum lag restarts with each report
+void log_reader_report(void) {
+//=============================================================================
+	for(uint8_t r = 0; r < _reader_count; r++) {
+		log_reader_t *reader = &_readers[r];
+		logtag(LOG_TAG_STATS, "reader %-6s %s lag %u max %u read %lu skipped %lu", reader->name,
+				reader->lossy ? "lossy" : "lossless", queue_used(reader_head(r)), reader->max_lag,
+				reader->bytes_read, reader->bytes_skipped);
+		reader->max_lag = 0;
+	}
+}
+
+#elif LOG_ENGINE == LOG_ENGINE_PINGPONG
+//=============================================================================
+// If the DMA is idle and the fill half holds data, swap halves and send the whole half
+// Called from log_enqueue() and the DMA completion ISR
+uint16_t restart_dma(void) {
+//=============================================================================
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	if(_last_dma_count || !_pp_fill_len || HAL_UART_GetState(&huart2) != HAL_UART_STATE_READY) {
+		__set_PRIMASK(primask);
+		return 0;
+	}
+	uint8_t send = _pp_fill;
+	_last_dma_count = _pp_fill_len;
+	_pp_fill ^= 1;
+	_pp_fill_len = 0;
+	latency_sent(_last_dma_count);
+	__set_PRIMASK(primask);
+
+	// The sent half is owned by the DMA until its completion clears _last_dma_count
+	HAL_UART_Transmit_DMA(&huart2,(uint8_t *)&_usart2_tx_dma_buffer[send * LOG_PP_HALF],_last_dma_count);
+	return _last_dma_count;
+}
+
+//=============================================================================
+// Append an item to the fill half, no wrap handling.  Interrupts are disabled for the copy, so the
+// ISR can't swap the half away while it is partly written.
+// Returns -1 if there isn't enough space
+static int queue_put(const char *data, uint16_t log_length) {
+//=============================================================================
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	if(_pp_fill_len + log_length > LOG_PP_HALF) {
+		__set_PRIMASK(primask);
+		return -1;
+	}
+	memcpy(&_usart2_tx_dma_buffer[_pp_fill * LOG_PP_HALF + _pp_fill_len], data, log_length);
+	_pp_fill_len += log_length;
+	__set_PRIMASK(primask);
+	return 0;
+}
+
+// A single reader (the UART), see log.h
+int log_reader_add(const char *name, uint8_t lossy) { (void)name; (void)lossy; return -1; }
+uint16_t log_reader_peek(int reader, const char **data) { (void)reader; (void)data; return 0; }
+uint16_t log_reader_record(int reader) { (void)reader; return 0; }
+void log_reader_consume(int reader, uint16_t length) { (void)reader; (void)length; }
+uint16_t log_reader_lag(int reader) { return reader ? 0 : _pp_fill_len + _last_dma_count; }
+void log_reader_report(void) { }
+
+#else
+#error "LOG_ENGINE: unknown queue engine"
+#endif
+
+//=============================================================================
+// Copy a composed log item into the DMA queue (engine selected by LOG_ENGINE)
+// This function is the ONLY method for writing to the UART TX DMA buffer.
+// The whole item is queued, or nothing at all (returns -1 if not enough space).
+// start_cycles is the DWT count when the caller began composing the item (cost accounting).
+static int log_enqueue(log_tag_t tag, const char *data, uint16_t log_length, uint32_t start_cycles) {
+//=============================================================================
+#if LOG_TAG_ACCOUNTING
+	log_tag_stats_t *stats = &log_tag_stats[tag];
+	uint32_t copy_cycles = dwt_cycles();
+	stats->cyc_format += copy_cycles - start_cycles;
+#endif
+	uint8_t measured = latency_open(log_length, start_cycles);
+	if(queue_put(data, log_length)) {
+		latency_commit(measured, log_length, 0);
+		METRIC_INC(LOG_DROPPED);
+#if LOG_TAG_ACCOUNTING
+		stats->dropped++;
+		stats->cyc_copy += dwt_cycles() - copy_cycles;
+#endif
+		return -1; // not enough space for message
+	}
+	latency_commit(measured, log_length, 1);
+	log_tag_charge(tag, log_length);
+
+#if LOG_TAG_ACCOUNTING
+	uint32_t dma_cycles = dwt_cycles();
+	stats->cyc_copy += dma_cycles - copy_cycles;
+#endif
+
+	// Log message is now in DMA queue, if not started, start the DMA transfer
+	restart_dma();
+
+#if LOG_TAG_ACCOUNTING
+	stats->cyc_dma += dwt_cycles() - dma_cycles;
+	stats->items++;
+	stats->bytes += log_length;
+#endif
+	return log_length;  // return full log item length, not just text length
+}
+
+#if LOG_MEMO_ENTRIES
+#define MEMO_HASH(h, v)  (((h) ^ (uint32_t)(v)) * 16777619u)  // FNV-1a, one word at a time
+// Only formats in flash are cached, a format in a RAM buffer may hold other text at the same address
+#define MEMO_CONSTANT(format)  ((uintptr_t)(format) < SRAM_BASE)
+
+//=============================================================================
+// Hash the arguments a format consumes, walking the conversions the way vsnprintf() does
+// Strings are hashed by content, up to the longest text an item holds.
+// Returns -1 if the format can't be cached (%n, unknown conversion)
+static int memo_hash(const char *format, va_list args, uint32_t *hash) {
+//=============================================================================
+	uint32_t h = 2166136261u;
+	for(const char *p = format; *p; p++) {
+		if(*p != '%') continue;
+		p++;
+		while(*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0') p++;
+		for(; (*p >= '0' && *p <= '9') || *p == '.' || *p == '*'; p++)
+			if(*p == '*') h = MEMO_HASH(h, va_arg(args, int));
+		char size = 0; // 'H' hh / h, 'l', 'q' ll, 'j', 'z', 't', 'L'
+		if(*p == 'h') { size = 'H'; p += (p[1] == 'h') ? 2 : 1; }
+		else if(*p == 'l' && p[1] == 'l') { size = 'q'; p += 2; }
+		else if(*p == 'l' || *p == 'j' || *p == 'z' || *p == 't' || *p == 'L') size = *p++;
+		switch(*p) {
+		case '%':
+			break;
+		case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+			if(size == 'q' || size == 'j') {
+				uint64_t v = va_arg(args, unsigned long long);
+				h = MEMO_HASH(MEMO_HASH(h, v), v >> 32);
+			}
+			else if(size == 'l') h = MEMO_HASH(h, va_arg(args, long));
+			else if(size == 'z') h = MEMO_HASH(h, va_arg(args, size_t));
+			else if(size == 't') h = MEMO_HASH(h, va_arg(args, ptrdiff_t));
+			else h = MEMO_HASH(h, va_arg(args, int));
+			break;
+		case 'p':
+			h = MEMO_HASH(h, (uintptr_t)va_arg(args, void *));
+			break;
+		case 's': {
+			const char *s = va_arg(args, const char *);
+			if(!s) s = "(null)";
+			for(uint16_t n = 0; n < LOG_MAX_TEXT && *s; n++) h = MEMO_HASH(h, *s++);
+			h = MEMO_HASH(h, 0);
+			break;
+		}
+		case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': {
+			uint64_t bits;
+			if(size == 'L') {
+				long double v = va_arg(args, long double);
+				double d = (double)v;
+				memcpy(&bits, &d, sizeof(bits));
+			} else {
+				double d = va_arg(args, double);
+				memcpy(&bits, &d, sizeof(bits));
+			}
+			h = MEMO_HASH(MEMO_HASH(h, bits), bits >> 32);
+			break;
+		}
+		default:
+			return -1; // %n, or a conversion we don't know the argument of
+		}
+		if(!*p) break;
+	}
+	*hash = h;
+	return 0;
+}
+
+//=============================================================================
+// Compose the message body at text (size bytes, null terminated), from the cache when the format and
+// arguments match an entry.  Returns the vsnprintf() style length.
+static uint16_t memo_format(char *text, uint16_t size, const char *format, va_list arg_ptr) {
+//=============================================================================
+	uint32_t start = dwt_cycles();
+	uint32_t hash = 0;
+	va_list args;
+	va_copy(args, arg_ptr);
+	int cacheable = MEMO_CONSTANT(format) && !memo_hash(format, args, &hash);
+	va_end(args);
+	log_memo_entry_t *memo = &_memo[(hash ^ ((uintptr_t)format >> 2)) % LOG_MEMO_ENTRIES];
+
+	if(cacheable && memo->format == format && memo->hash == hash) {
+		uint16_t length = memo->length;
+		uint16_t copy = (length < size) ? length : size - 1;
+		memcpy(text, memo->text, copy);
+		text[copy] = 0;
+		log_memo_stats.hits++;
+		log_memo_stats.cycles_saved += (int32_t)(memo->cycles - (dwt_cycles() - start));
+		return length;
+	}
+
+	uint32_t format_start = dwt_cycles();
+	uint16_t length = LOG_VSNPRINTF(text, size, format, arg_ptr);
+	if(!cacheable) {
+		log_memo_stats.uncached++;
+		return length;
+	}
+	log_memo_stats.misses++;
+	log_memo_stats.cycles_saved -= (int32_t)(format_start - start); // hashing, for nothing this time
+	if(length < LOG_MEMO_TEXT && length < size) { // whole body, not truncated
+		memo->format = format;
+		memo->hash = hash;
+		memo->cycles = dwt_cycles() - format_start;
+		memo->length = length;
+		memcpy(memo->text, text, length);
+	}
+	return length;
+}
+
+//=============================================================================
+void log_memo_report(void) {
+//=============================================================================
+	log_memo_stats_t s = log_memo_stats;
+	uint32_t lookups = s.hits + s.misses;
+	logtag(LOG_TAG_STATS, "memo %u entries: hits %lu misses %lu (%lu%%) uncached %lu saved %ld cycles",
+			LOG_MEMO_ENTRIES, s.hits, s.misses, lookups ? s.hits * 100 / lookups : 0, s.uncached, s.cycles_saved);
+	memset(&log_memo_stats, 0, sizeof(log_memo_stats));
+}
+#else
+#define memo_format(text, size, format, arg_ptr)  LOG_VSNPRINTF(text, size, format, arg_ptr)
+void log_memo_report(void) { }
+#endif
+
+//=============================================================================
 // vsnprintf() writes to intermediate static buffer, then copied into circular DMA buffer
 // This is the "lowest level" message API.  As timestamps, log level, and color become
 //   implemented, this API will update to support these features.
 // Prevent task switch while code proceeds though this function - a mutex comes to mind...
-int logmsg(const char *format, ...) {
+int vlogtag(log_tag_t tag, const char *format, va_list arg_ptr) {
 //=============================================================================
 	// For version 2.1.0, add time stamps to messages
 	// Allow "(265407628) " as an example prior to the message.
 	// Size of the timestamp changes as the target gets larger and larger values for HAL_GetTick()
+	uint32_t start_cycles = dwt_cycles();
+	if(!log_tag_admit(tag)) return -1; // over the tag's bandwidth share, don't spend cycles formatting
 
 	//============================
 	// Grab mutex (required for concurrent clients writing into buffer(s))
 	//============================
-	va_list arg_ptr;
-	va_start(arg_ptr, format);
 
 	// To limit the number of digits printed for timestamp, a "manual method" is needed to limit size of the timestamp.
 	//   A printf() format string alone won't get us there.
-	uint16_t ts_len = snprintf(_log_compose_buffer, LOG_MAX_TEXT, "(%lu) ",HAL_GetTick());
+	uint16_t ts_len = LOG_SNPRINTF(_log_compose_buffer, LOG_MAX_TEXT, "(%lu) ",HAL_GetTick());
 	// This will truncate the data written to the string as expected (with NULL termination)
-	uint16_t log_length = vsnprintf(&_log_compose_buffer[ts_len], LOG_MAX_TEXT-ts_len, format, arg_ptr);
+	uint16_t log_length = memo_format(&_log_compose_buffer[ts_len], LOG_MAX_TEXT-ts_len, format, arg_ptr);
 	// Convert length returned by vsnprintf() into actual length
-	if(log_length >= LOG_MAX_TEXT) log_length = LOG_MAX_TEXT-1;
+	if(log_length >= LOG_MAX_TEXT-ts_len) log_length = LOG_MAX_TEXT-ts_len-1;
 	// Add linefeed, \n, to the end
 	log_length+=1;
 	// Use log_length for total buffer data length
 	log_length += ts_len;
 
-	uint16_t log_space_available = (_queue_head <= _queue_tail)?    /* non-wrapped queue ? */
-			(LOG_DMA_BUFFER_SIZE - (_queue_tail - _queue_head) -1) :
-			(_queue_head - _queue_tail -1);
-	if(log_length > log_space_available) {
-		return -1; // not enough space for message
-	}
-
 	// Replace null termination on end of message with line feed '\n'
 	_log_compose_buffer[log_length-1] = '\n';
 
-	// We have enough space, copy intermediate buffer into circular DMA buffer
-	// Instead of the slower byte by byte process, break the process into two memcpy() function calls (if required)
-	if(_queue_tail + log_length >= LOG_DMA_BUFFER_SIZE) {
-		// two memcpy() calls needed -- wrapping end of buffer
-		uint16_t len_1 = LOG_DMA_BUFFER_SIZE - _queue_tail;
-		memcpy(&_usart2_tx_dma_buffer[_queue_tail],&_log_compose_buffer,len_1); // copy first part
-		memcpy(&_usart2_tx_dma_buffer,&_log_compose_buffer[len_1],log_length-len_1); // copy second part
-		_queue_tail = log_length-len_1; // update queue tail
+	return log_enqueue(tag, _log_compose_buffer, log_length, start_cycles);
+}
+
+//=============================================================================
+// Tagged log message, the tag selects which module the cost is accounted to (see log_tags.h)
+int logtag(log_tag_t tag, const char *format, ...) {
+//=============================================================================
+	va_list arg_ptr;
+	va_start(arg_ptr, format);
+	int result = vlogtag(tag, format, arg_ptr);
+	va_end(arg_ptr);
+	return result;
+}
+
+//=============================================================================
+int logmsg(const char *format, ...) {
+//=============================================================================
+	va_list arg_ptr;
+	va_start(arg_ptr, format);
+	int result = vlogtag(LOG_TAG_DEFAULT, format, arg_ptr);
+	va_end(arg_ptr);
+	return result;
+}
+
+//=============================================================================
+// Bounded time log message: the restricted formatter (log_format.h), no text cache.  The call costs at most
+// LOG_WCET_CYC_ITEM + log_wcet_bound(format) cycles, interrupts excluded.
+int vlogtag_wcet(log_tag_t tag, const char *format, va_list arg_ptr) {
+//=============================================================================
+	uint32_t start_cycles = dwt_cycles();
+	if(!log_tag_admit(tag)) return -1;
+
+	uint16_t ts_len = log_wcet_snprintf(_log_compose_buffer, LOG_MAX_TEXT, "(%lu) ", HAL_GetTick());
+	uint16_t log_length = log_wcet_vsnprintf(&_log_compose_buffer[ts_len], LOG_MAX_TEXT-ts_len, format, arg_ptr);
+	if(log_length >= LOG_MAX_TEXT-ts_len) log_length = LOG_MAX_TEXT-ts_len-1; // truncated
+	log_length += ts_len + 1;
+	_log_compose_buffer[log_length-1] = '\n';
+
+	return log_enqueue(tag, _log_compose_buffer, log_length, start_cycles);
+}
+
+//=============================================================================
+int logtag_wcet(log_tag_t tag, const char *format, ...) {
+//=============================================================================
+	va_list arg_ptr;
+	va_start(arg_ptr, format);
+	int result = vlogtag_wcet(tag, format, arg_ptr);
+	va_end(arg_ptr);
+	return result;
+}
+
+//=============================================================================
+int logmsg_wcet(const char *format, ...) {
+//=============================================================================
+	va_list arg_ptr;
+	va_start(arg_ptr, format);
+	int result = vlogtag_wcet(LOG_TAG_DEFAULT, format, arg_ptr);
+	va_end(arg_ptr);
+	return result;
+}
+
+//=============================================================================
+// Queue a binary frame (see log_frame.h) - header is added here, payload is copied as is
+// Frames share the DMA queue with text messages, and are never split by other log items.
+int log_frame(uint8_t type, const void *payload, uint16_t length) {
+//=============================================================================
+	uint32_t start_cycles = dwt_cycles();
+	if(length > LOG_ITEM_MAX_SIZE - LOG_FRAME_HEADER_SIZE) return -1; // frame too large for compose buffer
+	if(!log_frame_is_desc(type) && !log_tag_admit(LOG_TAG_TELEMETRY)) return -1;
+
+	_log_compose_buffer[0] = LOG_FRAME_SYNC;
+	_log_compose_buffer[1] = type;
+	_log_compose_buffer[2] = (char)length;
+	memcpy(&_log_compose_buffer[LOG_FRAME_HEADER_SIZE], payload, length);
+
+	return log_enqueue(LOG_TAG_TELEMETRY, _log_compose_buffer, length + LOG_FRAME_HEADER_SIZE, start_cycles);
+}
+
+#if LOG_ENGINE == LOG_ENGINE_CIRCULAR
+#if LOG_BLOB_DMA
+//=============================================================================
+// Program the mem2mem channel, word transfers when the addresses and length allow it
+static void blob_dma_copy(void *dst, const void *src, uint16_t length) {
+//=============================================================================
+	DMA_Channel_TypeDef *ch = LOG_BLOB_DMA_CH;
+	uint32_t ccr = DMA_CCR_MEM2MEM | DMA_CCR_PINC | DMA_CCR_MINC | DMA_CCR_TCIE | DMA_CCR_TEIE; // DIR 0: CPAR -> CMAR
+	ch->CCR = 0;
+	DMA1->IFCR = DMA_IFCR_CGIF2;
+	ch->CPAR = (uint32_t)src;
+	ch->CMAR = (uint32_t)dst;
+	if(!(((uintptr_t)dst | (uintptr_t)src | length) & 3)) {
+		ccr |= DMA_CCR_PSIZE_1 | DMA_CCR_MSIZE_1;
+		ch->CNDTR = length / 4;
 	} else {
-		memcpy(&_usart2_tx_dma_buffer[_queue_tail],&_log_compose_buffer,log_length); // copy the whole thing -- no wrap
-		_queue_tail += log_length; // update queue tail
+		ch->CNDTR = length;
 	}
+	ch->CCR = ccr | DMA_CCR_EN;
+}
 
-	// Log message is now in DMA queue, if not started, start the DMA transfer
+//=============================================================================
+// Move past the segment just copied, and size the next one: up to the end of the current frame's data,
+// or of the ring.  Returns 0 once the whole payload is in the ring.
+static uint8_t blob_advance(void) {
+//=============================================================================
+	_blob_src += _blob_segment;
+	_blob_left -= _blob_segment;
+	_blob_chunk_left -= _blob_segment;
+	_blob_dst += _blob_segment;
+	if(_blob_dst >= LOG_DMA_BUFFER_SIZE) _blob_dst -= LOG_DMA_BUFFER_SIZE;
+	if(!_blob_left) return 0;
+	if(!_blob_chunk_left) {
+		// skip the next frame's headers, written by log_blob()
+		_blob_dst += LOG_FRAME_HEADER_SIZE + LOG_BLOB_HEADER_SIZE;
+		if(_blob_dst >= LOG_DMA_BUFFER_SIZE) _blob_dst -= LOG_DMA_BUFFER_SIZE;
+		_blob_chunk_left = (_blob_left > LOG_BLOB_CHUNK) ? LOG_BLOB_CHUNK : _blob_left;
+	}
+	_blob_segment = _blob_chunk_left;
+	if(_blob_segment > LOG_DMA_BUFFER_SIZE - _blob_dst) _blob_segment = LOG_DMA_BUFFER_SIZE - _blob_dst;
+	return 1;
+}
+
+//=============================================================================
+// DMA1 channel 2 completion: start the next segment, or commit the blob's frames to the readers
+void log_blob_dma_irq(void) {
+//=============================================================================
+	uint32_t entry_cycles = dwt_cycles();
+	uint32_t isr = DMA1->ISR;
+	DMA1->IFCR = DMA_IFCR_CGIF2;
+	LOG_BLOB_DMA_CH->CCR = 0;
+	if(_blob_benchmark) {
+		_blob_isr_cycles = dwt_cycles() - entry_cycles;
+		_blob_benchmark = 0;
+		return;
+	}
+	if(!_blob_pending) return;
+
+	if(isr & DMA_ISR_TEIF2) {
+		// Bus error (bad source address?), the CPU copies the rest so the queue doesn't stall
+		do {
+			memcpy(&_usart2_tx_dma_buffer[_blob_dst], _blob_src, _blob_segment);
+		} while(blob_advance());
+	} else if(blob_advance()) {
+		blob_dma_copy(&_usart2_tx_dma_buffer[_blob_dst], _blob_src, _blob_segment);
+		return;
+	}
+	_queue_tail = _queue_write; // the blob, and whatever was queued behind it
+	_blob_pending = 0;
 	restart_dma();
+}
 
-	return log_length;  // return full log item length, not just text length
+//=============================================================================
+uint8_t log_blob_busy(void) {
+//=============================================================================
+	return _blob_pending;
+}
+
+//=============================================================================
+// Time memcpy() against a DMA copy for a few sizes, the DMA cost being the CPU time it takes: channel
+// setup, and the completion interrupt (body measured, plus entry and exit).  The DMA is used from the first
+// size where memcpy() costs more.  The destination is misaligned, as most ring positions are.
+void log_blob_benchmark(void) {
+//=============================================================================
+	static const uint16_t sizes[] = { 8, 16, 32, 64, 96, 128, 192, LOG_BLOB_CHUNK };
+	uint32_t src[LOG_BLOB_CHUNK / 4];
+	uint32_t dst[LOG_BLOB_CHUNK / 4 + 1];
+	if(_blob_pending) return;
+	for(uint16_t i = 0; i < sizeof(src) / 4; i++) src[i] = i * 0x01010101u;
+
+	logtag(LOG_TAG_STATS, "blob copy (cycles): bytes memcpy dma_cpu dma_done");
+	_blob_dma_min = UINT16_MAX;
+	for(uint8_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		uint16_t n = sizes[s];
+		uint32_t cpu = UINT32_MAX, dma = UINT32_MAX, done = UINT32_MAX;
+		for(uint8_t t = 0; t < 4; t++) {
+			uint32_t start = dwt_cycles();
+			memcpy((uint8_t *)dst + 1, src, n);
+			uint32_t cycles = dwt_cycles() - start;
+			if(cycles < cpu) cpu = cycles;
+
+			_blob_benchmark = 1;
+			start = dwt_cycles();
+			blob_dma_copy((uint8_t *)dst + 1, src, n);
+			uint32_t setup = dwt_cycles() - start;
+			while(_blob_benchmark && dwt_cycles() - start < SystemCoreClock / 1000) {
+			}
+			if(_blob_benchmark) {
+				// No completion interrupt within 1 ms, leave the DMA alone
+				LOG_BLOB_DMA_CH->CCR = 0;
+				_blob_benchmark = 0;
+				logtag(LOG_TAG_STATS, "blob copy: DMA1 channel 2 timed out, CPU copies only");
+				return;
+			}
+			cycles = dwt_cycles() - start;
+			if(cycles < done) done = cycles;
+			cycles = setup + _blob_isr_cycles + LOG_BLOB_IRQ_CYCLES;
+			if(cycles < dma) dma = cycles;
+		}
+		if(cpu > dma && _blob_dma_min == UINT16_MAX) _blob_dma_min = n;
+		logtag(LOG_TAG_STATS, "%u %lu %lu %lu", n, cpu, dma, done);
+	}
+	if(_blob_dma_min == UINT16_MAX) logtag(LOG_TAG_STATS, "blob copy: memcpy always faster, CPU copies only");
+	else logtag(LOG_TAG_STATS, "blob copy: DMA from %u bytes", _blob_dma_min);
+}
+#else
+void log_blob_dma_irq(void) { }
+uint8_t log_blob_busy(void) { return 0; }
+void log_blob_benchmark(void) { }
+#endif
+
+//=============================================================================
+// Queue length bytes as LOG_FRAME_BLOB frames (see log.h), all reserved at once.  The frame headers are
+// written here, the data is copied by memcpy(), or by the DMA for payloads from the benchmarked crossover
+// size (one DMA blob at a time, a second one is copied by the CPU and waits behind the first).
+// Returns the bytes queued (headers included), -1 if the payload doesn't fit
+int log_blob(uint8_t id, const void *data, uint16_t length) {
+//=============================================================================
+	uint32_t start_cycles = dwt_cycles();
+	uint16_t chunks = length ? (length + LOG_BLOB_CHUNK - 1) / LOG_BLOB_CHUNK : 1;
+	uint32_t total = length + (uint32_t)chunks * (LOG_FRAME_HEADER_SIZE + LOG_BLOB_HEADER_SIZE);
+	if(total > LOG_DMA_BUFFER_SIZE - 1) return -1; // would never fit the queue
+	if(!log_tag_admit(LOG_TAG_TELEMETRY)) return -1;
+#if LOG_TAG_ACCOUNTING
+	log_tag_stats_t *stats = &log_tag_stats[LOG_TAG_TELEMETRY];
+	uint32_t copy_cycles = dwt_cycles();
+	stats->cyc_format += copy_cycles - start_cycles;
+#endif
+	uint8_t measured = latency_open(total, start_cycles);
+	if(queue_reserve(total)) {
+		latency_commit(measured, total, 0);
+		METRIC_INC(LOG_DROPPED);
+#if LOG_TAG_ACCOUNTING
+		stats->dropped++;
+		stats->cyc_copy += dwt_cycles() - copy_cycles;
+#endif
+		return -1; // not enough space
+	}
+#if LOG_BLOB_DMA
+	uint8_t dma = (length >= _blob_dma_min) && !_blob_pending;
+#else
+	uint8_t dma = 0;
+#endif
+	latency_commit(measured, total, 1);
+
+	const uint8_t *src = data;
+	uint16_t pos = _queue_write;
+	for(uint16_t offset = 0, c = 0; c < chunks; c++, offset += LOG_BLOB_CHUNK) {
+		uint16_t n = (length - offset > LOG_BLOB_CHUNK) ? LOG_BLOB_CHUNK : length - offset;
+		uint8_t header[LOG_FRAME_HEADER_SIZE + LOG_BLOB_HEADER_SIZE] = {
+			LOG_FRAME_SYNC, LOG_FRAME_BLOB, (uint8_t)(LOG_BLOB_HEADER_SIZE + n),
+			id, (uint8_t)offset, (uint8_t)(offset >> 8), (uint8_t)length, (uint8_t)(length >> 8)
+		};
+		pos = ring_copy(pos, header, sizeof(header));
+		if(dma) {
+			pos += n;
+			if(pos >= LOG_DMA_BUFFER_SIZE) pos -= LOG_DMA_BUFFER_SIZE;
+		} else {
+			pos = ring_copy(pos, &src[offset], n);
+		}
+	}
+
+#if LOG_BLOB_DMA
+	if(dma) {
+		// The readers stop at the blob's first frame until the completion interrupt commits it
+		_blob_src = src;
+		// the first frame's data, after its headers (_queue_write is still the blob's start)
+		_blob_dst = _queue_write + LOG_FRAME_HEADER_SIZE + LOG_BLOB_HEADER_SIZE;
+		if(_blob_dst >= LOG_DMA_BUFFER_SIZE) _blob_dst -= LOG_DMA_BUFFER_SIZE;
+		_blob_left = length;
+		_blob_chunk_left = (length > LOG_BLOB_CHUNK) ? LOG_BLOB_CHUNK : length;
+		_blob_segment = 0;
+		blob_advance();
+		_blob_pending = 1;
+		queue_publish(pos);
+		blob_dma_copy(&_usart2_tx_dma_buffer[_blob_dst], _blob_src, _blob_segment);
+	} else
+#endif
+	{
+		queue_publish(pos);
+		restart_dma();
+	}
+	log_tag_charge(LOG_TAG_TELEMETRY, total);
+#if LOG_TAG_ACCOUNTING
+	stats->cyc_copy += dwt_cycles() - copy_cycles;
+	stats->items += chunks;
+	stats->bytes += total;
+#endif
+	return total;
 }
 
+#else
+// Blobs need the circular engine's reserve / commit (see log.h)
+int log_blob(uint8_t id, const void *data, uint16_t length) { (void)id; (void)data; (void)length; return -1; }
+uint8_t log_blob_busy(void) { return 0; }
+void log_blob_benchmark(void) { }
+void log_blob_dma_irq(void) { }
+#endif
+
+
+//=============================================================================
+// Panic / fault path: send everything still queued by polling the UART, with interrupts disabled.
+// Returns with interrupts still disabled - the caller is expected to halt or reset.
+void log_panic_flush(void) {
+//=============================================================================
+	__disable_irq();
+
+	// Let the DMA transfer in progress finish, its completion interrupt won't run, so advance the head here
+	if(_last_dma_count) {
+		DMA_Channel_TypeDef *dma = huart2.hdmatx->Instance;
+		while((dma->CCR & DMA_CCR_EN) && dma->CNDTR) {
+		}
+#if LOG_ENGINE == LOG_ENGINE_CIRCULAR
+		_queue_head += _last_dma_count;
+		if(_queue_head >= LOG_DMA_BUFFER_SIZE) _queue_head -= LOG_DMA_BUFFER_SIZE;
+#endif
+		_last_dma_count = 0;
+	}
+#if LOG_ENGINE == LOG_ENGINE_CIRCULAR && LOG_BLOB_DMA
+	if(_blob_pending) {
+		// The blob copy's completion interrupt won't run either: the CPU redoes the current segment and
+		// copies the rest, then commits the blob and what was queued behind it
+		LOG_BLOB_DMA_CH->CCR = 0;
+		DMA1->IFCR = DMA_IFCR_CGIF2;
+		do {
+			memcpy(&_usart2_tx_dma_buffer[_blob_dst], _blob_src, _blob_segment);
+		} while(blob_advance());
+		_queue_tail = _queue_write;
+		_blob_pending = 0;
+	}
+#endif
+
+	USART_TypeDef *uart = huart2.Instance;
+	uart->CR3 &= ~USART_CR3_DMAT;
+#if LOG_ENGINE == LOG_ENGINE_CIRCULAR
+	while(_queue_head != _queue_tail) {
+		while(!(uart->SR & USART_SR_TXE)) {
+		}
+		uart->DR = (uint8_t)_usart2_tx_dma_buffer[_queue_head];
+		if(++_queue_head >= LOG_DMA_BUFFER_SIZE) _queue_head = 0;
+	}
+#else
+	const char *fill = &_usart2_tx_dma_buffer[_pp_fill * LOG_PP_HALF];
+	for(uint16_t i = 0; i < _pp_fill_len; i++) {
+		while(!(uart->SR & USART_SR_TXE)) {
+		}
+		uart->DR = (uint8_t)fill[i];
+	}
+	_pp_fill_len = 0;
+#endif
+	while(!(uart->SR & USART_SR_TC)) {
+	}
+}
 
 //=============================================================================
 // In response to completing the last DMA transfer, restart the process if more data is available.
@@ -217,6 +1080,11 @@ void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart) {
 //		}
 //	}
 
+#if LOG_ENGINE == LOG_ENGINE_PINGPONG
+	// The sent half is free again, send the fill half if it holds anything
+	latency_done(_last_dma_count);
+	_last_dma_count = 0;
+#else
 	// If queue is empty
 	if(_queue_head == _queue_tail) {
 		// queue is empty
@@ -224,12 +1092,15 @@ void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart) {
 	}
 
 	// Advance the head
+	_readers[0].bytes_read += _last_dma_count;
 	_queue_head += _last_dma_count;
 	if(_queue_head >= LOG_DMA_BUFFER_SIZE) {
 		_queue_head -= LOG_DMA_BUFFER_SIZE;
 	}
+	latency_done(_last_dma_count);
 
 	_last_dma_count = 0;
+#endif
 
 	// If queue has more data/messages, setup the next USART TX DMA operation
 	restart_dma();
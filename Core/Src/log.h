@@ -1,7 +1,13 @@
 // Module: log.h
 //
 // logging library
+#ifndef LOG_H
+#define LOG_H
+
 #include <main.h>
+#include <stdarg.h>
+#include "log_frame.h"
+#include "log_tags.h"
 
 // Define ANSI colors, to be used within printf() text
 // The foreground colors 30 - 38, are the "normal" darker colors
@@ -25,6 +31,89 @@
 #define LOG_DMA_BUFFER_SIZE  4096
 //#define LOG_DMA_BUFFER_SIZE  16
 
+// Queue engines, selected with LOG_ENGINE
+// * CIRCULAR: one circular queue, each DMA transfer sends from the head up to the tail (or the end of
+//     the buffer, the wrapped part goes with the next transfer).  Items can use the whole buffer.
+// * PINGPONG: two halves of LOG_DMA_BUFFER_SIZE/2.  Items are appended to the fill half with no wrap
+//     handling, the DMA completion swaps halves and sends the whole fill half in one transfer.
+//     Appends run with interrupts disabled, as the swap happens in the ISR.
+// Tools/engine_bench.c simulates both with different message sizes and bursts.
+#define LOG_ENGINE_CIRCULAR  0
+#define LOG_ENGINE_PINGPONG  1
+#ifndef LOG_ENGINE
+#define LOG_ENGINE  LOG_ENGINE_CIRCULAR
+#endif
+
+// Readers (circular engine): the queue has one write position and up to LOG_READERS_MAX read cursors.
+// Reader 0 is the UART DMA, the others (SD card sink, ...) add themselves with log_reader_add() and pull
+// with log_reader_peek() / log_reader_consume() from the main loop.  Every item is formatted and stored
+// once.  Space is reclaimed behind the slowest lossless reader, a lossy reader that would be overrun
+// skips its backlog (jumps to the item being written) instead of blocking the producers.
+#define LOG_READERS_MAX  4
+#define LOG_READER_LOSSLESS  0
+#define LOG_READER_LOSSY     1
+
+typedef struct {
+	const char *name;
+	uint8_t lossy;
+	volatile uint16_t head;    // next byte to read (reader 0 uses the DMA queue head instead)
+	uint16_t max_lag;          // most bytes waiting for this reader, since the last report
+	uint32_t bytes_read;
+	uint32_t bytes_skipped;    // lossy: backlog given up
+} log_reader_t;
+
+// Latency tracking: a side table remembers the DWT cycle count of the logmsg() / log_frame() call for
+// each of the last LOG_LATENCY_RECORDS items still queued.  The DMA start stamps the items it sends,
+// the DMA completion retires them into two histograms (histo_def.h, exported with the others):
+// * log_queue_us : call to the start of the DMA transfer holding the first byte (time spent waiting)
+// * log_tx_us    : start of that transfer to completion of the one holding the last byte (on the wire)
+// Items queued while the table is full aren't measured.
+#ifndef LOG_LATENCY
+#define LOG_LATENCY  1
+#endif
+#define LOG_LATENCY_RECORDS  64  // power of two, up to 128
+
+// Formatted text cache: a message whose format pointer and argument values (hashed, %s by content) match a
+// cached entry skips vsnprintf(), the cached body is copied after a fresh timestamp.  Direct mapped,
+// LOG_MEMO_ENTRIES entries of bodies up to LOG_MEMO_TEXT characters.  0 entries removes the cache.
+// Formats in RAM or with %n aren't cached.  Hits, misses and net cycles saved are reported by log_memo_report().
+#ifndef LOG_MEMO_ENTRIES
+#define LOG_MEMO_ENTRIES  8
+#endif
+#define LOG_MEMO_TEXT  64
+
+typedef struct {
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t uncached;       // format not cacheable (in RAM, %n, unknown conversion)
+	int32_t cycles_saved;    // formatting cycles saved by the hits, less the hashing cost of all lookups
+} log_memo_stats_t;
+
+extern log_memo_stats_t log_memo_stats;
+
+// Binary payloads: log_blob() queues a buffer as LOG_FRAME_BLOB frames of up to LOG_BLOB_CHUNK data bytes,
+// reserved together so nothing gets in between.  The frame headers are written by the CPU, the data by
+// memcpy() or, when LOG_BLOB_DMA is set and the payload is at least the crossover size, by DMA1 channel 2
+// (memory to memory).  A DMA copy returns right away, the frames are committed to the readers from its
+// completion interrupt: the buffer must stay unchanged until log_blob_busy() returns 0.  Items queued in the
+// meantime wait behind the blob.  log_blob_benchmark() times both copies at startup and sets the crossover.
+// Circular engine only (log_blob() returns -1 with the ping-pong engine).
+#ifndef LOG_BLOB_DMA
+#define LOG_BLOB_DMA  1
+#endif
+#define LOG_BLOB_CHUNK    240   // data bytes per frame, LOG_BLOB_HEADER_SIZE + this fits a frame payload
+#define LOG_BLOB_DMA_MIN  64    // crossover used until log_blob_benchmark() runs
+
+// Bounded time logging: logmsg_wcet() / logtag_wcet() format with the restricted subset of log_format.h
+// (d i u x X c s %, capped widths and %s length, no floats), so a call costs at most
+// LOG_WCET_CYC_ITEM + log_wcet_bound(format) cycles, whatever the arguments.  Output past LOG_MAX_TEXT is
+// truncated.  Tools/wcet_check.c finds the calls in the sources and checks each format's bound on the host.
+
+#ifndef LOG_FAST_FORMAT
+#define LOG_FAST_FORMAT  1  // 1: messages are formatted by log_vsnprintf() (log_format.h, integer-only %f %e %g,
+                            //    ties, %f >= 2^63 and 16-17 digit %g differ from the C library, see there)
+#endif                      // 0: newlib vsnprintf() (%f needs "-u _printf_float" at link time)
+
 typedef enum {
     DBG_LOG_NONE,       /* No log output */
 	DBG_LOG_ERROR,      /* Critical errors, software module can not recover on its own */
@@ -34,9 +123,51 @@ typedef enum {
 	DBG_LOG_VERBOSE     /* Bigger chunks of debugging information, or frequent messages which can potentially flood the output. */
 } dbg_log_level_t;
 
-int logmsg(const char *format, ...);
+int log_init(void);
+int logmsg(const char *format, ...);                        // log_tag_t LOG_TAG_DEFAULT
+int logtag(log_tag_t tag, const char *format, ...);        // cost is accounted to the tag, see log_tags.h
+int vlogtag(log_tag_t tag, const char *format, va_list arg_ptr);
+int logmsg_wcet(const char *format, ...);                   // bounded time, restricted formats (see below)
+int logtag_wcet(log_tag_t tag, const char *format, ...);
+int vlogtag_wcet(log_tag_t tag, const char *format, va_list arg_ptr);
+int log_frame(uint8_t type, const void *payload, uint16_t length); // queue a binary frame, see log_frame.h
+void log_panic_flush(void); // send the queue by polling, interrupts left disabled (fault / panic path)
+int log_reader_add(const char *name, uint8_t lossy);        // returns the reader id, -1 if none left
+uint16_t log_reader_peek(int reader, const char **data);    // contiguous bytes waiting at the cursor
+uint16_t log_reader_record(int reader);                     // length of the whole record at the cursor, 0: none
+void log_reader_consume(int reader, uint16_t length);
+uint16_t log_reader_lag(int reader);                        // bytes waiting for the reader
+void log_reader_report(void);                               // log lag / read / skipped per reader
+void log_memo_report(void);                                 // log the formatted text cache stats, and clear them
+int log_blob(uint8_t id, const void *data, uint16_t length); // queue a binary payload, returns bytes queued
+uint8_t log_blob_busy(void);                                // a DMA blob copy is running, keep its buffer
+void log_blob_benchmark(void);                              // time memcpy() against DMA, set the crossover
+void log_blob_dma_irq(void);                                // DMA1 channel 2 interrupt
 extern const char bigstring[]; // log.c
 
+// Log a value only when it moves: LOG_ON_CHANGE(tag, value, deadband, keepalive_ms, format, ...)
+// Each call site keeps the last value it logged.  A record is queued when value (int32_t) differs from
+// it by more than deadband, or keepalive_ms after the previous record (0: no keep-alive).  Values
+// wandering inside the deadband around the logged one stay quiet (hysteresis), a slow drift is logged
+// each time it adds up to more than deadband.  Scale floats to integers (ex: centi-degrees) first.
+// A suppressed call is three compares (first call / deadband / keep-alive tick), no function call.
+// If the record is refused (queue full, tag over its share) it is tried again on the next call.
+//   LOG_ON_CHANGE(LOG_TAG_MAIN, temp_cdeg, 50, 60000, "temp %ld.%02ld C", temp_cdeg / 100, temp_cdeg % 100);
+#define LOG_ON_CHANGE(tag, value, deadband, keepalive_ms, ...) do { \
+	static int32_t _lc_logged; \
+	static uint32_t _lc_due; \
+	static uint8_t _lc_armed; \
+	int32_t _lc_value = (int32_t)(value); \
+	if(!_lc_armed || (uint32_t)_lc_value - (uint32_t)_lc_logged + (uint32_t)(deadband) > 2u * (uint32_t)(deadband) || \
+			((keepalive_ms) && (int32_t)(uwTick - _lc_due) >= 0)) { \
+		if(logtag(tag, __VA_ARGS__) >= 0) { \
+			_lc_logged = _lc_value; \
+			_lc_due = uwTick + (keepalive_ms); \
+			_lc_armed = 1; \
+		} \
+	} \
+} while(0)
+
 extern UART_HandleTypeDef huart2; // main.c - UART being used for logger
 
 
@@ -63,3 +194,5 @@ void dbg_log(dbg_log_level_t level,
 // Start simple
 void dbg_log(const char *format, ...);
 #endif
+
+#endif // LOG_H
@@ -0,0 +1,110 @@
+// Module: log_assert.c
+//
+// Assertion failure handling (see log_assert.h)
+// LOG_FRAME_ASSERT payload      : tick (uint32), descriptor index (uint16), policy, value count, values (uint32)...
+// LOG_FRAME_ASSERT_DESC payload : descriptor index (uint16), line (uint16), policy, file name, '\0', expression
+// All multi-byte fields are little endian.
+
+#include <stdint.h>
+#include <string.h>
+#include "log.h"
+#include "log_assert.h"
+#include "metrics.h"
+
+extern const log_assert_desc_t __log_assert_start[]; // linker script
+extern const log_assert_desc_t __log_assert_end[];
+
+static uint32_t _assert_counts[LOG_ASSERT_COUNTERS];
+static uint32_t _assert_failures;
+
+//=============================================================================
+static uint16_t log_assert_index(const log_assert_desc_t *desc) {
+//=============================================================================
+	return (uint16_t)(desc - __log_assert_start);
+}
+
+//=============================================================================
+static void send_failure(uint16_t index, uint8_t policy, uint8_t nvalues, uint32_t a, uint32_t b) {
+//=============================================================================
+	uint8_t payload[16];
+	log_put_u32(payload, HAL_GetTick());
+	payload[4] = (uint8_t)index;
+	payload[5] = (uint8_t)(index >> 8);
+	payload[6] = policy;
+	payload[7] = nvalues;
+	log_put_u32(&payload[8], a);
+	log_put_u32(&payload[12], b);
+	log_frame(LOG_FRAME_ASSERT, payload, 8 + 4 * nvalues);
+}
+
+//=============================================================================
+// Out of line, so the inline part of an assertion stays a compare, a branch and a call
+void log_assert_fail(const log_assert_desc_t *desc, uint8_t nvalues, uint32_t a, uint32_t b) {
+//=============================================================================
+	uint16_t index = log_assert_index(desc);
+
+	_assert_failures++;
+	METRIC_INC(ASSERT_FAILURES);
+	if(index < LOG_ASSERT_COUNTERS) _assert_counts[index]++;
+	if(desc->policy == LOG_ASSERT_COUNT) return;
+
+	send_failure(index, desc->policy, nvalues, a, b);
+
+	if(desc->policy == LOG_ASSERT_PANIC) {
+		log_panic_flush(); // returns with interrupts disabled
+		while(1) {
+		}
+	}
+}
+
+//=============================================================================
+// HAL parameter check failed: the file name isn't formatted, its address is sent instead
+// (look it up in the .map file / ELF)
+void log_assert_hal(const uint8_t *file, uint32_t line) {
+//=============================================================================
+	_assert_failures++;
+	METRIC_INC(ASSERT_FAILURES);
+	send_failure(LOG_ASSERT_HAL, LOG_ASSERT_CONTINUE, 2, line, (uint32_t)file);
+}
+
+//=============================================================================
+uint32_t log_assert_count(uint16_t index) {
+//=============================================================================
+	return index < LOG_ASSERT_COUNTERS ? _assert_counts[index] : 0;
+}
+
+//=============================================================================
+uint32_t log_assert_failures(void) {
+//=============================================================================
+	return _assert_failures;
+}
+
+//=============================================================================
+// One frame per descriptor.  Waits for space in the log queue, so call it before the
+// main loop gets busy (or when the host asks for it).
+void log_assert_send_table(void) {
+//=============================================================================
+	uint8_t payload[LOG_ITEM_MAX_SIZE - LOG_FRAME_HEADER_SIZE];
+	for(const log_assert_desc_t *d = __log_assert_start; d < __log_assert_end; d++) {
+		uint16_t index = log_assert_index(d);
+		const char *file = strrchr(d->file, '/');
+		file = file ? file + 1 : d->file;
+		uint16_t len = 5;
+		payload[0] = (uint8_t)index;
+		payload[1] = (uint8_t)(index >> 8);
+		payload[2] = (uint8_t)d->line;
+		payload[3] = (uint8_t)(d->line >> 8);
+		payload[4] = d->policy;
+		uint16_t n = strlen(file) + 1; // keep the '\0' separator
+		if(n > sizeof(payload) - len) n = sizeof(payload) - len;
+		memcpy(&payload[len], file, n);
+		len += n;
+		n = strlen(d->expr);
+		if(n > sizeof(payload) - len) n = sizeof(payload) - len;
+		memcpy(&payload[len], d->expr, n);
+		len += n;
+		uint32_t start = HAL_GetTick();
+		while(log_frame(LOG_FRAME_ASSERT_DESC, payload, len) < 0 && HAL_GetTick() - start < 100) {
+		}
+	}
+}
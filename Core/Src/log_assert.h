@@ -0,0 +1,57 @@
+// Module: log_assert.h
+//
+// Assertions that are cheap enough to leave enabled in production
+// The condition is evaluated inline (a compare and a branch).  The expression text, file and line
+// are kept in a flash descriptor, placed in the .log_assert section by the linker script, and
+// nothing is formatted on the target.  On failure, a LOG_FRAME_ASSERT frame carries the descriptor
+// index and up to two captured values; log_assert_send_table() sends the descriptors to the host.
+//
+//   ASSERT(cond)              log, continue
+//   ASSERT_COUNT(cond)        count failures only (see log_assert_count()), nothing is logged
+//   ASSERT_PANIC(cond)        log, flush the log queue with interrupts disabled, halt
+//   CHECK(cond, a, b)         log with the values of a and b, continue
+//   CHECK_PANIC(cond, a, b)   log with the values of a and b, flush, halt
+#ifndef LOG_ASSERT_H
+#define LOG_ASSERT_H
+
+#include <stdint.h>
+
+typedef enum {
+	LOG_ASSERT_CONTINUE,
+	LOG_ASSERT_COUNT,
+	LOG_ASSERT_PANIC,
+} log_assert_policy_t;
+
+typedef struct {
+	const char *expr;
+	const char *file;
+	uint16_t line;
+	uint8_t policy;   // log_assert_policy_t
+} log_assert_desc_t;
+
+#define LOG_ASSERT_COUNTERS  32      // first N descriptors get a failure counter
+#define LOG_ASSERT_HAL       0xFFFF  // descriptor index used by the HAL's assert_failed()
+
+// The descriptors are an array (indexed from __log_assert_start): the explicit alignment keeps the
+// compiler from padding between them (x86-64 GCC aligns larger objects to 16 bytes, for the emulator)
+#define LOG_ASSERT_IMPL(policy, cond, n, a, b) do { \
+	if(__builtin_expect(!(cond), 0)) { \
+		static const log_assert_desc_t _log_assert_desc \
+			__attribute__((section(".log_assert"), used, aligned(__alignof__(log_assert_desc_t)))) = \
+			{ #cond, __FILE__, __LINE__, policy }; \
+		log_assert_fail(&_log_assert_desc, n, (uint32_t)(a), (uint32_t)(b)); \
+	} } while(0)
+
+#define ASSERT(cond)              LOG_ASSERT_IMPL(LOG_ASSERT_CONTINUE, cond, 0, 0, 0)
+#define ASSERT_COUNT(cond)        LOG_ASSERT_IMPL(LOG_ASSERT_COUNT, cond, 0, 0, 0)
+#define ASSERT_PANIC(cond)        LOG_ASSERT_IMPL(LOG_ASSERT_PANIC, cond, 0, 0, 0)
+#define CHECK(cond, a, b)         LOG_ASSERT_IMPL(LOG_ASSERT_CONTINUE, cond, 2, a, b)
+#define CHECK_PANIC(cond, a, b)   LOG_ASSERT_IMPL(LOG_ASSERT_PANIC, cond, 2, a, b)
+
+void log_assert_fail(const log_assert_desc_t *desc, uint8_t nvalues, uint32_t a, uint32_t b);
+void log_assert_hal(const uint8_t *file, uint32_t line); // for assert_failed(), USE_FULL_ASSERT
+uint32_t log_assert_count(uint16_t index);                 // failures of one descriptor
+uint32_t log_assert_failures(void);                        // failures of all assertions
+void log_assert_send_table(void);                         // send all descriptors to the host
+
+#endif // LOG_ASSERT_H
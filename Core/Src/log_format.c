@@ -0,0 +1,658 @@
+// Module: log_format.c
+//
+// printf() style formatter with integer-only floating point (see log_format.h)
+//
+// Floating point method: a double is split into a 53 bit mantissa and a binary exponent, and held as
+// value = x * 2^be, with x normalized into [2^59, 2^60).  That leaves 4 bits of headroom, so
+// multiplying by 10 is exact in 64 bits.  Dividing by 10 loses at most one bit in 2^60, far below
+// the 53 bits of a double (it rounds to nearest).
+// * %f: the integer part is x >> -be, the fraction becomes a 60 bit fixed point number, and each
+//   decimal digit is the top 4 bits after multiplying the fraction by 10.  Rounding is half up, at the
+//   first digit not printed.
+// * %e: the value is scaled by powers of 10 until its integer part is a single digit, then formatted as %f.
+// * %g: the significant digits of %e, laid out in fixed or scientific notation depending on the
+//   decimal exponent, trailing zeros removed (unless '#').
+//
+// log_wcet_vsnprintf() shares the integer and field helpers; its limits keep them on the 32-bit path
+// with at most LOG_WCET_MAX_WIDTH characters of padding.
+
+#include <stdint.h>
+#include <string.h>
+#include "log_format.h"
+
+#define FMT_MAX_PRECISION  17
+
+typedef struct {
+	char *buf;
+	size_t size;
+	size_t len;      // characters produced so far (including those that didn't fit)
+} out_t;
+
+//=============================================================================
+static void out_char(out_t *o, char c) {
+//=============================================================================
+	if(o->len + 1 < o->size) o->buf[o->len] = c;
+	o->len++;
+}
+
+//=============================================================================
+static void out_repeat(out_t *o, char c, int n) {
+//=============================================================================
+	while(n-- > 0) out_char(o, c);
+}
+
+//=============================================================================
+static void out_mem(out_t *o, const char *s, size_t n) {
+//=============================================================================
+	if(o->len + 1 < o->size) {
+		size_t room = o->size - 1 - o->len;
+		memcpy(&o->buf[o->len], s, n < room ? n : room);
+	}
+	o->len += n;
+}
+
+// Conversion flags
+#define F_LEFT   0x01
+#define F_PLUS   0x02
+#define F_SPACE  0x04
+#define F_ALT    0x08
+#define F_ZERO   0x10
+#define F_UPPER  0x20
+
+//=============================================================================
+// Emit prefix (sign, 0x) + body with width padding.  zero_pad places '0's between prefix and body.
+static void out_field(out_t *o, const char *prefix, int plen, const char *body, int blen, int width, int flags) {
+//=============================================================================
+	int pad = width - plen - blen;
+	if(!(flags & F_LEFT) && !(flags & F_ZERO)) out_repeat(o, ' ', pad);
+	out_mem(o, prefix, plen);
+	if(!(flags & F_LEFT) && (flags & F_ZERO)) out_repeat(o, '0', pad);
+	out_mem(o, body, blen);
+	if(flags & F_LEFT) out_repeat(o, ' ', pad);
+}
+
+//=============================================================================
+// Unsigned to text, digits written backwards from end, returns start.  64-bit only when needed:
+// the 32-bit path avoids the software 64-bit division.
+static char *utoa_rev(char *end, uint64_t v, unsigned base, int upper) {
+//=============================================================================
+	const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+	char *p = end;
+	while(v > 0xFFFFFFFFu) {
+		*--p = digits[v % base];
+		v /= base;
+	}
+	uint32_t v32 = (uint32_t)v;
+	do {
+		*--p = digits[v32 % base];
+		v32 /= base;
+	} while(v32);
+	return p;
+}
+
+//=============================================================================
+static void format_integer(out_t *o, uint64_t v, int negative, unsigned base, int width, int precision, int flags) {
+//=============================================================================
+	char tmp[24 + 32];
+	char prefix[3];
+	int plen = 0;
+	char *end = tmp + sizeof(tmp);
+	char *p = (v == 0 && precision == 0) ? end : utoa_rev(end, v, base, flags & F_UPPER);
+
+	if(precision > 32) precision = 32;
+	while(end - p < precision) *--p = '0';
+	if(base == 8 && (flags & F_ALT) && *p != '0') *--p = '0';
+
+	if(negative) prefix[plen++] = '-';
+	else if(flags & F_PLUS) prefix[plen++] = '+';
+	else if(flags & F_SPACE) prefix[plen++] = ' ';
+	if(base == 16 && (flags & F_ALT) && v) {
+		prefix[plen++] = '0';
+		prefix[plen++] = (flags & F_UPPER) ? 'X' : 'x';
+	}
+	if(precision >= 0) flags &= ~F_ZERO; // C: precision given, the 0 flag is ignored
+	out_field(o, prefix, plen, p, (int)(end - p), width, flags);
+}
+
+//=============================================================================
+// Floating point, integer-only
+//=============================================================================
+typedef struct {
+	uint64_t x;   // mantissa, normalized into [2^59, 2^60) (or 0)
+	int be;       // binary exponent: value = x * 2^be
+} fp_t;
+
+#define FP_TOP  59
+
+//=============================================================================
+static void fp_normalize(fp_t *f) {
+//=============================================================================
+	if(!f->x) return;
+	while(f->x >= (1ull << (FP_TOP + 1))) {
+		f->x >>= 1;
+		f->be++;
+	}
+	while(f->x < (1ull << FP_TOP)) {
+		f->x <<= 1;
+		f->be--;
+	}
+}
+
+//=============================================================================
+static void fp_mul10(fp_t *f) {
+//=============================================================================
+	f->x *= 10; // < 2^64, exact
+	fp_normalize(f);
+}
+
+//=============================================================================
+static void fp_div10(fp_t *f) {
+//=============================================================================
+	// Use all 64 bits for the quotient
+	f->x <<= 63 - FP_TOP;
+	f->be -= 63 - FP_TOP;
+	f->x = (f->x + 5) / 10;
+	fp_normalize(f);
+}
+
+//=============================================================================
+// Integer part, if it fits in 63 bits (returns -1 if not)
+static int fp_int(const fp_t *f, uint64_t *ip) {
+//=============================================================================
+	if(f->be >= 63 - FP_TOP) return -1;
+	if(f->be >= 0) *ip = f->x << f->be;
+	else *ip = -f->be > 63 ? 0 : f->x >> -f->be;
+	return 0;
+}
+
+//=============================================================================
+// Fraction as a 60 bit fixed point number
+static uint64_t fp_frac60(const fp_t *f) {
+//=============================================================================
+	if(f->be >= 0) return 0;
+	int shift = -f->be;
+	if(shift > 63) return f->x >> (shift - 60); // shift < 124, see fp_fixed()
+	uint64_t frac = f->x & ((1ull << shift) - 1);
+	return shift <= 60 ? frac << (60 - shift) : frac >> (shift - 60);
+}
+
+//=============================================================================
+// Digits of a fixed notation number: integer part, '.', precision digits.  Returns length,
+// or -1 if the integer part doesn't fit in 63 bits.
+static int fp_fixed(const fp_t *f, int precision, int alt, char *out) {
+//=============================================================================
+	uint64_t ip;
+	char frac[FMT_MAX_PRECISION + 1];
+	char tmp[24];
+
+	if(f->be <= -124) { // tiny: integer and fraction are both zero at this precision
+		ip = 0;
+		memset(frac, '0', precision);
+	} else {
+		if(fp_int(f, &ip)) return -1;
+		uint64_t fr = fp_frac60(f);
+		for(int i = 0; i < precision; i++) {
+			fr *= 10;
+			frac[i] = '0' + (char)(fr >> 60);
+			fr &= (1ull << 60) - 1;
+		}
+		if(fr >= (1ull << 59)) { // round half up, carry through the digits into the integer part
+			int i = precision - 1;
+			for(; i >= 0; i--) {
+				if(frac[i] != '9') {
+					frac[i]++;
+					break;
+				}
+				frac[i] = '0';
+			}
+			if(i < 0) ip++;
+		}
+	}
+	char *end = tmp + sizeof(tmp);
+	char *p = utoa_rev(end, ip, 10, 0);
+	int len = (int)(end - p);
+	memcpy(out, p, len);
+	if(precision || alt) out[len++] = '.';
+	memcpy(&out[len], frac, precision);
+	return len + precision;
+}
+
+//=============================================================================
+// Scale into [1, 10), returns the decimal exponent
+static int fp_scale(fp_t *f) {
+//=============================================================================
+	int exp10 = 0;
+	uint64_t ip;
+	if(!f->x) return 0;
+	while(fp_int(f, &ip) || ip >= 10) {
+		fp_div10(f);
+		exp10++;
+	}
+	while(ip == 0) {
+		fp_mul10(f);
+		exp10--;
+		fp_int(f, &ip);
+	}
+	return exp10;
+}
+
+//=============================================================================
+// Scientific notation mantissa: d.ddd, decimal exponent in *exp10.
+// Values with an integer part of 2 to 19 digits take their digits from the exact integer
+// instead of scaling, so ties like 1049.5 -> 1.050e+03 round the same way %f would.
+static int fp_scientific(fp_t f, int precision, int alt, char *out, int *exp10) {
+//=============================================================================
+	char digits[24 + 1 + FMT_MAX_PRECISION];
+	char tmp[24];
+	uint64_t ip;
+	int n;
+
+	if(!fp_int(&f, &ip) && ip >= 10) {
+		char *end = tmp + sizeof(tmp);
+		char *p = utoa_rev(end, ip, 10, 0);
+		n = (int)(end - p);
+		*exp10 = 0;
+		if(n > precision + 1) memcpy(digits, p, n); // rounded on the next digit below
+		else n = fp_fixed(&f, precision + 1 - n, 0, digits);
+	} else {
+		*exp10 = fp_scale(&f);
+		n = fp_fixed(&f, precision, 0, digits);
+	}
+	// Digits before the '.' (2 if fp_fixed() rounded up to the next power of 10)
+	char *dot = memchr(digits, '.', n);
+	int int_digits = dot ? (int)(dot - digits) : n;
+	*exp10 += int_digits - 1;
+	if(dot) {
+		memmove(dot, dot + 1, n - int_digits - 1);
+		n--;
+	}
+	if(n > precision + 1 && digits[precision + 1] >= '5') { // round half up, carry
+		int i = precision;
+		for(; i >= 0; i--) {
+			if(digits[i] != '9') {
+				digits[i]++;
+				break;
+			}
+			digits[i] = '0';
+		}
+		if(i < 0) {
+			digits[0] = '1';
+			(*exp10)++;
+		}
+	}
+
+	int len = 0;
+	out[len++] = digits[0];
+	if(precision || alt) out[len++] = '.';
+	memcpy(&out[len], &digits[1], precision);
+	return len + precision;
+}
+
+//=============================================================================
+static int put_exponent(char *out, int exp10, int upper) {
+//=============================================================================
+	int len = 0;
+	out[len++] = upper ? 'E' : 'e';
+	out[len++] = exp10 < 0 ? '-' : '+';
+	if(exp10 < 0) exp10 = -exp10;
+	if(exp10 >= 100) {
+		out[len++] = '0' + exp10 / 100;
+		exp10 %= 100;
+	}
+	out[len++] = '0' + exp10 / 10;
+	out[len++] = '0' + exp10 % 10;
+	return len;
+}
+
+//=============================================================================
+static void format_float(out_t *o, double d, char conv, int width, int precision, int flags) {
+//=============================================================================
+	char body[24 + 2 + FMT_MAX_PRECISION + 8];
+	char prefix[1];
+	int plen = 0, len;
+	int upper = (conv == 'F' || conv == 'E' || conv == 'G');
+	uint64_t bits;
+	memcpy(&bits, &d, sizeof(bits));
+
+	int negative = (int)(bits >> 63);
+	int bexp = (int)((bits >> 52) & 0x7FF);
+	uint64_t mant = bits & ((1ull << 52) - 1);
+
+	if(negative) prefix[plen++] = '-';
+	else if(flags & F_PLUS) prefix[plen++] = '+';
+	else if(flags & F_SPACE) prefix[plen++] = ' ';
+
+	if(bexp == 0x7FF) { // infinity / NaN
+		memcpy(body, mant ? (upper ? "NAN" : "nan") : (upper ? "INF" : "inf"), 3);
+		out_field(o, prefix, plen, body, 3, width, flags & ~F_ZERO);
+		return;
+	}
+
+	fp_t f;
+	f.x = bexp ? (mant | (1ull << 52)) : mant;  // denormals have no hidden bit
+	f.be = (bexp ? bexp : 1) - 1075;
+	fp_normalize(&f);
+
+	if(precision < 0) precision = 6;
+	if(precision > FMT_MAX_PRECISION) precision = FMT_MAX_PRECISION;
+
+	int exp10;
+	if(conv == 'g' || conv == 'G') {
+		int p = precision ? precision : 1;
+		char sig[2 + FMT_MAX_PRECISION];
+		// p significant digits "d.ddd", the decimal exponent after rounding decides the style
+		fp_scientific(f, p - 1, 1, sig, &exp10);
+		memmove(&sig[1], &sig[2], p - 1);
+		int fixed = (p > exp10 && exp10 >= -4);
+		len = 0;
+		if(fixed && exp10 < 0) {
+			body[len++] = '0';
+			body[len++] = '.';
+			for(int i = -1; i > exp10; i--) body[len++] = '0';
+			memcpy(&body[len], sig, p);
+			len += p;
+		} else {
+			int int_digits = fixed ? exp10 + 1 : 1;
+			memcpy(body, sig, int_digits);
+			len = int_digits;
+			body[len++] = '.';
+			memcpy(&body[len], &sig[int_digits], p - int_digits);
+			len += p - int_digits;
+		}
+		if(!(flags & F_ALT)) {
+			// Strip trailing zeros of the fraction (and the '.' if nothing is left)
+			while(body[len - 1] == '0') len--;
+			if(body[len - 1] == '.') len--;
+		}
+		if(!fixed) len += put_exponent(&body[len], exp10, upper);
+	} else if(conv == 'e' || conv == 'E') {
+		len = fp_scientific(f, precision, flags & F_ALT, body, &exp10);
+		len += put_exponent(&body[len], exp10, upper);
+	} else {
+		len = fp_fixed(&f, precision, flags & F_ALT, body);
+		if(len < 0) { // beyond 2^63
+			len = fp_scientific(f, precision, flags & F_ALT, body, &exp10);
+			len += put_exponent(&body[len], exp10, upper);
+		}
+	}
+	out_field(o, prefix, plen, body, len, width, flags);
+}
+
+//=============================================================================
+int log_vsnprintf(char *buf, size_t size, const char *format, va_list ap) {
+//=============================================================================
+	out_t o = { buf, size, 0 };
+	const char *f = format;
+
+	while(*f) {
+		// Copy literal text in one go
+		const char *lit = f;
+		while(*f && *f != '%') f++;
+		if(f != lit) out_mem(&o, lit, f - lit);
+		if(!*f) break;
+		f++; // '%'
+
+		int flags = 0, width = 0, precision = -1, length = 0;
+		for(;; f++) {
+			if(*f == '-') flags |= F_LEFT;
+			else if(*f == '+') flags |= F_PLUS;
+			else if(*f == ' ') flags |= F_SPACE;
+			else if(*f == '#') flags |= F_ALT;
+			else if(*f == '0') flags |= F_ZERO;
+			else break;
+		}
+		if(*f == '*') {
+			width = va_arg(ap, int);
+			if(width < 0) {
+				flags |= F_LEFT;
+				width = -width;
+			}
+			f++;
+		} else {
+			while(*f >= '0' && *f <= '9') width = width * 10 + (*f++ - '0');
+		}
+		if(*f == '.') {
+			f++;
+			precision = 0;
+			if(*f == '*') {
+				precision = va_arg(ap, int);
+				f++;
+			} else {
+				while(*f >= '0' && *f <= '9') precision = precision * 10 + (*f++ - '0');
+			}
+		}
+		if(flags & F_LEFT) flags &= ~F_ZERO;
+
+		// Length: 1 = long, 2 = long long / intmax_t (64 bit), -1 = short, -2 = char
+		for(;; f++) {
+			if(*f == 'l') length++;
+			else if(*f == 'h') length--;
+			else if(*f == 'j') length = 2;
+			else if(*f == 'z' || *f == 't') length = sizeof(size_t) > 4 ? 2 : 1;
+			else if(*f == 'L') ;
+			else break;
+		}
+		if(length > 1) length = 2;
+
+		char conv = *f;
+		if(!conv) break;
+		f++;
+		switch(conv) {
+		case 'd':
+		case 'i': {
+			int64_t v = length == 2 ? va_arg(ap, long long) : length == 1 ? va_arg(ap, long) : va_arg(ap, int);
+			if(length == -1) v = (short)v;
+			if(length == -2) v = (signed char)v;
+			format_integer(&o, v < 0 ? -(uint64_t)v : (uint64_t)v, v < 0, 10, width, precision, flags);
+			break;
+		}
+		case 'u':
+		case 'o':
+		case 'x':
+		case 'X': {
+			uint64_t v = length == 2 ? va_arg(ap, unsigned long long) :
+					length == 1 ? va_arg(ap, unsigned long) : va_arg(ap, unsigned int);
+			if(length == -1) v = (unsigned short)v;
+			if(length == -2) v = (unsigned char)v;
+			if(conv == 'X') flags |= F_UPPER;
+			format_integer(&o, v, 0, conv == 'u' ? 10 : conv == 'o' ? 8 : 16, width, precision,
+					flags & ~(F_PLUS | F_SPACE));
+			break;
+		}
+		case 'p': {
+			uintptr_t v = (uintptr_t)va_arg(ap, void *);
+			format_integer(&o, v, 0, 16, width, precision, F_ALT | (flags & F_LEFT));
+			break;
+		}
+		case 'c': {
+			char c = (char)va_arg(ap, int);
+			out_field(&o, "", 0, &c, 1, width, flags & ~F_ZERO);
+			break;
+		}
+		case 's': {
+			const char *s = va_arg(ap, const char *);
+			if(!s) s = "(null)";
+			size_t n = 0;
+			while(s[n] && (precision < 0 || n < (size_t)precision)) n++;
+			out_field(&o, "", 0, s, (int)n, width, flags & ~F_ZERO);
+			break;
+		}
+		case 'f':
+		case 'F':
+		case 'e':
+		case 'E':
+		case 'g':
+		case 'G':
+			format_float(&o, va_arg(ap, double), conv, width, precision, flags);
+			break;
+		case '%':
+			out_char(&o, '%');
+			break;
+		default: // unsupported conversion, copy it
+			out_char(&o, '%');
+			out_char(&o, conv);
+			break;
+		}
+	}
+
+	if(size) o.buf[o.len < size ? o.len : size - 1] = 0;
+	return (int)o.len;
+}
+
+//=============================================================================
+int log_snprintf(char *buf, size_t size, const char *format, ...) {
+//=============================================================================
+	va_list ap;
+	va_start(ap, format);
+	int len = log_vsnprintf(buf, size, format, ap);
+	va_end(ap);
+	return len;
+}
+
+//=============================================================================
+// Flags, width and precision of a bounded time conversion (f is past the '%').  Returns the format
+// position of the conversion character, *subset is cleared for anything outside the subset.
+static const char *wcet_spec(const char *f, int *flags, int *width, int *precision, int *length, int *subset) {
+//=============================================================================
+	*flags = 0;
+	*width = 0;
+	*precision = -1;
+	*length = 0;
+	for(;; f++) {
+		if(*f == '-') *flags |= F_LEFT;
+		else if(*f == '0') *flags |= F_ZERO;
+		else break;
+	}
+	while(*f >= '0' && *f <= '9') *width = *width * 10 + (*f++ - '0');
+	if(*f == '.') {
+		f++;
+		*precision = 0;
+		while(*f >= '0' && *f <= '9') *precision = *precision * 10 + (*f++ - '0');
+	}
+	if(*width > LOG_WCET_MAX_WIDTH) *width = LOG_WCET_MAX_WIDTH;
+	if(*precision > LOG_WCET_MAX_WIDTH) *precision = LOG_WCET_MAX_WIDTH;
+	if(*flags & F_LEFT) *flags &= ~F_ZERO;
+	if(*f == 'l') {
+		*length = 1;
+		f++;
+	} else {
+		while(*f == 'h') f++; // promoted to int anyway
+	}
+	switch(*f) {
+	case 'd': case 'i': case 'u': case 'x': case 'X': case 'c': case 's': case '%':
+		break;
+	default:
+		*subset = 0;
+	}
+	return f;
+}
+
+//=============================================================================
+int log_wcet_vsnprintf(char *buf, size_t size, const char *format, va_list ap) {
+//=============================================================================
+	out_t o = { buf, size, 0 };
+	const char *f = format;
+
+	while(*f) {
+		const char *lit = f;
+		while(*f && *f != '%') f++;
+		if(f != lit) out_mem(&o, lit, f - lit);
+		if(!*f) break;
+
+		int flags, width, precision, length, subset = 1;
+		const char *spec = f;
+		f = wcet_spec(f + 1, &flags, &width, &precision, &length, &subset);
+		char conv = *f;
+		if(!conv) break;
+		f++;
+		if(!subset) { // copied as text, the argument is left alone
+			out_mem(&o, spec, f - spec);
+			continue;
+		}
+		switch(conv) {
+		case 'd':
+		case 'i': {
+			int32_t v = length ? (int32_t)va_arg(ap, long) : va_arg(ap, int);
+			format_integer(&o, v < 0 ? -(uint32_t)v : (uint32_t)v, v < 0, 10, width, precision, flags);
+			break;
+		}
+		case 'u':
+		case 'x':
+		case 'X': {
+			uint32_t v = length ? (uint32_t)va_arg(ap, unsigned long) : va_arg(ap, unsigned int);
+			format_integer(&o, v, 0, conv == 'u' ? 10 : 16, width, precision, flags | (conv == 'X' ? F_UPPER : 0));
+			break;
+		}
+		case 'c': {
+			char c = (char)va_arg(ap, int);
+			out_field(&o, "", 0, &c, 1, width, flags & ~F_ZERO);
+			break;
+		}
+		case 's': {
+			const char *s = va_arg(ap, const char *);
+			if(!s) s = "(null)";
+			size_t max = (precision >= 0 && precision < LOG_WCET_MAX_STR) ? (size_t)precision : LOG_WCET_MAX_STR;
+			size_t n = 0;
+			while(n < max && s[n]) n++;
+			out_field(&o, "", 0, s, (int)n, width, flags & ~F_ZERO);
+			break;
+		}
+		default: // '%'
+			out_char(&o, '%');
+			break;
+		}
+	}
+
+	if(size) o.buf[o.len < size ? o.len : size - 1] = 0;
+	return (int)o.len;
+}
+
+//=============================================================================
+int log_wcet_snprintf(char *buf, size_t size, const char *format, ...) {
+//=============================================================================
+	va_list ap;
+	va_start(ap, format);
+	int len = log_wcet_vsnprintf(buf, size, format, ap);
+	va_end(ap);
+	return len;
+}
+
+//=============================================================================
+// Worst case cycles of log_wcet_vsnprintf() for this format (any arguments, any buffer size), from the
+// LOG_WCET_CYC_x cost model.  *max_chars (may be NULL) receives the longest possible output.
+// Returns -1 if the format has a conversion outside the subset.
+int32_t log_wcet_bound(const char *format, uint16_t *max_chars) {
+//=============================================================================
+	uint32_t scanned = 0, chars = 0, conversions = 0, digits = 0;
+	const char *f = format;
+
+	while(*f) {
+		if(*f != '%') {
+			f++;
+			scanned++;
+			chars++;
+			continue;
+		}
+		int flags, width, precision, length, subset = 1;
+		const char *spec = f;
+		f = wcet_spec(f + 1, &flags, &width, &precision, &length, &subset);
+		if(!*f) break;
+		f++;
+		scanned += f - spec;
+		if(!subset) return -1;
+		conversions++;
+		uint32_t body = 1, n = 0; // longest body, integer digits
+		switch(f[-1]) {
+		case 'd': case 'i': n = 10; body = 11; break;
+		case 'u': n = 10; body = 10; break;
+		case 'x': case 'X': n = 8; body = 8; break;
+		case 's': body = (precision >= 0 && precision < LOG_WCET_MAX_STR) ? precision : LOG_WCET_MAX_STR; break;
+		}
+		if(n && precision > (int)n) body += precision - n; // leading zeros
+		digits += n;
+		chars += (uint32_t)width > body ? (uint32_t)width : body;
+	}
+	if(max_chars) *max_chars = chars > UINT16_MAX ? UINT16_MAX : (uint16_t)chars;
+	return LOG_WCET_CYC_CALL + LOG_WCET_CYC_CONV * conversions + LOG_WCET_CYC_CHAR * (scanned + chars) +
+			LOG_WCET_CYC_DIGIT * digits;
+}
@@ -0,0 +1,57 @@
+// Module: log_format.h
+//
+// printf() style formatter for the logger, with integer-only floating point conversions
+// newlib-nano's vsnprintf() has no %f unless _printf_float is linked, which costs kilobytes of flash
+// and soft-float divisions on the FPU-less Cortex-M3.  log_vsnprintf() handles %f %e %g with
+// 64-bit integer arithmetic only (no soft-float library calls).
+// For host side formatting of floats, send the raw IEEE bits instead: KV_FLOAT() in log_kv.h.
+// No HAL dependencies, the host benchmark (Tools/fmt_bench.c) compiles this file as is.
+//
+// Supported: flags "-+ #0", width and precision (numbers or *), length modifiers hh h l ll z j t L,
+// conversions d i u o x X c s p f F e E g G %.  Floating point precision is limited to 17 digits.
+// Differences from the C library (glibc / newlib with _printf_float), see Tools/fmt_bench.c:
+// * exact ties round half away from zero, the C library rounds them to even: "%.2f" of 0.125 is 0.13
+//   (0.12), "%.0f" of 2.5 is 3 (2).  Values that only look like ties (2.675 is 2.67499..) round as in
+//   the C library, on the exact binary value.
+// * %f / %F of values of 2^63 and more (magnitude) are printed as %e: "%f" of 1e19 is 1.000000e+19
+// * %e / %g scale by powers of 10 with up to one bit in 2^60 lost per step, so 16 and 17 digit outputs
+//   ("%.15g" - "%.17g") of values with extreme exponents can be off in the last digit or two
+//   ("%.17g" of 1.2345678901234567e300 is 1.2345678901234566e+300).  Up to 15 digits are exact.
+// LOG_FAST_FORMAT 0 (log.h) formats with the C library's vsnprintf() instead.
+#ifndef LOG_FORMAT_H
+#define LOG_FORMAT_H
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Same contract as vsnprintf(): output truncated to size-1 characters and null terminated,
+// returns the length the complete output would have had
+int log_vsnprintf(char *buf, size_t size, const char *format, va_list ap);
+int log_snprintf(char *buf, size_t size, const char *format, ...);
+
+// Bounded time subset, for hard real-time callers (logtag_wcet() in log.h)
+// Conversions d i u x X c s %, flags '-' and '0', width and precision as numbers up to LOG_WCET_MAX_WIDTH,
+// h / l length modifiers (values are 32-bit).  %s copies at most LOG_WCET_MAX_STR characters, fewer with a
+// precision.  No floats, '*', 64-bit or other flags: those are copied as text and take no argument.
+// Every loop is bounded by the format or by these limits, so the cost depends on the format only:
+// log_wcet_bound() adds up the cost model below, and returns -1 for a format outside the subset.
+#define LOG_WCET_MAX_WIDTH  16
+#define LOG_WCET_MAX_STR    32
+
+// Cost model, cycles on the STM32F103 at 72 MHz (2 flash wait states, -O2).  Conservative estimates, not
+// yet confirmed by a recorded hardware run: the target benchmark (set LOG_WCET_BENCH to 1 in main.c)
+// logs "wcet <format>: ... bound B cycles, worst W (P%)" for the formats that Tools/wcet_check checks, and
+// fails a CHECK() if a bound is exceeded.  Record a run here when one is taken; lower the constants only
+// with measured margin.
+#define LOG_WCET_CYC_CALL   80    // log_wcet_vsnprintf() entry and exit
+#define LOG_WCET_CYC_CONV   90    // per conversion: flags, width, argument, dispatch
+#define LOG_WCET_CYC_CHAR   12    // per format character scanned and per output character
+#define LOG_WCET_CYC_DIGIT  24    // per integer digit (one division)
+#define LOG_WCET_CYC_ITEM   2400  // logtag_wcet() around the formatter: admit, timestamp, queue copy, DMA start
+
+int log_wcet_vsnprintf(char *buf, size_t size, const char *format, va_list ap);
+int log_wcet_snprintf(char *buf, size_t size, const char *format, ...);
+int32_t log_wcet_bound(const char *format, uint16_t *max_chars); // cycles, -1 if not in the subset
+
+#endif // LOG_FORMAT_H
@@ -0,0 +1,106 @@
+// Module: log_frame.h
+//
+// Binary record framing shared by the target logger and the host tools.
+// This header has no HAL dependencies, so host programs in Tools/ may include it directly.
+//
+// A binary frame is written into the log stream on a record boundary, in between the
+// "(ticks) text\n" lines produced by logmsg():
+//
+//   |LOG_FRAME_SYNC|type|length|payload[length]|
+//
+// Text records always begin with '(', so the ASCII "record separator" sync byte is never
+// confused with a text line.  A reader at a record boundary checks the first byte, and either
+// reads a text line up to '\n' or skips header + length bytes.
+#ifndef LOG_FRAME_H
+#define LOG_FRAME_H
+
+#include <stdint.h>
+
+#define LOG_FRAME_SYNC         0x1E  // ASCII RS, first byte of every binary frame
+#define LOG_FRAME_HEADER_SIZE  3     // sync, type, length
+#define LOG_FRAME_MAX_PAYLOAD  255   // length is a single byte
+
+typedef enum {
+	LOG_FRAME_NONE,
+	LOG_FRAME_METRIC_DESC,   // id, kind, name[] - sent once at startup, maps metric ids to names
+	LOG_FRAME_METRICS,       // tick32, flags, { id, zigzag varint delta }...
+	LOG_FRAME_HISTO_DESC,    // id, name[] - sent once at startup
+	LOG_FRAME_HISTOGRAM,     // tick32, id, varint count/min/max/sum, { bucket, varint count }...
+	LOG_FRAME_ASSERT_DESC,   // index16, line16, policy, file[], '\0', expression[]
+	LOG_FRAME_ASSERT,        // tick32, index16, policy, value count, value32...
+	LOG_FRAME_STATE_DESC,    // machine, state (0xFF: the machine), tick32, name[]
+	LOG_FRAME_STATE,         // machine, from, to, varint ms since previous transition
+	LOG_FRAME_KEY,           // key, name[] - interned key names for LOG_FRAME_KV
+	LOG_FRAME_KV,            // level, event key, CBOR tick, pair count, { key, CBOR value }...
+	LOG_FRAME_EVENTS,        // input, us32, { varint (us delta << 1 | rising) }... - captured edges
+	LOG_FRAME_TRACE_SYNC,    // tick32, cycles32, seq - GPIO trace sync pulse (gpio_trace.h)
+	LOG_FRAME_BLOB,          // id, offset16, total16, data[] - one chunk of a log_blob() payload
+} log_frame_type_t;
+
+#define LOG_BLOB_HEADER_SIZE  5  // LOG_FRAME_BLOB payload bytes ahead of the data
+
+// Descriptor frames: name tables sent once, not repeated if lost
+static inline int log_frame_is_desc(uint8_t type)
+{
+	return type == LOG_FRAME_METRIC_DESC || type == LOG_FRAME_HISTO_DESC || type == LOG_FRAME_ASSERT_DESC ||
+			type == LOG_FRAME_STATE_DESC || type == LOG_FRAME_KEY;
+}
+
+// LOG_FRAME_METRICS flags
+#define LOG_METRICS_FLAG_KEY   0x01  // values are deltas from zero (absolute), not from the previous frame
+
+//=============================================================================
+// Little helpers for the variable length integers used inside frame payloads
+// (LEB128 style: 7 bits per byte, high bit set when more bytes follow)
+//=============================================================================
+static inline uint32_t log_zigzag(int32_t v)
+{
+	return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t log_unzigzag(uint32_t v)
+{
+	return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+// Write v into p, return number of bytes written (1 to 5)
+static inline uint8_t log_put_varint(uint8_t *p, uint32_t v)
+{
+	uint8_t n = 0;
+	while(v >= 0x80) {
+		p[n++] = (uint8_t)(v | 0x80);
+		v >>= 7;
+	}
+	p[n++] = (uint8_t)v;
+	return n;
+}
+
+// Read a varint from p (no more than avail bytes), return bytes consumed, 0 if truncated
+static inline uint8_t log_get_varint(const uint8_t *p, uint32_t avail, uint32_t *v)
+{
+	uint32_t result = 0;
+	uint8_t n;
+	for(n = 0; n < 5 && n < avail; n++) {
+		result |= (uint32_t)(p[n] & 0x7F) << (7 * n);
+		if(!(p[n] & 0x80)) {
+			*v = result;
+			return n + 1;
+		}
+	}
+	return 0;
+}
+
+static inline void log_put_u32(uint8_t *p, uint32_t v)
+{
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+	p[2] = (uint8_t)(v >> 16);
+	p[3] = (uint8_t)(v >> 24);
+}
+
+static inline uint32_t log_get_u32(const uint8_t *p)
+{
+	return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+#endif // LOG_FRAME_H
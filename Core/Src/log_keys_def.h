@@ -0,0 +1,10 @@
+// Module: log_keys_def.h
+//
+// Interned keys for structured logging, LOG_KV() (no include guard, included several times)
+// LOG_KEY(id, name) : the id becomes LOG_KEY_<id>, the name is sent to the host once.
+// Keys are used both as event names and as field names.
+
+LOG_KEY(BENCH,      "bench")
+LOG_KEY(MESSAGES,   "messages")
+LOG_KEY(US,         "us")
+LOG_KEY(DROPPED,    "dropped")
@@ -0,0 +1,132 @@
+// Module: log_kv.c
+//
+// Structured key/value logging (see log_kv.h)
+// LOG_FRAME_KV payload  : level, event key, tick (CBOR unsigned), pair count, { key, CBOR data item }...
+// LOG_FRAME_KEY payload : key, name[]
+// CBOR data items used (RFC 8949, big endian arguments):
+//   major 0 unsigned, major 1 negative, major 2 byte string, major 3 text string, 0xFA float32
+// Strings and byte strings are truncated to fit the frame.
+
+#include <stdint.h>
+#include <string.h>
+#include "log.h"
+#include "log_kv.h"
+
+#define KV_MAX_PAYLOAD  (LOG_ITEM_MAX_SIZE - LOG_FRAME_HEADER_SIZE)
+
+static const char * const _log_key_names[LOG_KEY_COUNT] = {
+#define LOG_KEY(id, name) name,
+#include "log_keys_def.h"
+#undef LOG_KEY
+};
+
+dbg_log_level_t log_kv_level = DBG_LOG_INFO;
+
+//=============================================================================
+// CBOR head: major type in the top 3 bits, argument in the low 5 bits or following bytes
+static uint8_t cbor_head(uint8_t *p, uint8_t major, uint32_t arg) {
+//=============================================================================
+	major <<= 5;
+	if(arg < 24) {
+		p[0] = major | (uint8_t)arg;
+		return 1;
+	}
+	if(arg <= 0xFF) {
+		p[0] = major | 24;
+		p[1] = (uint8_t)arg;
+		return 2;
+	}
+	if(arg <= 0xFFFF) {
+		p[0] = major | 25;
+		p[1] = (uint8_t)(arg >> 8);
+		p[2] = (uint8_t)arg;
+		return 3;
+	}
+	p[0] = major | 26;
+	p[1] = (uint8_t)(arg >> 24);
+	p[2] = (uint8_t)(arg >> 16);
+	p[3] = (uint8_t)(arg >> 8);
+	p[4] = (uint8_t)arg;
+	return 5;
+}
+
+//=============================================================================
+// Encode one value at p, with no more than room bytes, return bytes used (0: didn't fit)
+static uint16_t encode_value(uint8_t *p, uint16_t room, const log_kv_t *kv) {
+//=============================================================================
+	uint8_t head[5];
+	uint16_t len = 0;
+	uint16_t n;
+	const void *data = 0;
+
+	switch(kv->type) {
+	case LOG_KV_INT:
+		if(kv->v.i < 0) n = cbor_head(head, 1, (uint32_t)(-1 - kv->v.i));
+		else n = cbor_head(head, 0, (uint32_t)kv->v.i);
+		break;
+	case LOG_KV_UINT:
+		n = cbor_head(head, 0, kv->v.u);
+		break;
+	case LOG_KV_FLOAT: {
+		uint32_t bits;
+		memcpy(&bits, &kv->v.f, sizeof(bits));
+		head[0] = 0xFA;
+		head[1] = (uint8_t)(bits >> 24);
+		head[2] = (uint8_t)(bits >> 16);
+		head[3] = (uint8_t)(bits >> 8);
+		head[4] = (uint8_t)bits;
+		n = 5;
+		break;
+	}
+	case LOG_KV_STR:
+	case LOG_KV_BYTES:
+		data = kv->v.p;
+		len = kv->type == LOG_KV_STR ? (data ? strlen(data) : 0) : kv->len;
+		if(room < 2) return 0;
+		if(len > room - 2) len = room - 2; // truncate, the head of a string shorter than 256 is 1 or 2 bytes
+		n = cbor_head(head, kv->type == LOG_KV_STR ? 3 : 2, len);
+		break;
+	default:
+		return 0;
+	}
+	if(n + len > room) return 0;
+	memcpy(p, head, n);
+	if(len) memcpy(p + n, data, len);
+	return n + len;
+}
+
+//=============================================================================
+// Encode and queue one structured record.  Pairs that don't fit are left out.
+int log_kv(dbg_log_level_t level, log_key_t event, const log_kv_t *kv, uint8_t count) {
+//=============================================================================
+	uint8_t payload[KV_MAX_PAYLOAD];
+	uint16_t len;
+	uint8_t pairs = 0;
+
+	payload[0] = (uint8_t)level;
+	payload[1] = (uint8_t)event;
+	len = 2 + cbor_head(&payload[2], 0, HAL_GetTick());
+	uint16_t count_at = len++;
+	for(uint8_t i = 0; i < count && len + 2 < KV_MAX_PAYLOAD; i++) {
+		uint16_t n = encode_value(&payload[len + 1], KV_MAX_PAYLOAD - len - 1, &kv[i]);
+		if(!n) continue;
+		payload[len] = kv[i].key;
+		len += 1 + n;
+		pairs++;
+	}
+	payload[count_at] = pairs;
+	return log_frame(LOG_FRAME_KV, payload, len);
+}
+
+//=============================================================================
+void log_kv_send_keys(void) {
+//=============================================================================
+	uint8_t payload[KV_MAX_PAYLOAD];
+	for(uint8_t key = 0; key < LOG_KEY_COUNT; key++) {
+		uint16_t len = strlen(_log_key_names[key]);
+		if(len > KV_MAX_PAYLOAD - 1) len = KV_MAX_PAYLOAD - 1;
+		payload[0] = key;
+		memcpy(&payload[1], _log_key_names[key], len);
+		log_frame(LOG_FRAME_KEY, payload, len + 1);
+	}
+}
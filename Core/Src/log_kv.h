@@ -0,0 +1,58 @@
+// Module: log_kv.h
+//
+// Structured key/value logging with a compact binary encoding
+//   LOG_KV(DBG_LOG_INFO, BENCH, KV_UINT(MESSAGES, 10), KV_UINT(US, stop_us-start_us));
+// Event and field names are interned keys (log_keys_def.h), sent as one byte ids.  Values are typed
+// and encoded like CBOR data items, straight into a LOG_FRAME_KV frame - nothing is formatted as text.
+// The host decoder turns the frames into JSON lines (logdecode -j).
+#ifndef LOG_KV_H
+#define LOG_KV_H
+
+#include <stdint.h>
+#include "log.h"
+
+typedef enum {
+#define LOG_KEY(id, name) LOG_KEY_##id,
+#include "log_keys_def.h"
+#undef LOG_KEY
+	LOG_KEY_COUNT
+} log_key_t;
+
+typedef enum {
+	LOG_KV_INT,
+	LOG_KV_UINT,
+	LOG_KV_FLOAT,
+	LOG_KV_STR,     // null terminated string
+	LOG_KV_BYTES,
+} log_kv_type_t;
+
+typedef struct {
+	uint8_t key;     // log_key_t
+	uint8_t type;    // log_kv_type_t
+	uint16_t len;    // LOG_KV_BYTES length
+	union {
+		int32_t i;
+		uint32_t u;
+		float f;
+		const void *p;
+	} v;
+} log_kv_t;
+
+#define KV_INT(k, x)          ((log_kv_t){ .key = LOG_KEY_##k, .type = LOG_KV_INT,   .v.i = (x) })
+#define KV_UINT(k, x)         ((log_kv_t){ .key = LOG_KEY_##k, .type = LOG_KV_UINT,  .v.u = (x) })
+#define KV_FLOAT(k, x)        ((log_kv_t){ .key = LOG_KEY_##k, .type = LOG_KV_FLOAT, .v.f = (x) })
+#define KV_STR(k, s)          ((log_kv_t){ .key = LOG_KEY_##k, .type = LOG_KV_STR,   .v.p = (s) })
+#define KV_BYTES(k, ptr, n)   ((log_kv_t){ .key = LOG_KEY_##k, .type = LOG_KV_BYTES, .len = (n), .v.p = (ptr) })
+
+extern dbg_log_level_t log_kv_level;   // records above this level are discarded before encoding
+
+#define LOG_KV(level, event, ...) do { \
+	if((level) <= log_kv_level) { \
+		const log_kv_t _kv[] = { __VA_ARGS__ }; \
+		log_kv((level), LOG_KEY_##event, _kv, sizeof(_kv) / sizeof(_kv[0])); \
+	} } while(0)
+
+int log_kv(dbg_log_level_t level, log_key_t event, const log_kv_t *kv, uint8_t count);
+void log_kv_send_keys(void);   // send the key names to the host
+
+#endif // LOG_KV_H
@@ -0,0 +1,150 @@
+// Module: log_sd.c
+//
+// SD card sink for the logger (see log_sd.h)
+
+#include <stdint.h>
+#include <string.h>
+#include <main.h>
+#include "log.h"
+#include "log_sd.h"
+#include "logfs.h"
+#include "sd_spi.h"
+
+#if LOG_SD_SINK
+
+#if LOG_ENGINE != LOG_ENGINE_CIRCULAR
+#error "LOG_SD_SINK reads the circular queue, set LOG_ENGINE to LOG_ENGINE_CIRCULAR"
+#endif
+
+#define BATCH_BYTES  (LOG_SD_BATCH_SECTORS * BLOCKDEV_SECTOR_SIZE)
+
+log_sd_stats_t log_sd_stats;
+static blockdev_t _sd_dev;
+static logfs_t _sd_fs;
+static uint8_t _sd_ok;
+static int _sd_reader = -1;              // log queue reader id
+
+static uint8_t _sd_batch[2][BATCH_BYTES];
+static uint16_t _sd_used[2][LOG_SD_BATCH_SECTORS];
+static uint8_t _sd_fill;                 // batch being filled
+static uint8_t _sd_fill_sector;          // sector being filled within that batch
+static volatile uint8_t _sd_ready;       // other batch is waiting to be written (sector count, 0: none)
+static uint8_t _sd_writing;              // and its write is running (logfs_write_poll())
+static uint32_t _sd_fill_tick;           // when the first byte went into the batch being filled
+
+//=============================================================================
+int log_sd_init(void) {
+//=============================================================================
+	_sd_ok = 0;
+	if(sd_spi_init(&_sd_dev)) return -1;
+	if(logfs_mount(&_sd_fs, &_sd_dev, 0) && logfs_format(&_sd_fs, &_sd_dev)) return -1;
+	if(_sd_reader < 0) _sd_reader = log_reader_add("sd", LOG_SD_LOSSY ? LOG_READER_LOSSY : LOG_READER_LOSSLESS);
+	if(_sd_reader < 0) return -1;
+	_sd_ok = 1;
+	return 0;
+}
+
+//=============================================================================
+// Hand the batch being filled to log_sd_poll(), continue in the other one
+static void swap_batch(void) {
+//=============================================================================
+	_sd_ready = _sd_fill_sector + (_sd_used[_sd_fill][_sd_fill_sector] ? 1 : 0);
+	_sd_fill ^= 1;
+	_sd_fill_sector = 0;
+	memset(_sd_used[_sd_fill], 0, sizeof(_sd_used[_sd_fill]));
+}
+
+//=============================================================================
+// Payload bytes the batches can still take: the rest of the one being filled, and the other if it's free
+static uint16_t stage_space(void) {
+//=============================================================================
+	uint16_t space = (LOG_SD_BATCH_SECTORS - _sd_fill_sector) * LOGFS_PAYLOAD_SIZE - _sd_used[_sd_fill][_sd_fill_sector];
+	if(!_sd_ready) space += LOG_SD_BATCH_SECTORS * LOGFS_PAYLOAD_SIZE;
+	return space;
+}
+
+//=============================================================================
+// Copy log data into the sector images, len is at most stage_space()
+static void stage(const char *data, uint16_t len) {
+//=============================================================================
+	while(len) {
+		uint16_t *used = &_sd_used[_sd_fill][_sd_fill_sector];
+		if(*used == LOGFS_PAYLOAD_SIZE) {
+			if(_sd_fill_sector + 1 < LOG_SD_BATCH_SECTORS) {
+				_sd_fill_sector++;
+				continue;
+			}
+			swap_batch();
+			continue;
+		}
+		if(!_sd_fill_sector && !*used) _sd_fill_tick = HAL_GetTick();
+		uint16_t n = LOGFS_PAYLOAD_SIZE - *used;
+		if(n > len) n = len;
+		memcpy(logfs_payload(&_sd_batch[_sd_fill][_sd_fill_sector * BLOCKDEV_SECTOR_SIZE]) + *used, data, n);
+		*used += n;
+		data += n;
+		len -= n;
+	}
+}
+
+//=============================================================================
+// Pull the records the logger queued since the last call, whole ones only: if the lossy reader is
+// overrun, it skips to a record boundary, and the card never holds part of a record.
+static void drain(void) {
+//=============================================================================
+	uint16_t record;
+	while((record = log_reader_record(_sd_reader)) != 0 && record <= stage_space()) {
+		while(record) {
+			const char *data;
+			uint16_t len = log_reader_peek(_sd_reader, &data); // two pieces if it wraps the queue
+			if(len > record) len = record;
+			stage(data, len);
+			log_reader_consume(_sd_reader, len);
+			record -= len;
+		}
+	}
+}
+
+//=============================================================================
+// The write of the ready batch ended (result of logfs_write_start() / logfs_write_poll()), it's free again
+static void write_done(int result) {
+//=============================================================================
+	if(result)
+		log_sd_stats.write_errors++;
+	else
+		log_sd_stats.sectors_written += _sd_ready;
+	_sd_writing = 0;
+	_sd_ready = 0;
+}
+
+//=============================================================================
+void log_sd_poll(void) {
+//=============================================================================
+	if(!_sd_ok) return;
+	if(_sd_writing) {
+		int result = logfs_write_poll(&_sd_fs);
+		if(result <= 0) write_done(result);
+	}
+	drain();
+
+	// Don't let a partial batch sit in RAM for long
+	if(!_sd_ready && _sd_used[_sd_fill][0] && HAL_GetTick() - _sd_fill_tick >= LOG_SD_FLUSH_MS)
+		swap_batch();
+
+	if(!_sd_ready || _sd_writing) return;
+	uint8_t batch = _sd_fill ^ 1;
+	int result = logfs_write_start(&_sd_fs, _sd_batch[batch], _sd_used[batch], _sd_ready);
+	if(result > 0) {
+		_sd_writing = 1;
+		return;
+	}
+	write_done(result);
+	drain();
+}
+
+#else // LOG_SD_SINK
+
+int log_sd_init(void) { return -1; }
+void log_sd_poll(void) { }
+
+#endif // LOG_SD_SINK
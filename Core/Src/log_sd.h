@@ -0,0 +1,43 @@
+// Module: log_sd.h
+//
+// Block device (SD card) sink for the logger
+// The sink is a reader of the log queue (see log_reader_add() in log.h): log_sd_poll() pulls the items
+// queued since its last call into 512 byte sector images.  Full batches of LOG_SD_BATCH_SECTORS sectors
+// are written with one multiple block write each (ACMD23 pre-erases that many), onto the log structured
+// layout of logfs.h.  Two batches are staged, so one can fill while the other is written.
+// The write runs in the background: the data goes out by DMA, and each log_sd_poll() only checks on the
+// card (logfs_write_poll()), so a card busy for tens of ms doesn't hold up the main loop.
+// As a lossy reader (LOG_SD_LOSSY), the sink never holds up the producers: if the card falls behind by
+// a whole queue, its backlog is skipped (reported as "skipped" by log_reader_report()).  Only whole
+// records are staged (log_reader_record()), so the card holds a gap between records, never part of one.
+// Needs the circular queue engine (LOG_ENGINE), log from the main loop only.
+#ifndef LOG_SD_H
+#define LOG_SD_H
+
+#include <stdint.h>
+
+#ifndef LOG_SD_SINK
+#define LOG_SD_SINK  0   // 1: enable the SD card sink (card on SPI2, see sd_spi.h)
+#endif
+// Sectors per multiple block write.  Cards program faster in longer writes (less per command overhead
+// and busy time per sector), but the RAM is 2 batches of these: 8 KB of the 20 KB at 8.  At 4 (4 KB),
+// a 115200 baud stream (11.5 KB/s) fills a batch in ~170 ms, far longer than the card takes to write it.
+#ifndef LOG_SD_BATCH_SECTORS
+#define LOG_SD_BATCH_SECTORS  4
+#endif
+#define LOG_SD_FLUSH_MS       1000   // write a partially filled batch after this long
+#ifndef LOG_SD_LOSSY
+#define LOG_SD_LOSSY  1    // 0: the UART drops items rather than the card missing any
+#endif
+
+typedef struct {
+	uint32_t sectors_written;
+	uint32_t write_errors;
+} log_sd_stats_t;
+
+extern log_sd_stats_t log_sd_stats;
+
+int log_sd_init(void);                                // initialize card, mount or format, returns 0 on success
+void log_sd_poll(void);                               // call from main loop
+
+#endif // LOG_SD_H
@@ -0,0 +1,196 @@
+// Module: log_tags.c
+//
+// Log tag names, the "top talkers" report, and bandwidth shares (see log_tags.h)
+
+#include <stdint.h>
+#include <string.h>
+#include "log.h"
+#include "log_tags.h"
+#include "dwt.h"
+
+const char * const log_tag_names[LOG_TAG_COUNT] = {
+#define LOG_TAG(id, name, share) name,
+#include "log_tags_def.h"
+#undef LOG_TAG
+};
+
+log_tag_stats_t log_tag_stats[LOG_TAG_COUNT];
+
+#if LOG_TAG_SHARES
+// Token buckets count milli-bytes, so slow refills don't round away
+#define TOKENS_PER_BYTE  1000
+#define BUCKET_DEPTH     (LOG_TAG_BURST_BYTES * TOKENS_PER_BYTE)
+#define SPARE_DEPTH      (LOG_TAG_SPARE_BYTES * TOKENS_PER_BYTE)
+
+static const uint8_t _tag_share[LOG_TAG_COUNT] = {
+#define LOG_TAG(id, name, share) share,
+#include "log_tags_def.h"
+#undef LOG_TAG
+};
+static int32_t _tag_tokens[LOG_TAG_COUNT] = {
+#define LOG_TAG(id, name, share) BUCKET_DEPTH,
+#include "log_tags_def.h"
+#undef LOG_TAG
+};
+static int32_t _tag_spare = SPARE_DEPTH;  // startup bursts (name tables, banners) borrow from a full pool
+static uint32_t _tag_refill_tick;
+#endif
+static uint32_t _tag_interval = LOG_TAG_REPORT_MS;
+static uint32_t _tag_last_tick;          // poll interval
+static uint32_t _tag_report_tick;        // last report, any caller
+
+//=============================================================================
+static uint64_t tag_cycles(const log_tag_stats_t *s) {
+//=============================================================================
+	return (uint64_t)s->cyc_format + s->cyc_copy + s->cyc_dma;
+}
+
+//=============================================================================
+// Tag numbers in order, most cycles first (by_bytes 0) or most bytes first (insertion sort, descending)
+static void tag_order(const log_tag_stats_t *snap, uint8_t *order, uint8_t by_bytes) {
+//=============================================================================
+	for(uint8_t i = 0; i < LOG_TAG_COUNT; i++) {
+		uint64_t key = by_bytes ? snap[i].bytes : tag_cycles(&snap[i]);
+		uint8_t j = i;
+		while(j > 0 && (by_bytes ? snap[order[j-1]].bytes : tag_cycles(&snap[order[j-1]])) < key) {
+			order[j] = order[j-1];
+			j--;
+		}
+		order[j] = i;
+	}
+}
+
+//=============================================================================
+// Two tables of the interval since the previous report, then clear the counts: the tags by CPU time
+// (cycles, % of the CPU, cost per item), and by UART bytes (bytes/s, % of the link).
+void log_tag_report(void) {
+//=============================================================================
+	log_tag_stats_t snap[LOG_TAG_COUNT];
+	uint8_t order[LOG_TAG_COUNT];
+	uint64_t total_cycles = 0;
+	uint32_t total_bytes = 0;
+	uint32_t now = HAL_GetTick();
+	uint32_t elapsed_ms = now - _tag_report_tick;
+	_tag_report_tick = now;
+	if(!elapsed_ms) elapsed_ms = 1;
+
+	// the report's own items count in the next interval
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	memcpy(snap, log_tag_stats, sizeof(snap));
+	memset(log_tag_stats, 0, sizeof(log_tag_stats));
+	__set_PRIMASK(primask);
+	for(uint8_t i = 0; i < LOG_TAG_COUNT; i++) {
+		total_cycles += tag_cycles(&snap[i]);
+		total_bytes += snap[i].bytes;
+	}
+	if(!total_cycles && !total_bytes) return;
+	uint64_t interval_cycles = (uint64_t)elapsed_ms * DWT_CYCLES_PER_US * 1000;
+
+	logtag(LOG_TAG_STATS, "top talkers by CPU, %lu ms: tag items drop reject cycles cpu(%%) log(%%) fmt/copy/dma per item",
+			elapsed_ms);
+	tag_order(snap, order, 0);
+	for(uint8_t i = 0; i < LOG_TAG_COUNT; i++) {
+		const log_tag_stats_t *s = &snap[order[i]];
+		uint32_t n = s->items ? s->items : 1;
+		uint64_t cycles = tag_cycles(s);
+		uint32_t cpu = (uint32_t)(cycles * 10000 / interval_cycles); // hundredths of a percent
+		if(!s->items && !s->dropped && !s->rejected) continue;
+		logtag(LOG_TAG_STATS, "%-10s %lu %lu %lu %lu %lu.%02lu %lu %lu/%lu/%lu",
+				log_tag_names[order[i]], s->items, s->dropped, s->rejected, (uint32_t)cycles, cpu / 100, cpu % 100,
+				(uint32_t)(cycles * 100 / (total_cycles ? total_cycles : 1)),
+				s->cyc_format / n, s->cyc_copy / n, s->cyc_dma / n);
+	}
+
+	logtag(LOG_TAG_STATS, "top talkers by bytes, %lu ms: tag bytes B/s link(%%) log(%%) borrowed", elapsed_ms);
+	tag_order(snap, order, 1);
+	for(uint8_t i = 0; i < LOG_TAG_COUNT && snap[order[i]].bytes; i++) {
+		const log_tag_stats_t *s = &snap[order[i]];
+		uint32_t rate = (uint32_t)((uint64_t)s->bytes * 1000 / elapsed_ms);
+		logtag(LOG_TAG_STATS, "%-10s %lu %lu %lu %lu %lu", log_tag_names[order[i]], s->bytes, rate,
+				rate * 100 / LOG_TAG_LINK_BPS, (uint32_t)((uint64_t)s->bytes * 100 / total_bytes), s->borrowed);
+	}
+}
+
+#if LOG_TAG_SHARES
+//=============================================================================
+// Add the tokens earned since the last call, overflow of full buckets goes to the spare pool
+static void tag_refill(void) {
+//=============================================================================
+	uint32_t now = HAL_GetTick();
+	uint32_t ms = now - _tag_refill_tick;
+	if(!ms) return;
+	_tag_refill_tick = now;
+	if(ms > 1000) ms = 1000; // every bucket is full after this long anyway
+
+	for(uint8_t i = 0; i < LOG_TAG_COUNT; i++) {
+		// milli-bytes per ms = bytes per second * share / 100
+		int32_t tokens = _tag_tokens[i] + (int32_t)(LOG_TAG_LINK_BPS * _tag_share[i] / 100 * ms);
+		if(tokens > BUCKET_DEPTH) {
+			_tag_spare += tokens - BUCKET_DEPTH;
+			tokens = BUCKET_DEPTH;
+		}
+		_tag_tokens[i] = tokens;
+	}
+	if(_tag_spare > SPARE_DEPTH) _tag_spare = SPARE_DEPTH;
+}
+
+//=============================================================================
+// Called before formatting, the length isn't known yet: a tag with tokens left may go into debt
+// by one item, log_tag_charge() takes the actual length.
+int log_tag_admit(log_tag_t tag) {
+//=============================================================================
+	tag_refill();
+	if(_tag_tokens[tag] > 0) return 1;
+
+	// Borrow unused shares of the other tags
+	if(_tag_spare > 0) {
+		int32_t loan = LOG_ITEM_MAX_SIZE * TOKENS_PER_BYTE;
+		if(loan > _tag_spare) loan = _tag_spare;
+		_tag_spare -= loan;
+		_tag_tokens[tag] += loan;
+		log_tag_stats[tag].borrowed += loan / TOKENS_PER_BYTE;
+		if(_tag_tokens[tag] > 0) return 1;
+	}
+	// Nothing waiting for the UART: nobody else is using the bandwidth
+	if(log_reader_lag(0) == 0) return 1;
+
+	log_tag_stats[tag].rejected++;
+	return 0;
+}
+
+//=============================================================================
+void log_tag_charge(log_tag_t tag, uint16_t bytes) {
+//=============================================================================
+	int32_t tokens = _tag_tokens[tag] - (int32_t)bytes * TOKENS_PER_BYTE;
+	_tag_tokens[tag] = tokens < -BUCKET_DEPTH ? -BUCKET_DEPTH : tokens; // debt is limited to one bucket
+}
+
+#else
+int log_tag_admit(log_tag_t tag) { (void)tag; return 1; }
+void log_tag_charge(log_tag_t tag, uint16_t bytes) { (void)tag; (void)bytes; }
+#endif
+
+//=============================================================================
+void log_tag_reset(void) {
+//=============================================================================
+	memset(log_tag_stats, 0, sizeof(log_tag_stats));
+}
+
+//=============================================================================
+void log_tag_set_interval(uint32_t ms) {
+//=============================================================================
+	_tag_interval = ms;
+}
+
+//=============================================================================
+void log_tag_poll(void) {
+//=============================================================================
+	if(!_tag_interval) return;
+	uint32_t now = HAL_GetTick();
+	if(now - _tag_last_tick < _tag_interval) return;
+	_tag_last_tick = now;
+	log_tag_report();
+	log_reader_report();
+	log_memo_report();
+}
@@ -0,0 +1,60 @@
+// Module: log_tags.h
+//
+// Log tags, and per tag accounting of what logging costs
+// With LOG_TAG_ACCOUNTING enabled, each log item records the DWT cycles spent formatting, copying into
+// the DMA queue, and (re)starting the DMA, plus bytes queued and items dropped, against its tag.
+// log_tag_report() logs the "top talkers" since the previous report, ranked by CPU time and by UART
+// bytes, and clears the counts.  A cycle counter holds ~59 s of the whole CPU: report intervals of a few
+// minutes are safe while logging takes less than a few percent.
+//
+// With LOG_TAG_SHARES enabled, each tag gets its share of the UART bandwidth (log_tags_def.h) as a token
+// bucket, refilled from HAL_GetTick() and checked before the item is formatted.  Tokens a full bucket
+// can't hold go to a spare pool that any tag may borrow from, and an item is always accepted when the
+// UART is idle, so unused shares are lent rather than lost.  Items refused are counted per tag.
+// Descriptor frames (name tables sent once, see log_frame_is_desc()) are always admitted, the host can't
+// decode without them; they are still charged to the TELEMETRY bucket.
+#ifndef LOG_TAGS_H
+#define LOG_TAGS_H
+
+#include <stdint.h>
+
+#ifndef LOG_TAG_ACCOUNTING
+#define LOG_TAG_ACCOUNTING  1      // 0 removes the accounting (and its ~20 cycles per log item)
+#endif
+#define LOG_TAG_REPORT_MS  60000  // default interval of the periodic report
+#ifndef LOG_TAG_SHARES
+#define LOG_TAG_SHARES  0          // 1: bandwidth shares (opt-in), 0: tags only limited by the queue space
+#endif
+#define LOG_TAG_LINK_BPS     11520 // USART2 bytes per second (115200 baud, 10 bits per byte)
+#define LOG_TAG_BURST_BYTES  512   // token bucket depth of each tag
+#define LOG_TAG_SPARE_BYTES  1024  // spare pool limit
+
+typedef enum {
+#define LOG_TAG(id, name, share) LOG_TAG_##id,
+#include "log_tags_def.h"
+#undef LOG_TAG
+	LOG_TAG_COUNT
+} log_tag_t;
+
+typedef struct {
+	uint32_t items;        // log items queued
+	uint32_t dropped;      // log items dropped, DMA queue full
+	uint32_t bytes;        // bytes queued for the UART
+	uint32_t cyc_format;   // cycles composing the item (timestamp + vsnprintf)
+	uint32_t cyc_copy;     // cycles checking space and copying into the DMA queue
+	uint32_t cyc_dma;      // cycles in restart_dma(), contending with the DMA ISR for the UART
+	uint32_t rejected;     // log items refused, over the tag's bandwidth share (LOG_TAG_SHARES)
+	uint32_t borrowed;     // bytes borrowed from the spare pool
+} log_tag_stats_t;
+
+extern const char * const log_tag_names[LOG_TAG_COUNT];
+extern log_tag_stats_t log_tag_stats[LOG_TAG_COUNT];
+
+void log_tag_set_interval(uint32_t ms);   // 0 disables the periodic report
+void log_tag_poll(void);                  // call from main loop, reports tags, log_reader_report(), log_memo_report()
+void log_tag_report(void);                // log the top talkers now, and clear the counts
+void log_tag_reset(void);
+int log_tag_admit(log_tag_t tag);                     // 1: within the tag's share (logger use)
+void log_tag_charge(log_tag_t tag, uint16_t bytes);   // take the bytes of a queued item (logger use)
+
+#endif // LOG_TAGS_H
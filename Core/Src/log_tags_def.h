@@ -0,0 +1,11 @@
+// Module: log_tags_def.h
+//
+// Log tag list - one tag per module / subsystem (no include guard, included several times)
+// LOG_TAG(id, name, share) : the id becomes LOG_TAG_<id>, used with logtag()
+//   share: percent of the UART bandwidth guaranteed to the tag when the link is busy (LOG_TAG_SHARES),
+//   the shares should add up to 100
+
+LOG_TAG(DEFAULT,    "default",   40)  // logmsg()
+LOG_TAG(TELEMETRY,  "telemetry", 20)  // binary frames: metrics, histograms, ...
+LOG_TAG(STATS,      "stats",     10)  // the logger's own reports
+LOG_TAG(MAIN,       "main",      30)
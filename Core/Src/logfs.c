@@ -0,0 +1,268 @@
+// Module: logfs.c
+//
+// Append-only log structured layout on a block device (see logfs.h)
+// Sector checksums are Fletcher-32: cheap on a Cortex-M3 without a CRC table, and good enough to
+// detect a sector torn by power loss, or stale data from a previous trip around the circular log.
+
+#include <stdint.h>
+#include <string.h>
+#include "logfs.h"
+
+// Superblock field offsets
+#define SB_MAGIC         0
+#define SB_VERSION       4
+#define SB_GEN           8
+#define SB_NEXT_SEQ      12
+#define SB_DATA_SECTORS  16
+#define SB_BOOT_COUNT    20
+#define SB_CHECK         24
+#define SB_SIZE          28
+
+// Data sector header field offsets
+#define DS_MAGIC   0
+#define DS_SEQ     4
+#define DS_USED    8
+#define DS_FLAGS   10
+#define DS_CHECK   12
+
+// logfs_write_start() stages
+enum { WRITE_IDLE, WRITE_DATA, WRITE_WRAPPED, WRITE_SUPER };
+
+//=============================================================================
+static void put16(uint8_t *p, uint16_t v) { p[0] = (uint8_t)v; p[1] = (uint8_t)(v >> 8); }
+static void put32(uint8_t *p, uint32_t v) { put16(p, (uint16_t)v); put16(p + 2, (uint16_t)(v >> 16)); }
+static uint16_t get16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static uint32_t get32(const uint8_t *p) { return get16(p) | ((uint32_t)get16(p + 2) << 16); }
+//=============================================================================
+
+//=============================================================================
+// Fletcher-32, over two separate byte ranges (header fields, payload)
+static uint32_t fletcher32(const uint8_t *a, uint32_t alen, const uint8_t *b, uint32_t blen) {
+//=============================================================================
+	uint32_t sum1 = 0xFFFF, sum2 = 0xFFFF;
+	const uint8_t *p = a;
+	uint32_t len = alen;
+	for(int part = 0; part < 2; part++) {
+		while(len) {
+			uint32_t block = len > 359 ? 359 : len; // keeps the sums from overflowing before reduction
+			len -= block;
+			while(block--) {
+				sum1 += *p++;
+				sum2 += sum1;
+			}
+			sum1 = (sum1 & 0xFFFF) + (sum1 >> 16);
+			sum2 = (sum2 & 0xFFFF) + (sum2 >> 16);
+		}
+		p = b;
+		len = blen;
+	}
+	sum1 = (sum1 & 0xFFFF) + (sum1 >> 16);
+	sum2 = (sum2 & 0xFFFF) + (sum2 >> 16);
+	return (sum2 << 16) | sum1;
+}
+
+//=============================================================================
+static uint32_t data_sector(const logfs_t *fs, uint32_t seq) {
+//=============================================================================
+	return LOGFS_DATA_START + seq % fs->data_sectors;
+}
+
+//=============================================================================
+// Fill in the next superblock generation (in fs->work), returns the sector it goes to: the older copy
+static uint32_t fill_superblock(logfs_t *fs) {
+//=============================================================================
+	uint8_t *sb = fs->work;
+	fs->super_gen++;
+	memset(sb, 0, BLOCKDEV_SECTOR_SIZE);
+	put32(&sb[SB_MAGIC], LOGFS_MAGIC_SUPER);
+	put16(&sb[SB_VERSION], LOGFS_VERSION);
+	put32(&sb[SB_GEN], fs->super_gen);
+	put32(&sb[SB_NEXT_SEQ], fs->next_seq);
+	put32(&sb[SB_DATA_SECTORS], fs->data_sectors);
+	put32(&sb[SB_BOOT_COUNT], fs->boot_count);
+	put32(&sb[SB_CHECK], fletcher32(sb, SB_CHECK, 0, 0));
+	return fs->super_gen & 1;
+}
+
+//=============================================================================
+static int write_superblock(logfs_t *fs) {
+//=============================================================================
+	uint32_t sector = fill_superblock(fs);
+	if(fs->dev->write(fs->dev, sector, fs->work, 1)) return -1;
+	fs->checkpoint_seq = fs->next_seq;
+	return 0;
+}
+
+//=============================================================================
+// Begin a write with the device's non-blocking write if it has one, else do it now
+static int dev_write_start(logfs_t *fs, uint32_t sector, const uint8_t *buf, uint32_t count) {
+//=============================================================================
+	blockdev_t *dev = fs->dev;
+	if(dev->write_start) return dev->write_start(dev, sector, buf, count);
+	return dev->write(dev, sector, buf, count);
+}
+
+//=============================================================================
+// Read superblock copy, return 0 if it's valid (fields left in fs->work)
+static int read_superblock(logfs_t *fs, uint32_t sector) {
+//=============================================================================
+	uint8_t *sb = fs->work;
+	if(fs->dev->read(fs->dev, sector, sb, 1)) return -1;
+	if(get32(&sb[SB_MAGIC]) != LOGFS_MAGIC_SUPER || get16(&sb[SB_VERSION]) != LOGFS_VERSION) return -1;
+	if(get32(&sb[SB_CHECK]) != fletcher32(sb, SB_CHECK, 0, 0)) return -1;
+	return 0;
+}
+
+//=============================================================================
+// Create an empty log using the whole device
+int logfs_format(logfs_t *fs, blockdev_t *dev) {
+//=============================================================================
+	if(dev->sectors <= LOGFS_DATA_START) return -1;
+	memset(fs, 0, sizeof(*fs));
+	fs->dev = dev;
+	fs->data_sectors = dev->sectors - LOGFS_DATA_START;
+	fs->boot_pending = 1;
+	// Two generations, so both copies are valid
+	if(write_superblock(fs)) return -1;
+	return write_superblock(fs);
+}
+
+//=============================================================================
+// Find the newest valid superblock, then scan data sectors from its checkpoint to the end of the log
+int logfs_mount(logfs_t *fs, blockdev_t *dev, int read_only) {
+//=============================================================================
+	uint32_t gen = 0, next_seq = 0, data_sectors = 0, boot_count = 0;
+	int found = 0;
+
+	memset(fs, 0, sizeof(*fs));
+	fs->dev = dev;
+	for(uint32_t copy = 0; copy < 2; copy++) {
+		if(read_superblock(fs, copy)) continue;
+		uint32_t g = get32(&fs->work[SB_GEN]);
+		if(found && (int32_t)(g - gen) < 0) continue;
+		found = 1;
+		gen = g;
+		next_seq = get32(&fs->work[SB_NEXT_SEQ]);
+		data_sectors = get32(&fs->work[SB_DATA_SECTORS]);
+		boot_count = get32(&fs->work[SB_BOOT_COUNT]);
+	}
+	if(!found || !data_sectors || data_sectors > dev->sectors - LOGFS_DATA_START) return -1;
+
+	fs->super_gen = gen;
+	fs->data_sectors = data_sectors;
+	fs->next_seq = next_seq;
+	fs->checkpoint_seq = next_seq;
+	fs->boot_count = read_only ? boot_count : boot_count + 1;
+	fs->boot_pending = !read_only;
+
+	// Sectors written after the last checkpoint carry consecutive sequence numbers
+	for(uint32_t i = 0; i < data_sectors; i++) {
+		if(logfs_read(fs, fs->next_seq, fs->work) < 0) break;
+		fs->next_seq++;
+	}
+
+	// Record the boot, and the recovered end of the log
+	if(read_only) return 0;
+	return write_superblock(fs);
+}
+
+//=============================================================================
+// Fill in sector headers, and start writing the sectors with as few multi-block writes as possible
+// (one, or two when wrapping the end of the device)
+int logfs_write_start(logfs_t *fs, uint8_t *sectors, const uint16_t *used, uint32_t count) {
+//=============================================================================
+	if(fs->write_stage || !count || count > fs->data_sectors / 2) return -1;
+
+	for(uint32_t i = 0; i < count; i++) {
+		uint8_t *s = &sectors[i * BLOCKDEV_SECTOR_SIZE];
+		uint16_t u = used[i] > LOGFS_PAYLOAD_SIZE ? LOGFS_PAYLOAD_SIZE : used[i];
+		put32(&s[DS_MAGIC], LOGFS_MAGIC_DATA);
+		put32(&s[DS_SEQ], fs->next_seq + i);
+		put16(&s[DS_USED], u);
+		put16(&s[DS_FLAGS], (i == 0 && fs->boot_pending) ? LOGFS_FLAG_BOOT : 0);
+		put32(&s[DS_CHECK], fletcher32(s, DS_CHECK, logfs_payload(s), u));
+	}
+
+	uint32_t first = data_sector(fs, fs->next_seq);
+	uint32_t until_wrap = LOGFS_DATA_START + fs->data_sectors - first;
+	fs->write_sectors = sectors;
+	fs->write_count = count;
+	fs->write_part = count < until_wrap ? count : until_wrap;
+	if(fs->dev->pre_erase) fs->dev->pre_erase(fs->dev, fs->write_part);
+	if(dev_write_start(fs, first, sectors, fs->write_part)) return -1;
+	fs->write_stage = WRITE_DATA;
+	return 1;
+}
+
+//=============================================================================
+// Move the write along: the wrapped part, then a checkpoint if one is due
+int logfs_write_poll(logfs_t *fs) {
+//=============================================================================
+	if(fs->write_stage == WRITE_IDLE) return 0;
+	int busy = fs->dev->write_poll ? fs->dev->write_poll(fs->dev) : 0;
+	if(busy > 0) return 1;
+	if(busy < 0) {
+		fs->write_stage = WRITE_IDLE;
+		return -1;
+	}
+
+	switch(fs->write_stage) {
+	case WRITE_DATA:
+		if(fs->write_part < fs->write_count) {
+			uint32_t rest = fs->write_count - fs->write_part;
+			if(fs->dev->pre_erase) fs->dev->pre_erase(fs->dev, rest);
+			if(dev_write_start(fs, LOGFS_DATA_START, &fs->write_sectors[fs->write_part * BLOCKDEV_SECTOR_SIZE], rest))
+				break;
+			fs->write_stage = WRITE_WRAPPED;
+			return 1;
+		}
+		// fall through
+	case WRITE_WRAPPED: {
+		fs->next_seq += fs->write_count;
+		fs->boot_pending = 0;
+
+		// The checkpoint sector must not be overwritten before the next checkpoint, or mount can't find
+		// the end of the log: on small devices, checkpoint at least twice per trip around the log
+		uint32_t interval = fs->data_sectors / 2 < LOGFS_CHECKPOINT_SECTORS ? fs->data_sectors / 2 : LOGFS_CHECKPOINT_SECTORS;
+		if(fs->next_seq - fs->checkpoint_seq < interval) {
+			fs->write_stage = WRITE_IDLE;
+			return 0;
+		}
+		uint32_t sector = fill_superblock(fs);
+		if(dev_write_start(fs, sector, fs->work, 1)) break;
+		fs->write_stage = WRITE_SUPER;
+		return 1;
+	}
+	case WRITE_SUPER:
+		fs->checkpoint_seq = fs->next_seq;
+		fs->write_stage = WRITE_IDLE;
+		return 0;
+	}
+	fs->write_stage = WRITE_IDLE;
+	return -1;
+}
+
+//=============================================================================
+int logfs_write(logfs_t *fs, uint8_t *sectors, const uint16_t *used, uint32_t count) {
+//=============================================================================
+	int result = logfs_write_start(fs, sectors, used, count);
+	while(result > 0) result = logfs_write_poll(fs);
+	return result;
+}
+
+//=============================================================================
+int logfs_read(logfs_t *fs, uint32_t seq, uint8_t *sector) {
+//=============================================================================
+	if(fs->dev->read(fs->dev, data_sector(fs, seq), sector, 1)) return -1;
+	if(get32(&sector[DS_MAGIC]) != LOGFS_MAGIC_DATA || get32(&sector[DS_SEQ]) != seq) return -1;
+	uint16_t used = get16(&sector[DS_USED]);
+	if(used > LOGFS_PAYLOAD_SIZE) return -1;
+	if(get32(&sector[DS_CHECK]) != fletcher32(sector, DS_CHECK, logfs_payload(sector), used)) return -1;
+	return used;
+}
+
+//=============================================================================
+uint32_t logfs_oldest_seq(const logfs_t *fs) {
+//=============================================================================
+	return fs->next_seq > fs->data_sectors ? fs->next_seq - fs->data_sectors : 0;
+}
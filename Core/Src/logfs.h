@@ -0,0 +1,73 @@
+// Module: logfs.h
+//
+// Append-only, log structured layout for writing the log stream onto a block device.
+// No HAL dependencies - the same code runs on the target (SD card) and the host (file stand-in).
+//
+// Layout:
+//   sector 0, 1 : superblock copies A / B, written alternately (a torn write leaves the other intact)
+//   sector 2..N : data sectors, used as a circular log.  Data sector with sequence number "seq"
+//                 always lives at LOGFS_DATA_START + seq % data_sectors.
+//
+// Each data sector holds a header (magic, seq, bytes used, flags, checksum) and up to
+// LOGFS_PAYLOAD_SIZE bytes of the log stream.  The superblock is only rewritten every
+// LOGFS_CHECKPOINT_SECTORS data sectors (or every half trip around a small device).  Mounting starts at the checkpoint and scans forward
+// over data sectors with the expected seq and a good checksum, so sectors written after the last
+// checkpoint are recovered, and a sector torn by power loss ends the log.
+#ifndef LOGFS_H
+#define LOGFS_H
+
+#include <stdint.h>
+#include "blockdev.h"
+
+#define LOGFS_MAGIC_SUPER        0x46474F4CUL  // "LOGF"
+#define LOGFS_MAGIC_DATA         0x5344474CUL  // "LGDS"
+#define LOGFS_VERSION            1
+#define LOGFS_DATA_START         2
+#define LOGFS_HEADER_SIZE        16
+#define LOGFS_PAYLOAD_SIZE       (BLOCKDEV_SECTOR_SIZE - LOGFS_HEADER_SIZE)
+#define LOGFS_CHECKPOINT_SECTORS 256
+
+// Data sector flags
+#define LOGFS_FLAG_BOOT   0x0001   // first sector written after mount (a reset happened before it)
+
+typedef struct {
+	blockdev_t *dev;
+	uint32_t data_sectors;     // number of sectors in the circular data area
+	uint32_t next_seq;         // sequence number of the next data sector to write
+	uint32_t checkpoint_seq;   // next_seq as recorded in the newest superblock
+	uint32_t super_gen;        // generation of the newest superblock
+	uint32_t boot_count;
+	uint8_t boot_pending;      // next sector written gets LOGFS_FLAG_BOOT
+	uint8_t write_stage;       // logfs_write_start() in progress: data, wrapped part, superblock
+	uint8_t *write_sectors;
+	uint32_t write_count;
+	uint32_t write_part;       // sectors before the end of the device
+	uint8_t work[BLOCKDEV_SECTOR_SIZE]; // scratch sector used while mounting / updating the superblock
+} logfs_t;
+
+int logfs_format(logfs_t *fs, blockdev_t *dev);
+// Recover the end of the log, returns 0 on success.  The mount is recorded (boot count, superblock with
+// the recovered end); read_only leaves the device untouched, to inspect a card without writing to it.
+int logfs_mount(logfs_t *fs, blockdev_t *dev, int read_only);
+
+// Write count sectors.  The caller fills the payload of each sector (see logfs_payload()),
+// used[i] gives the payload bytes in sector i.  Headers are filled in here.
+// count may be up to half the data area.
+int logfs_write(logfs_t *fs, uint8_t *sectors, const uint16_t *used, uint32_t count);
+
+// Non-blocking logfs_write(), with the device's write_start / write_poll (else the steps block): start,
+// then poll until done.  Both return 1 while the write runs, 0 once done, -1 on error.  The sectors
+// must stay untouched until then, and there is one write at a time.
+int logfs_write_start(logfs_t *fs, uint8_t *sectors, const uint16_t *used, uint32_t count);
+int logfs_write_poll(logfs_t *fs);
+
+// Read data sector with sequence number seq, returns payload bytes (>= 0), -1 if not valid
+int logfs_read(logfs_t *fs, uint32_t seq, uint8_t *sector);
+uint32_t logfs_oldest_seq(const logfs_t *fs);
+
+static inline uint8_t *logfs_payload(uint8_t *sector)
+{
+	return sector + LOGFS_HEADER_SIZE;
+}
+
+#endif // LOGFS_H
@@ -22,17 +22,45 @@
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
 #include "log.h"
+#include "metrics.h"
+#include "histo.h"
+#include "log_sd.h"
+#include "log_assert.h"
+#include "state_trace.h"
+#include "log_kv.h"
+#include "log_format.h"
+#include "event_capture.h"
+#include "profile.h"
+#include "gpio_trace.h"
+#include "dwt.h"
 #include <stdio.h> // printf()
+#include <string.h>
+#include "blocking.h" // last: times the HAL blocking calls of this file (__io_putchar(), HAL_Delay(), ...)
 
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
 /* USER CODE BEGIN PTD */
+// Phases of the main loop, traced with STATE_TRACE()
+typedef enum {
+	MAIN_BENCH,    // composing the benchmark messages
+	MAIN_REPORT,   // metrics / histograms / stats
+	MAIN_WAIT,     // HAL_Delay() while the DMA catches up
+} main_state_t;
 
 /* USER CODE END PTD */
 
 /* Private define ------------------------------------------------------------*/
 /* USER CODE BEGIN PD */
+#define SM_MAIN  0   // state_trace machine id
+#define TRACE_LOGMSG  1   // gpio_trace bus codes
+#define TRACE_REPORT  2
+#ifndef LOG_FORMAT_BENCH
+#define LOG_FORMAT_BENCH  0  // 1: log_snprintf() against newlib snprintf() once at startup
+#endif
+#ifndef LOG_WCET_BENCH
+#define LOG_WCET_BENCH  0    // 1: logmsg_wcet() worst case against its bound once at startup (~0.3 s)
+#endif
 
 /* USER CODE END PD */
 
@@ -48,6 +76,7 @@ UART_HandleTypeDef huart2;
 DMA_HandleTypeDef hdma_usart2_tx;
 
 /* USER CODE BEGIN PV */
+static const char * const main_state_names[] = { "BENCH", "REPORT", "WAIT" };
 
 /* USER CODE END PV */
 
@@ -88,6 +117,78 @@ int __io_getchar(void)
         return EOF;
 }
 
+#if LOG_FORMAT_BENCH
+// Average cycles per conversion, log_snprintf() against newlib snprintf()
+// newlib-nano only formats %f with "-u _printf_float" in the linker flags, without it the
+// snprintf() column times an empty conversion.
+static void log_format_benchmark(void)
+{
+	static const char * const formats[] = { "%.3f", "%f", "%.2e", "%g" };
+	static const double values[] = { 3.14159, -273.15, 1013.25, 0.000123, 123456.789, 42.0, -0.5, 1e9 };
+	const unsigned n = sizeof(values) / sizeof(values[0]);
+	char buf[40];
+
+	for(unsigned f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+		uint32_t fast = 0, libc = 0;
+		for(unsigned i = 0; i < n; i++) {
+			uint32_t t0 = dwt_cycles();
+			log_snprintf(buf, sizeof(buf), formats[f], values[i]);
+			uint32_t t1 = dwt_cycles();
+			snprintf(buf, sizeof(buf), formats[f], values[i]);
+			uint32_t t2 = dwt_cycles();
+			fast += t1 - t0;
+			libc += t2 - t1;
+		}
+		logmsg("format %s: log_snprintf %lu cycles, snprintf %lu cycles", formats[f], fast / n, libc / n);
+	}
+}
+#endif
+
+#if LOG_WCET_BENCH
+// Most cycles a logmsg_wcet() call took, against LOG_WCET_CYC_ITEM + log_wcet_bound(format).
+// Arguments are the extremes (longest numbers, %s longer than LOG_WCET_MAX_STR) and a few others.
+// Interrupts are off around each call, and the queue is drained first so every call starts the DMA.
+// All arguments are 32-bit words on the Cortex-M3, ints and pointers are passed the same way.
+static void log_wcet_benchmark(void)
+{
+	static const char * const formats[] = {
+		"count %u", "adc %4d %4d %4d", "state %s -> %s", "reg 0x%08lX", "%-16s|%16s|%c", "%5u %-6d %x %.3s",
+	};
+	static const char long_text[] = "The quick brown fox jumped over the lazy dog!";
+	static const uint32_t values[] = { 0x80000000u, 0xFFFFFFFFu, 0, 1234567, 42, 0x7FFFFFFFu };
+	const unsigned n = sizeof(values) / sizeof(values[0]);
+
+	for(unsigned f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+		uint16_t chars;
+		int32_t bound = log_wcet_bound(formats[f], &chars) + LOG_WCET_CYC_ITEM;
+		uint32_t worst = 0;
+		for(unsigned i = 0; i < n; i++) {
+			uintptr_t args[6] = {0};
+			uint8_t a = 0;
+			for(const char *p = formats[f]; *p && a < 6; p++) {
+				if(*p != '%') continue;
+				p += strcspn(p + 1, "diuxXcs") + 1;
+				args[a] = (*p == 's') ? (uintptr_t)(i & 1 ? "" : long_text) : values[(i + a) % n];
+				a++;
+			}
+			uint32_t t0 = HAL_GetTick();
+			while(log_reader_lag(0) && HAL_GetTick() - t0 < 100) {
+			}
+			uint32_t primask = __get_PRIMASK();
+			__disable_irq();
+			uint32_t start = dwt_cycles();
+			logmsg_wcet(formats[f], args[0], args[1], args[2], args[3], args[4], args[5]);
+			uint32_t cycles = dwt_cycles() - start;
+			__set_PRIMASK(primask);
+			if(cycles > worst) worst = cycles;
+		}
+		logmsg("wcet \"%s\": %u chars, bound %ld cycles, worst %lu (%lu%%)", formats[f], chars, bound, worst,
+				worst * 100 / bound);
+		CHECK(worst <= (uint32_t)bound, f, worst);
+	}
+}
+#endif
+
 /* USER CODE END 0 */
 
 /**
@@ -128,6 +229,25 @@ int main(void)
   //HAL_UART_Transmit(&huart2, (uint8_t *)version, strlen(version), 50);
   setvbuf(stdout, NULL, _IONBF, 0); // stdout is to be unbuffered
   printf("VER 2.1.1\n");
+  log_init();
+#if LOG_SD_SINK
+  if(log_sd_init()) printf("SD card not available\n");
+#endif
+  metrics_init(); // send metric names to the host
+  histo_init();
+  log_assert_send_table(); // assertion descriptors, for the host decoder
+  state_trace_register(SM_MAIN, "main", main_state_names, 3);
+  log_kv_send_keys();
+  event_capture_init(); // edges on PB7 (jumper from B1 / PC13 to time the button)
+  profile_init();
+  gpio_trace_init(); // PC0 - PC5 for a logic analyzer, see Tools/la_align.c
+  log_blob_benchmark(); // memcpy / DMA crossover for log_blob()
+#if LOG_FORMAT_BENCH
+  log_format_benchmark();
+#endif
+#if LOG_WCET_BENCH
+  log_wcet_benchmark();
+#endif
   /* USER CODE END 2 */
 
   /* Infinite loop */
@@ -156,6 +276,7 @@ int main(void)
 	// Test: Record time to post 10 quantity - 50 byte (49+null) message, each with a '0X%08X' hex value
 	//               1         2         3         4         5         6         7         8         9         0         1         2         3
 	//      123456789012345678901234567890123456789012345678901234567890123456789012345678901234567890123456789012345678901234567890123456789"); // 129 + Null
+	STATE_TRACE(SM_MAIN, MAIN_WAIT, MAIN_BENCH);
 	uint16_t start_us = TIM4->CNT; // read us hardware timer
 //	logmsg("1234567890123456789012345678901234567890X%08lX",_32bitnumber);
 //	logmsg("#######################################0X%08lX",_32bitnumber);
@@ -177,7 +298,13 @@ int main(void)
 	// 49.5 us each.  Test was performed with STM32F103RB at 72MHz.
 
 
-	logmsg("1234567890123456789012345678901234567890123456789");
+	HISTO_TIME(LOGMSG_US) {
+		PROFILE_BEGIN(LOGMSG);
+		GPIO_TRACE_BEGIN(TRACE_LOGMSG);
+		logmsg("1234567890123456789012345678901234567890123456789");
+		GPIO_TRACE_END();
+		PROFILE_END(LOGMSG);
+	}
 	logmsg("#################################################");
 	logmsg("AAAAAAAAAABBBBBBBBBBCCCCCCCCCCDDDDDDDDDDEEEEEEEEE");
 	logmsg("*************************************************");
@@ -189,7 +316,28 @@ int main(void)
 	logmsg("@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@");
 
 	uint16_t stop_us = TIM4->CNT; // read us hardware timer
+	STATE_TRACE(SM_MAIN, MAIN_BENCH, MAIN_REPORT);
 	logmsg("Time: %dus",stop_us-start_us);
+	LOG_KV(DBG_LOG_INFO, BENCH, KV_UINT(MESSAGES, 10), KV_UINT(US, (uint16_t)(stop_us-start_us)),
+			KV_UINT(DROPPED, metric_values[METRIC_LOG_DROPPED]));
+	METRIC_SET(LOG_BENCH_US, (uint16_t)(stop_us-start_us));
+	METRIC_INC(MAIN_LOOPS);
+	// Only when drops happened since the last record, and once a minute
+	LOG_ON_CHANGE(LOG_TAG_MAIN, metric_values[METRIC_LOG_DROPPED], 0, 60000, "log dropped %ld",
+			(long)metric_values[METRIC_LOG_DROPPED]);
+	PROFILE_BEGIN(REPORT);
+	GPIO_TRACE_BEGIN(TRACE_REPORT);
+	metrics_poll();
+	histo_poll();
+	log_tag_poll();
+	log_sd_poll();
+	event_capture_poll();
+	GPIO_TRACE_END();
+	PROFILE_END(REPORT);
+	profile_poll();
+	gpio_trace_poll();
+	block_poll();
+	STATE_TRACE(SM_MAIN, MAIN_REPORT, MAIN_WAIT);
 
 	// Test results #3:  375us to compose and queue 10 debug messages (no expansion within format string)
 	// 37.5 us each.  Test was performed with STM32F103RB at 72MHz.
@@ -197,8 +345,13 @@ int main(void)
     //void hexdump(const void* address, unsigned count);
     //extern char _usart2_tx_dma_buffer[];
     //hexdump(_usart2_tx_dma_buffer,LOG_DMA_BUFFER_SIZE);  // Dump the contents of the DMA buffer
+    //log_blob(0, _usart2_tx_dma_buffer, 1024);  // or part of it as binary frames (Tools/logdecode shows them as hex)
 
-	HAL_Delay(5000); // Allow DMA printing process to catch up
+	// Allow DMA printing process to catch up, captured edges are sent meanwhile
+	for(uint32_t wait_start = HAL_GetTick(); HAL_GetTick() - wait_start < 5000; ) {
+		HAL_Delay(EVENT_CAPTURE_POLL_MS);
+		event_capture_poll();
+	}
     /* USER CODE END WHILE */
 
     /* USER CODE BEGIN 3 */
@@ -425,6 +578,7 @@ void assert_failed(uint8_t *file, uint32_t line)
   /* USER CODE BEGIN 6 */
   /* User can add his own implementation to report the file name and line number,
      ex: printf("Wrong parameters value: file %s on line %d\r\n", file, line) */
+  log_assert_hal(file, line); // binary record, the file name isn't formatted
   /* USER CODE END 6 */
 }
 #endif /* USE_FULL_ASSERT */
@@ -0,0 +1,102 @@
+// Module: metrics.c
+//
+// Metrics registry (see metrics.h)
+// Wire format of a LOG_FRAME_METRICS payload:
+//   tick (uint32 little endian), flags, then { metric id, zigzag varint delta } for each changed metric
+// A metric that didn't change since the last snapshot costs nothing on the wire.
+// If the changes don't fit in a single frame, additional frames (same tick) are sent.
+
+#include <stdint.h>
+#include <string.h>
+#include "log.h"
+#include "metrics.h"
+
+// Descriptor table lives in flash
+const metric_desc_t metric_table[METRIC_COUNT] = {
+#define METRIC_COUNTER(id, name) { name, METRIC_KIND_COUNTER },
+#define METRIC_GAUGE(id, name)   { name, METRIC_KIND_GAUGE },
+#include "metrics_def.h"
+#undef METRIC_COUNTER
+#undef METRIC_GAUGE
+};
+
+int32_t metric_values[METRIC_COUNT];
+static int32_t _metric_sent[METRIC_COUNT];  // values as of the last snapshot
+static uint32_t _metrics_interval = METRICS_INTERVAL_MS;
+static uint32_t _metrics_last_tick;
+static uint8_t _metrics_key_count;
+
+// Payload must fit log_frame() (compose buffer less frame header)
+#define METRICS_MAX_PAYLOAD  (LOG_ITEM_MAX_SIZE - LOG_FRAME_HEADER_SIZE)
+#define METRICS_ENTRY_MAX    6  // id + 5 byte varint
+
+//=============================================================================
+// Send the descriptor table, one frame per metric: id, kind, name (not null terminated)
+void metrics_init(void) {
+//=============================================================================
+	uint8_t payload[METRICS_MAX_PAYLOAD];
+	for(uint8_t id = 0; id < METRIC_COUNT; id++) {
+		uint16_t len = strlen(metric_table[id].name);
+		if(len > METRICS_MAX_PAYLOAD - 2) len = METRICS_MAX_PAYLOAD - 2;
+		payload[0] = id;
+		payload[1] = metric_table[id].kind;
+		memcpy(&payload[2], metric_table[id].name, len);
+		log_frame(LOG_FRAME_METRIC_DESC, payload, len + 2);
+	}
+	_metrics_last_tick = HAL_GetTick();
+	_metrics_key_count = 0; // next snapshot is a key frame
+}
+
+//=============================================================================
+void metrics_set_interval(uint32_t ms) {
+//=============================================================================
+	_metrics_interval = ms;
+}
+
+//=============================================================================
+// Build and send snapshot frame(s).  Returns number of frames sent, -1 if the log queue was full
+// (in which case the next snapshot is a key frame, so the host doesn't lose track of any value).
+int metrics_snapshot(void) {
+//=============================================================================
+	uint8_t payload[METRICS_MAX_PAYLOAD];
+	uint32_t tick = HAL_GetTick();
+	uint8_t key = (_metrics_key_count == 0);
+	int sent = 0;
+	uint8_t id = 0;
+
+	if(++_metrics_key_count >= METRICS_KEY_EVERY) _metrics_key_count = 0;
+
+	do {
+		uint16_t len = 5;
+		log_put_u32(payload, tick);
+		payload[4] = key ? LOG_METRICS_FLAG_KEY : 0;
+		for(; id < METRIC_COUNT && len + METRICS_ENTRY_MAX <= METRICS_MAX_PAYLOAD; id++) {
+			int32_t value = metric_values[id]; // single read, value may change under us
+			int32_t base = key ? 0 : _metric_sent[id];
+			if(!key && value == base) continue;
+			payload[len++] = id;
+			len += log_put_varint(&payload[len], log_zigzag(value - base));
+			_metric_sent[id] = value;
+		}
+		if(len > 5) {
+			if(log_frame(LOG_FRAME_METRICS, payload, len) < 0) {
+				// Queue full, the deltas in this frame are lost - resynchronize the host with a key frame
+				_metrics_key_count = 0;
+				return -1;
+			}
+			sent++;
+		}
+	} while(id < METRIC_COUNT);
+
+	return sent;
+}
+
+//=============================================================================
+void metrics_poll(void) {
+//=============================================================================
+	if(!_metrics_interval) return;
+	uint32_t now = HAL_GetTick();
+	if(now - _metrics_last_tick < _metrics_interval) return;
+	_metrics_last_tick = now;
+	metrics_snapshot();
+}
@@ -0,0 +1,47 @@
+// Module: metrics.h
+//
+// Metrics registry - named counters and gauges, snapshot periodically into a binary telemetry frame
+// Updating a metric is a single increment / store into a RAM array (no formatting, no logging).
+// metrics_poll(), called from the main loop, sends the values that changed since the last
+// snapshot, delta-encoded, as one LOG_FRAME_METRICS frame.
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+
+typedef enum {
+#define METRIC_COUNTER(id, name) METRIC_##id,
+#define METRIC_GAUGE(id, name)   METRIC_##id,
+#include "metrics_def.h"
+#undef METRIC_COUNTER
+#undef METRIC_GAUGE
+	METRIC_COUNT
+} metric_id_t;
+
+typedef enum {
+	METRIC_KIND_COUNTER,
+	METRIC_KIND_GAUGE,
+} metric_kind_t;
+
+typedef struct {
+	const char *name;
+	uint8_t kind;   // metric_kind_t
+} metric_desc_t;
+
+#define METRICS_INTERVAL_MS   1000  // default snapshot interval
+#define METRICS_KEY_EVERY     10    // every Nth snapshot sends all values (lets the host resynchronize)
+
+extern const metric_desc_t metric_table[METRIC_COUNT]; // flash resident descriptors
+extern int32_t metric_values[METRIC_COUNT];
+
+// Not atomic - a metric should be updated from a single context (main loop or one ISR)
+#define METRIC_INC(id)      (metric_values[METRIC_##id]++)
+#define METRIC_ADD(id, n)   (metric_values[METRIC_##id] += (n))
+#define METRIC_SET(id, v)   (metric_values[METRIC_##id] = (v))
+
+void metrics_init(void);                   // send descriptor table to the host
+void metrics_set_interval(uint32_t ms);    // 0 disables periodic snapshots
+void metrics_poll(void);                   // call from main loop, sends a snapshot when the interval elapsed
+int metrics_snapshot(void);                // send a snapshot now
+
+#endif // METRICS_H
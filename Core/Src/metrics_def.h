@@ -0,0 +1,14 @@
+// Module: metrics_def.h
+//
+// Metric descriptor list - add new counters and gauges here (no include guard, included several times)
+// METRIC_COUNTER(id, name) : monotonic count, updated with METRIC_INC() / METRIC_ADD()
+// METRIC_GAUGE(id, name)   : current value, updated with METRIC_SET()
+// The id becomes METRIC_<id>, the name string stays in flash and is sent once to the host.
+
+METRIC_COUNTER(MAIN_LOOPS,      "main.loops")
+METRIC_COUNTER(LOG_DROPPED,     "log.dropped")
+METRIC_COUNTER(ASSERT_FAILURES, "assert.failures")
+METRIC_GAUGE  (LOG_BENCH_US,    "log.bench_us")
+METRIC_COUNTER(EVENT_EDGES,     "events.edges")    // event_capture_stats, copied by event_capture_poll()
+METRIC_COUNTER(EVENT_LOST,      "events.lost")
+METRIC_COUNTER(EVENT_OVERRUNS,  "events.overruns")
@@ -0,0 +1,167 @@
+// Module: profile.c
+//
+// DWT event counter region profiler (see profile.h)
+
+#include <stdint.h>
+#include <string.h>
+#include "log.h"
+#include "profile.h"
+#include "dwt.h"
+
+const char * const profile_names[PROFILE_COUNT] = {
+#define PROFILE_REGION(id, name) name,
+#include "profile_def.h"
+#undef PROFILE_REGION
+};
+
+profile_region_t profile_regions[PROFILE_COUNT];
+static uint32_t _profile_total[PROFILE_COUNTERS];   // 32-bit totals of the 8-bit counters (CYC unused)
+static uint8_t _profile_last[PROFILE_COUNTERS];     // 8-bit counter values at the last sample
+static uint32_t _profile_overhead[PROFILE_COUNTERS]; // an empty region
+static uint32_t _profile_interval = PROFILE_REPORT_MS;
+static uint32_t _profile_last_tick;
+static uint8_t _profile_debugmon;
+
+//=============================================================================
+// Read the 8-bit counters, in profile_counter_t order (CYC left out)
+static inline void read_counters(uint8_t *v) {
+//=============================================================================
+	v[PROFILE_CPI] = DWT->CPICNT;
+	v[PROFILE_EXC] = DWT->EXCCNT;
+	v[PROFILE_SLEEP] = DWT->SLEEPCNT;
+	v[PROFILE_LSU] = DWT->LSUCNT;
+	v[PROFILE_FOLD] = DWT->FOLDCNT;
+}
+
+//=============================================================================
+// Fold the 8-bit counters into the totals, and take a snapshot of all six (snap may be NULL)
+// Interrupts are disabled so the DebugMon handler can't sample in between.
+static void snapshot(uint32_t *snap) {
+//=============================================================================
+	uint8_t now[PROFILE_COUNTERS];
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	uint32_t cycles = dwt_cycles();
+	read_counters(now);
+	for(uint8_t i = PROFILE_CPI; i < PROFILE_COUNTERS; i++) {
+		_profile_total[i] += (uint8_t)(now[i] - _profile_last[i]);
+		_profile_last[i] = now[i];
+	}
+	if(snap) {
+		memcpy(snap, _profile_total, sizeof(_profile_total));
+		snap[PROFILE_CYC] = cycles;
+	}
+	__set_PRIMASK(primask);
+}
+
+//=============================================================================
+void profile_sample(void) {
+//=============================================================================
+	snapshot(NULL);
+}
+
+//=============================================================================
+void profile_begin(profile_id_t id) {
+//=============================================================================
+	snapshot(profile_regions[id].start);
+}
+
+//=============================================================================
+void profile_end(profile_id_t id) {
+//=============================================================================
+	uint32_t now[PROFILE_COUNTERS];
+	snapshot(now);
+	profile_region_t *r = &profile_regions[id];
+	for(uint8_t i = 0; i < PROFILE_COUNTERS; i++) {
+		uint32_t delta = now[i] - r->start[i];
+		delta = (delta > _profile_overhead[i]) ? delta - _profile_overhead[i] : 0;
+		r->total[i] += delta;
+		if(i == PROFILE_CYC && delta > r->max_cycles) r->max_cycles = delta;
+	}
+	r->calls++;
+}
+
+//=============================================================================
+// DWT comparator 0 matched CYCCNT: sample, and set the next match
+void profile_debugmon(void) {
+//=============================================================================
+	if(!(SCB->DFSR & SCB_DFSR_DWTTRAP_Msk)) return;
+	SCB->DFSR = SCB_DFSR_DWTTRAP_Msk; // write 1 to clear
+	(void)DWT->FUNCTION0;               // reading clears MATCHED
+	snapshot(NULL);
+	DWT->COMP0 = dwt_cycles() + PROFILE_DEBUGMON_CYCLES;
+}
+
+//=============================================================================
+// Enable the event counters, and measure an empty region (smallest of a few tries)
+void profile_init(void) {
+//=============================================================================
+	DWT->CTRL |= DWT_CTRL_CPIEVTENA_Msk | DWT_CTRL_EXCEVTENA_Msk | DWT_CTRL_SLEEPEVTENA_Msk |
+			DWT_CTRL_LSUEVTENA_Msk | DWT_CTRL_FOLDEVTENA_Msk;
+	read_counters(_profile_last);
+	memset(_profile_total, 0, sizeof(_profile_total));
+
+#if PROFILE_DEBUGMON
+	// With a debugger attached, halting debug takes the DWT events and would stop the core
+	if(!(CoreDebug->DHCSR & CoreDebug_DHCSR_C_DEBUGEN_Msk)) {
+		DWT->COMP0 = dwt_cycles() + PROFILE_DEBUGMON_CYCLES;
+		DWT->MASK0 = 0;
+		DWT->FUNCTION0 = DWT_FUNCTION_CYCMATCH_Msk | (4 << DWT_FUNCTION_FUNCTION_Pos); // debug event on match
+		CoreDebug->DEMCR |= CoreDebug_DEMCR_MON_EN_Msk;
+		_profile_debugmon = 1;
+	}
+#endif
+
+	memset(_profile_overhead, 0, sizeof(_profile_overhead));
+	uint32_t overhead[PROFILE_COUNTERS];
+	for(uint8_t n = 0; n < 8; n++) {
+		profile_region_t *r = &profile_regions[0];
+		memset(r, 0, sizeof(*r));
+		profile_begin(0);
+		profile_end(0);
+		for(uint8_t i = 0; i < PROFILE_COUNTERS; i++)
+			if(!n || r->total[i] < overhead[i]) overhead[i] = r->total[i];
+	}
+	memcpy(_profile_overhead, overhead, sizeof(overhead));
+	memset(profile_regions, 0, sizeof(profile_regions));
+	_profile_last_tick = HAL_GetTick();
+}
+
+//=============================================================================
+void profile_set_interval(uint32_t ms) {
+//=============================================================================
+	_profile_interval = ms;
+}
+
+//=============================================================================
+// One line per region that ran: calls, then per call averages, instructions and cycles per instruction
+void profile_report(void) {
+//=============================================================================
+	logtag(LOG_TAG_STATS, "profile (%s, overhead %lu cyc): region calls cyc max cpi exc sleep lsu fold instr cpi(x100)",
+			_profile_debugmon ? "debugmon" : "sampled", _profile_overhead[PROFILE_CYC]);
+	for(uint8_t id = 0; id < PROFILE_COUNT; id++) {
+		profile_region_t r = profile_regions[id];
+		if(!r.calls) continue;
+		uint32_t avg[PROFILE_COUNTERS];
+		for(uint8_t i = 0; i < PROFILE_COUNTERS; i++) avg[i] = r.total[i] / r.calls;
+		uint32_t stalls = avg[PROFILE_CPI] + avg[PROFILE_EXC] + avg[PROFILE_SLEEP] + avg[PROFILE_LSU];
+		uint32_t instr = (avg[PROFILE_CYC] > stalls) ? avg[PROFILE_CYC] - stalls + avg[PROFILE_FOLD] : 0;
+		logtag(LOG_TAG_STATS, "%-8s %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu", profile_names[id], r.calls,
+				avg[PROFILE_CYC], r.max_cycles, avg[PROFILE_CPI], avg[PROFILE_EXC], avg[PROFILE_SLEEP],
+				avg[PROFILE_LSU], avg[PROFILE_FOLD], instr, instr ? avg[PROFILE_CYC] * 100 / instr : 0);
+		// start is left alone, the region may be open
+		profile_regions[id].calls = 0;
+		profile_regions[id].max_cycles = 0;
+		memset(profile_regions[id].total, 0, sizeof(r.total));
+	}
+}
+
+//=============================================================================
+void profile_poll(void) {
+//=============================================================================
+	if(!_profile_interval) return;
+	uint32_t now = HAL_GetTick();
+	if(now - _profile_last_tick < _profile_interval) return;
+	_profile_last_tick = now;
+	profile_report();
+}
@@ -0,0 +1,82 @@
+// Module: profile.h
+//
+// Region profiler using the Cortex-M3 DWT event counters
+// PROFILE_BEGIN(id) / PROFILE_END(id) snapshot six counters and add the differences to the region:
+// * cyc   : CYCCNT, clock cycles
+// * cpi   : CPICNT, extra cycles of multi-cycle instructions (except load / store), and instruction fetch stalls
+// * exc   : EXCCNT, exception entry / exit overhead
+// * sleep : SLEEPCNT, cycles sleeping
+// * lsu   : LSUCNT, extra cycles of load / store instructions (flash wait states, bus contention)
+// * fold  : FOLDCNT, instructions that took no cycle (folded IT instructions)
+// Instructions executed = cyc - cpi - exc - sleep - lsu + fold.
+//
+// All but CYCCNT are 8-bit and wrap after 256 events.  Each snapshot folds them into 32-bit totals, so
+// a region is exact as long as no counter sees 256 events between two snapshots:
+// * PROFILE_SAMPLE() adds a snapshot, call it inside long loops, or
+// * PROFILE_DEBUGMON 1: the DWT comparator 0 raises DebugMon every PROFILE_DEBUGMON_CYCLES cycles, and
+//     the handler takes the snapshot.  Exact for any region, but costs ~20% of the CPU, and needs no
+//     debugger attached (a debug event would halt the core instead), else falls back to sampling.
+// The counters cover all code, interrupts included, so an ISR firing inside a region is counted in it.
+// The cost of an empty region is measured by profile_init() and subtracted.
+// profile_report() logs the per call averages of each region, and clears them.
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+
+#ifndef PROFILE
+#define PROFILE  1                 // 0 removes the regions
+#endif
+#ifndef PROFILE_DEBUGMON
+#define PROFILE_DEBUGMON  0        // 1: snapshot from the DebugMon handler
+#endif
+#define PROFILE_DEBUGMON_CYCLES  240   // less than 256, so no 8-bit counter can wrap twice
+#define PROFILE_REPORT_MS  60000       // default interval of the periodic report
+
+typedef enum {
+#define PROFILE_REGION(id, name) PROFILE_##id,
+#include "profile_def.h"
+#undef PROFILE_REGION
+	PROFILE_COUNT
+} profile_id_t;
+
+typedef enum {
+	PROFILE_CYC,
+	PROFILE_CPI,
+	PROFILE_EXC,
+	PROFILE_SLEEP,
+	PROFILE_LSU,
+	PROFILE_FOLD,
+	PROFILE_COUNTERS
+} profile_counter_t;
+
+typedef struct {
+	uint32_t calls;
+	uint32_t max_cycles;
+	uint32_t total[PROFILE_COUNTERS];
+	uint32_t start[PROFILE_COUNTERS];   // snapshot of PROFILE_BEGIN()
+} profile_region_t;
+
+extern const char * const profile_names[PROFILE_COUNT];
+extern profile_region_t profile_regions[PROFILE_COUNT];
+
+void profile_init(void);                   // after log_init() (enables the DWT), measures the overhead
+void profile_sample(void);                 // fold the 8-bit counters into the 32-bit totals
+void profile_begin(profile_id_t id);
+void profile_end(profile_id_t id);
+void profile_debugmon(void);               // from DebugMon_Handler()
+void profile_set_interval(uint32_t ms);    // 0 disables the periodic report
+void profile_poll(void);                   // call from main loop
+void profile_report(void);                 // log the regions now, and clear them
+
+#if PROFILE
+#define PROFILE_BEGIN(id)  profile_begin(PROFILE_##id)
+#define PROFILE_END(id)    profile_end(PROFILE_##id)
+#define PROFILE_SAMPLE()   profile_sample()
+#else
+#define PROFILE_BEGIN(id)  ((void)0)
+#define PROFILE_END(id)    ((void)0)
+#define PROFILE_SAMPLE()   ((void)0)
+#endif
+
+#endif // PROFILE_H
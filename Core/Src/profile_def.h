@@ -0,0 +1,7 @@
+// Module: profile_def.h
+//
+// Profiled regions - add new regions here (no include guard, included several times)
+// PROFILE_REGION(id, name) : the id becomes PROFILE_<id>, used with PROFILE_BEGIN(id) / PROFILE_END(id).
+
+PROFILE_REGION(LOGMSG,  "logmsg")   // main.c, one logmsg() of the benchmark
+PROFILE_REGION(REPORT,  "report")   // main.c, metrics / histograms / stats polling
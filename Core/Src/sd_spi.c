@@ -0,0 +1,348 @@
+// Module: sd_spi.c
+//
+// SD card (SDv1, SDv2 standard and high capacity) in SPI mode on SPI2 (see sd_spi.h)
+// Only what the logger needs is implemented: single block read, multiple block write with
+// ACMD23 pre-erase, and the card size from the CSD register.
+// Commands and reads are polled, byte at a time.  Write data goes out by DMA (DMA1 channel 5, SPI2 TX;
+// the received bytes are thrown away), and sd_write_poll() takes one step of a multiple block write per
+// call without waiting for the card: a sector transfer (~0.3 ms at 18 MHz) or the card's programming
+// busy time (typically 0.5 to a few ms per sector, up to 250 ms) are checked on, not waited for.
+
+#include <stdint.h>
+#include <main.h>
+#include "sd_spi.h"
+
+#define SD_TIMEOUT_MS    500
+#define SD_INIT_TIMEOUT  1000
+
+// Commands, bit 7 marks an application command (sent after CMD55)
+#define CMD0    (0)          // GO_IDLE_STATE
+#define CMD8    (8)          // SEND_IF_COND
+#define CMD9    (9)          // SEND_CSD
+#define CMD16   (16)         // SET_BLOCKLEN
+#define CMD17   (17)         // READ_SINGLE_BLOCK
+#define CMD25   (25)         // WRITE_MULTIPLE_BLOCK
+#define CMD55   (55)         // APP_CMD
+#define CMD58   (58)         // READ_OCR
+#define ACMD23  (0x80 | 23)  // SET_WR_BLK_ERASE_COUNT
+#define ACMD41  (0x80 | 41)  // SD_SEND_OP_COND
+
+#define TOKEN_START_BLOCK   0xFE
+#define TOKEN_START_MULTI   0xFC
+#define TOKEN_STOP_TRAN     0xFD
+
+#define SD_DMA_CH        DMA1_Channel5  // SPI2_TX request
+
+static uint8_t _sd_block_addressing; // SDHC/SDXC: sector number, else byte address
+
+// Multiple block write in progress (sd_write_start() / sd_write_poll())
+enum { WRITE_IDLE, WRITE_DATA, WRITE_BUSY, WRITE_STOP };
+static uint8_t _sd_write_state;
+static const uint8_t *_sd_write_buf;     // next sector to send
+static uint32_t _sd_write_left;          // sectors not sent yet
+static uint32_t _sd_write_tick;          // start of the current wait, for SD_TIMEOUT_MS
+
+//=============================================================================
+static uint8_t spi_xfer(uint8_t out) {
+//=============================================================================
+	while(!(SPI2->SR & SPI_SR_TXE));
+	*(volatile uint8_t *)&SPI2->DR = out;
+	while(!(SPI2->SR & SPI_SR_RXNE));
+	return (uint8_t)SPI2->DR;
+}
+
+//=============================================================================
+static void spi_set_speed(uint32_t baud_bits) {
+//=============================================================================
+	SPI2->CR1 &= ~SPI_CR1_SPE;
+	SPI2->CR1 = (SPI2->CR1 & ~SPI_CR1_BR) | baud_bits;
+	SPI2->CR1 |= SPI_CR1_SPE;
+}
+
+//=============================================================================
+static int wait_ready(void) {
+//=============================================================================
+	uint32_t start = HAL_GetTick();
+	while(spi_xfer(0xFF) != 0xFF) {
+		if(HAL_GetTick() - start > SD_TIMEOUT_MS) return -1;
+	}
+	return 0;
+}
+
+//=============================================================================
+static void sd_deselect(void) {
+//=============================================================================
+	SD_CS_GPIO_Port->BSRR = SD_CS_Pin;
+	spi_xfer(0xFF); // card releases MISO on the next clock
+}
+
+//=============================================================================
+static int sd_select(void) {
+//=============================================================================
+	SD_CS_GPIO_Port->BSRR = (uint32_t)SD_CS_Pin << 16;
+	spi_xfer(0xFF);
+	if(wait_ready() == 0) return 0;
+	sd_deselect();
+	return -1;
+}
+
+//=============================================================================
+// Send a command, return the R1 response (bit 7 set: no response / timeout)
+static uint8_t send_cmd(uint8_t cmd, uint32_t arg) {
+//=============================================================================
+	uint8_t r1;
+	if(cmd & 0x80) {
+		cmd &= 0x7F;
+		r1 = send_cmd(CMD55, 0);
+		if(r1 > 1) return r1;
+	}
+	sd_deselect();
+	if(sd_select()) return 0xFF;
+
+	spi_xfer(0x40 | cmd);
+	spi_xfer((uint8_t)(arg >> 24));
+	spi_xfer((uint8_t)(arg >> 16));
+	spi_xfer((uint8_t)(arg >> 8));
+	spi_xfer((uint8_t)arg);
+	// CRC is only checked for CMD0 and CMD8 while in SPI mode
+	spi_xfer(cmd == CMD0 ? 0x95 : cmd == CMD8 ? 0x87 : 0x01);
+
+	for(int i = 0; i < 10; i++) {
+		r1 = spi_xfer(0xFF);
+		if(!(r1 & 0x80)) break;
+	}
+	return r1;
+}
+
+//=============================================================================
+static int receive_block(uint8_t *buf, uint32_t len) {
+//=============================================================================
+	uint32_t start = HAL_GetTick();
+	uint8_t token;
+	while((token = spi_xfer(0xFF)) == 0xFF) {
+		if(HAL_GetTick() - start > SD_TIMEOUT_MS) return -1;
+	}
+	if(token != TOKEN_START_BLOCK) return -1;
+	while(len--) *buf++ = spi_xfer(0xFF);
+	spi_xfer(0xFF); // CRC, ignored
+	spi_xfer(0xFF);
+	return 0;
+}
+
+//=============================================================================
+static int sd_read(blockdev_t *dev, uint32_t sector, uint8_t *buf, uint32_t count) {
+//=============================================================================
+	(void)dev;
+	int result = 0;
+	for(; count && !result; count--, sector++, buf += BLOCKDEV_SECTOR_SIZE) {
+		uint32_t addr = _sd_block_addressing ? sector : sector * BLOCKDEV_SECTOR_SIZE;
+		if(send_cmd(CMD17, addr) != 0 || receive_block(buf, BLOCKDEV_SECTOR_SIZE)) result = -1;
+	}
+	sd_deselect();
+	return result;
+}
+
+//=============================================================================
+static int sd_pre_erase(blockdev_t *dev, uint32_t count) {
+//=============================================================================
+	(void)dev;
+	// Must immediately precede CMD25, logfs_write_start() calls this right before sd_write_start()
+	return send_cmd(ACMD23, count) == 0 ? 0 : -1;
+}
+
+//=============================================================================
+// Data token, then the sector's 512 bytes by DMA.  CRC and the card's data response follow its completion.
+static void send_sector(void) {
+//=============================================================================
+	spi_xfer(0xFF);
+	spi_xfer(TOKEN_START_MULTI);
+	DMA1->IFCR = DMA_IFCR_CGIF5;
+	SD_DMA_CH->CMAR = (uint32_t)_sd_write_buf;
+	SD_DMA_CH->CNDTR = BLOCKDEV_SECTOR_SIZE;
+	SD_DMA_CH->CCR = DMA_CCR_MINC | DMA_CCR_DIR | DMA_CCR_EN;
+	_sd_write_buf += BLOCKDEV_SECTOR_SIZE;
+	_sd_write_left--;
+	_sd_write_state = WRITE_DATA;
+}
+
+//=============================================================================
+// Multiple block write: one command, then a data token + 512 bytes + CRC per sector, see sd_write_poll()
+static int sd_write_start(blockdev_t *dev, uint32_t sector, const uint8_t *buf, uint32_t count) {
+//=============================================================================
+	(void)dev;
+	uint32_t addr = _sd_block_addressing ? sector : sector * BLOCKDEV_SECTOR_SIZE;
+
+	if(_sd_write_state != WRITE_IDLE || !count) return -1;
+	if(send_cmd(CMD25, addr) != 0) {
+		sd_deselect();
+		return -1;
+	}
+	_sd_write_buf = buf;
+	_sd_write_left = count;
+	send_sector();
+	return 0;
+}
+
+//=============================================================================
+// One step of the write in progress, returns 1 while busy, 0 when done, -1 on error
+static int sd_write_poll(blockdev_t *dev) {
+//=============================================================================
+	(void)dev;
+	switch(_sd_write_state) {
+	case WRITE_IDLE:
+		return 0;
+
+	case WRITE_DATA:
+		if(!(DMA1->ISR & DMA_ISR_TCIF5)) return 1;
+		SD_DMA_CH->CCR = 0;
+		DMA1->IFCR = DMA_IFCR_CGIF5;
+		while(!(SPI2->SR & SPI_SR_TXE) || (SPI2->SR & SPI_SR_BSY)); // last byte shifting out, ~0.5 us
+		(void)SPI2->DR; // clears the overrun of the bytes received meanwhile
+		(void)SPI2->SR;
+		spi_xfer(0xFF); // CRC, ignored
+		spi_xfer(0xFF);
+		if((spi_xfer(0xFF) & 0x1F) != 0x05) break; // data response: not accepted
+		_sd_write_state = WRITE_BUSY;
+		_sd_write_tick = HAL_GetTick();
+		return 1;
+
+	case WRITE_BUSY:
+		// card programming the sector
+		if(spi_xfer(0xFF) != 0xFF) {
+			if(HAL_GetTick() - _sd_write_tick > SD_TIMEOUT_MS) break;
+			return 1;
+		}
+		if(_sd_write_left) {
+			send_sector();
+			return 1;
+		}
+		spi_xfer(TOKEN_STOP_TRAN);
+		spi_xfer(0xFF);
+		_sd_write_state = WRITE_STOP;
+		_sd_write_tick = HAL_GetTick();
+		return 1;
+
+	case WRITE_STOP:
+		// card busy while programming the last block
+		if(spi_xfer(0xFF) != 0xFF) {
+			if(HAL_GetTick() - _sd_write_tick > SD_TIMEOUT_MS) break;
+			return 1;
+		}
+		sd_deselect();
+		_sd_write_state = WRITE_IDLE;
+		return 0;
+	}
+
+	// Error: end the transfer, the card sees the stop token or the deselect
+	SD_DMA_CH->CCR = 0;
+	if(_sd_write_state != WRITE_STOP) {
+		spi_xfer(TOKEN_STOP_TRAN);
+		spi_xfer(0xFF);
+		wait_ready();
+	}
+	sd_deselect();
+	_sd_write_state = WRITE_IDLE;
+	return -1;
+}
+
+//=============================================================================
+static int sd_write(blockdev_t *dev, uint32_t sector, const uint8_t *buf, uint32_t count) {
+//=============================================================================
+	int result;
+	if(sd_write_start(dev, sector, buf, count)) return -1;
+	while((result = sd_write_poll(dev)) > 0);
+	return result;
+}
+
+//=============================================================================
+// Card size in sectors, from the CSD register
+static uint32_t read_sector_count(void) {
+//=============================================================================
+	uint8_t csd[16];
+	uint32_t sectors = 0;
+	if(send_cmd(CMD9, 0) == 0 && receive_block(csd, sizeof(csd)) == 0) {
+		if((csd[0] >> 6) == 1) { // CSD version 2.0: C_SIZE [69:48], capacity = (C_SIZE + 1) * 512 KB
+			uint32_t c_size = ((uint32_t)(csd[7] & 0x3F) << 16) | ((uint32_t)csd[8] << 8) | csd[9];
+			sectors = (c_size + 1) << 10;
+		} else { // CSD version 1.0
+			uint32_t c_size = ((uint32_t)(csd[6] & 0x03) << 10) | ((uint32_t)csd[7] << 2) | (csd[8] >> 6);
+			uint8_t c_size_mult = ((csd[9] & 0x03) << 1) | (csd[10] >> 7);
+			uint8_t read_bl_len = csd[5] & 0x0F;
+			sectors = (c_size + 1) << (c_size_mult + 2 + read_bl_len - 9);
+		}
+	}
+	sd_deselect();
+	return sectors;
+}
+
+//=============================================================================
+int sd_spi_init(blockdev_t *dev) {
+//=============================================================================
+	GPIO_InitTypeDef GPIO_InitStruct = {0};
+	uint8_t ocr[4];
+	uint32_t start;
+
+	__HAL_RCC_GPIOB_CLK_ENABLE();
+	__HAL_RCC_SPI2_CLK_ENABLE();
+	__HAL_RCC_DMA1_CLK_ENABLE();
+
+	HAL_GPIO_WritePin(SD_CS_GPIO_Port, SD_CS_Pin, GPIO_PIN_SET);
+	GPIO_InitStruct.Pin = SD_CS_Pin;
+	GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_PP;
+	GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_HIGH;
+	HAL_GPIO_Init(SD_CS_GPIO_Port, &GPIO_InitStruct);
+	GPIO_InitStruct.Pin = GPIO_PIN_13 | GPIO_PIN_15;  // SCK, MOSI
+	GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
+	HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
+	GPIO_InitStruct.Pin = GPIO_PIN_14;                // MISO
+	GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
+	GPIO_InitStruct.Pull = GPIO_PULLUP;
+	HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
+
+	// Master, mode 0, 8 bit, software NSS, APB1 (36 MHz) / 128 = 281 kHz for card identification
+	SPI2->CR1 = SPI_CR1_MSTR | SPI_CR1_SSM | SPI_CR1_SSI | SPI_CR1_BR_2 | SPI_CR1_BR_1;
+	SPI2->CR1 |= SPI_CR1_SPE;
+
+	for(int i = 0; i < 10; i++) spi_xfer(0xFF); // 80 clocks with CS high, card enters SPI mode
+
+	if(send_cmd(CMD0, 0) != 1) goto fail;
+	start = HAL_GetTick();
+	if(send_cmd(CMD8, 0x1AA) == 1) {
+		// SDv2
+		for(int i = 0; i < 4; i++) ocr[i] = spi_xfer(0xFF);
+		if(ocr[2] != 0x01 || ocr[3] != 0xAA) goto fail; // voltage range not accepted
+		while(send_cmd(ACMD41, 1UL << 30) != 0) {
+			if(HAL_GetTick() - start > SD_INIT_TIMEOUT) goto fail;
+		}
+		if(send_cmd(CMD58, 0) != 0) goto fail;
+		for(int i = 0; i < 4; i++) ocr[i] = spi_xfer(0xFF);
+		_sd_block_addressing = (ocr[0] & 0x40) != 0; // CCS bit
+	} else {
+		// SDv1
+		while(send_cmd(ACMD41, 0) != 0) {
+			if(HAL_GetTick() - start > SD_INIT_TIMEOUT) goto fail;
+		}
+		_sd_block_addressing = 0;
+	}
+	if(!_sd_block_addressing && send_cmd(CMD16, BLOCKDEV_SECTOR_SIZE) != 0) goto fail;
+
+	spi_set_speed(0); // APB1 / 2 = 18 MHz
+	SD_DMA_CH->CCR = 0;
+	SD_DMA_CH->CPAR = (uint32_t)&SPI2->DR;
+	SPI2->CR2 |= SPI_CR2_TXDMAEN; // requests only reach the DMA while the channel is enabled
+	_sd_write_state = WRITE_IDLE;
+
+	dev->read = sd_read;
+	dev->write = sd_write;
+	dev->pre_erase = sd_pre_erase;
+	dev->write_start = sd_write_start;
+	dev->write_poll = sd_write_poll;
+	dev->ctx = 0;
+	dev->sectors = read_sector_count();
+	sd_deselect();
+	return dev->sectors ? 0 : -1;
+
+fail:
+	sd_deselect();
+	return -1;
+}
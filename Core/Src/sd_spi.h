@@ -0,0 +1,16 @@
+// Module: sd_spi.h
+//
+// SD card in SPI mode, on SPI2: PB13 SCK, PB14 MISO, PB15 MOSI, PB12 chip select
+// (SPI1 isn't used since its SCK pin, PA5, drives LD2 on the NUCLEO board)
+// Provides a blockdev_t for logfs.c.  Register level driver, the HAL SPI module isn't part of this project.
+#ifndef SD_SPI_H
+#define SD_SPI_H
+
+#include "blockdev.h"
+
+#define SD_CS_Pin        GPIO_PIN_12
+#define SD_CS_GPIO_Port  GPIOB
+
+int sd_spi_init(blockdev_t *dev);   // configure SPI2, initialize the card, returns 0 on success
+
+#endif // SD_SPI_H
@@ -0,0 +1,56 @@
+// Module: state_trace.c
+//
+// State machine transition tracing (see state_trace.h)
+// LOG_FRAME_STATE_DESC payload : machine, state (STATE_DESC_MACHINE for the machine itself), tick (uint32), name[]
+// LOG_FRAME_STATE payload      : machine, from, to, varint milliseconds since the previous transition
+//                                (or since registration, for the first one)
+
+#include <stdint.h>
+#include <string.h>
+#include "log.h"
+#include "state_trace.h"
+
+#define STATE_DESC_MACHINE  0xFF
+
+static uint32_t _state_last_tick[STATE_TRACE_MACHINES];
+
+//=============================================================================
+static int send_name(uint8_t machine, uint8_t state, uint32_t tick, const char *name) {
+//=============================================================================
+	uint8_t payload[LOG_ITEM_MAX_SIZE - LOG_FRAME_HEADER_SIZE];
+	uint16_t len = strlen(name);
+	if(len > sizeof(payload) - 6) len = sizeof(payload) - 6;
+	payload[0] = machine;
+	payload[1] = state;
+	log_put_u32(&payload[2], tick);
+	memcpy(&payload[6], name, len);
+	return log_frame(LOG_FRAME_STATE_DESC, payload, len + 6);
+}
+
+//=============================================================================
+// Send the machine and state names, and start timing the machine's initial state
+int state_trace_register(uint8_t machine, const char *name, const char * const *state_names, uint8_t count) {
+//=============================================================================
+	if(machine >= STATE_TRACE_MACHINES) return -1;
+	uint32_t tick = HAL_GetTick();
+	_state_last_tick[machine] = tick;
+	int result = send_name(machine, STATE_DESC_MACHINE, tick, name);
+	for(uint8_t s = 0; s < count && s < STATE_DESC_MACHINE; s++) {
+		if(send_name(machine, s, tick, state_names[s]) < 0) result = -1;
+	}
+	return result;
+}
+
+//=============================================================================
+void state_trace(uint8_t machine, uint8_t from, uint8_t to) {
+//=============================================================================
+	uint8_t payload[8];
+	if(machine >= STATE_TRACE_MACHINES) return;
+	uint32_t now = HAL_GetTick();
+	payload[0] = machine;
+	payload[1] = from;
+	payload[2] = to;
+	uint8_t len = 3 + log_put_varint(&payload[3], now - _state_last_tick[machine]);
+	_state_last_tick[machine] = now;
+	log_frame(LOG_FRAME_STATE, payload, len);
+}
@@ -0,0 +1,26 @@
+// Module: state_trace.h
+//
+// State machine transition tracing with compact binary records
+// A state machine registers once with its id and a table of state names (kept in flash; the names are
+// only sent to the host at registration).  Each transition is then a LOG_FRAME_STATE record: machine,
+// from, to, and the time spent in the "from" state as a varint in milliseconds (1 byte up to 127 ms,
+// 3 up to ~35 minutes, 5 at most).  With the 3 byte frame header that's 7 to 9 bytes on the link for
+// dwell times under ~35 minutes, 11 at most.
+// The host decoder rebuilds per machine timelines and dwell time statistics (logdecode -s).
+//
+//   static const char * const pump_states[] = { "IDLE", "PRIME", "RUN", "FAULT" };
+//   state_trace_register(SM_PUMP, "pump", pump_states, 4);
+//   STATE_TRACE(SM_PUMP, PUMP_IDLE, PUMP_PRIME);
+#ifndef STATE_TRACE_H
+#define STATE_TRACE_H
+
+#include <stdint.h>
+
+#define STATE_TRACE_MACHINES  16   // machine ids 0 .. STATE_TRACE_MACHINES-1
+
+int state_trace_register(uint8_t machine, const char *name, const char * const *state_names, uint8_t count);
+void state_trace(uint8_t machine, uint8_t from, uint8_t to);
+
+#define STATE_TRACE(machine, from, to)  state_trace((machine), (uint8_t)(from), (uint8_t)(to))
+
+#endif // STATE_TRACE_H
@@ -22,6 +22,10 @@
 #include "stm32f1xx_it.h"
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
+#include "event_capture.h"
+#include "profile.h"
+#include "gpio_trace.h"
+#include "log.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -158,6 +162,7 @@ void SVC_Handler(void)
 void DebugMon_Handler(void)
 {
   /* USER CODE BEGIN DebugMonitor_IRQn 0 */
+  profile_debugmon();
 
   /* USER CODE END DebugMonitor_IRQn 0 */
   /* USER CODE BEGIN DebugMonitor_IRQn 1 */
@@ -219,10 +224,12 @@ void DMA1_Channel7_IRQHandler(void)
 void USART2_IRQHandler(void)
 {
   /* USER CODE BEGIN USART2_IRQn 0 */
+  GPIO_TRACE_ISR_ENTER(); // DMA completion, HAL_UART_TxCpltCallback() runs from here
 
   /* USER CODE END USART2_IRQn 0 */
   HAL_UART_IRQHandler(&huart2);
   /* USER CODE BEGIN USART2_IRQn 1 */
+  GPIO_TRACE_ISR_EXIT();
 
   /* USER CODE END USART2_IRQn 1 */
 }
@@ -242,5 +249,20 @@ void EXTI15_10_IRQHandler(void)
 }
 
 /* USER CODE BEGIN 1 */
+/**
+  * @brief This function handles TIM4 global interrupt (event capture: overflow and half period).
+  */
+void TIM4_IRQHandler(void)
+{
+  event_capture_irq();
+}
+
+/**
+  * @brief This function handles DMA1 channel2 global interrupt (log_blob() memory to memory copy).
+  */
+void DMA1_Channel2_IRQHandler(void)
+{
+  log_blob_dma_irq();
+}
 
 /* USER CODE END 1 */
@@ -0,0 +1,27 @@
+#!/bin/sh
+# Builds the host emulation of the firmware (see emu.c): ./emu
+# Usage: Tools/emu/build.sh [extra cc flags, ex: -DLOG_ENGINE=LOG_ENGINE_PINGPONG]   (from the repository root)
+set -e
+CC=${CC:-cc}
+EMU=Tools/emu
+HAL=Drivers/STM32F1xx_HAL_Driver
+
+# Firmware sources minus the newlib glue (syscalls.c, sysmem.c): the host C library does that part
+SRC=$(ls Core/Src/*.c | grep -v -e syscalls.c -e sysmem.c -e main.c)
+# HAL minus the power driver (unused, its WFE workaround is inline assembly)
+HAL_SRC=$(ls $HAL/Src/*.c | grep -v stm32f1xx_hal_pwr.c)
+
+# -no-pie: code and data below 4 GB, the DMA registers take 32-bit addresses
+# Tools/emu first: its core_cm3.h replaces the Cortex-M intrinsics
+# LOG_WCET_BENCH=0: virtual time around trapped registers isn't target cycles, the bounds would all fail
+$CC -O2 -g -std=gnu11 -no-pie -fno-pie -pthread \
+	-DSTM32F103xB -DUSE_HAL_DRIVER -DLOG_SD_SINK=0 -DLOG_WCET_BENCH=0 \
+	-I$EMU -ICore/Inc -ICore/Src -I$HAL/Inc -IDrivers/CMSIS/Device/ST/STM32F1xx/Include -IDrivers/CMSIS/Include \
+	-Wno-unused-parameter -Wno-attributes -Wno-pointer-to-int-cast -Wno-int-to-pointer-cast -Wno-overflow "$@" \
+	-Dmain=firmware_main -c Core/Src/main.c -o /tmp/emu_main.$$.o
+$CC -O2 -g -std=gnu11 -no-pie -fno-pie -pthread \
+	-DSTM32F103xB -DUSE_HAL_DRIVER -DLOG_SD_SINK=0 -DLOG_WCET_BENCH=0 \
+	-I$EMU -ICore/Inc -ICore/Src -I$HAL/Inc -IDrivers/CMSIS/Device/ST/STM32F1xx/Include -IDrivers/CMSIS/Include \
+	-Wno-unused-parameter -Wno-attributes -Wno-pointer-to-int-cast -Wno-int-to-pointer-cast -Wno-overflow "$@" \
+	-o emu $EMU/emu.c $SRC $HAL_SRC /tmp/emu_main.$$.o -Wl,-T,$EMU/emu.ld
+rm -f /tmp/emu_main.$$.o
@@ -0,0 +1,97 @@
+// Module: core_cm3.h (host emulation)
+//
+// Found ahead of Drivers/CMSIS/Include/core_cm3.h by the emulation build (Tools/emu/build.sh).
+// The CMSIS intrinsics of cmsis_gcc.h are Cortex-M instructions, here they are replaced by host code:
+// PRIMASK is a flag of the emulator, __WFI() lets virtual time jump to the next event.  The rest of
+// the real core_cm3.h is used as is, its registers are host memory mapped at the real addresses (emu.c).
+#ifndef EMU_CORE_CM3_H
+#define EMU_CORE_CM3_H
+
+#include <stdint.h>
+
+#define __CMSIS_GCC_H  // keep cmsis_gcc.h out
+
+#ifndef __has_builtin
+#define __has_builtin(x) (0)
+#endif
+#define __ASM                   __asm
+#define __INLINE                inline
+#define __STATIC_INLINE         static inline
+#define __STATIC_FORCEINLINE    __attribute__((always_inline)) static inline
+#define __NO_RETURN             __attribute__((__noreturn__))
+#define __USED                  __attribute__((used))
+#define __WEAK                  __attribute__((weak))
+#define __PACKED                __attribute__((packed, aligned(1)))
+#define __PACKED_STRUCT         struct __attribute__((packed, aligned(1)))
+#define __PACKED_UNION          union __attribute__((packed, aligned(1)))
+#define __ALIGNED(x)            __attribute__((aligned(x)))
+#define __RESTRICT              __restrict
+#define __COMPILER_BARRIER()    __ASM volatile("" ::: "memory")
+
+struct __attribute__((packed)) T_UINT32 { uint32_t v; };
+__PACKED_STRUCT T_UINT16_WRITE { uint16_t v; };
+__PACKED_STRUCT T_UINT16_READ { uint16_t v; };
+__PACKED_STRUCT T_UINT32_WRITE { uint32_t v; };
+__PACKED_STRUCT T_UINT32_READ { uint32_t v; };
+#define __UNALIGNED_UINT32(x)                  (((struct T_UINT32 *)(x))->v)
+#define __UNALIGNED_UINT16_WRITE(addr, val)    (void)((((struct T_UINT16_WRITE *)(void *)(addr))->v) = (val))
+#define __UNALIGNED_UINT16_READ(addr)          (((const struct T_UINT16_READ *)(const void *)(addr))->v)
+#define __UNALIGNED_UINT32_WRITE(addr, val)    (void)((((struct T_UINT32_WRITE *)(void *)(addr))->v) = (val))
+#define __UNALIGNED_UINT32_READ(addr)          (((const struct T_UINT32_READ *)(const void *)(addr))->v)
+
+// emu.c
+extern volatile uint32_t emu_primask;
+extern volatile uint32_t emu_ipsr;
+void emu_irq_unmasked(void);  // deliver what became pending while masked
+void emu_wfi(void);
+
+__STATIC_FORCEINLINE void __disable_irq(void) { emu_primask = 1; __COMPILER_BARRIER(); }
+__STATIC_FORCEINLINE void __enable_irq(void) { __COMPILER_BARRIER(); emu_primask = 0; emu_irq_unmasked(); }
+__STATIC_FORCEINLINE uint32_t __get_PRIMASK(void) { return emu_primask; }
+__STATIC_FORCEINLINE void __set_PRIMASK(uint32_t primask) {
+	__COMPILER_BARRIER();
+	emu_primask = primask & 1;
+	if(!emu_primask) emu_irq_unmasked();
+}
+__STATIC_FORCEINLINE void __enable_fault_irq(void) { }
+__STATIC_FORCEINLINE void __disable_fault_irq(void) { }
+__STATIC_FORCEINLINE uint32_t __get_FAULTMASK(void) { return 0; }
+__STATIC_FORCEINLINE void __set_FAULTMASK(uint32_t faultmask) { (void)faultmask; }
+__STATIC_FORCEINLINE uint32_t __get_BASEPRI(void) { return 0; }
+__STATIC_FORCEINLINE void __set_BASEPRI(uint32_t basepri) { (void)basepri; }
+__STATIC_FORCEINLINE void __set_BASEPRI_MAX(uint32_t basepri) { (void)basepri; }
+__STATIC_FORCEINLINE uint32_t __get_IPSR(void) { return emu_ipsr; }
+__STATIC_FORCEINLINE uint32_t __get_xPSR(void) { return emu_ipsr; }
+__STATIC_FORCEINLINE uint32_t __get_APSR(void) { return 0; }
+__STATIC_FORCEINLINE uint32_t __get_CONTROL(void) { return 0; }
+__STATIC_FORCEINLINE void __set_CONTROL(uint32_t control) { (void)control; }
+
+#define __NOP()        __COMPILER_BARRIER()
+#define __WFI()        emu_wfi()
+#define __WFE()        emu_wfi()
+#define __SEV()        __COMPILER_BARRIER()
+#define __ISB()        __sync_synchronize()
+#define __DSB()        __sync_synchronize()
+#define __DMB()        __sync_synchronize()
+#define __BKPT(value)  __builtin_trap()
+#define __REV(x)       __builtin_bswap32(x)
+#define __REV16(x)     ((uint32_t)((((x) & 0xFF00FF00u) >> 8) | (((x) & 0x00FF00FFu) << 8)))
+#define __REVSH(x)     ((int16_t)__builtin_bswap16(x))
+#define __CLZ(x)       (uint8_t)((x) ? __builtin_clz(x) : 32)
+#define __CLREX()      __COMPILER_BARRIER()
+
+__STATIC_FORCEINLINE uint32_t __RBIT(uint32_t v) {
+	uint32_t r = 0;
+	for(int i = 0; i < 32; i++, v >>= 1) r = (r << 1) | (v & 1);
+	return r;
+}
+__STATIC_FORCEINLINE uint32_t __LDREXW(volatile uint32_t *addr) { return *addr; }
+__STATIC_FORCEINLINE uint32_t __STREXW(uint32_t value, volatile uint32_t *addr) { *addr = value; return 0; }
+__STATIC_FORCEINLINE uint8_t __LDREXB(volatile uint8_t *addr) { return *addr; }
+__STATIC_FORCEINLINE uint32_t __STREXB(uint8_t value, volatile uint8_t *addr) { *addr = value; return 0; }
+__STATIC_FORCEINLINE uint16_t __LDREXH(volatile uint16_t *addr) { return *addr; }
+__STATIC_FORCEINLINE uint32_t __STREXH(uint16_t value, volatile uint16_t *addr) { *addr = value; return 0; }
+
+#include_next <core_cm3.h>
+
+#endif // EMU_CORE_CM3_H
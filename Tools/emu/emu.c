@@ -0,0 +1,761 @@
+// Tool: emu.c
+//
+// Runs the whole firmware on Linux: main.c with its MX_x_Init() calls, the HAL drivers and the interrupt
+// handlers of stm32f1xx_it.c, unchanged.  The HAL is not stubbed, the peripherals under it are emulated:
+// host memory is mapped at the STM32F103 register addresses (peripherals, bit-band alias, Cortex-M3 system
+// block) and kept inaccessible to the firmware.  Each register access faults, the emulator brings the
+// peripherals up to the current time, lets the access through (single step) and acts on what it wrote:
+// * RCC: oscillator and PLL ready flags follow their enable bits, the clock switch status follows the switch
+// * SysTick, DWT->CYCCNT, TIM4 (counter, update and output compare flags) count in virtual time.  The
+//   firmware polls CYCCNT and TIM4->CNT too often for a fault per read: Tools/emu/stm32f1xx_hal_conf.h
+//   turns the DWT and TIM4 pointers into a call to emu_counters(), which updates them first.
+// * USART2 transmit through DMA1 channel 7: bytes leave at the programmed baud rate, the half / complete
+//   flags and the USART TC flag raise their interrupts, the bytes are written to stdout.  Bytes written
+//   to USART2->DR directly (blocking HAL_UART_Transmit(), panic flush) go to stdout at once.
+// * DMA memory to memory transfers (log_blob()) complete at once
+// * NVIC: enable bits, priorities and PRIMASK decide when a pending interrupt runs its handler
+// Timed events (SysTick, UART transfer end) interrupt the firmware through a host timer signal.
+//
+// Virtual time is the CPU time of the firmware thread times the slowdown (-x, a 72 MHz Cortex-M3 runs C
+// code roughly 20 times slower than a current x86 core), plus the time skipped by HAL_Delay() / __WFI():
+// idle waits cost nothing, a 30 s run takes a second or two.  Time spent in the emulator isn't counted.
+// Timings logged by the firmware (ex: "Time: %dus") are the host's, scaled: good for comparing changes,
+// not a cycle accurate simulation.
+//
+// Limits: no input (UART receive, button, event capture edges), no SD card (LOG_SD_SINK=0), interrupts
+// don't preempt each other, the core runs at 72 MHz from reset, printf() goes to stdout directly, 64-bit
+// host: integers passed to %lu / %ld are 32-bit on the target and 64-bit here.
+//
+// Build: Tools/emu/build.sh                   (from the repository root, makes ./emu, x86-64 Linux)
+// Usage: emu [-t seconds] [-x slowdown] [-q] > capture.bin
+//        Tools/logdecode capture.bin          (or pipe: ./emu -t 30 | logdecode)
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "main.h"
+#include "stm32f1xx_it.h"
+
+// The registers themselves here, not emu_counters() (Tools/emu/stm32f1xx_hal_conf.h)
+#undef TIM4
+#define TIM4  ((TIM_TypeDef *)TIM4_BASE)
+#undef DWT
+#define DWT   ((DWT_Type *)DWT_BASE)
+
+#define CORE_MHZ     72
+#define FW_STACK     0x10000        // host C library calls need more than the target's 4 KB
+#define TRAP_FLAG    0x100          // x86 EFLAGS.TF: single step
+#define PF_WRITE     0x2            // page fault error code: write access
+#define TIMER_MAX_NS 1000000        // longest host time between timer signals
+#define TIMER_MIN_NS 20000
+#define CALIBRATION  200            // traps timed at startup
+
+int firmware_main(void); // main.c, renamed by build.sh
+
+volatile uint32_t emu_primask;
+volatile uint32_t emu_ipsr;
+
+static struct {
+	uintptr_t base;
+	size_t size;
+	int trap;                       // firmware accesses fault
+} const regions[] = {
+	{ 0x1FFFF000, 0x1000, 0 },        // system memory: flash size, unique id
+	{ SRAM_BASE, FW_STACK, 0 },       // the firmware stack
+	{ PERIPH_BASE, 0x1000, 0 },       // TIM2 - TIM4: TIM4->CNT is read through emu_counters()
+	{ PERIPH_BASE + 0x1000, 0x2F000, 1 }, // APB1, APB2, AHB (DMA, RCC, flash interface)
+	{ PERIPH_BB_BASE, 0x2000000, 1 }, // peripheral bit-band alias (the HAL sets RCC bits through it)
+	{ 0xE0000000, 0x1000, 1 },        // ITM
+	{ DWT_BASE, 0x1000, 0 },          // DWT: CYCCNT is read through emu_counters()
+	{ 0xE0002000, 0xFE000, 1 },       // SCS (NVIC, SCB, SysTick), DBGMCU
+};
+
+// Virtual time
+static const clockid_t fw_clock = CLOCK_THREAD_CPUTIME_ID; // the firmware is the only thread
+static timer_t timer;
+static double slowdown = 20;
+static int64_t stop_cycles = 10LL * CORE_MHZ * 1000000;
+static int64_t skipped_ns;          // HAL_Delay() / __WFI()
+static int64_t excluded_ns;         // firmware thread CPU time spent in the emulator
+static int64_t clock_cycles;        // time of the last event handled (the counters don't go back)
+static int64_t next_deadline = INT64_MAX; // next timed event
+static volatile int in_emulator, stepping, trapping, deferred;
+static int64_t kernel_ns;           // host kernel time per signal (average): not firmware time
+static int64_t entered_ns, left_ns; // firmware thread CPU time entering / leaving the emulator
+static int quiet;
+
+// Peripheral state
+static int64_t cyccnt_base = -1;    // CYCCNT counting since
+static int64_t systick_base = -1, systick_next;
+static uint32_t systick_load;
+static int64_t tim4_base = -1;      // TIM4 counting since, counter value then
+static uint32_t tim4_offset;
+static struct {
+	int active;
+	int64_t half, done;             // event times, half already signalled when 0
+	uint16_t length;
+	uint8_t data[0x10000];
+} uart;
+static uint64_t irq_pending;        // bit n: IRQ n, bit 63: SysTick
+static uint32_t rcc_alias[4][32];   // RCC bit-band words as last written by us
+static uint32_t usart2_sr, tim4_sr; // status registers as last written by us: flags clear on a 0 write
+static uint32_t nvic_enabled[2];    // ISER reads this, set by ISER writes, cleared by ICER writes
+static uintptr_t fault_address;
+static int fault_write;
+static unsigned long stat_irqs, stat_bytes, stat_traps;
+
+#define SYSTICK_PENDING  (1ull << 63)
+
+//=============================================================================
+static int64_t cpu_ns(void) {
+//=============================================================================
+	struct timespec ts;
+	clock_gettime(fw_clock, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+//=============================================================================
+// (in the emulator: as of entering it, its own time isn't firmware time)
+static int64_t virtual_cycles(void) {
+//=============================================================================
+	double ns = ((in_emulator ? entered_ns : cpu_ns()) - excluded_ns) * slowdown + skipped_ns;
+	int64_t cycles = (int64_t)(ns * CORE_MHZ / 1000);
+	return cycles > clock_cycles ? cycles : clock_cycles;
+}
+
+//=============================================================================
+// Register pages: inaccessible to the firmware, or open (emulator at work, access being single stepped)
+static void set_trapping(int on) {
+//=============================================================================
+	if(trapping == on) return;
+	for(unsigned r = 0; r < sizeof(regions) / sizeof(regions[0]); r++)
+		if(regions[r].trap) mprotect((void *)regions[r].base, regions[r].size, on ? PROT_NONE : PROT_READ | PROT_WRITE);
+	trapping = on;
+}
+
+//=============================================================================
+static void output(const uint8_t *data, size_t length) {
+//=============================================================================
+	stat_bytes += length;
+	while(length) {
+		ssize_t n = write(STDOUT_FILENO, data, length);
+		if(n <= 0) _exit(1); // reader gone
+		data += n;
+		length -= n;
+	}
+}
+
+//=============================================================================
+static void finish(void) {
+//=============================================================================
+	if(!quiet) {
+		char line[200];
+		struct timespec ts;
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+		int n = snprintf(line, sizeof(line), "emu: %.3f s virtual, %.3f s host CPU (x%.0f), %lu UART bytes, "
+				"%lu interrupts, %lu register traps\n", (double)clock_cycles / (CORE_MHZ * 1e6),
+				ts.tv_sec + ts.tv_nsec * 1e-9, slowdown, stat_bytes, stat_irqs, stat_traps);
+		if(write(STDERR_FILENO, line, n) < 0) _exit(1);
+	}
+	_exit(0);
+}
+
+//=============================================================================
+// TIM4 counter, counting from tim4_base at TIM clock / (PSC + 1)  (TIM clock = core clock, APB1 x2)
+static uint64_t tim4_count(int64_t cycles) {
+//=============================================================================
+	return (uint64_t)((cycles - tim4_base) / (TIM4->PSC + 1)) + tim4_offset;
+}
+
+//=============================================================================
+static void write_counters(int64_t cycles) {
+//=============================================================================
+	if(cyccnt_base >= 0) DWT->CYCCNT = (uint32_t)(cycles - cyccnt_base);
+	if(tim4_base >= 0) TIM4->CNT = (uint32_t)(tim4_count(cycles) % (TIM4->ARR + 1));
+	if(systick_base >= 0) SysTick->VAL = (uint32_t)((systick_next - cycles) % (systick_load + 1));
+}
+
+//=============================================================================
+// Flag bits of DMA channel n (1..7) in DMA1->ISR / IFCR
+static inline uint32_t dma_flags(int n, uint32_t flags) {
+//=============================================================================
+	return flags << (4 * (n - 1));
+}
+
+static DMA_Channel_TypeDef * const dma_channels[8] = {
+	NULL, DMA1_Channel1, DMA1_Channel2, DMA1_Channel3, DMA1_Channel4, DMA1_Channel5, DMA1_Channel6, DMA1_Channel7,
+};
+
+//=============================================================================
+// Memory to memory transfer: all of it at once
+static void dma_mem2mem(int n) {
+//=============================================================================
+	DMA_Channel_TypeDef *ch = dma_channels[n];
+	uint32_t ccr = ch->CCR;
+	unsigned psize = 1u << ((ccr & DMA_CCR_PSIZE) >> DMA_CCR_PSIZE_Pos);
+	unsigned msize = 1u << ((ccr & DMA_CCR_MSIZE) >> DMA_CCR_MSIZE_Pos);
+	uint8_t *periph = (uint8_t *)(uintptr_t)ch->CPAR;
+	uint8_t *memory = (uint8_t *)(uintptr_t)ch->CMAR;
+	for(uint32_t i = ch->CNDTR; i; i--) {
+		uint32_t v = 0;
+		if(ccr & DMA_CCR_DIR) {
+			memcpy(&v, memory, msize);
+			memcpy(periph, &v, psize);
+		} else {
+			memcpy(&v, periph, psize);
+			memcpy(memory, &v, msize);
+		}
+		if(ccr & DMA_CCR_PINC) periph += psize;
+		if(ccr & DMA_CCR_MINC) memory += msize;
+	}
+	ch->CNDTR = 0;
+	DMA1->ISR |= dma_flags(n, DMA_ISR_GIF1 | DMA_ISR_TCIF1 | DMA_ISR_HTIF1);
+}
+
+//=============================================================================
+// USART2 transmit requests feed DMA1 channel 7: the transfer starts when both are enabled
+static void uart_start(int64_t now) {
+//=============================================================================
+	uint32_t brr = USART2->BRR ? USART2->BRR : 1;
+	int64_t byte_cycles = 10 * (int64_t)brr * 2; // 10 bits, PCLK1 = core clock / 2
+	uart.length = (uint16_t)DMA1_Channel7->CNDTR;
+	memcpy(uart.data, (const void *)(uintptr_t)DMA1_Channel7->CMAR, uart.length);
+	uart.half = now + byte_cycles * (uart.length / 2);
+	uart.done = now + byte_cycles * uart.length;
+	uart.active = 1;
+	USART2->SR = usart2_sr &= ~(USART_SR_TC | USART_SR_TXE);
+}
+
+//=============================================================================
+// CYCCNT, TIM4 enabled: counting from now
+static void start_counters(int64_t now) {
+//=============================================================================
+	if(cyccnt_base < 0 && (DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk)) cyccnt_base = now - DWT->CYCCNT;
+	if(tim4_base < 0 && (TIM4->CR1 & TIM_CR1_CEN)) {
+		tim4_base = now;
+		tim4_offset = TIM4->CNT;
+	}
+}
+
+//=============================================================================
+// Act on register writes, raise the level triggered interrupt requests
+static void sync_registers(int64_t now) {
+//=============================================================================
+	// NVIC: write 1 to set / clear
+	for(int r = 0; r < 2; r++) {
+		nvic_enabled[r] = (nvic_enabled[r] | NVIC->ISER[r]) & ~NVIC->ICER[r];
+		NVIC->ISER[r] = nvic_enabled[r];
+		NVIC->ICER[r] = 0;
+		irq_pending = (irq_pending | (uint64_t)NVIC->ISPR[r] << (32 * r)) & ~((uint64_t)NVIC->ICPR[r] << (32 * r));
+		NVIC->ISPR[r] = NVIC->ICPR[r] = 0;
+	}
+	EXTI->PR = 0;
+
+	// Status flags the firmware clears by writing 0 (writing 1 leaves them)
+	USART2->SR = usart2_sr &= USART2->SR;
+	TIM4->SR = tim4_sr &= TIM4->SR;
+
+	// RCC: ready flags follow the enables, also when set through the bit-band alias
+	static const uint32_t rcc_offset[4] = { 0x00, 0x04, 0x20, 0x24 }; // CR, CFGR, BDCR, CSR
+	for(int r = 0; r < 4; r++) {
+		volatile uint32_t *reg = (volatile uint32_t *)(RCC_BASE + rcc_offset[r]);
+		volatile uint32_t *alias = (volatile uint32_t *)(PERIPH_BB_BASE + (RCC_BASE - PERIPH_BASE + rcc_offset[r]) * 32);
+		for(int bit = 0; bit < 32; bit++) {
+			if(alias[bit] == rcc_alias[r][bit]) continue;
+			if(alias[bit] & 1) *reg |= 1u << bit;
+			else *reg &= ~(1u << bit);
+		}
+	}
+	uint32_t cr = RCC->CR;
+	RCC->CR = (cr & ~(RCC_CR_HSIRDY | RCC_CR_HSERDY | RCC_CR_PLLRDY)) | ((cr & RCC_CR_HSION) << 1) |
+			((cr & RCC_CR_HSEON) << 1) | ((cr & RCC_CR_PLLON) << 1);
+	RCC->CFGR = (RCC->CFGR & ~RCC_CFGR_SWS) | ((RCC->CFGR & RCC_CFGR_SW) << 2);
+	RCC->CSR = (RCC->CSR & ~RCC_CSR_LSIRDY) | ((RCC->CSR & RCC_CSR_LSION) << 1);
+	RCC->BDCR = (RCC->BDCR & ~RCC_BDCR_LSERDY) | ((RCC->BDCR & RCC_BDCR_LSEON) << 1);
+	for(int r = 0; r < 4; r++) {
+		uint32_t v = *(volatile uint32_t *)(RCC_BASE + rcc_offset[r]);
+		volatile uint32_t *alias = (volatile uint32_t *)(PERIPH_BB_BASE + (RCC_BASE - PERIPH_BASE + rcc_offset[r]) * 32);
+		for(int bit = 0; bit < 32; bit++) alias[bit] = rcc_alias[r][bit] = (v >> bit) & 1;
+	}
+
+	// GPIO set / reset registers
+	static GPIO_TypeDef * const ports[] = { GPIOA, GPIOB, GPIOC, GPIOD, GPIOE };
+	for(unsigned p = 0; p < sizeof(ports) / sizeof(ports[0]); p++) {
+		uint32_t bsrr = ports[p]->BSRR, brr = ports[p]->BRR;
+		if(!bsrr && !brr) continue;
+		ports[p]->ODR = (ports[p]->ODR & ~(bsrr >> 16) & ~brr) | (bsrr & 0xFFFF);
+		ports[p]->BSRR = 0;
+		ports[p]->BRR = 0;
+	}
+
+	// DMA: flag clear register, memory to memory transfers, USART2 transmit
+	uint32_t ifcr = DMA1->IFCR;
+	if(ifcr) {
+		for(int n = 1; n <= 7; n++)
+			if(ifcr & dma_flags(n, DMA_IFCR_CGIF1)) ifcr |= dma_flags(n, 0xF);
+		DMA1->ISR &= ~ifcr;
+		DMA1->IFCR = 0;
+	}
+	for(int n = 1; n <= 7; n++) {
+		DMA_Channel_TypeDef *ch = dma_channels[n];
+		if((ch->CCR & (DMA_CCR_EN | DMA_CCR_MEM2MEM)) == (DMA_CCR_EN | DMA_CCR_MEM2MEM) && ch->CNDTR) dma_mem2mem(n);
+	}
+	if(uart.active && !(DMA1_Channel7->CCR & DMA_CCR_EN)) uart.active = 0; // aborted
+	if(!uart.active && (USART2->CR3 & USART_CR3_DMAT) && (USART2->CR1 & USART_CR1_TE) &&
+			(DMA1_Channel7->CCR & DMA_CCR_EN) && DMA1_Channel7->CNDTR)
+		uart_start(now);
+
+	// Counters started / reconfigured
+	start_counters(now);
+	if(TIM4->EGR & TIM_EGR_UG) {
+		TIM4->EGR = 0;
+		TIM4->SR = tim4_sr |= TIM_SR_UIF;
+		tim4_base = (TIM4->CR1 & TIM_CR1_CEN) ? now : -1;
+		tim4_offset = 0;
+		TIM4->CNT = 0;
+	}
+	if(!(TIM4->CR1 & TIM_CR1_CEN)) tim4_base = -1;
+	uint32_t ctrl = SysTick->CTRL;
+	if((ctrl & SysTick_CTRL_ENABLE_Msk) && (systick_base < 0 || SysTick->LOAD != systick_load)) {
+		systick_load = SysTick->LOAD;
+		systick_base = now;
+		systick_next = now + systick_load + 1;
+	} else if(!(ctrl & SysTick_CTRL_ENABLE_Msk)) {
+		systick_base = -1;
+	}
+
+	// Level triggered interrupt requests
+	uint32_t isr = DMA1->ISR;
+	for(int n = 1; n <= 7; n++) {
+		uint32_t ccr = dma_channels[n]->CCR;
+		uint32_t enabled = ((ccr & DMA_CCR_TCIE) ? DMA_ISR_TCIF1 : 0) | ((ccr & DMA_CCR_HTIE) ? DMA_ISR_HTIF1 : 0) |
+				((ccr & DMA_CCR_TEIE) ? DMA_ISR_TEIF1 : 0);
+		if((isr >> (4 * (n - 1))) & enabled) irq_pending |= 1ull << (DMA1_Channel1_IRQn + n - 1);
+	}
+	if(USART2->SR & USART2->CR1 & (USART_SR_TXE | USART_SR_TC | USART_SR_RXNE | USART_SR_IDLE))
+		irq_pending |= 1ull << USART2_IRQn;
+	if(TIM4->SR & TIM4->DIER & (TIM_SR_UIF | TIM_SR_CC1IF | TIM_SR_CC2IF | TIM_SR_CC3IF | TIM_SR_CC4IF | TIM_SR_TIF))
+		irq_pending |= 1ull << TIM4_IRQn;
+}
+
+//=============================================================================
+// Next TIM4 counter value from now matching target (mod ARR + 1), as a time
+static int64_t tim4_when(int64_t now, uint32_t target) {
+//=============================================================================
+	uint64_t period = TIM4->ARR + 1;
+	uint64_t count = tim4_count(now);
+	uint64_t next = count - count % period + target;
+	if(next <= count) next += period;
+	return tim4_base + (int64_t)(next - tim4_offset) * (TIM4->PSC + 1);
+}
+
+//=============================================================================
+// Timed events: the earliest one after now (INT64_MAX if none), *which tells what it is
+static int64_t next_event(int64_t now, int *which) {
+//=============================================================================
+	int64_t t = INT64_MAX;
+	*which = -1;
+	if(systick_base >= 0) {
+		t = systick_next;
+		*which = 0;
+	}
+	if(uart.active) {
+		int64_t u = uart.half ? uart.half : uart.done;
+		if(u < t) {
+			t = u;
+			*which = 1;
+		}
+	}
+	if(tim4_base >= 0) {
+		uint32_t dier = TIM4->DIER;
+		if(dier & TIM_DIER_UIE) {
+			int64_t u = tim4_when(now, 0);
+			if(u < t) {
+				t = u;
+				*which = 2;
+			}
+		}
+		static const uint32_t ccie[4] = { TIM_DIER_CC1IE, TIM_DIER_CC2IE, TIM_DIER_CC3IE, TIM_DIER_CC4IE };
+		volatile uint32_t *ccr = &TIM4->CCR1;
+		for(int c = 0; c < 4; c++) {
+			uint32_t ccmr = c < 2 ? TIM4->CCMR1 >> (8 * c) : TIM4->CCMR2 >> (8 * (c - 2));
+			if(!(dier & ccie[c]) || (ccmr & TIM_CCMR1_CC1S)) continue; // output compare only (no input edges)
+			int64_t u = tim4_when(now, ccr[c]);
+			if(u < t) {
+				t = u;
+				*which = 3 + c;
+			}
+		}
+	}
+	return t;
+}
+
+//=============================================================================
+static void fire(int which) {
+//=============================================================================
+	switch(which) {
+	case 0: // SysTick
+		systick_next += systick_load + 1;
+		SysTick->CTRL |= SysTick_CTRL_COUNTFLAG_Msk;
+		if(SysTick->CTRL & SysTick_CTRL_TICKINT_Msk) irq_pending |= SYSTICK_PENDING;
+		break;
+	case 1: // UART DMA half / complete
+		if(uart.half) {
+			uart.half = 0;
+			DMA1->ISR |= dma_flags(7, DMA_ISR_GIF1 | DMA_ISR_HTIF1);
+			DMA1_Channel7->CNDTR = uart.length - uart.length / 2;
+			break;
+		}
+		output(uart.data, uart.length);
+		uart.active = 0;
+		DMA1_Channel7->CNDTR = 0;
+		DMA1->ISR |= dma_flags(7, DMA_ISR_GIF1 | DMA_ISR_TCIF1);
+		USART2->SR = usart2_sr |= USART_SR_TC | USART_SR_TXE;
+		break;
+	case 2: // TIM4 update
+		TIM4->SR = tim4_sr |= TIM_SR_UIF;
+		break;
+	default: // TIM4 compare match
+		TIM4->SR = tim4_sr |= TIM_SR_CC1IF << (which - 3);
+		break;
+	}
+}
+
+//=============================================================================
+// Run the handler of the highest priority pending interrupt that is enabled, returns 0 if none
+static int dispatch(void) {
+//=============================================================================
+	int best = -1;
+	uint8_t best_priority = 0xFF;
+	if((irq_pending & SYSTICK_PENDING) && (SysTick->CTRL & SysTick_CTRL_TICKINT_Msk)) {
+		best = 63;
+		best_priority = SCB->SHP[11];
+	}
+	for(int n = 0; n < 60; n++) {
+		if(!(irq_pending & (1ull << n)) || !(nvic_enabled[n >> 5] & (1u << (n & 31)))) continue;
+		if(best < 0 || NVIC->IP[n] < best_priority) {
+			best = n;
+			best_priority = NVIC->IP[n];
+		}
+	}
+	if(best < 0) return 0;
+	irq_pending &= ~(1ull << best);
+
+	void (*handler)(void) = NULL;
+	switch(best) {
+	case 63: handler = SysTick_Handler; break;
+	case DMA1_Channel2_IRQn: handler = DMA1_Channel2_IRQHandler; break;
+	case DMA1_Channel7_IRQn: handler = DMA1_Channel7_IRQHandler; break;
+	case USART2_IRQn: handler = USART2_IRQHandler; break;
+	case TIM4_IRQn: handler = TIM4_IRQHandler; break;
+	case EXTI15_10_IRQn: handler = EXTI15_10_IRQHandler; break;
+	}
+	if(!handler) return 1; // enabled without a handler here: the target would go to Default_Handler
+	emu_ipsr = best == 63 ? 15 : best + 16;
+	emu_primask = 0;
+	handler();
+	emu_primask = 0;
+	emu_ipsr = 0;
+	stat_irqs++;
+	return 1;
+}
+
+//=============================================================================
+// Bring the peripherals up to the current virtual time, running interrupt handlers on the way.
+// Called by the signal handlers, between enter() and leave().
+static void service(void) {
+//=============================================================================
+	uint32_t primask = emu_primask;
+	int64_t now = virtual_cycles();
+	for(;;) {
+		if(now >= stop_cycles) {
+			clock_cycles = now;
+			finish();
+		}
+		sync_registers(clock_cycles);
+		if(!primask && irq_pending) {
+			excluded_ns += cpu_ns() - entered_ns;
+			int ran = dispatch();
+			entered_ns = cpu_ns();
+			if(ran) {
+				now = virtual_cycles(); // the handler's time is firmware time
+				continue;
+			}
+		}
+		int which;
+		int64_t t = next_event(clock_cycles, &which);
+		if(t > now) break;
+		clock_cycles = t;
+		write_counters(t);
+		fire(which);
+	}
+	clock_cycles = now;
+	write_counters(now);
+	int which;
+	next_deadline = next_event(now, &which);
+
+	// Timer signal at the next event (in host time), or to check again
+	int64_t wait = next_deadline == INT64_MAX ? TIMER_MAX_NS :
+			(int64_t)((next_deadline - now) * 1000 / CORE_MHZ / slowdown);
+	if(wait > TIMER_MAX_NS) wait = TIMER_MAX_NS;
+	if(wait < TIMER_MIN_NS) wait = TIMER_MIN_NS;
+	struct itimerspec its = { .it_value = { .tv_sec = 0, .tv_nsec = wait } };
+	timer_settime(timer, 0, &its, NULL);
+
+	emu_primask = primask;
+}
+
+//=============================================================================
+// Emulator entry.  From a signal handler, the kernel's part of the firmware thread CPU time since the
+// last leave() isn't firmware time either.  After a single step it is all of it (one instruction ran):
+// that's the measure of the kernel's part, charged for the other signals (at most the time since leave()).
+enum { NO_SIGNAL, SIGNAL, STEP };
+static void enter(int from) {
+//=============================================================================
+	in_emulator = 1;
+	entered_ns = cpu_ns();
+	int64_t gap = entered_ns - left_ns;
+	if(from == STEP) {
+		kernel_ns += (gap - kernel_ns) / 8;
+		excluded_ns += gap;
+	} else if(from == SIGNAL) {
+		excluded_ns += gap < kernel_ns ? gap : kernel_ns;
+	}
+}
+
+//=============================================================================
+static void leave(void) {
+//=============================================================================
+	left_ns = cpu_ns();
+	excluded_ns += left_ns - entered_ns;
+	in_emulator = 0;
+}
+
+//=============================================================================
+// SIGUSR1: timer, __WFI(), interrupts unmasked
+static void on_signal(int sig) {
+//=============================================================================
+	(void)sig;
+	if(in_emulator) { // emu_counters() at work: right after it
+		deferred = 1;
+		return;
+	}
+	enter(SIGNAL);
+	set_trapping(0);
+	service();
+	if(!stepping) set_trapping(1);
+	leave();
+}
+
+//=============================================================================
+// SIGSEGV: register access.  Counters and flags are brought up to date, the access goes through with the
+// register pages open, and the single step trap comes right after it.
+static void on_fault(int sig, siginfo_t *info, void *context) {
+//=============================================================================
+	ucontext_t *uc = context;
+	uintptr_t address = (uintptr_t)info->si_addr;
+	int ours = 0;
+	for(unsigned r = 0; r < sizeof(regions) / sizeof(regions[0]); r++)
+		if(regions[r].trap && address - regions[r].base < regions[r].size) ours = 1;
+	if(!ours || !trapping) { // a real crash
+		signal(sig, SIG_DFL);
+		return;
+	}
+	enter(SIGNAL);
+	stat_traps++;
+	set_trapping(0);
+	fault_address = address;
+	fault_write = (uc->uc_mcontext.gregs[REG_ERR] & PF_WRITE) != 0;
+	service();
+	stepping = 1;
+	uc->uc_mcontext.gregs[REG_EFL] |= TRAP_FLAG;
+	leave();
+}
+
+//=============================================================================
+// SIGTRAP: after the register access
+static void on_step(int sig, siginfo_t *info, void *context) {
+//=============================================================================
+	(void)sig;
+	(void)info;
+	ucontext_t *uc = context;
+	enter(STEP);
+	uc->uc_mcontext.gregs[REG_EFL] &= ~TRAP_FLAG;
+	stepping = 0;
+	if(fault_write && fault_address == (uintptr_t)&USART2->DR && (USART2->CR1 & USART_CR1_TE)) {
+		uint8_t byte = (uint8_t)USART2->DR; // blocking transmit: sent at once
+		output(&byte, 1);
+	}
+	service();
+	set_trapping(1);
+	leave();
+}
+
+//=============================================================================
+// TIM4 / DWT through stm32f1xx_hal_conf.h: counters up to date, no trap (the firmware times itself with them)
+void *emu_counters(uintptr_t base) {
+//=============================================================================
+	// TIM4->SR isn't trapped: the previous access's 0 writes are applied now, before another write hides
+	// them (in the emulator, timer signals wait)
+	if(in_emulator) { // set to the event time
+		TIM4->SR = tim4_sr &= TIM4->SR;
+		return (void *)base;
+	}
+	if(virtual_cycles() >= next_deadline) raise(SIGUSR1); // an event is due: it comes first
+	enter(NO_SIGNAL);
+	TIM4->SR = tim4_sr &= TIM4->SR;
+	int64_t now = virtual_cycles();
+	clock_cycles = now;
+	start_counters(now);
+	if(tim4_base >= 0) TIM4->CNT = (uint32_t)(tim4_count(now) % (TIM4->ARR + 1));
+	if(cyccnt_base >= 0) DWT->CYCCNT = (uint32_t)(now - cyccnt_base);
+	leave();
+	if(deferred) {
+		deferred = 0;
+		raise(SIGUSR1);
+	}
+	return (void *)base;
+}
+
+//=============================================================================
+// __enable_irq() / __set_PRIMASK(0): interrupts that became pending while masked run now
+void emu_irq_unmasked(void) {
+//=============================================================================
+	if(irq_pending && !in_emulator) raise(SIGUSR1);
+}
+
+//=============================================================================
+// __WFI(): nothing to do until the next event, skip to it
+void emu_wfi(void) {
+//=============================================================================
+	if(in_emulator) return;
+	int64_t wait = next_deadline - virtual_cycles();
+	if(wait > CORE_MHZ * 1000) wait = CORE_MHZ * 1000; // at most 1 ms
+	if(wait > 0) skipped_ns += wait * 1000 / CORE_MHZ + 1;
+	raise(SIGUSR1);
+}
+
+//=============================================================================
+// Replaces the weak HAL_Delay() of stm32f1xx_hal.c: the wait is skipped, not spent
+void HAL_Delay(uint32_t Delay) {
+//=============================================================================
+	uint32_t tickstart = HAL_GetTick();
+	uint32_t wait = Delay;
+	if(wait < HAL_MAX_DELAY) wait += (uint32_t)uwTickFreq;
+	while((HAL_GetTick() - tickstart) < wait) emu_wfi();
+}
+
+//=============================================================================
+// A few register traps before the firmware starts, for a first kernel_ns
+static void calibrate(void) {
+//=============================================================================
+	set_trapping(1);
+	for(int i = 0; i < CALIBRATION; i++) (void)DBGMCU->IDCODE;
+	set_trapping(0);
+	stat_traps = 0;
+	clock_cycles = 0;
+	left_ns = excluded_ns = cpu_ns(); // the firmware starts now
+}
+
+//=============================================================================
+// Reset values the HAL and the firmware look at
+static void reset(void) {
+//=============================================================================
+	RCC->CR = 0x00000083;
+	RCC->CSR = 0x0C000000;
+	USART2->SR = usart2_sr = USART_SR_TXE | USART_SR_TC;
+	GPIO_TypeDef * const ports[] = { GPIOA, GPIOB, GPIOC, GPIOD, GPIOE };
+	for(unsigned p = 0; p < sizeof(ports) / sizeof(ports[0]); p++) {
+		ports[p]->CRL = ports[p]->CRH = 0x44444444;
+		ports[p]->IDR = 0xFFFF; // pulled up: the button (PC13, active low) isn't pressed
+	}
+	TIM4->ARR = 0xFFFF;
+	*(volatile uint32_t *)&SCB->CPUID = 0x412FC231;
+	DWT->CTRL = 4u << DWT_CTRL_NUMCOMP_Pos;
+	DBGMCU->IDCODE = 0x20036410;
+	*(volatile uint16_t *)FLASHSIZE_BASE = 128;
+}
+
+static ucontext_t main_context, fw_context;
+
+//=============================================================================
+static void firmware(void) {
+//=============================================================================
+	set_trapping(1);
+	SystemInit(); // as the startup code does
+	firmware_main();
+	finish();
+}
+
+//=============================================================================
+int main(int argc, char *argv[]) {
+//=============================================================================
+	int opt;
+	while((opt = getopt(argc, argv, "t:x:q")) != -1) {
+		switch(opt) {
+		case 't': stop_cycles = (int64_t)(atof(optarg) * CORE_MHZ * 1e6); break;
+		case 'x': slowdown = atof(optarg); break;
+		case 'q': quiet = 1; break;
+		default:
+			fprintf(stderr, "usage: %s [-t seconds] [-x slowdown] [-q] > capture.bin\n", argv[0]);
+			return 2;
+		}
+	}
+	if(slowdown <= 0) slowdown = 1;
+
+	for(unsigned r = 0; r < sizeof(regions) / sizeof(regions[0]); r++) {
+		void *p = mmap((void *)regions[r].base, regions[r].size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE | MAP_NORESERVE, -1, 0);
+		if(p != (void *)regions[r].base) {
+			fprintf(stderr, "emu: can't map 0x%08lx (build with -no-pie, see build.sh)\n", (unsigned long)regions[r].base);
+			return 1;
+		}
+	}
+	reset();
+
+	// Signal handlers keep each other out
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sigemptyset(&sa.sa_mask);
+	sigaddset(&sa.sa_mask, SIGUSR1);
+	sigaddset(&sa.sa_mask, SIGSEGV);
+	sigaddset(&sa.sa_mask, SIGTRAP);
+	sa.sa_flags = SA_RESTART;
+	sa.sa_handler = on_signal;
+	sigaction(SIGUSR1, &sa, NULL);
+	sa.sa_flags = SA_RESTART | SA_SIGINFO;
+	sa.sa_sigaction = on_fault;
+	sigaction(SIGSEGV, &sa, NULL);
+	sa.sa_sigaction = on_step;
+	sigaction(SIGTRAP, &sa, NULL);
+
+	struct sigevent sev;
+	memset(&sev, 0, sizeof(sev));
+	sev.sigev_notify = SIGEV_THREAD_ID;
+	sev.sigev_signo = SIGUSR1;
+	sev._sigev_un._tid = (pid_t)syscall(SYS_gettid);
+	if(timer_create(CLOCK_MONOTONIC, &sev, &timer)) {
+		perror("emu: timer_create");
+		return 1;
+	}
+
+	calibrate();
+
+	// The firmware runs on a stack in the target's SRAM, so its addresses fit the 32-bit DMA registers
+	getcontext(&fw_context);
+	fw_context.uc_stack.ss_sp = (void *)SRAM_BASE;
+	fw_context.uc_stack.ss_size = FW_STACK;
+	fw_context.uc_link = &main_context;
+	makecontext(&fw_context, firmware, 0);
+	swapcontext(&main_context, &fw_context);
+	finish();
+	return 0;
+}
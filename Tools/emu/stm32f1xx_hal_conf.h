@@ -0,0 +1,18 @@
+// Module: stm32f1xx_hal_conf.h (host emulation)
+//
+// Found ahead of Core/Inc/stm32f1xx_hal_conf.h by the emulation build (Tools/emu/build.sh), includes it,
+// then routes the counters the firmware times itself with (TIM4->CNT, DWT->CYCCNT) through emu.c: their
+// registers aren't trapped like the others, emu_counters() brings them up to date on each use instead.
+#ifndef EMU_HAL_CONF_H
+#define EMU_HAL_CONF_H
+
+#include_next "stm32f1xx_hal_conf.h"
+
+void *emu_counters(uintptr_t base);
+
+#undef TIM4
+#define TIM4  ((TIM_TypeDef *)emu_counters(TIM4_BASE))
+#undef DWT
+#define DWT   ((DWT_Type *)emu_counters(DWT_BASE))
+
+#endif // EMU_HAL_CONF_H
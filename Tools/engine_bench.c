@@ -0,0 +1,147 @@
+// Tool: engine_bench.c
+//
+// Host simulation of the two logger queue engines (LOG_ENGINE in Core/Src/log.h, modelled in queue_model.h):
+//   circular : one circular queue, each DMA transfer sends head..tail, or head..end of buffer when wrapped
+//   pingpong : two half buffers, the DMA completion swaps halves and sends the whole fill half
+// The UART drains one byte per bit time * 10, every DMA (re)start costs a fixed ISR gap.  Messages
+// arrive as described by a scenario (size distribution x arrival pattern).
+//
+// Build: cc -O2 -Wall -o engine_bench engine_bench.c -lm
+// Usage: engine_bench [-n buffer-bytes] [-b baud] [-g dma-gap-us] [-t seconds]
+//
+// Per engine and scenario:
+//   offered / sent : bytes per second offered by the producers, and actually sent on the link
+//   drop%          : messages dropped for lack of space
+//   lat avg / p99  : queueing latency, logmsg() to the last byte of the message on the wire (ms)
+//   peak use%      : the most buffer bytes in use at any time, as a percentage of the buffer size.
+//                    Pingpong only ever stores into half the buffer; this is its memory cost
+//   dma/s          : DMA transfers per second (ISR load)
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "queue_model.h"
+
+#define MAX_MSG  128  // LOG_ITEM_MAX_SIZE
+
+typedef struct {
+	const char *name;
+	int (*size)(void);
+} size_dist_t;
+
+typedef struct {
+	const char *name;
+	double load;        // average offered load, fraction of the link capacity
+	int burst;          // messages per burst (1: Poisson arrivals)
+	double spacing_us;  // time between the messages of a burst (compose time)
+} pattern_t;
+
+static double urand(void) { return (rand() + 0.5) / ((double)RAND_MAX + 1); }
+
+static int size_fixed(void) { return 48; }
+static int size_uniform(void) { return 16 + rand() % (MAX_MSG - 16 + 1); }
+static int size_bimodal(void) { return urand() < 0.9 ? 24 : MAX_MSG; }
+
+static const size_dist_t sizes[] = {
+	{ "fixed 48", size_fixed },
+	{ "uniform 16-128", size_uniform },
+	{ "bimodal 24/128", size_bimodal },
+};
+
+static const pattern_t patterns[] = {
+	{ "steady 50%", 0.50, 1, 0 },
+	{ "steady 90%", 0.90, 1, 0 },
+	{ "burst 40, 50%", 0.50, 40, 20 },
+	{ "burst 200, 50%", 0.50, 200, 10 },
+	{ "burst 200, 95%", 0.95, 200, 10 },
+};
+
+//=============================================================================
+static int cmp_double(const void *a, const void *b) {
+//=============================================================================
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+//=============================================================================
+// Both engines see the same arrivals (same seed)
+static void run(engine_t engine, const size_dist_t *sd, const pattern_t *pat, uint32_t size, double seconds) {
+//=============================================================================
+	sim_t s;
+	sim_init(&s, engine, size);
+	srand(12345);
+
+	// Average message size, to derive the arrival rate for the offered load
+	double avg = 0;
+	for(int i = 0; i < 10000; i++) avg += sd->size();
+	avg /= 10000;
+	srand(54321);
+	double msgs_per_us = pat->load / (avg * byte_us);
+	double end_us = seconds * 1e6;
+	double now = 0;
+
+	while(now < end_us) {
+		// Next burst start: exponential gaps with the mean keeping the average load
+		double gap = -log(urand()) * pat->burst / msgs_per_us;
+		if(pat->burst > 1) gap = pat->burst / msgs_per_us; // periodic bursts
+		double next = now + gap;
+		for(int m = 0; m < pat->burst; m++) {
+			double t = now + m * pat->spacing_us;
+			while(s.dma_count && s.dma_done <= t) complete(&s);
+			enqueue(&s, t, sd->size());
+		}
+		while(s.dma_count && s.dma_done <= next) complete(&s);
+		now = next;
+	}
+	double last = now;
+	while(s.dma_count) {
+		last = s.dma_done;
+		complete(&s);
+	}
+
+	qsort(s.latency, s.latencies, sizeof(double), cmp_double);
+	double sum = 0;
+	for(size_t i = 0; i < s.latencies; i++) sum += s.latency[i];
+	double p99 = s.latencies ? s.latency[(size_t)(s.latencies * 0.99)] : 0;
+	printf("%-9s %-15s %-15s %8.0f %8.0f %6.2f %8.2f %8.2f %6.1f %8.0f\n",
+			engine == ENGINE_CIRCULAR ? "circular" : "pingpong", sd->name, pat->name,
+			s.offered_bytes / (now / 1e6), s.queued / (last / 1e6), 100.0 * s.dropped / s.offered_msgs,
+			s.latencies ? sum / s.latencies / 1000 : 0, p99 / 1000, 100.0 * s.peak_used / size,
+			s.dma_starts / (last / 1e6));
+	sim_free(&s);
+}
+
+//=============================================================================
+int main(int argc, char **argv) {
+//=============================================================================
+	uint32_t size = 4096;   // LOG_DMA_BUFFER_SIZE
+	double baud = 115200, seconds = 20;
+	gap_us = 5;
+	int opt;
+	while((opt = getopt(argc, argv, "n:b:g:t:")) != -1) {
+		switch(opt) {
+		case 'n': size = (uint32_t)strtoul(optarg, NULL, 0); break;
+		case 'b': baud = atof(optarg); break;
+		case 'g': gap_us = atof(optarg); break;
+		case 't': seconds = atof(optarg); break;
+		default:
+			fprintf(stderr, "usage: engine_bench [-n buffer-bytes] [-b baud] [-g dma-gap-us] [-t seconds]\n");
+			return 1;
+		}
+	}
+	byte_us = 10 * 1e6 / baud;
+	printf("buffer %u bytes, %.0f baud (%.0f bytes/s), %.1f us per DMA start, %.0f s per scenario\n\n",
+			size, baud, 1e6 / byte_us, gap_us, seconds);
+	printf("%-9s %-15s %-15s %8s %8s %6s %8s %8s %6s %8s\n", "engine", "sizes", "arrivals",
+			"offered", "sent", "drop%", "lat avg", "lat p99", "peak%", "dma/s");
+	for(unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		for(unsigned j = 0; j < sizeof(patterns) / sizeof(patterns[0]); j++) {
+			run(ENGINE_CIRCULAR, &sizes[i], &patterns[j], size, seconds);
+			run(ENGINE_PINGPONG, &sizes[i], &patterns[j], size, seconds);
+		}
+	}
+	return 0;
+}
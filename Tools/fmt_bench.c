@@ -0,0 +1,128 @@
+// Tool: fmt_bench.c
+//
+// Checks Core/Src/log_format.c against the C library's snprintf() and compares their speed.
+//
+// Build: cc -O2 -Wall -I../Core/Src -o fmt_bench fmt_bench.c ../Core/Src/log_format.c -lm
+// Usage: fmt_bench [values]
+//
+// Every value is formatted with each of the formats below by both implementations.  Outputs that
+// differ are counted as ties when the C library gives the same output for a neighbouring double:
+// log_vsnprintf() rounds half up (on the exact binary value), the C library rounds half to even.  %e and %g lose up to one bit in 2^60
+// per power of 10 while scaling, so 16 and 17 digit outputs of very large or small values can be off
+// by a few units in the last digit; those count as ties when the values agree to 1e-15.  %f of values beyond 2^63
+// switches to %e by design, those are counted separately.  Anything else is a mismatch.
+// Host timings are only a relative measure, the target numbers come from log_format_benchmark()
+// in main.c (LOG_FORMAT_BENCH).
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "log_format.h"
+
+static const char *formats[] = {
+	"%f", "%.3f", "%.0f", "%#.0f", "%10.2f", "%-10.1f|", "%+.4f", "%012.3f", "%.9f",
+	"%e", "%.0e", "%.3E", "%.9e", "%.16e",
+	"%g", "%.3g", "%#g", "%.10G", "%.17g",
+	"%d %5i %-5u| %x %#X %o %c %s %.2s %%",
+};
+
+//=============================================================================
+static double random_value(unsigned i) {
+//=============================================================================
+	switch(i % 5) {
+	case 0: return (rand() - RAND_MAX / 2) / 1000.0;            // typical sensor values
+	case 1: return (double)rand() / RAND_MAX;
+	case 2: return ldexp((double)rand() / RAND_MAX, rand() % 200 - 100); // wide range
+	case 3: return (rand() % 20000 - 10000) / 8.0;               // exact binary fractions, rounding ties
+	default: {
+		uint64_t bits = ((uint64_t)rand() << 33) ^ ((uint64_t)rand() << 11) ^ rand(); // any double
+		double d;
+		memcpy(&d, &bits, sizeof(d));
+		return d;
+	}
+	}
+}
+
+//=============================================================================
+// The C library formats a neighbouring double like log_vsnprintf() did
+static int neighbour_matches(const char *format, double v, const char *a) {
+//=============================================================================
+	char b[512];
+	snprintf(b, sizeof(b), format, nextafter(v, INFINITY));
+	if(!strcmp(a, b)) return 1;
+	snprintf(b, sizeof(b), format, nextafter(v, -INFINITY));
+	return !strcmp(a, b);
+}
+
+//=============================================================================
+static double now(void) {
+//=============================================================================
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//=============================================================================
+int main(int argc, char **argv) {
+//=============================================================================
+	unsigned count = argc > 1 ? (unsigned)strtoul(argv[1], NULL, 0) : 100000;
+	unsigned nformats = sizeof(formats) / sizeof(formats[0]);
+	unsigned long mismatches = 0, ties = 0, large = 0, total = 0;
+	char a[512], b[512];
+	double *values = malloc(count * sizeof(double));
+	if(!values) return 1;
+
+	srand(1);
+	for(unsigned i = 0; i < count; i++) values[i] = random_value(i);
+
+	for(unsigned f = 0; f < nformats; f++) {
+		int integers = strchr(formats[f], 'd') != NULL;
+		for(unsigned i = 0; i < count; i++) {
+			int la, lb;
+			if(integers) {
+				int v = (int)(values[i] * 1000);
+				la = log_snprintf(a, sizeof(a), formats[f], v, -v, v, v, v, v, 'A' + (v & 15), "str", "str");
+				lb = snprintf(b, sizeof(b), formats[f], v, -v, v, v, v, v, 'A' + (v & 15), "str", "str");
+			} else {
+				la = log_snprintf(a, sizeof(a), formats[f], values[i]);
+				lb = snprintf(b, sizeof(b), formats[f], values[i]);
+			}
+			total++;
+			if(la == lb && !strcmp(a, b)) continue;
+			if(!integers && strchr(formats[f], 'f') && fabs(values[i]) >= 0x1p63) {
+				large++;
+				continue;
+			}
+			if(neighbour_matches(formats[f], values[i], a) || fabs(strtod(a, NULL) - strtod(b, NULL)) <= fabs(strtod(b, NULL)) * 1e-15) {
+				ties++;
+				continue;
+			}
+			if(mismatches++ < 20) printf("mismatch %s (%a): log \"%s\" libc \"%s\"\n", formats[f], values[i], a, b);
+		}
+	}
+	printf("%lu conversions, %lu rounding differences, %lu %%f beyond 2^63, %lu mismatches\n",
+			total, ties, large, mismatches);
+
+	// Truncation keeps the vsnprintf() contract
+	int len = log_snprintf(a, 8, "%.3f", 12345.6789);
+	if(len != 9 || strcmp(a, "12345.6")) {
+		printf("truncation: got %d \"%s\"\n", len, a);
+		mismatches++;
+	}
+
+	printf("%-8s %10s %10s\n", "format", "log ns", "libc ns");
+	for(unsigned f = 0; f < nformats; f++) {
+		if(strchr(formats[f], 'd')) continue;
+		double t0 = now();
+		for(unsigned i = 0; i < count; i++) log_snprintf(a, sizeof(a), formats[f], values[i] / 1e6);
+		double t1 = now();
+		for(unsigned i = 0; i < count; i++) snprintf(b, sizeof(b), formats[f], values[i] / 1e6);
+		double t2 = now();
+		printf("%-8s %10.1f %10.1f\n", formats[f], (t1 - t0) * 1e9 / count, (t2 - t1) * 1e9 / count);
+	}
+	free(values);
+	return mismatches ? 1 : 0;
+}
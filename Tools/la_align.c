@@ -0,0 +1,448 @@
+// Tool: la_align.c
+//
+// Aligns a logic analyzer capture of the GPIO trace pins (Core/Src/gpio_trace.h) with the UART log
+// capture of the same run, and prints both on one timeline.
+// The sync pulses are matched to the LOG_FRAME_TRACE_SYNC frames (low 4 bits of the sequence number on
+// the bus, and the spacing of the pulses against the DWT cycles in the frames), then a least squares
+// fit maps analyzer time to target cycles, which corrects the clock drift between the two.
+// Pin activity keeps the analyzer resolution (durations in target time); log lines only have their
+// millisecond tick.
+//
+// Build: cc -O2 -Wall -I../Core/Src -o la_align la_align.c -lm
+// Usage: la_align [-f core-MHz] [-S sync-ch] [-I isr-ch] [-B bus-ch] [-T csv-time-unit] capture-file la-export
+//   la-export : VCD (PulseView, ...), channels numbered in $var order, or
+//               CSV (Saleae, ...), "time,ch0,ch1,..." rows, time in seconds (times -T, ex: -T 1e-9 for ns)
+//   -S / -I / -B : analyzer channels wired to PC0 (sync), PC1 (ISR), PC2 (first of 4 bus bits),
+//                  default 0 / 1 / 2
+// Timeline (stdout): target ms since boot, source, then:
+//   la  bus <code> [(previous code for <ns>)] | isr enter | isr exit (<ns>) | sync <seq>
+//   log <text line>
+// The match quality (pulses matched, drift in ppm, residual) goes to stderr.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+#include <ctype.h>
+#include <unistd.h>
+#include "log_frame.h"
+
+#define BUS_BITS    4
+#define MAX_LINE    4096
+#define MAX_ANCHORS 32    // pulses tried as the anchor of the match
+
+typedef struct {
+	uint32_t tick;
+	uint64_t cycles;   // unwrapped
+	uint8_t seq;
+} sync_frame_t;
+
+typedef struct {
+	uint32_t tick;
+	char *text;
+} line_t;
+
+typedef struct {
+	double ns;
+	uint32_t state;    // channel levels, bit n = channel n
+} sample_t;
+
+typedef struct {
+	double ns;
+	uint8_t code;      // bus, while the sync pin was high
+	int frame;         // matched sync frame, -1 none
+} pulse_t;
+
+typedef struct {
+	double ms;
+	size_t order;
+	const char *source;
+	char *text;
+} out_t;
+
+static sync_frame_t *syncs;
+static size_t sync_count, sync_alloc;
+static line_t *lines;
+static size_t line_count, line_alloc;
+static sample_t *samples;
+static size_t sample_count, sample_alloc;
+static pulse_t *pulses;
+static size_t pulse_count, pulse_alloc;
+static out_t *outs;
+static size_t out_count, out_alloc;
+
+static int sync_ch = 0, isr_ch = 1, bus_ch = 2;
+static double core_mhz = 72.0;
+static double csv_unit = 1.0; // seconds per CSV time unit
+
+#define PUSH(array, count, alloc) \
+	(((count) == (alloc) ? ((alloc) = (alloc) ? (alloc) * 2 : 1024, \
+		(array) = realloc((array), (alloc) * sizeof(*(array)))) : (array)), &(array)[(count)++])
+
+//=============================================================================
+// Log capture: sync frames and text lines.  A tick going backwards is a target reset, only the
+// last run is kept.
+static int read_capture(const char *path) {
+//=============================================================================
+	FILE *in = fopen(path, "rb");
+	if(!in) {
+		perror(path);
+		return -1;
+	}
+	static char line[MAX_LINE + 1];
+	uint8_t payload[LOG_FRAME_MAX_PAYLOAD];
+	uint32_t last_cycles = 0, last_tick = 0;
+	uint64_t cycles64 = 0;
+	int c;
+
+	while((c = getc(in)) != EOF) {
+		if(c == LOG_FRAME_SYNC) {
+			int type = getc(in);
+			int length = getc(in);
+			if(type == EOF || length == EOF || fread(payload, 1, length, in) != (size_t)length) break;
+			if(type != LOG_FRAME_TRACE_SYNC || length < 9) continue;
+			uint32_t tick = log_get_u32(payload);
+			uint32_t cycles = log_get_u32(&payload[4]);
+			if(tick < last_tick) {
+				for(size_t i = 0; i < line_count; i++) free(lines[i].text);
+				sync_count = line_count = 0;
+			}
+			cycles64 = sync_count ? cycles64 + (uint32_t)(cycles - last_cycles) : cycles;
+			last_cycles = cycles;
+			last_tick = tick;
+			sync_frame_t *s = PUSH(syncs, sync_count, sync_alloc);
+			s->tick = tick;
+			s->cycles = cycles64;
+			s->seq = payload[8];
+			continue;
+		}
+		size_t n = 0;
+		while(c != EOF && c != '\n') {
+			if(n < MAX_LINE) line[n++] = (char)c;
+			c = getc(in);
+		}
+		line[n] = 0;
+		if(line[0] != '(') continue;
+		line_t *l = PUSH(lines, line_count, line_alloc);
+		l->tick = strtoul(&line[1], NULL, 10);
+		l->text = strdup(line);
+	}
+	fclose(in);
+	return 0;
+}
+
+//=============================================================================
+static void add_sample(double ns, uint32_t state) {
+//=============================================================================
+	if(sample_count && samples[sample_count - 1].state == state) return;
+	if(sample_count && samples[sample_count - 1].ns == ns) {
+		samples[sample_count - 1].state = state; // several changes at one timestamp
+		return;
+	}
+	sample_t *s = PUSH(samples, sample_count, sample_alloc);
+	s->ns = ns;
+	s->state = state;
+}
+
+//=============================================================================
+// VCD: $timescale, 1-bit $var (channel = declaration order), #time, 0<id> / 1<id> value changes
+static int read_vcd(FILE *in) {
+//=============================================================================
+	char tok[256];
+	char ids[32][64];
+	int channels = 0;
+	double scale = 1.0; // ns per time unit
+	double ns = 0;
+	uint32_t state = 0;
+	int have_time = 0;
+
+	while(fscanf(in, "%255s", tok) == 1) {
+		if(!strcmp(tok, "$timescale")) {
+			double v = 1;
+			char unit[64] = "ns";
+			if(fscanf(in, "%255s", tok) != 1) break;
+			char *end;
+			v = strtod(tok, &end);
+			if(*end) strncpy(unit, end, sizeof(unit) - 1);
+			else if(fscanf(in, "%63s", unit) != 1) break;
+			scale = v * (!strncmp(unit, "fs", 2) ? 1e-6 : !strncmp(unit, "ps", 2) ? 1e-3 :
+					!strncmp(unit, "ns", 2) ? 1 : !strncmp(unit, "us", 2) ? 1e3 :
+					!strncmp(unit, "ms", 2) ? 1e6 : 1e9);
+			while(fscanf(in, "%255s", tok) == 1 && strcmp(tok, "$end")) {
+			}
+		} else if(!strcmp(tok, "$var")) {
+			char type[64], size[64], id[64];
+			if(fscanf(in, "%63s %63s %63s", type, size, id) != 3) break;
+			if(channels < 32 && !strcmp(size, "1")) strcpy(ids[channels++], id);
+			while(fscanf(in, "%255s", tok) == 1 && strcmp(tok, "$end")) {
+			}
+		} else if(tok[0] == '$') {
+			if(!strcmp(tok, "$dumpvars") || !strcmp(tok, "$end")) continue; // values follow / end of block
+			while(fscanf(in, "%255s", tok) == 1 && strcmp(tok, "$end")) {
+			}
+		} else if(tok[0] == '#') {
+			if(have_time) add_sample(ns, state);
+			ns = strtod(&tok[1], NULL) * scale;
+			have_time = 1;
+		} else if(strchr("01xXzZ", tok[0])) {
+			for(int ch = 0; ch < channels; ch++) {
+				if(strcmp(&tok[1], ids[ch])) continue;
+				state = (tok[0] == '1') ? state | (1u << ch) : state & ~(1u << ch);
+				break;
+			}
+		} else if(tok[0] == 'b' || tok[0] == 'r') {
+			if(fscanf(in, "%255s", tok) != 1) break; // vector / real value: skip its id
+		}
+	}
+	if(have_time) add_sample(ns, state);
+	return 0;
+}
+
+//=============================================================================
+// CSV: rows starting with a number, time then one column per channel (header lines skipped)
+static int read_csv(FILE *in) {
+//=============================================================================
+	static char line[MAX_LINE];
+	while(fgets(line, sizeof(line), in)) {
+		char *p = line;
+		while(*p == ' ') p++;
+		if(!isdigit((unsigned char)*p) && *p != '-' && *p != '.') continue;
+		char *end;
+		double t = strtod(p, &end) * csv_unit * 1e9;
+		uint32_t state = 0;
+		for(int ch = 0; ch < 32 && *end; ch++) {
+			p = strchr(end, ',');
+			if(!p) break;
+			long v = strtol(p + 1, &end, 0);
+			if(v) state |= 1u << ch;
+		}
+		add_sample(t, state);
+	}
+	return 0;
+}
+
+//=============================================================================
+static int read_la(const char *path) {
+//=============================================================================
+	FILE *in = fopen(path, "r");
+	if(!in) {
+		perror(path);
+		return -1;
+	}
+	int c;
+	while((c = getc(in)) != EOF && isspace(c)) {
+	}
+	ungetc(c, in);
+	int result = (c == '$') ? read_vcd(in) : read_csv(in);
+	fclose(in);
+	return result;
+}
+
+//=============================================================================
+static uint8_t bus_code(uint32_t state) {
+//=============================================================================
+	return (state >> bus_ch) & ((1u << BUS_BITS) - 1);
+}
+
+//=============================================================================
+// Nearest sync frame by cycles (frames are in cycle order)
+static size_t nearest_frame(double cycles) {
+//=============================================================================
+	size_t lo = 0, hi = sync_count;
+	while(lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if((double)syncs[mid].cycles < cycles) lo = mid + 1;
+		else hi = mid;
+	}
+	if(lo == sync_count || (lo > 0 && cycles - syncs[lo - 1].cycles < syncs[lo].cycles - cycles)) lo--;
+	return lo;
+}
+
+//=============================================================================
+// Pair pulses with frames: each of the first pulses is tried as the anchor with every frame carrying its
+// code, the other pulses are predicted from their spacing at the nominal clock.  The anchor pairing
+// most pulses wins.  Returns the number of pulses matched.
+static size_t match_pulses(void) {
+//=============================================================================
+	double cycles_per_ns = core_mhz / 1000.0;
+	size_t best = 0, best_anchor = 0, best_frame = 0;
+
+	for(size_t a = 0; a < pulse_count && a < MAX_ANCHORS; a++) {
+		for(size_t f = 0; f < sync_count; f++) {
+			if((syncs[f].seq & 15) != pulses[a].code) continue;
+			size_t count = 0;
+			for(size_t p = 0; p < pulse_count; p++) {
+				double span = (pulses[p].ns - pulses[a].ns) * cycles_per_ns;
+				double expect = syncs[f].cycles + span;
+				size_t k = nearest_frame(expect);
+				double tolerance = fabs(span) * 500e-6 + 20000 * cycles_per_ns; // 500 ppm + 20 us
+				if((syncs[k].seq & 15) == pulses[p].code && fabs(syncs[k].cycles - expect) < tolerance)
+					count++;
+			}
+			if(count > best) {
+				best = count;
+				best_anchor = a;
+				best_frame = f;
+			}
+		}
+	}
+	for(size_t p = 0; p < pulse_count; p++) {
+		pulses[p].frame = -1;
+		if(!best) continue;
+		double span = (pulses[p].ns - pulses[best_anchor].ns) * cycles_per_ns;
+		double expect = syncs[best_frame].cycles + span;
+		size_t k = nearest_frame(expect);
+		if((syncs[k].seq & 15) == pulses[p].code &&
+				fabs(syncs[k].cycles - expect) < fabs(span) * 500e-6 + 20000 * cycles_per_ns)
+			pulses[p].frame = (int)k;
+	}
+	return best;
+}
+
+//=============================================================================
+static void add_out(double ms, const char *source, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+static void add_out(double ms, const char *source, const char *fmt, ...) {
+//=============================================================================
+	char buf[MAX_LINE];
+	va_list ap;
+	va_start(ap, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	out_t *o = PUSH(outs, out_count, out_alloc);
+	o->ms = ms;
+	o->order = out_count;
+	o->source = source;
+	o->text = strdup(buf);
+}
+
+//=============================================================================
+static int compare_outs(const void *a, const void *b) {
+//=============================================================================
+	const out_t *x = a, *y = b;
+	if(x->ms != y->ms) return x->ms < y->ms ? -1 : 1;
+	return x->order < y->order ? -1 : 1;
+}
+
+//=============================================================================
+int main(int argc, char *argv[]) {
+//=============================================================================
+	int opt;
+	while((opt = getopt(argc, argv, "f:S:I:B:T:")) != -1) {
+		switch(opt) {
+		case 'f': core_mhz = strtod(optarg, NULL); break;
+		case 'S': sync_ch = atoi(optarg); break;
+		case 'I': isr_ch = atoi(optarg); break;
+		case 'B': bus_ch = atoi(optarg); break;
+		case 'T': csv_unit = strtod(optarg, NULL); break;
+		default:
+			optind = argc;
+			break;
+		}
+	}
+	if(argc - optind != 2 || core_mhz <= 0 || csv_unit <= 0) {
+		fprintf(stderr, "usage: %s [-f core-MHz] [-S sync-ch] [-I isr-ch] [-B bus-ch] [-T csv-time-unit] "
+				"capture-file la-export\n", argv[0]);
+		return 1;
+	}
+	if(read_capture(argv[optind]) || read_la(argv[optind + 1])) return 1;
+	if(!sample_count) {
+		fprintf(stderr, "%s: no samples\n", argv[optind + 1]);
+		return 1;
+	}
+
+	// Sync pulses: rising edges of the sync channel, with the code on the bus
+	for(size_t i = 1; i < sample_count; i++) {
+		uint32_t rise = samples[i].state & ~samples[i - 1].state;
+		if(!(rise & (1u << sync_ch))) continue;
+		pulse_t *p = PUSH(pulses, pulse_count, pulse_alloc);
+		p->ns = samples[i].ns;
+		p->code = bus_code(samples[i].state);
+	}
+	size_t matched = match_pulses();
+	if(!matched) {
+		fprintf(stderr, "no sync pulse matches a LOG_FRAME_TRACE_SYNC frame (%zu pulses, %zu frames)\n",
+				pulse_count, sync_count);
+		return 1;
+	}
+
+	// Least squares fit: cycles = slope * ns + offset (centred, for precision)
+	double mean_ns = 0, mean_cyc = 0;
+	for(size_t p = 0; p < pulse_count; p++) {
+		if(pulses[p].frame < 0) continue;
+		mean_ns += pulses[p].ns;
+		mean_cyc += syncs[pulses[p].frame].cycles;
+	}
+	mean_ns /= matched;
+	mean_cyc /= matched;
+	double sxx = 0, sxy = 0;
+	for(size_t p = 0; p < pulse_count; p++) {
+		if(pulses[p].frame < 0) continue;
+		double dx = pulses[p].ns - mean_ns;
+		sxx += dx * dx;
+		sxy += dx * (syncs[pulses[p].frame].cycles - mean_cyc);
+	}
+	double slope = (matched > 1 && sxx > 0) ? sxy / sxx : core_mhz / 1000.0;
+	double cycles_per_ms = core_mhz * 1000.0;
+	// Tick offset: HAL_GetTick() counts whole ms, so the true time is half a ms later on average
+	double tick_offset = 0, residual = 0;
+	for(size_t p = 0; p < pulse_count; p++) {
+		if(pulses[p].frame < 0) continue;
+		const sync_frame_t *s = &syncs[pulses[p].frame];
+		double fit = mean_cyc + slope * (pulses[p].ns - mean_ns);
+		residual += (fit - s->cycles) * (fit - s->cycles);
+		tick_offset += s->tick + 0.5 - s->cycles / cycles_per_ms;
+	}
+	tick_offset /= matched;
+	residual = sqrt(residual / matched) / (core_mhz / 1000.0);
+	fprintf(stderr, "%zu of %zu sync pulses matched (%zu frames), analyzer clock %+.1f ppm, residual %.0f ns rms\n",
+			matched, pulse_count, sync_count, (core_mhz / 1000.0 / slope - 1) * 1e6, residual);
+
+#define TARGET_MS(ns) ((mean_cyc + slope * ((ns) - mean_ns)) / cycles_per_ms + tick_offset)
+#define TARGET_NS(ns) ((ns) * slope / (core_mhz / 1000.0)) // analyzer duration in target time
+
+	// Pin activity
+	double bus_since = samples[0].ns, isr_since = samples[0].ns;
+	size_t pulse = 0;
+	for(size_t i = 1; i < sample_count; i++) {
+		uint32_t before = samples[i - 1].state, after = samples[i].state;
+		double ns = samples[i].ns, ms = TARGET_MS(ns);
+		uint32_t changed = before ^ after;
+		if(changed & (1u << sync_ch)) {
+			if(after & (1u << sync_ch)) {
+				while(pulse < pulse_count && pulses[pulse].ns < ns) pulse++;
+				if(pulse < pulse_count && pulses[pulse].frame >= 0)
+					add_out(ms, "la", "sync %u", syncs[pulses[pulse].frame].seq);
+				else
+					add_out(ms, "la", "sync ? (bus %u, no frame)", bus_code(after));
+			}
+			bus_since = ns; // the bus carried the sequence number, not a code
+		} else if(bus_code(changed) && !(after & (1u << sync_ch))) {
+			if(bus_code(before))
+				add_out(ms, "la", "bus %u (%u for %.0f ns)", bus_code(after), bus_code(before), TARGET_NS(ns - bus_since));
+			else
+				add_out(ms, "la", "bus %u", bus_code(after));
+			bus_since = ns;
+		}
+		if(changed & (1u << isr_ch)) {
+			if(after & (1u << isr_ch))
+				add_out(ms, "la", "isr enter");
+			else
+				add_out(ms, "la", "isr exit (%.0f ns)", TARGET_NS(ns - isr_since));
+			isr_since = ns;
+		}
+	}
+
+	// Log lines within the analyzer capture (their tick is the logmsg() call, ms resolution)
+	double first = TARGET_MS(samples[0].ns) - 1, last = TARGET_MS(samples[sample_count - 1].ns) + 1;
+	for(size_t i = 0; i < line_count; i++) {
+		if(lines[i].tick < first || lines[i].tick > last) continue;
+		add_out(lines[i].tick, "log", "%s", lines[i].text);
+	}
+
+	qsort(outs, out_count, sizeof(out_t), compare_outs);
+	for(size_t i = 0; i < out_count; i++)
+		printf("%14.6f %-3s %s\n", outs[i].ms, outs[i].source, outs[i].text);
+	return 0;
+}
@@ -0,0 +1,526 @@
+// Tool: logcapd.c
+//
+// Capture daemon for the logger stream (Linux): reads the ST-LINK VCP (or a pty, for tests) into one
+// large ring, finds the record boundaries in place, and fans the stream out to several outputs:
+//   file     : raw capture, split into files of -s MB on record boundaries (lossless: the serial
+//              read pauses if the disk falls a whole ring behind)
+//   terminal : live view, ticks and binary frames coloured (lossy: skips ahead if the terminal is slow)
+//   socket   : UNIX stream socket, each client gets the raw stream from the next record boundary
+//              after it connects (lossy per client), ex: socat UNIX-CONNECT:/tmp/logcapd - | logdecode
+// The ring is mapped twice back to back, so a record or write crossing the end of the ring is still
+// contiguous: nothing is copied between the serial read and the write() of each output.
+//
+// Build: cc -O2 -Wall -I../Core/Src -o logcapd logcapd.c
+// Usage: logcapd [-b baud] [-r ring-MB] [-o file-prefix] [-s file-MB] [-k files] [-t] [-u socket-path]
+//                [-i stats-seconds] device|pty
+//   device : serial device, set to raw 8N1 at -b baud (default 115200)
+//   pty    : creates a pseudo terminal and prints its name, write a capture to it to test
+//   -o     : capture files <prefix>.000000.bin, .000001.bin, ...  -k keeps only the newest files
+//   -i     : statistics to stderr every n seconds (default 10, 0: only at exit and on SIGUSR1):
+//            per stage bytes/s, records, and backlog (bytes received but not yet written by the output)
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "log_frame.h"
+
+#define MAX_LINE      4096   // text without '\n' longer than this is cut into a record (resync)
+#define MAX_CLIENTS   8
+#define READ_CHUNK    (1 << 20)
+#define WRITE_CHUNK   (1 << 20)
+
+typedef enum { OUT_FILE, OUT_TERMINAL, OUT_SOCKET } output_kind_t;
+
+typedef struct {
+	output_kind_t kind;
+	const char *name;
+	int fd;                 // -1: not in use
+	int lossless;
+	int blocked;            // last write would block, wait for POLLOUT
+	uint64_t pos;           // ring position of the next byte to write
+	uint64_t bytes;         // written
+	uint64_t records;       // terminal: records shown
+	uint64_t dropped;       // lossy: bytes skipped
+	uint64_t last_bytes;    // for the rate, at the previous report
+} output_t;
+
+// Ring positions count bytes since start, the ring index is position & ring_mask
+static uint8_t *ring;
+static uint64_t ring_size, ring_mask;
+static uint64_t in_pos;       // received
+static uint64_t dec_pos;      // decoded, always a record boundary
+static uint64_t in_last;      // for the rate
+static uint64_t stalls;       // serial reads skipped, ring full
+static uint64_t records, frames, resyncs, records_last;
+
+static output_t file_out = { .kind = OUT_FILE, .name = "file", .fd = -1, .lossless = 1 };
+static output_t term_out = { .kind = OUT_TERMINAL, .name = "terminal", .fd = -1 };
+static output_t clients[MAX_CLIENTS];
+static int listen_fd = -1;
+
+static const char *file_prefix;
+static uint64_t file_limit = 64ull << 20;
+static unsigned file_keep;
+static unsigned file_index;
+static uint64_t file_bytes;
+static int file_full;         // next write starts a new file
+
+static volatile sig_atomic_t stop, report_now;
+
+//=============================================================================
+static const char *frame_type_name(uint8_t type) {
+//=============================================================================
+	static const char * const names[] = {
+		"none", "metric_desc", "metrics", "histo_desc", "histogram", "assert_desc", "assert",
+		"state_desc", "state", "key", "kv", "events", "trace_sync", "blob",
+	};
+	return type < sizeof(names) / sizeof(names[0]) ? names[type] : "frame";
+}
+
+//=============================================================================
+// The ring, mapped twice in a row from one memory file
+static int ring_init(uint64_t size) {
+//=============================================================================
+	int fd = memfd_create("logcapd", 0);
+	if(fd < 0 || ftruncate(fd, size)) return -1;
+	uint8_t *base = mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(base == MAP_FAILED) return -1;
+	if(mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+			mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+		return -1;
+	close(fd);
+	ring = base;
+	ring_size = size;
+	ring_mask = size - 1;
+	return 0;
+}
+
+static inline uint8_t *ring_at(uint64_t pos) { return &ring[pos & ring_mask]; }
+
+//=============================================================================
+// Length of the record at pos, 0 if it isn't complete yet
+static uint64_t record_length(uint64_t pos, uint64_t end) {
+//=============================================================================
+	uint64_t avail = end - pos;
+	const uint8_t *p = ring_at(pos);
+	if(p[0] == LOG_FRAME_SYNC) {
+		if(avail < LOG_FRAME_HEADER_SIZE) return 0;
+		uint64_t length = LOG_FRAME_HEADER_SIZE + p[2];
+		return length <= avail ? length : 0;
+	}
+	uint64_t scan = avail < MAX_LINE ? avail : MAX_LINE;
+	const uint8_t *nl = memchr(p, '\n', scan);
+	if(nl) return nl - p + 1;
+	return avail >= MAX_LINE ? MAX_LINE : 0;
+}
+
+//=============================================================================
+// Advance dec_pos over the complete records received
+static void decode(void) {
+//=============================================================================
+	uint64_t length;
+	while(dec_pos < in_pos && (length = record_length(dec_pos, in_pos))) {
+		const uint8_t *p = ring_at(dec_pos);
+		if(p[0] == LOG_FRAME_SYNC) frames++;
+		else if(p[length - 1] != '\n') resyncs++;
+		records++;
+		dec_pos += length;
+	}
+}
+
+//=============================================================================
+static void file_rotate(void) {
+//=============================================================================
+	char path[4096];
+	if(file_out.fd >= 0) close(file_out.fd);
+	if(file_keep && file_index >= file_keep) {
+		snprintf(path, sizeof(path), "%s.%06u.bin", file_prefix, file_index - file_keep);
+		unlink(path);
+	}
+	snprintf(path, sizeof(path), "%s.%06u.bin", file_prefix, file_index++);
+	file_out.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_NONBLOCK, 0644);
+	if(file_out.fd < 0) {
+		perror(path);
+		exit(1);
+	}
+	file_bytes = 0;
+}
+
+//=============================================================================
+// Raw outputs: write what was decoded, straight from the ring.  Returns -1 if the output failed.
+static int write_raw(output_t *out) {
+//=============================================================================
+	if(out == &file_out && file_full && out->pos < dec_pos) {
+		file_rotate();
+		file_full = 0;
+	}
+	while(out->pos < dec_pos) {
+		uint64_t length = dec_pos - out->pos;
+		if(length > WRITE_CHUNK) length = WRITE_CHUNK;
+		ssize_t n = write(out->fd, ring_at(out->pos), length);
+		if(n < 0) {
+			if(errno == EAGAIN || errno == EINTR) {
+				out->blocked = 1;
+				return 0;
+			}
+			return -1;
+		}
+		out->pos += n;
+		out->bytes += n;
+		if(out == &file_out) file_bytes += n;
+	}
+	out->blocked = 0;
+	// Caught up, so on a record boundary: a good place to start the next file
+	if(out == &file_out && file_bytes >= file_limit) file_full = 1;
+	return 0;
+}
+
+//=============================================================================
+// Terminal: one record at a time, cyan ticks, yellow frames, magenta for text outside the "(tick)" format
+static void write_terminal(output_t *out) {
+//=============================================================================
+	static char buf[WRITE_CHUNK + 2 * MAX_LINE];
+	size_t used = 0;
+	uint64_t pos = out->pos, length;
+
+	while(pos < dec_pos && used < WRITE_CHUNK && (length = record_length(pos, dec_pos))) {
+		const uint8_t *p = ring_at(pos);
+		if(p[0] == LOG_FRAME_SYNC) {
+			used += snprintf(&buf[used], sizeof(buf) - used, "\033[33m[%s, %u bytes]\033[0m\n",
+					frame_type_name(p[1]), p[2]);
+		} else {
+			size_t text = length - (p[length - 1] == '\n');
+			const uint8_t *tick_end = (p[0] == '(') ? memchr(p, ')', text) : NULL;
+			if(tick_end) {
+				size_t tick = tick_end - p + 1;
+				used += snprintf(&buf[used], sizeof(buf) - used, "\033[36m%.*s\033[0m%.*s\n",
+						(int)tick, (const char *)p, (int)(text - tick), (const char *)p + tick);
+			} else {
+				used += snprintf(&buf[used], sizeof(buf) - used, "\033[35m%.*s\033[0m\n", (int)text, (const char *)p);
+			}
+		}
+		pos += length;
+		out->records++;
+	}
+	if(!used) return;
+
+	ssize_t n = write(out->fd, buf, used);
+	if(n == (ssize_t)used) {
+		out->blocked = 0;
+		out->bytes += pos - out->pos;
+	} else {
+		// The terminal can't keep up (a partial line may be left on screen): give up this batch
+		out->blocked = (n < 0 && errno == EAGAIN);
+		out->dropped += pos - out->pos;
+	}
+	out->pos = pos;
+}
+
+//=============================================================================
+// Lossy outputs more than half a ring behind skip to the newest record
+static void skip_if_behind(output_t *out) {
+//=============================================================================
+	if(out->fd < 0 || out->lossless || dec_pos - out->pos <= ring_size / 2) return;
+	out->dropped += dec_pos - out->pos;
+	out->pos = dec_pos;
+}
+
+//=============================================================================
+static void serve_outputs(void) {
+//=============================================================================
+	if(file_out.fd >= 0 && !file_out.blocked && write_raw(&file_out)) {
+		perror("capture file");
+		exit(1);
+	}
+	skip_if_behind(&term_out);
+	if(term_out.fd >= 0 && !term_out.blocked) write_terminal(&term_out);
+	for(int i = 0; i < MAX_CLIENTS; i++) {
+		output_t *c = &clients[i];
+		if(c->fd < 0) continue;
+		skip_if_behind(c);
+		if(!c->blocked && write_raw(c)) {
+			close(c->fd); // client went away
+			c->fd = -1;
+		}
+	}
+}
+
+//=============================================================================
+// Oldest byte still needed: the lossless file output, and the records not decoded yet
+static uint64_t ring_tail(void) {
+//=============================================================================
+	uint64_t tail = dec_pos;
+	if(file_out.fd >= 0 && file_out.pos < tail) tail = file_out.pos;
+	for(int i = 0; i < MAX_CLIENTS; i++)    // lossy outputs still reading older data keep it too,
+		if(clients[i].fd >= 0 && clients[i].pos < tail) tail = clients[i].pos; // they skip at half a ring
+	if(term_out.fd >= 0 && term_out.pos < tail) tail = term_out.pos;
+	return tail;
+}
+
+//=============================================================================
+static speed_t baud_constant(unsigned long baud) {
+//=============================================================================
+	switch(baud) {
+	case 9600: return B9600;
+	case 19200: return B19200;
+	case 38400: return B38400;
+	case 57600: return B57600;
+	case 115200: return B115200;
+	case 230400: return B230400;
+	case 460800: return B460800;
+	case 921600: return B921600;
+	case 1000000: return B1000000;
+	case 2000000: return B2000000;
+	case 3000000: return B3000000;
+	case 4000000: return B4000000;
+	default: return 0;
+	}
+}
+
+//=============================================================================
+// Serial device, or a new pty (its slave is kept open and raw, so writers' bytes arrive unchanged)
+static int open_input(const char *device, unsigned long baud) {
+//=============================================================================
+	struct termios tio;
+	int fd;
+	if(!strcmp(device, "pty")) {
+		fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+		if(fd < 0 || grantpt(fd) || unlockpt(fd)) return -1;
+		int slave = open(ptsname(fd), O_RDWR | O_NOCTTY);
+		if(slave < 0 || tcgetattr(slave, &tio)) return -1;
+		cfmakeraw(&tio);
+		tcsetattr(slave, TCSANOW, &tio);
+		fprintf(stderr, "logcapd: reading %s\n", ptsname(fd));
+		return fd;
+	}
+	fd = open(device, O_RDONLY | O_NOCTTY | O_NONBLOCK);
+	if(fd < 0) return -1;
+	if(!tcgetattr(fd, &tio)) {
+		speed_t speed = baud_constant(baud);
+		if(!speed) {
+			fprintf(stderr, "logcapd: unsupported baud rate %lu\n", baud);
+			exit(1);
+		}
+		cfmakeraw(&tio);
+		tio.c_cflag |= CLOCAL | CREAD;
+		cfsetispeed(&tio, speed);
+		cfsetospeed(&tio, speed);
+		tcsetattr(fd, TCSANOW, &tio);
+		tcflush(fd, TCIFLUSH);
+	}
+	return fd;
+}
+
+//=============================================================================
+static int open_socket(const char *path) {
+//=============================================================================
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if(strlen(path) >= sizeof(addr.sun_path)) return -1;
+	strcpy(addr.sun_path, path);
+	unlink(path);
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if(fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(fd, MAX_CLIENTS)) return -1;
+	return fd;
+}
+
+//=============================================================================
+static void accept_client(void) {
+//=============================================================================
+	int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK);
+	if(fd < 0) return;
+	for(int i = 0; i < MAX_CLIENTS; i++) {
+		output_t *c = &clients[i];
+		if(c->fd >= 0) continue;
+		memset(c, 0, sizeof(*c));
+		c->kind = OUT_SOCKET;
+		c->name = "socket";
+		c->fd = fd;
+		c->pos = dec_pos; // live from the next record
+		return;
+	}
+	close(fd); // no room
+}
+
+//=============================================================================
+static double now_seconds(void) {
+//=============================================================================
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//=============================================================================
+static void print_output(const output_t *out, double seconds) {
+//=============================================================================
+	fprintf(stderr, " | %s %.0f kB/s backlog %llu dropped %llu", out->name,
+			(out->bytes - out->last_bytes) / seconds / 1000, (unsigned long long)(dec_pos - out->pos),
+			(unsigned long long)out->dropped);
+}
+
+//=============================================================================
+// One line: input rate and records, then per output rate, backlog and drops
+static void report(double seconds) {
+//=============================================================================
+	if(seconds <= 0) seconds = 1e-9;
+	fprintf(stderr, "in %.3f Mbit/s %llu B (stalls %llu) | decoded %.0f rec/s frames %llu resync %llu backlog %llu",
+			(in_pos - in_last) * 8 / seconds / 1e6, (unsigned long long)in_pos, (unsigned long long)stalls,
+			(records - records_last) / seconds, (unsigned long long)frames, (unsigned long long)resyncs,
+			(unsigned long long)(in_pos - dec_pos));
+	in_last = in_pos;
+	records_last = records;
+	output_t *outs[2 + MAX_CLIENTS] = { &file_out, &term_out };
+	for(int i = 0; i < MAX_CLIENTS; i++) outs[2 + i] = &clients[i];
+	for(int i = 0; i < 2 + MAX_CLIENTS; i++) {
+		if(outs[i]->fd < 0) continue;
+		print_output(outs[i], seconds);
+		outs[i]->last_bytes = outs[i]->bytes;
+	}
+	fprintf(stderr, "\n");
+}
+
+static void on_signal(int sig) {
+	if(sig == SIGUSR1) report_now = 1;
+	else stop = 1;
+}
+
+//=============================================================================
+int main(int argc, char *argv[]) {
+//=============================================================================
+	unsigned long baud = 115200;
+	uint64_t ring_mb = 16;
+	double interval = 10;
+	const char *socket_path = NULL;
+	int terminal = 0, opt;
+
+	for(int i = 0; i < MAX_CLIENTS; i++) clients[i].fd = -1;
+	while((opt = getopt(argc, argv, "b:r:o:s:k:tu:i:")) != -1) {
+		switch(opt) {
+		case 'b': baud = strtoul(optarg, NULL, 0); break;
+		case 'r': ring_mb = strtoull(optarg, NULL, 0); break;
+		case 'o': file_prefix = optarg; break;
+		case 's': file_limit = strtoull(optarg, NULL, 0) << 20; break;
+		case 'k': file_keep = strtoul(optarg, NULL, 0); break;
+		case 't': terminal = 1; break;
+		case 'u': socket_path = optarg; break;
+		case 'i': interval = strtod(optarg, NULL); break;
+		default: optind = argc + 1; break;
+		}
+	}
+	if(optind != argc - 1 || !ring_mb || (ring_mb & (ring_mb - 1)) || !file_limit) {
+		fprintf(stderr, "usage: %s [-b baud] [-r ring-MB, power of 2] [-o file-prefix] [-s file-MB] [-k files] [-t]\n"
+				"       [-u socket-path] [-i stats-seconds] device|pty\n", argv[0]);
+		return 1;
+	}
+	if(ring_init(ring_mb << 20)) {
+		perror("ring");
+		return 1;
+	}
+	int in_fd = open_input(argv[optind], baud);
+	if(in_fd < 0) {
+		perror(argv[optind]);
+		return 1;
+	}
+	if(file_prefix) file_rotate();
+	if(terminal) {
+		term_out.fd = STDOUT_FILENO;
+		fcntl(STDOUT_FILENO, F_SETFL, fcntl(STDOUT_FILENO, F_GETFL) | O_NONBLOCK);
+	}
+	if(socket_path && (listen_fd = open_socket(socket_path)) < 0) {
+		perror(socket_path);
+		return 1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	signal(SIGUSR1, on_signal);
+
+	double start = now_seconds(), last_report = start;
+	int input_open = 1;
+	while(!stop) {
+		struct pollfd fds[3 + MAX_CLIENTS];
+		output_t *owner[3 + MAX_CLIENTS];
+		int n = 0;
+		uint64_t space = ring_size - (in_pos - ring_tail());
+		if(input_open && space) {
+			fds[n] = (struct pollfd){ .fd = in_fd, .events = POLLIN };
+			owner[n++] = NULL;
+		}
+		if(listen_fd >= 0) {
+			fds[n] = (struct pollfd){ .fd = listen_fd, .events = POLLIN };
+			owner[n++] = NULL;
+		}
+		output_t *outs[2 + MAX_CLIENTS] = { &file_out, &term_out };
+		for(int i = 0; i < MAX_CLIENTS; i++) outs[2 + i] = &clients[i];
+		for(int i = 0; i < 2 + MAX_CLIENTS; i++) {
+			if(outs[i]->fd < 0 || !outs[i]->blocked) continue;
+			fds[n] = (struct pollfd){ .fd = outs[i]->fd, .events = POLLOUT };
+			owner[n++] = outs[i];
+		}
+		if(!input_open && dec_pos == ring_tail()) break; // input closed and everything written
+		if(input_open && !space) stalls++;
+
+		poll(fds, n, 200);
+		for(int i = 0; i < n; i++) {
+			if(!fds[i].revents) continue;
+			if(owner[i]) owner[i]->blocked = 0;
+			else if(fds[i].fd == listen_fd) accept_client();
+		}
+
+		// Large reads straight into the ring, as much as the free space allows (contiguous, mirrored)
+		while(input_open && (space = ring_size - (in_pos - ring_tail()))) {
+			ssize_t got = read(in_fd, ring_at(in_pos), space < READ_CHUNK ? space : READ_CHUNK);
+			if(got > 0) {
+				in_pos += got;
+				decode();
+				serve_outputs(); // a read at a time, so files split close to -s and outputs stay live
+				continue;
+			}
+			if(got == 0 || (errno != EAGAIN && errno != EINTR)) {
+				input_open = !(got == 0 || errno == EIO); // end of file / pty closed
+				if(input_open) perror("read");
+			}
+			break;
+		}
+		if(!input_open && in_pos != dec_pos) {
+			dec_pos = in_pos; // partial record at the end, keep it in the capture
+			records++;
+			resyncs++;
+		}
+		serve_outputs();
+
+		double now = now_seconds();
+		if(report_now || (interval > 0 && now - last_report >= interval)) {
+			report(now - last_report);
+			last_report = now;
+			report_now = 0;
+		}
+	}
+	// Stopped: the capture file gets everything received, a partial last record included
+	if(in_pos != dec_pos) {
+		dec_pos = in_pos;
+		records++;
+		resyncs++;
+	}
+	if(file_out.fd >= 0) {
+		fcntl(file_out.fd, F_SETFL, fcntl(file_out.fd, F_GETFL) & ~O_NONBLOCK);
+		file_full = 0;
+		write_raw(&file_out);
+	}
+	report(now_seconds() - last_report);
+	fprintf(stderr, "total %llu bytes, %llu records in %.1f s\n", (unsigned long long)in_pos,
+			(unsigned long long)records, now_seconds() - start);
+	if(socket_path) unlink(socket_path);
+	return 0;
+}
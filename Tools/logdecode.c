@@ -0,0 +1,907 @@
+// Tool: logdecode.c
+//
+// Host side decoder for the logger stream: "(ticks) text\n" lines interleaved with
+// binary frames (see Core/Src/log_frame.h for the framing).
+//
+// Build: cc -O2 -Wall -I../Core/Src -o logdecode logdecode.c
+// Usage: logdecode [-m|-H|-a|-s|-j] [-W] [-w window-ms] [-b baud] [capture-file]     (reads stdin if no file is given)
+//   default : text lines are passed through, binary frames are printed as readable text
+//   -m      : metrics mode, expand LOG_FRAME_METRICS frames into "tick,name,value" CSV time series
+//   -H      : histogram mode, print p50/p99/p999 per exported interval and a summary of the whole capture
+//   -a      : traffic analysis, rank message sources by bytes on the link (see analyze_record())
+//             -w sets the time window (ms) used to find the busiest period, -b the UART baud rate
+//             -W adds one line per window as it closes: records, bytes, % of link and its top sources
+//   -s      : state machine mode, print transition timelines and dwell time statistics per state
+//   -j      : JSON lines, one object per structured (LOG_KV) record and per text line
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include "log_frame.h"
+
+// Captures can be several GB, avoid stdio locking per byte
+#define getc(f)   getc_unlocked(f)
+
+#define MAX_LINE  4096  // longer text lines are truncated (target lines are at most LOG_ITEM_MAX_SIZE)
+
+typedef struct {
+	int is_frame;                  // 1: binary frame, 0: text line
+	uint8_t type;                  // frame type
+	uint16_t length;               // payload / text length (text excludes '\n')
+	uint8_t data[MAX_LINE + 1];    // frame payload or null terminated text
+} record_t;
+
+typedef enum { MODE_TEXT, MODE_METRICS, MODE_HISTO, MODE_ANALYZE, MODE_STATE, MODE_JSON } mode_t_;
+
+static mode_t_ mode = MODE_TEXT;
+
+// Metric state, rebuilt from the descriptor and snapshot frames
+static char metric_name[256][LOG_FRAME_MAX_PAYLOAD + 1];
+static int32_t metric_value[256];
+
+// Histogram state: names, and totals accumulated over the whole capture
+#define HISTO_BUCKETS 33
+typedef struct {
+	uint64_t count;
+	uint32_t min;
+	uint32_t max;
+	uint64_t sum;
+	uint64_t bucket[HISTO_BUCKETS];
+} histo_t;
+static char histo_name[256][LOG_FRAME_MAX_PAYLOAD + 1];
+static histo_t histo_total[256];
+
+// Assertion descriptors: "file:line expression", by descriptor index
+#define MAX_ASSERTS 4096
+static char *assert_desc[MAX_ASSERTS];
+
+// State machines, rebuilt from LOG_FRAME_STATE_DESC / LOG_FRAME_STATE
+#define MAX_MACHINES 256
+typedef struct {
+	uint64_t count;
+	uint64_t total;   // ms
+	uint32_t min;
+	uint32_t max;
+} dwell_t;
+typedef struct {
+	char *name;
+	char *state_name[256];
+	uint32_t time;     // ms, registration tick + sum of transition deltas
+	int state;         // current state, -1 unknown
+	uint64_t lost;     // transitions missing from the capture (from != current state)
+	dwell_t dwell[256];
+} machine_t;
+static machine_t *machines[MAX_MACHINES];
+
+// Interned key names for structured records
+static char *key_name[256];
+
+//=============================================================================
+static const char *frame_type_name(uint8_t type) {
+//=============================================================================
+	static const char * const names[] = {
+		"none", "metric_desc", "metrics", "histo_desc", "histogram", "assert_desc", "assert",
+		"state_desc", "state", "key", "kv", "events", "trace_sync", "blob",
+	};
+	return type < sizeof(names) / sizeof(names[0]) ? names[type] : "frame";
+}
+
+//=============================================================================
+// Read the next record from the stream, return 0 at end of input
+static int read_record(FILE *in, record_t *rec) {
+//=============================================================================
+	int c = getc(in);
+	if(c == EOF) return 0;
+
+	if(c == LOG_FRAME_SYNC) {
+		int type = getc(in);
+		int length = getc(in);
+		if(type == EOF || length == EOF) return 0; // truncated capture
+		rec->is_frame = 1;
+		rec->type = (uint8_t)type;
+		rec->length = (uint16_t)length;
+		if(fread(rec->data, 1, length, in) != (size_t)length) return 0;
+		return 1;
+	}
+
+	rec->is_frame = 0;
+	rec->length = 0;
+	while(c != EOF && c != '\n') {
+		if(rec->length < MAX_LINE) rec->data[rec->length++] = (uint8_t)c;
+		c = getc(in);
+	}
+	rec->data[rec->length] = 0;
+	return 1;
+}
+
+//=============================================================================
+static const char *metric_label(uint8_t id) {
+//=============================================================================
+	static char unknown[16];
+	if(metric_name[id][0]) return metric_name[id];
+	snprintf(unknown, sizeof(unknown), "metric%u", id);
+	return unknown;
+}
+
+//=============================================================================
+static void decode_metric_desc(const record_t *rec) {
+//=============================================================================
+	if(rec->length < 2) return;
+	memcpy(metric_name[rec->data[0]], &rec->data[2], rec->length - 2);
+	metric_name[rec->data[0]][rec->length - 2] = 0;
+	if(mode == MODE_TEXT)
+		printf("[metric %u] %s (%s)\n", rec->data[0], metric_name[rec->data[0]],
+				rec->data[1] ? "gauge" : "counter");
+}
+
+//=============================================================================
+static void decode_metrics(const record_t *rec) {
+//=============================================================================
+	if(rec->length < 5) return;
+	uint32_t tick = log_get_u32(rec->data);
+	int key = rec->data[4] & LOG_METRICS_FLAG_KEY;
+	uint16_t pos = 5;
+
+	if(mode == MODE_TEXT) printf("(%u) [metrics]", tick);
+	while(pos < rec->length) {
+		uint8_t id = rec->data[pos++];
+		uint32_t zz;
+		uint8_t n = log_get_varint(&rec->data[pos], rec->length - pos, &zz);
+		if(!n) break; // corrupt frame
+		pos += n;
+		metric_value[id] = (key ? 0 : metric_value[id]) + log_unzigzag(zz);
+		if(mode == MODE_METRICS)
+			printf("%u,%s,%d\n", tick, metric_label(id), metric_value[id]);
+		else if(mode == MODE_TEXT)
+			printf(" %s=%d", metric_label(id), metric_value[id]);
+	}
+	if(mode == MODE_TEXT) printf("\n");
+}
+
+//=============================================================================
+static const char *histo_label(uint8_t id) {
+//=============================================================================
+	static char unknown[16];
+	if(histo_name[id][0]) return histo_name[id];
+	snprintf(unknown, sizeof(unknown), "histo%u", id);
+	return unknown;
+}
+
+//=============================================================================
+// Estimate a percentile: find the bucket holding the rank, interpolate linearly inside
+// the bucket's value range, and clamp to the recorded min / max
+static double histo_percentile(const histo_t *h, double p) {
+//=============================================================================
+	double rank = p * (double)h->count;
+	uint64_t seen = 0;
+	for(int b = 0; b < HISTO_BUCKETS; b++) {
+		if(!h->bucket[b]) continue;
+		if(seen + h->bucket[b] >= rank) {
+			double lo = b ? (double)(1ull << (b - 1)) : 0.0;
+			double hi = b ? (double)((1ull << b) - 1) : 0.0;
+			double v = lo + (hi - lo) * ((rank - seen) / (double)h->bucket[b]);
+			if(v < h->min) v = h->min;
+			if(v > h->max) v = h->max;
+			return v;
+		}
+		seen += h->bucket[b];
+	}
+	return h->max;
+}
+
+//=============================================================================
+static void print_histo(uint32_t tick, uint8_t id, const histo_t *h) {
+//=============================================================================
+	if(!h->count) return;
+	printf("(%u) [histo %s] n=%llu min=%u mean=%.1f max=%u p50=%.0f p99=%.0f p999=%.0f\n",
+			tick, histo_label(id), (unsigned long long)h->count, h->min,
+			(double)h->sum / (double)h->count, h->max,
+			histo_percentile(h, 0.50), histo_percentile(h, 0.99), histo_percentile(h, 0.999));
+}
+
+//=============================================================================
+static void decode_histo_desc(const record_t *rec) {
+//=============================================================================
+	if(rec->length < 1) return;
+	memcpy(histo_name[rec->data[0]], &rec->data[1], rec->length - 1);
+	histo_name[rec->data[0]][rec->length - 1] = 0;
+	if(mode == MODE_TEXT) printf("[histo %u] %s\n", rec->data[0], histo_name[rec->data[0]]);
+}
+
+//=============================================================================
+// A histogram export is a summary frame, possibly followed by continuation frames (count of zero)
+// holding more buckets.  The interval is printed when the next summary (or end of input) arrives.
+static histo_t histo_interval;
+static uint32_t histo_interval_tick;
+static int histo_interval_id = -1;
+
+static void flush_histo_interval(void) {
+//=============================================================================
+	if(histo_interval_id < 0) return;
+	if(mode == MODE_TEXT || mode == MODE_HISTO) print_histo(histo_interval_tick, histo_interval_id, &histo_interval);
+	histo_interval_id = -1;
+}
+
+static void decode_histogram(const record_t *rec) {
+//=============================================================================
+	uint32_t v[4] = {0};
+	uint16_t pos = 5;
+	if(rec->length < 6) return;
+	uint8_t id = rec->data[4];
+	histo_t *total = &histo_total[id];
+
+	for(int i = 0; i < 4; i++) {
+		uint8_t n = log_get_varint(&rec->data[pos], rec->length - pos, &v[i]);
+		if(!n) return;
+		pos += n;
+		if(i == 0 && v[0] == 0) break; // continuation frame, buckets only
+	}
+	if(v[0]) {
+		flush_histo_interval();
+		memset(&histo_interval, 0, sizeof(histo_interval));
+		histo_interval_id = id;
+		histo_interval_tick = log_get_u32(rec->data);
+		histo_interval.count = v[0];
+		histo_interval.min = v[1];
+		histo_interval.max = v[2];
+		histo_interval.sum = v[3];
+		if(!total->count || v[1] < total->min) total->min = v[1];
+		if(v[2] > total->max) total->max = v[2];
+		total->count += v[0];
+		total->sum += v[3];
+	}
+	while(pos < rec->length) {
+		uint8_t b = rec->data[pos++];
+		uint32_t count;
+		uint8_t n = log_get_varint(&rec->data[pos], rec->length - pos, &count);
+		if(!n || b >= HISTO_BUCKETS) break; // corrupt frame
+		pos += n;
+		total->bucket[b] += count;
+		if(histo_interval_id == id) histo_interval.bucket[b] += count;
+	}
+}
+
+//=============================================================================
+static void decode_assert_desc(const record_t *rec) {
+//=============================================================================
+	if(rec->length < 6) return;
+	uint16_t index = rec->data[0] | (rec->data[1] << 8);
+	uint16_t line = rec->data[2] | (rec->data[3] << 8);
+	const char *file = (const char *)&rec->data[5];
+	size_t file_len = strnlen(file, rec->length - 5);
+	int expr_len = rec->length - 5 - (int)file_len - 1;
+	char text[2 * LOG_FRAME_MAX_PAYLOAD];
+	if(index >= MAX_ASSERTS) return;
+	snprintf(text, sizeof(text), "%.*s:%u %.*s", (int)file_len, file, line,
+			expr_len > 0 ? expr_len : 0, expr_len > 0 ? file + file_len + 1 : "");
+	free(assert_desc[index]);
+	assert_desc[index] = strdup(text);
+}
+
+//=============================================================================
+static void decode_assert(const record_t *rec) {
+//=============================================================================
+	static const char * const policy[] = { "", " (count)", " PANIC" };
+	if(rec->length < 8 || mode != MODE_TEXT) return;
+	uint16_t index = rec->data[4] | (rec->data[5] << 8);
+	uint8_t nvalues = rec->data[7];
+	printf("(%u) ASSERT%s ", log_get_u32(rec->data), rec->data[6] < 3 ? policy[rec->data[6]] : "");
+	if(index == 0xFFFF && nvalues == 2 && rec->length >= 16) // HAL assert_failed()
+		printf("HAL parameter check, line %u, file name at 0x%08X\n",
+				log_get_u32(&rec->data[8]), log_get_u32(&rec->data[12]));
+	else {
+		if(index < MAX_ASSERTS && assert_desc[index]) printf("%s", assert_desc[index]);
+		else printf("#%u", index);
+		for(int i = 0; i < nvalues && 8 + 4 * i + 4 <= rec->length; i++)
+			printf(" %c=0x%X", 'a' + i, log_get_u32(&rec->data[8 + 4 * i]));
+		printf("\n");
+	}
+}
+
+//=============================================================================
+static machine_t *get_machine(uint8_t id) {
+//=============================================================================
+	if(!machines[id]) {
+		machines[id] = calloc(1, sizeof(machine_t));
+		machines[id]->state = -1;
+	}
+	return machines[id];
+}
+
+//=============================================================================
+static const char *state_label(machine_t *m, int state) {
+//=============================================================================
+	static char unknown[2][16];
+	static int which;
+	if(state >= 0 && m->state_name[state]) return m->state_name[state];
+	which ^= 1;
+	snprintf(unknown[which], sizeof(unknown[which]), "%d", state);
+	return unknown[which];
+}
+
+//=============================================================================
+static void decode_state_desc(const record_t *rec) {
+//=============================================================================
+	if(rec->length < 6) return;
+	machine_t *m = get_machine(rec->data[0]);
+	char *name = strndup((const char *)&rec->data[6], rec->length - 6);
+	if(rec->data[1] == 0xFF) {
+		// (Re)registration: a new timeline starts, in the machine's initial state (unknown)
+		free(m->name);
+		m->name = name;
+		m->time = log_get_u32(&rec->data[2]);
+		m->state = -1;
+	} else {
+		free(m->state_name[rec->data[1]]);
+		m->state_name[rec->data[1]] = name;
+	}
+}
+
+//=============================================================================
+static void decode_state(const record_t *rec) {
+//=============================================================================
+	uint32_t delta;
+	if(rec->length < 4 || !log_get_varint(&rec->data[3], rec->length - 3, &delta)) return;
+	machine_t *m = get_machine(rec->data[0]);
+	uint8_t from = rec->data[1], to = rec->data[2];
+
+	if(m->state >= 0 && m->state != from) m->lost++;
+	m->time += delta;
+	m->state = to;
+
+	dwell_t *d = &m->dwell[from];
+	if(!d->count || delta < d->min) d->min = delta;
+	if(delta > d->max) d->max = delta;
+	d->count++;
+	d->total += delta;
+
+	if(mode == MODE_TEXT || mode == MODE_STATE)
+		printf("(%u) [state %s] %s -> %s (%u ms)\n", m->time, m->name ? m->name : "?",
+				state_label(m, from), state_label(m, to), delta);
+}
+
+//=============================================================================
+static void print_state_summary(void) {
+//=============================================================================
+	for(int id = 0; id < MAX_MACHINES; id++) {
+		machine_t *m = machines[id];
+		uint64_t total = 0;
+		if(!m) continue;
+		for(int s = 0; s < 256; s++) total += m->dwell[s].total;
+		printf("\nmachine %d %s: %llu ms traced, %llu lost transitions\n", id, m->name ? m->name : "?",
+				(unsigned long long)total, (unsigned long long)m->lost);
+		printf("  %-16s %10s %12s %7s %10s %10s %10s\n", "state", "visits", "total ms", "%", "min", "mean", "max");
+		for(int s = 0; s < 256; s++) {
+			dwell_t *d = &m->dwell[s];
+			if(!d->count) continue;
+			printf("  %-16s %10llu %12llu %7.2f %10u %10.1f %10u\n", state_label(m, s),
+					(unsigned long long)d->count, (unsigned long long)d->total,
+					100.0 * d->total / (total ? total : 1), d->min, (double)d->total / d->count, d->max);
+		}
+	}
+}
+
+//=============================================================================
+static const char *key_label(uint8_t key) {
+//=============================================================================
+	static char unknown[2][16];
+	static int which;
+	if(key_name[key]) return key_name[key];
+	which ^= 1;
+	snprintf(unknown[which], sizeof(unknown[which]), "key%u", key);
+	return unknown[which];
+}
+
+//=============================================================================
+static void decode_key(const record_t *rec) {
+//=============================================================================
+	if(rec->length < 1) return;
+	free(key_name[rec->data[0]]);
+	key_name[rec->data[0]] = strndup((const char *)&rec->data[1], rec->length - 1);
+}
+
+//=============================================================================
+static void print_json_string(const uint8_t *p, uint32_t len) {
+//=============================================================================
+	putchar('"');
+	for(uint32_t i = 0; i < len; i++) {
+		uint8_t c = p[i];
+		if(c == '"' || c == '\\') printf("\\%c", c);
+		else if(c < ' ' || c > '~') printf("\\u%04x", c);
+		else putchar(c);
+	}
+	putchar('"');
+}
+
+//=============================================================================
+// Decode one CBOR data item (the subset written by log_kv.c), print it as JSON, return bytes used
+static uint32_t print_cbor(const uint8_t *p, uint32_t avail) {
+//=============================================================================
+	if(!avail) return 0;
+	uint8_t major = p[0] >> 5, info = p[0] & 0x1F;
+	uint32_t arg = info, n = 1;
+	if(major == 7 && info == 26) { // float32
+		if(avail < 5) return 0;
+		uint32_t bits = ((uint32_t)p[1] << 24) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 8) | p[4];
+		float f;
+		memcpy(&f, &bits, sizeof(f));
+		if(f != f || f - f != 0) printf("null"); // NaN / infinity aren't JSON
+		else printf("%.9g", f);
+		return 5;
+	}
+	if(info >= 24) {
+		uint32_t bytes = info == 24 ? 1 : info == 25 ? 2 : info == 26 ? 4 : 0;
+		if(!bytes || avail < 1 + bytes) return 0;
+		arg = 0;
+		for(uint32_t i = 0; i < bytes; i++) arg = (arg << 8) | p[1 + i];
+		n += bytes;
+	}
+	switch(major) {
+	case 0: printf("%u", arg); return n;
+	case 1: printf("%lld", -1 - (long long)arg); return n;
+	case 2:
+		if(n + arg > avail) return 0;
+		putchar('"');
+		for(uint32_t i = 0; i < arg; i++) printf("%02x", p[n + i]);
+		putchar('"');
+		return n + arg;
+	case 3:
+		if(n + arg > avail) return 0;
+		print_json_string(&p[n], arg);
+		return n + arg;
+	}
+	return 0;
+}
+
+//=============================================================================
+static uint32_t cbor_uint(const uint8_t *p, uint32_t avail, uint32_t *value) {
+//=============================================================================
+	if(!avail || (p[0] >> 5) != 0) return 0;
+	uint8_t info = p[0] & 0x1F;
+	if(info < 24) { *value = info; return 1; }
+	uint32_t bytes = info == 24 ? 1 : info == 25 ? 2 : info == 26 ? 4 : 0;
+	if(!bytes || avail < 1 + bytes) return 0;
+	*value = 0;
+	for(uint32_t i = 0; i < bytes; i++) *value = (*value << 8) | p[1 + i];
+	return 1 + bytes;
+}
+
+//=============================================================================
+static void decode_kv(const record_t *rec) {
+//=============================================================================
+	static const char * const levels[] = { "none", "error", "warn", "info", "debug", "verbose" };
+	uint32_t tick, pos, n;
+	if(rec->length < 4 || (mode != MODE_TEXT && mode != MODE_JSON)) return;
+	if(!(n = cbor_uint(&rec->data[2], rec->length - 2, &tick))) return;
+	pos = 2 + n;
+	if(pos >= rec->length) return;
+	uint8_t pairs = rec->data[pos++];
+	const char *level = rec->data[0] < 6 ? levels[rec->data[0]] : "?";
+
+	if(mode == MODE_JSON)
+		printf("{\"t\":%u,\"level\":\"%s\",\"event\":\"%s\"", tick, level, key_label(rec->data[1]));
+	else
+		printf("(%u) [%s] %s", tick, level, key_label(rec->data[1]));
+	for(uint8_t i = 0; i < pairs && pos < rec->length; i++) {
+		uint8_t key = rec->data[pos++];
+		printf(mode == MODE_JSON ? ",\"%s\":" : " %s=", key_label(key));
+		if(!(n = print_cbor(&rec->data[pos], rec->length - pos))) break; // corrupt
+		pos += n;
+	}
+	printf(mode == MODE_JSON ? "}\n" : "\n");
+}
+
+//=============================================================================
+// Text line as a JSON object: {"t":ticks,"msg":"text"}
+static void print_text_json(const record_t *rec) {
+//=============================================================================
+	uint32_t tick = 0;
+	uint16_t pos = 0;
+	if(rec->length > 2 && rec->data[0] == '(') {
+		uint16_t i = 1;
+		while(i < rec->length && isdigit(rec->data[i])) tick = tick * 10 + (rec->data[i++] - '0');
+		if(i > 1 && i < rec->length && rec->data[i] == ')') {
+			pos = i + 1;
+			if(pos < rec->length && rec->data[pos] == ' ') pos++;
+			printf("{\"t\":%u,\"msg\":", tick);
+		}
+	}
+	if(!pos) printf("{\"msg\":");
+	print_json_string(&rec->data[pos], rec->length - pos);
+	printf("}\n");
+}
+
+//=============================================================================
+// Captured edges: one line per edge, with the time since the previous edge of the same frame
+static void decode_events(const record_t *rec) {
+//=============================================================================
+	if(rec->length < 5 || (mode != MODE_TEXT && mode != MODE_JSON)) return;
+	uint8_t input = rec->data[0];
+	uint32_t us = log_get_u32(&rec->data[1]);
+	uint16_t pos = 5;
+	while(pos < rec->length) {
+		uint32_t v;
+		uint8_t n = log_get_varint(&rec->data[pos], rec->length - pos, &v);
+		if(!n) break;
+		pos += n;
+		us += v >> 1;
+		const char *edge = (v & 1) ? "rise" : "fall";
+		if(mode == MODE_JSON)
+			printf("{\"t\":%u,\"us\":%u,\"input\":%u,\"edge\":\"%s\"}\n", us / 1000, us, input, edge);
+		else
+			printf("(%u) [event %u %s] %u.%06u s (+%u us)\n", us / 1000, input, edge, us / 1000000, us % 1000000, v >> 1);
+	}
+}
+
+//=============================================================================
+// GPIO trace sync pulse (Tools/la_align.c matches them to a logic analyzer capture)
+static void decode_trace_sync(const record_t *rec) {
+//=============================================================================
+	if(rec->length < 9) return;
+	uint32_t tick = log_get_u32(rec->data);
+	uint32_t cycles = log_get_u32(&rec->data[4]);
+	if(mode == MODE_JSON)
+		printf("{\"t\":%u,\"trace_sync\":%u,\"cycles\":%u}\n", tick, rec->data[8], cycles);
+	else if(mode == MODE_TEXT)
+		printf("(%u) [trace sync %u] cycles %u\n", tick, rec->data[8], cycles);
+}
+
+//=============================================================================
+// log_blob() chunk: hex dump, offsets are from the start of the payload
+static void decode_blob(const record_t *rec) {
+//=============================================================================
+	if(rec->length < LOG_BLOB_HEADER_SIZE) return;
+	uint8_t id = rec->data[0];
+	uint16_t offset = rec->data[1] | rec->data[2] << 8;
+	uint16_t total = rec->data[3] | rec->data[4] << 8;
+	const uint8_t *data = &rec->data[LOG_BLOB_HEADER_SIZE];
+	uint16_t length = rec->length - LOG_BLOB_HEADER_SIZE;
+	if(mode == MODE_JSON) {
+		printf("{\"blob\":%u,\"offset\":%u,\"total\":%u,\"hex\":\"", id, offset, total);
+		for(uint16_t i = 0; i < length; i++) printf("%02x", data[i]);
+		printf("\"}\n");
+	} else if(mode == MODE_TEXT) {
+		printf("[blob %u] %u-%u of %u bytes\n", id, offset, offset + length, total);
+		for(uint16_t line = 0; line < length; line += 16) {
+			printf("  %04x ", offset + line);
+			for(uint16_t i = line; i < line + 16; i++) {
+				if(i < length) printf(" %02x", data[i]);
+				else printf("   ");
+			}
+			printf("  |");
+			for(uint16_t i = line; i < line + 16 && i < length; i++) putchar(isprint(data[i]) ? data[i] : '.');
+			printf("|\n");
+		}
+	}
+}
+
+//=============================================================================
+// Traffic analysis - a single streaming pass with bounded memory
+//
+// Each record is attributed to a "source":
+// * binary frames: the frame type (and the metric / histogram id where the payload has one)
+// * text lines: a cluster of lines sharing a format, found by dropping the "(ticks) " prefix and
+//   replacing every run of digits (decimal or hex 0x..) with '#', ex: "Time: #us"
+// At most MAX_SOURCES sources are tracked; once the table is full, new sources are counted as "(other)".
+// Estimated saving: a text line moved to a binary frame would need the frame header, a 16-bit format
+// id, a 32-bit tick and about 3 bytes (varint) per numeric field, instead of the text.
+//=============================================================================
+#define MAX_SOURCES   1024
+#define SOURCE_KEY    48     // cluster key length, longer formats are truncated
+
+typedef struct {
+	char key[SOURCE_KEY + 1];
+	int is_text;
+	uint64_t records;
+	uint64_t bytes;          // bytes on the link, including framing / '\n'
+	uint64_t binary_bytes;   // estimated bytes if the record was a binary frame
+	uint64_t window_records; // in the current time window
+	uint64_t window_bytes;
+} source_t;
+
+static source_t sources[MAX_SOURCES + 1]; // last entry is "(other)"
+static int source_count;
+static int source_index[MAX_SOURCES * 2]; // open addressing hash table of source numbers + 1
+
+#define WINDOW_TOP    3      // sources per line of the -W report
+
+static uint32_t window_ms = 1000;
+static int window_report;
+static uint32_t baud = 115200;
+static int have_tick;
+static uint32_t first_tick, last_tick;
+static uint32_t window_start;
+static uint64_t window_bytes, window_records;
+static uint64_t peak_window_bytes, peak_window_records;
+static uint32_t peak_window_start;
+static source_t *window_sources[MAX_SOURCES + 1]; // sources seen in the current window
+static int window_source_count;
+static uint64_t total_bytes, total_records, text_records, frame_records;
+
+//=============================================================================
+static source_t *find_source(const char *key, int is_text) {
+//=============================================================================
+	uint32_t h = 2166136261u; // FNV-1a
+	for(const char *k = key; *k; k++) h = (h ^ (uint8_t)*k) * 16777619u;
+	h += is_text;
+	for(uint32_t i = 0; i < MAX_SOURCES * 2; i++) {
+		int *slot = &source_index[(h + i) % (MAX_SOURCES * 2)];
+		if(!*slot) {
+			if(source_count >= MAX_SOURCES) break;
+			source_t *s = &sources[source_count++];
+			snprintf(s->key, sizeof(s->key), "%s", key);
+			s->is_text = is_text;
+			*slot = source_count;
+			return s;
+		}
+		source_t *s = &sources[*slot - 1];
+		if(s->is_text == is_text && !strcmp(s->key, key)) return s;
+	}
+	source_t *other = &sources[MAX_SOURCES];
+	strcpy(other->key, "(other)");
+	return other;
+}
+
+//=============================================================================
+// Parse "(ticks) " prefix of a text line, return offset of the message body
+static uint16_t parse_tick(const record_t *rec, uint32_t *tick, int *valid) {
+//=============================================================================
+	uint16_t pos = 1;
+	uint32_t t = 0;
+	*valid = 0;
+	if(rec->length < 3 || rec->data[0] != '(') return 0;
+	while(pos < rec->length && rec->data[pos] >= '0' && rec->data[pos] <= '9')
+		t = t * 10 + (rec->data[pos++] - '0');
+	if(pos == 1 || pos >= rec->length || rec->data[pos] != ')') return 0;
+	pos++;
+	if(pos < rec->length && rec->data[pos] == ' ') pos++;
+	*tick = t;
+	*valid = 1;
+	return pos;
+}
+
+//=============================================================================
+// Reduce a text body to its cluster key, return the number of numeric fields found
+static int cluster_key(const uint8_t *body, uint16_t length, char *key) {
+//=============================================================================
+	int fields = 0, k = 0;
+	for(uint16_t i = 0; i < length && k < SOURCE_KEY; ) {
+		uint8_t c = body[i];
+		if(c >= '0' && c <= '9') {
+			if(c == '0' && i + 1 < length && (body[i+1] == 'x' || body[i+1] == 'X')) i += 2;
+			while(i < length && isxdigit(body[i])) i++;
+			key[k++] = '#';
+			fields++;
+		} else {
+			key[k++] = (c < ' ' || c > '~') ? '.' : (char)c;
+			i++;
+		}
+	}
+	key[k] = 0;
+	return fields;
+}
+
+//=============================================================================
+// Close the current window: print its line (-W), and clear the per source window counts.
+// Windows without records are not printed.
+static void flush_window(void) {
+//=============================================================================
+	if(window_report && window_records) {
+		source_t *top[WINDOW_TOP] = {0};
+		for(int i = 0; i < window_source_count; i++) {
+			source_t *s = window_sources[i];
+			int j = WINDOW_TOP;
+			while(j > 0 && (!top[j-1] || top[j-1]->window_bytes < s->window_bytes)) {
+				if(j < WINDOW_TOP) top[j] = top[j-1];
+				j--;
+			}
+			if(j < WINDOW_TOP) top[j] = s;
+		}
+		printf("(%u) window %llu records, %llu bytes, %.1f%% of link:", window_start,
+				(unsigned long long)window_records, (unsigned long long)window_bytes,
+				100.0 * window_bytes / (baud / 10.0 * window_ms / 1000.0));
+		for(int j = 0; j < WINDOW_TOP && top[j]; j++)
+			printf("%s %llu B %s", j ? "," : "", (unsigned long long)top[j]->window_bytes, top[j]->key);
+		printf("\n");
+	}
+	for(int i = 0; i < window_source_count; i++)
+		window_sources[i]->window_records = window_sources[i]->window_bytes = 0;
+	window_source_count = 0;
+	window_bytes = window_records = 0;
+}
+
+//=============================================================================
+static void account_window(uint32_t tick, uint64_t bytes, source_t *s) {
+//=============================================================================
+	if(!have_tick) {
+		have_tick = 1;
+		first_tick = last_tick = window_start = tick;
+	}
+	if(tick > last_tick) last_tick = tick;
+	if(tick < window_start) tick = window_start; // out of order record, count it in the current window
+	if(tick - window_start >= window_ms) {
+		flush_window();
+		window_start += (tick - window_start) / window_ms * window_ms;
+	}
+	if(!s->window_records) window_sources[window_source_count++] = s;
+	s->window_records++;
+	s->window_bytes += bytes;
+	window_bytes += bytes;
+	window_records++;
+	if(window_bytes > peak_window_bytes) {
+		peak_window_bytes = window_bytes;
+		peak_window_records = window_records;
+		peak_window_start = window_start;
+	}
+}
+
+//=============================================================================
+static void analyze_record(const record_t *rec) {
+//=============================================================================
+	char key[SOURCE_KEY + 1];
+	uint64_t bytes, binary;
+	uint32_t tick = last_tick;
+	int valid = 0;
+	source_t *s;
+
+	if(rec->is_frame) {
+		const char *name = frame_type_name(rec->type);
+		bytes = binary = rec->length + LOG_FRAME_HEADER_SIZE;
+		if(rec->type == LOG_FRAME_HISTOGRAM && rec->length > 4)
+			snprintf(key, sizeof(key), "[%s %s]", name, histo_label(rec->data[4]));
+		else
+			snprintf(key, sizeof(key), "[%s %u]", name, rec->type);
+		if((rec->type == LOG_FRAME_METRICS || rec->type == LOG_FRAME_HISTOGRAM ||
+				rec->type == LOG_FRAME_ASSERT) && rec->length >= 4) {
+			tick = log_get_u32(rec->data);
+			valid = 1;
+		}
+		frame_records++;
+		s = find_source(key, 0);
+	} else {
+		uint16_t body = parse_tick(rec, &tick, &valid);
+		int fields = cluster_key(&rec->data[body], rec->length - body, key);
+		bytes = rec->length + 1;
+		binary = LOG_FRAME_HEADER_SIZE + 2 + 4 + 3 * fields;
+		if(binary > bytes) binary = bytes;
+		text_records++;
+		s = find_source(key, 1);
+	}
+	if(valid || have_tick) account_window(tick, bytes, s);
+
+	s->records++;
+	s->bytes += bytes;
+	s->binary_bytes += binary;
+	total_records++;
+	total_bytes += bytes;
+}
+
+//=============================================================================
+static int compare_sources(const void *a, const void *b) {
+//=============================================================================
+	const source_t *sa = a, *sb = b;
+	return (sa->bytes < sb->bytes) - (sa->bytes > sb->bytes);
+}
+
+//=============================================================================
+static void print_analysis(void) {
+//=============================================================================
+	double seconds = have_tick && last_tick > first_tick ? (last_tick - first_tick) / 1000.0 : 0.0;
+	double link = baud / 10.0; // bytes per second, 8N1
+	uint64_t saving = 0;
+	int n = source_count;
+
+	flush_window(); // the last one, before the sources are sorted
+	if(window_report && have_tick) printf("\n");
+	if(sources[MAX_SOURCES].records) sources[n++] = sources[MAX_SOURCES];
+	qsort(sources, n, sizeof(sources[0]), compare_sources);
+
+	printf("records %llu (text %llu, binary %llu), bytes %llu, duration %.1f s\n",
+			(unsigned long long)total_records, (unsigned long long)text_records,
+			(unsigned long long)frame_records, (unsigned long long)total_bytes, seconds);
+	if(seconds > 0)
+		printf("average %.0f B/s (%.1f%% of %u baud), %.1f records/s\n",
+				total_bytes / seconds, 100.0 * total_bytes / seconds / link, baud, total_records / seconds);
+	if(peak_window_bytes)
+		printf("busiest %u ms window at tick %u: %llu records, %llu bytes (%.1f%% of link)\n",
+				window_ms, peak_window_start, (unsigned long long)peak_window_records,
+				(unsigned long long)peak_window_bytes, 100.0 * peak_window_bytes / (link * window_ms / 1000.0));
+	printf("\n%6s %10s %12s %6s %10s %12s  %s\n", "rank", "records", "bytes", "%", "B/s", "save(bin)", "source");
+	for(int i = 0; i < n; i++) {
+		source_t *s = &sources[i];
+		uint64_t save = s->is_text ? s->bytes - s->binary_bytes : 0;
+		saving += save;
+		if(i < 50)
+			printf("%6d %10llu %12llu %6.2f %10.1f %12llu  %s\n", i + 1,
+					(unsigned long long)s->records, (unsigned long long)s->bytes,
+					100.0 * s->bytes / (total_bytes ? total_bytes : 1),
+					seconds > 0 ? s->bytes / seconds : 0.0, (unsigned long long)save, s->key);
+	}
+	printf("\nestimated saving if all text sources moved to binary frames: %llu bytes (%.1f%%)\n",
+			(unsigned long long)saving, 100.0 * saving / (total_bytes ? total_bytes : 1));
+}
+
+//=============================================================================
+static void decode_record(const record_t *rec) {
+//=============================================================================
+	if(mode == MODE_ANALYZE) {
+		analyze_record(rec);
+		if(!rec->is_frame) return; // descriptor frames are still decoded, for source names
+	}
+	if(!rec->is_frame || rec->type != LOG_FRAME_HISTOGRAM)
+		flush_histo_interval();
+	if(!rec->is_frame) {
+		if(mode == MODE_TEXT) printf("%s\n", (const char *)rec->data);
+		if(mode == MODE_JSON) print_text_json(rec);
+		return;
+	}
+	switch(rec->type) {
+	case LOG_FRAME_METRIC_DESC: decode_metric_desc(rec); break;
+	case LOG_FRAME_METRICS:     decode_metrics(rec); break;
+	case LOG_FRAME_HISTO_DESC:  decode_histo_desc(rec); break;
+	case LOG_FRAME_HISTOGRAM:   decode_histogram(rec); break;
+	case LOG_FRAME_ASSERT_DESC: decode_assert_desc(rec); break;
+	case LOG_FRAME_ASSERT:      decode_assert(rec); break;
+	case LOG_FRAME_STATE_DESC:  decode_state_desc(rec); break;
+	case LOG_FRAME_STATE:       decode_state(rec); break;
+	case LOG_FRAME_KEY:         decode_key(rec); break;
+	case LOG_FRAME_KV:          decode_kv(rec); break;
+	case LOG_FRAME_EVENTS:      decode_events(rec); break;
+	case LOG_FRAME_TRACE_SYNC:  decode_trace_sync(rec); break;
+	case LOG_FRAME_BLOB:        decode_blob(rec); break;
+	default:
+		if(mode == MODE_TEXT) printf("[frame type %u, %u bytes]\n", rec->type, rec->length);
+		break;
+	}
+}
+
+//=============================================================================
+int main(int argc, char *argv[]) {
+//=============================================================================
+	static record_t rec;
+	FILE *in = stdin;
+	int opt;
+
+	while((opt = getopt(argc, argv, "mHasjWw:b:")) != -1) {
+		switch(opt) {
+		case 'm': mode = MODE_METRICS; break;
+		case 'H': mode = MODE_HISTO; break;
+		case 'a': mode = MODE_ANALYZE; break;
+		case 's': mode = MODE_STATE; break;
+		case 'j': mode = MODE_JSON; break;
+		case 'W': window_report = 1; break;
+		case 'w': window_ms = strtoul(optarg, NULL, 0); if(!window_ms) window_ms = 1; break;
+		case 'b': baud = strtoul(optarg, NULL, 0); if(!baud) baud = 115200; break;
+		default:
+			fprintf(stderr, "usage: %s [-m|-H|-a|-s|-j] [-W] [-w window-ms] [-b baud] [capture-file]\n", argv[0]);
+			return 1;
+		}
+	}
+	if(optind < argc) {
+		in = fopen(argv[optind], "rb");
+		if(!in) {
+			perror(argv[optind]);
+			return 1;
+		}
+	}
+
+	if(mode == MODE_METRICS) printf("tick,metric,value\n");
+	while(read_record(in, &rec))
+		decode_record(&rec);
+	flush_histo_interval();
+
+	if(mode == MODE_ANALYZE)
+		print_analysis();
+	if(mode == MODE_STATE)
+		print_state_summary();
+	if(mode == MODE_HISTO) {
+		printf("Summary of capture:\n");
+		for(int id = 0; id < 256; id++)
+			print_histo(0, id, &histo_total[id]);
+	}
+
+	return 0;
+}
@@ -0,0 +1,389 @@
+// Tool: logparse.cpp
+//
+// Fast parser for logger text captures: "(ticks) text\n" lines, as written by logmsg(), with binary
+// frames (Core/Src/log_frame.h) skipped.  Newline and ')' positions are found 64 bytes at a time with
+// SSE2 or AVX2 compares (bit masks), the tick field is converted with SSE2 multiply-adds.
+//
+// Build: c++ -O2 -std=c++17 -Wall -I../Core/Src -o logparse logparse.cpp
+// Usage: logparse [-c | -i index-file | -n] [-S] capture
+//   -c (default)   CSV on stdout: tick,flags,"text"
+//   -i index-file  binary index, see index_header_t / index_entry_t below
+//   -n             parse only, print the statistics
+//   -S             use SSE2 even if the CPU has AVX2 (for comparison)
+// Statistics (lines, bad lines, frames, MB/s) go to stderr.
+//
+// Damaged input is not an error: a line without a valid "(digits) " prefix is reported with
+// FLAG_BAD_PREFIX and the tick of the previous line, a last line without '\n' gets FLAG_TRUNCATED,
+// lines longer than the target ever sends (merged by a lost '\n') get FLAG_LONG.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#else
+#define HAVE_X86 0
+#endif
+#include "log_frame.h"
+
+#define MAX_TARGET_LINE  128   // LOG_ITEM_MAX_SIZE
+
+enum : uint8_t {
+	FLAG_BAD_PREFIX = 0x01,
+	FLAG_TRUNCATED  = 0x02,
+	FLAG_LONG       = 0x04,
+};
+
+// Index file: header, then one entry per text line, little endian
+struct index_header_t {
+	char magic[4];        // "LGIX"
+	uint32_t version;     // 1
+	uint64_t count;       // entries
+};
+struct index_entry_t {
+	uint64_t offset;      // of the line in the capture ('(' of the prefix)
+	uint32_t tick;
+	uint16_t length;      // line length without '\n' (saturates at 65535)
+	uint8_t flags;
+	uint8_t text;         // offset of the text within the line (after "(ticks) ")
+};
+static_assert(sizeof(index_entry_t) == 16, "index entry layout");
+
+//=============================================================================
+// Bit masks of '\n' and ')' for 64 byte blocks
+//=============================================================================
+struct block_masks_t {
+	uint64_t newline;
+	uint64_t paren;
+};
+
+typedef void (*mask_fn_t)(const char *p, block_masks_t *m);
+
+static void masks_scalar(const char *p, size_t n, block_masks_t *m) {
+	m->newline = m->paren = 0;
+	for(size_t i = 0; i < n; i++) {
+		if(p[i] == '\n') m->newline |= 1ull << i;
+		else if(p[i] == ')') m->paren |= 1ull << i;
+	}
+}
+
+#if HAVE_X86
+static void masks_sse2(const char *p, block_masks_t *m) {
+	const __m128i nl = _mm_set1_epi8('\n'), cp = _mm_set1_epi8(')');
+	uint64_t n = 0, c = 0;
+	for(int i = 0; i < 4; i++) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(p + 16 * i));
+		n |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)) << (16 * i);
+		c |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, cp)) << (16 * i);
+	}
+	m->newline = n;
+	m->paren = c;
+}
+
+__attribute__((target("avx2")))
+static void masks_avx2(const char *p, block_masks_t *m) {
+	const __m256i nl = _mm256_set1_epi8('\n'), cp = _mm256_set1_epi8(')');
+	__m256i a = _mm256_loadu_si256((const __m256i *)p);
+	__m256i b = _mm256_loadu_si256((const __m256i *)(p + 32));
+	m->newline = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, nl)) |
+			(uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(b, nl)) << 32;
+	m->paren = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, cp)) |
+			(uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(b, cp)) << 32;
+}
+#else
+static void masks_generic(const char *p, block_masks_t *m) { masks_scalar(p, 64, m); }
+#endif
+
+//=============================================================================
+// Finds the next '\n' or ')' at or after a position, computing the masks of each block once
+//=============================================================================
+class scanner_t {
+public:
+	scanner_t(const char *buf, size_t size, mask_fn_t fn) : buf_(buf), size_(size), fn_(fn) { load(0); }
+
+	// Position of the next '\n' at or after pos, size if none
+	size_t next_newline(size_t pos) { return next(pos, &block_masks_t::newline); }
+	// Position of the next ')' at or after pos, before limit (returns limit if none)
+	size_t next_paren(size_t pos, size_t limit) {
+		size_t p = next(pos, &block_masks_t::paren);
+		return p < limit ? p : limit;
+	}
+
+private:
+	size_t next(size_t pos, uint64_t block_masks_t::*which) {
+		while(pos < size_) {
+			if(pos < base_ || pos >= base_ + 64) load(pos & ~(size_t)63);
+			uint64_t m = masks_.*which & (~0ull << (pos - base_));
+			if(m) return base_ + __builtin_ctzll(m);
+			pos = base_ + 64;
+		}
+		return size_;
+	}
+	void load(size_t base) {
+		base_ = base;
+		if(base + 64 <= size_) fn_(buf_ + base, &masks_);
+		else masks_scalar(buf_ + base, base < size_ ? size_ - base : 0, &masks_);
+	}
+
+	const char *buf_;
+	size_t size_;
+	mask_fn_t fn_;
+	size_t base_ = 0;
+	block_masks_t masks_;
+};
+
+//=============================================================================
+// Tick field: n (1..16) digits ending before end.  Returns false if they aren't all digits.
+//=============================================================================
+static bool parse_digits_scalar(const char *end, int n, uint64_t *value) {
+	uint64_t v = 0;
+	for(const char *p = end - n; p < end; p++) {
+		unsigned d = (unsigned char)*p - '0';
+		if(d > 9) return false;
+		v = v * 10 + d;
+	}
+	*value = v;
+	return true;
+}
+
+#if HAVE_X86
+// 16 byte load ending at end, so the digits are right aligned; the bytes before them are masked off.
+// Needs 16 readable bytes before end.
+static bool parse_digits_sse2(const char *end, int n, uint64_t *value) {
+	static const uint8_t ones[32] = {
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+		0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	};
+	__m128i keep = _mm_loadu_si128((const __m128i *)(ones + n)); // last n bytes set
+	__m128i v = _mm_sub_epi8(_mm_loadu_si128((const __m128i *)(end - 16)), _mm_set1_epi8('0'));
+	v = _mm_and_si128(v, keep);
+	const __m128i nine = _mm_set1_epi8(9);
+	if(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(v, nine), nine)) != 0xFFFF) return false;
+
+	// Pairs of digits (even byte is the more significant), then pairs of pairs
+	__m128i hi = _mm_and_si128(v, _mm_set1_epi16(0x00FF));
+	__m128i lo = _mm_srli_epi16(v, 8);
+	__m128i d2 = _mm_add_epi16(_mm_mullo_epi16(hi, _mm_set1_epi16(10)), lo);   // 8 x 0..99
+	__m128i d4 = _mm_madd_epi16(d2, _mm_set1_epi32(0x00010064));               // 4 x 0..9999
+	uint32_t r[4];
+	_mm_storeu_si128((__m128i *)r, d4);
+	*value = (uint64_t)(r[0] * 10000 + r[1]) * 100000000 + r[2] * 10000 + r[3];
+	return true;
+}
+#endif
+
+//=============================================================================
+// Output
+//=============================================================================
+enum output_mode_t { MODE_CSV, MODE_INDEX, MODE_NONE };
+
+class output_t {
+public:
+	output_t(FILE *f) : f_(f), buf_(1 << 20) { }
+	~output_t() { flush(); }
+	void put(const char *p, size_t n) {
+		if(used_ + n > buf_.size()) {
+			flush();
+			if(n > buf_.size()) buf_.resize(n);
+		}
+		memcpy(&buf_[used_], p, n);
+		used_ += n;
+	}
+	void put(char c) { put(&c, 1); }
+	void flush() {
+		if(used_ && f_) fwrite(buf_.data(), 1, used_, f_);
+		used_ = 0;
+	}
+private:
+	FILE *f_;
+	std::vector<char> buf_;
+	size_t used_ = 0;
+};
+
+static void csv_line(output_t &out, uint32_t tick, uint8_t flags, const char *text, size_t len) {
+	char num[24];
+	char *p0 = num + sizeof(num);
+	*--p0 = '"';
+	*--p0 = ',';
+	*--p0 = (char)('0' + flags % 10); // flags < 10
+	*--p0 = ',';
+	do {
+		*--p0 = (char)('0' + tick % 10);
+		tick /= 10;
+	} while(tick);
+	out.put(p0, num + sizeof(num) - p0);
+	const char *p = text, *end = text + len;
+	while(p < end) { // double the quotes
+		const char *q = (const char *)memchr(p, '"', end - p);
+		if(!q) {
+			out.put(p, end - p);
+			break;
+		}
+		out.put(p, q + 1 - p);
+		out.put('"');
+		p = q + 1;
+	}
+	out.put("\"\n", 2);
+}
+
+//=============================================================================
+int main(int argc, char **argv) {
+//=============================================================================
+	output_mode_t mode = MODE_CSV;
+	const char *index_name = nullptr;
+	int opt;
+	bool force_sse2 = false;
+	while((opt = getopt(argc, argv, "ci:nS")) != -1) {
+		switch(opt) {
+		case 'c': mode = MODE_CSV; break;
+		case 'i': mode = MODE_INDEX; index_name = optarg; break;
+		case 'n': mode = MODE_NONE; break;
+		case 'S': force_sse2 = true; break;
+		default:
+			fprintf(stderr, "usage: logparse [-c | -i index-file | -n] [-S] capture\n");
+			return 1;
+		}
+	}
+	if(optind >= argc) {
+		fprintf(stderr, "usage: logparse [-c | -i index-file | -n] [-S] capture\n");
+		return 1;
+	}
+
+	int fd = open(argv[optind], O_RDONLY);
+	struct stat st;
+	if(fd < 0 || fstat(fd, &st)) {
+		perror(argv[optind]);
+		return 1;
+	}
+	size_t size = (size_t)st.st_size;
+	const char *buf = "";
+	if(size) {
+		void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(map == MAP_FAILED) {
+			perror("mmap");
+			return 1;
+		}
+		madvise(map, size, MADV_SEQUENTIAL);
+		buf = (const char *)map;
+	}
+
+	mask_fn_t masks;
+	const char *isa;
+#if HAVE_X86
+	if(!force_sse2 && __builtin_cpu_supports("avx2")) {
+		masks = masks_avx2;
+		isa = "avx2";
+	} else {
+		masks = masks_sse2;
+		isa = "sse2";
+	}
+#else
+	(void)force_sse2;
+	masks = masks_generic;
+	isa = "scalar";
+#endif
+
+	FILE *index_file = nullptr;
+	if(mode == MODE_INDEX) {
+		index_file = fopen(index_name, "wb");
+		if(!index_file) {
+			perror(index_name);
+			return 1;
+		}
+		index_header_t h = { { 'L', 'G', 'I', 'X' }, 1, 0 };
+		fwrite(&h, sizeof(h), 1, index_file); // count is filled in at the end
+	}
+	output_t out(mode == MODE_CSV ? stdout : index_file);
+
+	auto t0 = std::chrono::steady_clock::now();
+	scanner_t scan(buf, size, masks);
+	uint64_t lines = 0, bad = 0, truncated = 0, frames = 0, frame_bytes = 0;
+	uint32_t tick = 0;
+	size_t pos = 0;
+
+	while(pos < size) {
+		// Binary frames can hold any byte, including '\n': skip them as a whole
+		if((uint8_t)buf[pos] == LOG_FRAME_SYNC) {
+			if(pos + LOG_FRAME_HEADER_SIZE <= size) {
+				size_t len = LOG_FRAME_HEADER_SIZE + (uint8_t)buf[pos + 2];
+				if(pos + len <= size) {
+					frames++;
+					frame_bytes += len;
+					pos += len;
+					continue;
+				}
+			}
+			pos = size; // truncated frame at the end of the capture
+			break;
+		}
+
+		size_t nl = scan.next_newline(pos);
+		uint8_t flags = 0;
+		if(nl == size) flags |= FLAG_TRUNCATED;
+		if(nl - pos > MAX_TARGET_LINE) flags |= FLAG_LONG;
+
+		// "(digits) "
+		size_t text = pos;
+		bool ok = false;
+		if(buf[pos] == '(') {
+			size_t close = scan.next_paren(pos + 1, nl < pos + 18 ? nl : pos + 18);
+			int n = (int)(close - pos - 1);
+			if(close < nl && n >= 1 && n <= 10) { // "(%lu) ": a 32-bit tick has at most 10 digits
+				uint64_t v;
+#if HAVE_X86
+				ok = (close >= 16) ? parse_digits_sse2(buf + close, n, &v) : parse_digits_scalar(buf + close, n, &v);
+#else
+				ok = parse_digits_scalar(buf + close, n, &v);
+#endif
+				if(ok && v > UINT32_MAX) ok = false; // merged or corrupt digits
+				if(ok) {
+					tick = (uint32_t)v;
+					text = close + 1;
+					if(text < nl && buf[text] == ' ') text++;
+				}
+			}
+		}
+		if(!ok) {
+			flags |= FLAG_BAD_PREFIX;
+			bad++;
+		}
+		if(flags & FLAG_TRUNCATED) truncated++;
+		lines++;
+
+		if(mode == MODE_CSV) {
+			csv_line(out, tick, flags, buf + text, nl - text);
+		} else if(mode == MODE_INDEX) {
+			index_entry_t e;
+			e.offset = pos;
+			e.tick = tick;
+			e.length = nl - pos > 0xFFFF ? 0xFFFF : (uint16_t)(nl - pos);
+			e.flags = flags;
+			e.text = text - pos > 0xFF ? 0xFF : (uint8_t)(text - pos);
+			out.put((const char *)&e, sizeof(e));
+		}
+		pos = nl + 1;
+	}
+	out.flush();
+
+	if(index_file) {
+		fseek(index_file, offsetof(index_header_t, count), SEEK_SET);
+		fwrite(&lines, sizeof(lines), 1, index_file);
+		fclose(index_file);
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	fprintf(stderr, "%s: %llu lines (%llu bad prefix, %llu truncated), %llu frames (%llu bytes), %.1f MB in %.3f s, %.0f MB/s\n",
+			isa, (unsigned long long)lines, (unsigned long long)bad, (unsigned long long)truncated,
+			(unsigned long long)frames, (unsigned long long)frame_bytes, size / 1e6, seconds,
+			seconds > 0 ? size / 1e6 / seconds : 0);
+	return 0;
+}
@@ -0,0 +1,313 @@
+// Tool: logplan.c
+//
+// Capacity planner for the logger queue: picks LOG_DMA_BUFFER_SIZE, LOG_ENGINE (log.h) and the UART baud
+// rate for a target drop probability and latency, from the traffic of a capture or from per tag statistics.
+//
+// Build: cc -O2 -Wall -I../Core/Src -o logplan logplan.c -lm
+// Usage: logplan [-p drop%] [-l latency-ms] [-b baud,...] [-m max-bytes] [-g dma-gap-us] [-c compose-us] [-C] capture-file
+//        logplan -s stats-file [-t seconds] [options as above]
+//
+// The arrivals are replayed through the queue engine model shared with Tools/engine_bench.c (queue_model.h):
+// an item that doesn't fit is dropped whole (log_enqueue()), a circular DMA transfer stops at the end of the
+// buffer, pingpong stores into half the buffer.  Buffer sizes from 256 bytes to -m, at each baud rate (-b).
+// * capture: every text line and binary frame is an item of its length on the link, arriving at its
+//   "(ticks)" time (frames without a time take the last one).  Items of the same millisecond arrive back
+//   to back, one per compose time (-c).  Items the target dropped aren't in the capture: plan from one
+//   taken with a large buffer at a high baud rate (log.dropped stays 0), or the load is under-estimated.
+// * stats file: one line per tag, "name items/s mean-bytes [max-bytes [burst]]" (ex: items and bytes
+//   of the top talkers report over its interval).  Bursts of items arrive at exponential intervals, sizes
+//   are uniform from 2 * mean - max to max.  '#' starts a comment.
+// Output: drop% and latency (logmsg() to the last byte on the wire) against the buffer size, per engine
+// and baud rate (-C: as CSV, for plotting), then the smallest buffer meeting the targets (-p, -l) at each
+// baud rate, and the pick: the lowest baud rate with a buffer that meets them, its smallest buffer.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "log_frame.h"
+#include "queue_model.h"
+
+#define MAX_LINE   4096
+#define MIN_BUFFER 256
+#define MAX_BAUDS  16
+
+typedef struct {
+	double time;       // us
+	uint16_t bytes;
+} arrival_t;
+
+typedef struct {
+	double drop;       // % of the items
+	double p50, p99;   // latency, ms
+	double peak;       // most bytes in use, % of the buffer
+} result_t;
+
+static arrival_t *arrivals;
+static size_t arrival_count, arrival_cap;
+static uint64_t offered_bytes;
+
+static double compose_us = 20;
+static int csv;
+
+//=============================================================================
+static void add_arrival(double time, uint32_t bytes) {
+//=============================================================================
+	if(arrival_count == arrival_cap) {
+		arrival_cap = arrival_cap ? arrival_cap * 2 : 65536;
+		arrivals = realloc(arrivals, arrival_cap * sizeof(*arrivals));
+		if(!arrivals) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+	}
+	arrivals[arrival_count].time = time;
+	arrivals[arrival_count].bytes = (uint16_t)bytes;
+	arrival_count++;
+	offered_bytes += bytes;
+}
+
+//=============================================================================
+// Next record of a capture (as logdecode.c): its length on the link, and its tick if it has one
+static int read_record(FILE *in, uint32_t *bytes, uint32_t *tick) {
+//=============================================================================
+	static uint8_t data[MAX_LINE + 1];
+	int c = getc(in);
+	if(c == EOF) return 0;
+
+	if(c == LOG_FRAME_SYNC) {
+		int type = getc(in);
+		int length = getc(in);
+		if(type == EOF || length == EOF || fread(data, 1, length, in) != (size_t)length) return 0;
+		*bytes = LOG_FRAME_HEADER_SIZE + length;
+		if((type == LOG_FRAME_METRICS || type == LOG_FRAME_HISTOGRAM || type == LOG_FRAME_ASSERT) && length >= 4)
+			*tick = log_get_u32(data);
+		return 1;
+	}
+
+	uint32_t length = 0;
+	while(c != EOF && c != '\n') {
+		if(length < MAX_LINE) data[length] = (uint8_t)c;
+		length++;
+		c = getc(in);
+	}
+	*bytes = length + 1;
+	// "(ticks) " prefix
+	uint32_t pos = 1, t = 0;
+	if(length < 3 || data[0] != '(') return 1;
+	while(pos < length && pos < MAX_LINE && data[pos] >= '0' && data[pos] <= '9') t = t * 10 + (data[pos++] - '0');
+	if(pos == 1 || pos >= length || data[pos] != ')') return 1;
+	*tick = t;
+	return 1;
+}
+
+//=============================================================================
+static int load_capture(const char *file) {
+//=============================================================================
+	FILE *in = fopen(file, "rb");
+	if(!in) {
+		perror(file);
+		return -1;
+	}
+	uint32_t bytes, tick = 0;
+	double last = -compose_us;
+	while(read_record(in, &bytes, &tick)) {
+		// Same millisecond, or time going back (reset): right after the previous item
+		double t = tick * 1000.0;
+		if(t < last + compose_us) t = last + compose_us;
+		add_arrival(t, bytes);
+		last = t;
+	}
+	fclose(in);
+	return 0;
+}
+
+static double urand(void) { return (rand() + 0.5) / ((double)RAND_MAX + 1); }
+
+//=============================================================================
+static int compare_arrivals(const void *a, const void *b) {
+//=============================================================================
+	double x = ((const arrival_t *)a)->time, y = ((const arrival_t *)b)->time;
+	return x < y ? -1 : x > y;
+}
+
+//=============================================================================
+static int load_stats(const char *file, double seconds) {
+//=============================================================================
+	FILE *in = fopen(file, "r");
+	if(!in) {
+		perror(file);
+		return -1;
+	}
+	char line[MAX_LINE];
+	unsigned tags = 0, number = 0;
+	srand(12345);
+	while(fgets(line, sizeof(line), in)) {
+		number++;
+		char *comment = strchr(line, '#');
+		if(comment) *comment = 0;
+		char name[64];
+		double rate, mean, max = 0;
+		int burst = 1;
+		int n = sscanf(line, "%63s %lf %lf %lf %d", name, &rate, &mean, &max, &burst);
+		if(n <= 0) continue;
+		if(n < 3 || rate <= 0 || mean < 1 || burst < 1) {
+			fprintf(stderr, "%s:%u: expected \"name items/s mean-bytes [max-bytes [burst]]\"\n", file, number);
+			fclose(in);
+			return -1;
+		}
+		if(max < mean) max = mean;
+		double min = 2 * mean - max < 1 ? 1 : 2 * mean - max;
+		if(!csv) printf("tag %-12s %8.1f items/s, %5.1f bytes (%.0f-%.0f), bursts of %d\n", name, rate, mean, min, max, burst);
+		for(double t = -log(urand()) * burst / rate * 1e6; t < seconds * 1e6; t += -log(urand()) * burst / rate * 1e6)
+			for(int m = 0; m < burst; m++)
+				add_arrival(t + m * compose_us, (uint32_t)(min + urand() * (max - min) + 0.5));
+		tags++;
+	}
+	fclose(in);
+	if(!tags) {
+		fprintf(stderr, "%s: no tags\n", file);
+		return -1;
+	}
+	qsort(arrivals, arrival_count, sizeof(*arrivals), compare_arrivals);
+	return 0;
+}
+
+//=============================================================================
+static int compare_double(const void *a, const void *b) {
+//=============================================================================
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+//=============================================================================
+static result_t simulate(engine_t engine, uint32_t size) {
+//=============================================================================
+	sim_t s;
+	sim_init(&s, engine, size);
+	for(size_t i = 0; i < arrival_count; i++) {
+		while(s.dma_count && s.dma_done <= arrivals[i].time) complete(&s);
+		enqueue(&s, arrivals[i].time, arrivals[i].bytes);
+	}
+	while(s.dma_count) complete(&s);
+
+	result_t r = { 0 };
+	r.drop = arrival_count ? 100.0 * s.dropped / arrival_count : 0;
+	r.peak = 100.0 * s.peak_used / size;
+	if(s.latencies) {
+		qsort(s.latency, s.latencies, sizeof(double), compare_double);
+		r.p50 = s.latency[s.latencies / 2] / 1000;
+		r.p99 = s.latency[(size_t)(s.latencies * 0.99)] / 1000;
+	}
+	sim_free(&s);
+	return r;
+}
+
+//=============================================================================
+int main(int argc, char *argv[]) {
+//=============================================================================
+	static const char usage[] = "usage: logplan [-p drop%] [-l latency-ms] [-b baud,...] [-m max-bytes] "
+			"[-g dma-gap-us] [-c compose-us] [-C] {capture-file | -s stats-file [-t seconds]}\n";
+	double target_drop = 0.1, target_ms = 100, seconds = 60;
+	double bauds[MAX_BAUDS] = { 115200, 230400, 460800, 921600 };
+	int baud_count = 4;
+	uint32_t max_size = 32768;
+	const char *stats = NULL;
+	gap_us = 5;
+	int opt;
+	while((opt = getopt(argc, argv, "p:l:b:m:g:c:s:t:C")) != -1) {
+		switch(opt) {
+		case 'p': target_drop = atof(optarg); break;
+		case 'l': target_ms = atof(optarg); break;
+		case 'b':
+			baud_count = 0;
+			for(char *p = optarg; *p && baud_count < MAX_BAUDS; p += *p == ',') {
+				bauds[baud_count] = strtod(p, &p);
+				if(bauds[baud_count] <= 0) break;
+				baud_count++;
+			}
+			break;
+		case 'm': max_size = (uint32_t)strtoul(optarg, NULL, 0); break;
+		case 'g': gap_us = atof(optarg); break;
+		case 'c': compose_us = atof(optarg); break;
+		case 's': stats = optarg; break;
+		case 't': seconds = atof(optarg); break;
+		case 'C': csv = 1; break;
+		default:
+			fputs(usage, stderr);
+			return 2;
+		}
+	}
+	if(!baud_count || max_size < MIN_BUFFER || max_size > 65535 || (!stats && optind >= argc)) {
+		fputs(usage, stderr);
+		return 2;
+	}
+	if(stats ? load_stats(stats, seconds) : load_capture(argv[optind])) return 1;
+	if(!arrival_count) {
+		fprintf(stderr, "no log items\n");
+		return 1;
+	}
+	double duration = (arrivals[arrival_count - 1].time - arrivals[0].time) / 1e6;
+	if(duration <= 0) duration = 1e-3;
+	if(!csv) {
+		printf("%zu items, %llu bytes over %.1f s: %.0f B/s offered, %.1f us per DMA start, %.0f us compose\n",
+				arrival_count, (unsigned long long)offered_bytes, duration, offered_bytes / duration, gap_us, compose_us);
+		printf("targets: drop <= %.3f%%, p99 latency <= %.1f ms, buffer <= %u bytes\n", target_drop, target_ms, max_size);
+	} else {
+		printf("engine,baud,buffer,drop_pct,lat_p50_ms,lat_p99_ms,peak_pct\n");
+	}
+
+	static const char * const engine_names[] = { "circular", "pingpong" };
+	uint32_t best[MAX_BAUDS][2] = { { 0 } };
+	for(int b = 0; b < baud_count; b++) {
+		byte_us = 10 * 1e6 / bauds[b];
+		for(int e = ENGINE_CIRCULAR; e <= ENGINE_PINGPONG; e++) {
+			if(!csv) {
+				printf("\n%s, %.0f baud (offered load %.1f%% of the link)\n", engine_names[e], bauds[b],
+						100.0 * offered_bytes / duration * byte_us / 1e6);
+				printf("%8s %8s %10s %10s %6s\n", "buffer", "drop%", "lat p50", "lat p99", "peak%");
+			}
+			for(uint32_t size = MIN_BUFFER; size <= max_size; size *= 2) {
+				result_t r = simulate(e, size);
+				int meets = r.drop <= target_drop && r.p99 <= target_ms;
+				if(meets && !best[b][e]) best[b][e] = size;
+				if(csv)
+					printf("%s,%.0f,%u,%.4f,%.3f,%.3f,%.1f\n", engine_names[e], bauds[b], size, r.drop, r.p50, r.p99, r.peak);
+				else
+					printf("%8u %8.3f %10.2f %10.2f %6.1f%s\n", size, r.drop, r.p50, r.p99, r.peak, meets ? "  ok" : "");
+				if(size > max_size / 2) break;
+			}
+		}
+	}
+	if(csv) return 0;
+
+	printf("\nsmallest buffer meeting the targets\n%10s %10s %10s\n", "baud", "circular", "pingpong");
+	int pick_baud = -1, pick_engine = 0;
+	for(int b = 0; b < baud_count; b++) {
+		printf("%10.0f", bauds[b]);
+		for(int e = ENGINE_CIRCULAR; e <= ENGINE_PINGPONG; e++) {
+			if(best[b][e]) printf(" %10u", best[b][e]);
+			else printf(" %10s", "-");
+		}
+		printf("\n");
+		// Lowest baud rate first, then least RAM (circular on a tie: it uses all of it)
+		for(int e = ENGINE_CIRCULAR; e <= ENGINE_PINGPONG; e++) {
+			if(!best[b][e]) continue;
+			if(pick_baud < 0 || (bauds[b] < bauds[pick_baud]) ||
+					(bauds[b] == bauds[pick_baud] && best[b][e] < best[pick_baud][pick_engine])) {
+				pick_baud = b;
+				pick_engine = e;
+			}
+		}
+	}
+	if(pick_baud < 0) {
+		printf("\nno configuration meets the targets: raise -m, the baud rates (-b) or the targets\n");
+		return 1;
+	}
+	printf("\npick: %s, LOG_DMA_BUFFER_SIZE %u, %.0f baud\n",
+			pick_engine == ENGINE_CIRCULAR ? "LOG_ENGINE_CIRCULAR" : "LOG_ENGINE_PINGPONG",
+			best[pick_baud][pick_engine], bauds[pick_baud]);
+	return 0;
+}
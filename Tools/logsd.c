@@ -0,0 +1,264 @@
+// Tool: logsd.c
+//
+// Host stand-in for the SD card sink: runs Core/Src/logfs.c on a file backed block device.
+//
+// Build: cc -O2 -Wall -I../Core/Src -o logsd logsd.c ../Core/Src/logfs.c
+// Usage:
+//   logsd format <image> <sectors>      create an image file holding an empty log
+//   logsd write <image> [-c N]          append stdin to the log, like the target sink does
+//                                       (-c N: simulate power loss during the Nth sector write)
+//   logsd info <image>                  read-only mount (recovering the end of the log), print its state
+//   logsd dump <image>                  read-only mount, write the logged stream to stdout (pipe into logdecode)
+//   logsd crashtest [iterations]        power loss recovery test, see crashtest()
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "logfs.h"
+
+#define BATCH_SECTORS  4   // same as LOG_SD_BATCH_SECTORS on the target
+
+//=============================================================================
+// File backed block device.  A simulated power loss tears the sector being written
+// (only its first part reaches the file), and fails every later write.
+//=============================================================================
+typedef struct {
+	int fd;
+	long crash_after;    // sector writes left before power loss, -1: never
+	int crashed;
+	uint32_t sectors_written;
+} filedev_t;
+
+static int file_read(blockdev_t *dev, uint32_t sector, uint8_t *buf, uint32_t count) {
+	filedev_t *f = dev->ctx;
+	size_t len = (size_t)count * BLOCKDEV_SECTOR_SIZE;
+	if(sector + count > dev->sectors) return -1;
+	return pread(f->fd, buf, len, (off_t)sector * BLOCKDEV_SECTOR_SIZE) == (ssize_t)len ? 0 : -1;
+}
+
+static int file_write(blockdev_t *dev, uint32_t sector, const uint8_t *buf, uint32_t count) {
+	filedev_t *f = dev->ctx;
+	if(f->crashed || sector + count > dev->sectors) return -1;
+	for(uint32_t i = 0; i < count; i++) {
+		off_t at = (off_t)(sector + i) * BLOCKDEV_SECTOR_SIZE;
+		const uint8_t *p = &buf[i * BLOCKDEV_SECTOR_SIZE];
+		if(f->crash_after == 0) {
+			// Power lost part way through programming this sector
+			if(pwrite(f->fd, p, BLOCKDEV_SECTOR_SIZE / 3, at) < 0) return -1;
+			f->crashed = 1;
+			return -1;
+		}
+		if(f->crash_after > 0) f->crash_after--;
+		if(pwrite(f->fd, p, BLOCKDEV_SECTOR_SIZE, at) != BLOCKDEV_SECTOR_SIZE) return -1;
+		f->sectors_written++;
+	}
+	return 0;
+}
+
+static int file_open(blockdev_t *dev, filedev_t *f, const char *path, int create, uint32_t sectors, int read_only) {
+	memset(f, 0, sizeof(*f));
+	f->crash_after = -1;
+	f->fd = open(path, (read_only ? O_RDONLY : O_RDWR) | (create ? O_CREAT | O_TRUNC : 0), 0644);
+	if(f->fd < 0) {
+		perror(path);
+		return -1;
+	}
+	if(create && ftruncate(f->fd, (off_t)sectors * BLOCKDEV_SECTOR_SIZE)) return -1;
+	dev->read = file_read;
+	dev->write = file_write;
+	dev->pre_erase = NULL;
+	dev->write_start = NULL;
+	dev->write_poll = NULL;
+	dev->ctx = f;
+	dev->sectors = (uint32_t)(lseek(f->fd, 0, SEEK_END) / BLOCKDEV_SECTOR_SIZE);
+	return 0;
+}
+
+//=============================================================================
+// Append a byte stream the way log_sd.c does: fill sector payloads, write batches
+//=============================================================================
+typedef struct {
+	uint8_t sectors[BATCH_SECTORS * BLOCKDEV_SECTOR_SIZE];
+	uint16_t used[BATCH_SECTORS];
+	uint32_t fill;
+} batch_t;
+
+static int batch_flush(logfs_t *fs, batch_t *b) {
+	uint32_t count = b->fill + (b->used[b->fill] ? 1 : 0);
+	int result = count ? logfs_write(fs, b->sectors, b->used, count) : 0;
+	memset(b->used, 0, sizeof(b->used));
+	b->fill = 0;
+	return result;
+}
+
+static int batch_append(logfs_t *fs, batch_t *b, const uint8_t *data, size_t len) {
+	while(len) {
+		if(b->used[b->fill] == LOGFS_PAYLOAD_SIZE) {
+			if(b->fill + 1 < BATCH_SECTORS) b->fill++;
+			else if(batch_flush(fs, b)) return -1;
+			continue;
+		}
+		size_t n = LOGFS_PAYLOAD_SIZE - b->used[b->fill];
+		if(n > len) n = len;
+		memcpy(logfs_payload(&b->sectors[b->fill * BLOCKDEV_SECTOR_SIZE]) + b->used[b->fill], data, n);
+		b->used[b->fill] += n;
+		data += n;
+		len -= n;
+	}
+	return 0;
+}
+
+//=============================================================================
+static int mount_or_complain(logfs_t *fs, blockdev_t *dev, const char *path, int read_only) {
+//=============================================================================
+	if(logfs_mount(fs, dev, read_only) == 0) return 0;
+	fprintf(stderr, "%s: no valid log found (format it first)\n", path);
+	return -1;
+}
+
+//=============================================================================
+// Power loss test: a deterministic stream is written into a small image (so the circular log wraps),
+// power is lost at a random sector write, then the image is mounted again.  The recovered log
+// must hold exactly stream[oldest * payload, next * payload), and must contain every sector that
+// was written before the failing write.  Logging then continues from the recovered end, and the
+// whole cycle repeats a few times on the same image.
+//=============================================================================
+static uint8_t stream_byte(uint64_t pos) {
+	return (uint8_t)((pos * 2654435761u) >> 13);
+}
+
+static int verify(logfs_t *fs, uint64_t *checked) {
+	static uint8_t sector[BLOCKDEV_SECTOR_SIZE];
+	for(uint32_t seq = logfs_oldest_seq(fs); seq < fs->next_seq; seq++) {
+		int used = logfs_read(fs, seq, sector);
+		if(used != LOGFS_PAYLOAD_SIZE) {
+			// A torn sector may be the oldest one: the slot it was going to overwrite
+			if(seq == logfs_oldest_seq(fs)) continue;
+			fprintf(stderr, "seq %u: invalid sector (%d)\n", seq, used);
+			return -1;
+		}
+		for(int i = 0; i < used; i++) {
+			if(logfs_payload(sector)[i] != stream_byte((uint64_t)seq * LOGFS_PAYLOAD_SIZE + i)) {
+				fprintf(stderr, "seq %u: data mismatch at %d\n", seq, i);
+				return -1;
+			}
+		}
+		(*checked)++;
+	}
+	return 0;
+}
+
+static int crashtest(int iterations) {
+	const char *path = "logsd_crashtest.img";
+	uint64_t checked = 0;
+	srand(1);
+	for(int it = 0; it < iterations; it++) {
+		blockdev_t dev;
+		filedev_t f;
+		logfs_t fs;
+		uint32_t sectors = 8 + rand() % 64;
+		if(file_open(&dev, &f, path, 1, sectors, 0) || logfs_format(&fs, &dev)) return 1;
+
+		for(int cycle = 0; cycle < 4; cycle++) {
+			static batch_t b;
+			uint8_t chunk[97];
+			uint64_t pos = (uint64_t)fs.next_seq * LOGFS_PAYLOAD_SIZE;
+			f.crash_after = rand() % (3 * sectors);
+			f.crashed = 0;
+			f.sectors_written = 0;
+			uint32_t start_seq = fs.next_seq;
+			memset(&b, 0, sizeof(b));
+			// Only whole sectors are written by this test, so every sector is full
+			while(!f.crashed) {
+				for(size_t i = 0; i < sizeof(chunk); i++) chunk[i] = stream_byte(pos + i);
+				if(batch_append(&fs, &b, chunk, sizeof(chunk))) break;
+				pos += sizeof(chunk);
+			}
+			// Data sectors confirmed written before the power loss (superblock writes excluded)
+			uint32_t durable = fs.next_seq;
+
+			f.crash_after = -1;
+			f.crashed = 0;
+			if(logfs_mount(&fs, &dev, 0)) {
+				fprintf(stderr, "iteration %d cycle %d: mount failed\n", it, cycle);
+				return 1;
+			}
+			if(fs.next_seq < durable || fs.next_seq > durable + BATCH_SECTORS) {
+				fprintf(stderr, "iteration %d cycle %d: recovered seq %u, expected %u..%u (started %u)\n",
+						it, cycle, fs.next_seq, durable, durable + BATCH_SECTORS, start_seq);
+				return 1;
+			}
+			if(verify(&fs, &checked)) {
+				fprintf(stderr, "iteration %d cycle %d: verify failed\n", it, cycle);
+				return 1;
+			}
+		}
+		close(f.fd);
+	}
+	unlink(path);
+	printf("crashtest: %d iterations passed, %llu sectors verified\n", iterations, (unsigned long long)checked);
+	return 0;
+}
+
+//=============================================================================
+int main(int argc, char *argv[]) {
+//=============================================================================
+	blockdev_t dev;
+	filedev_t f;
+	logfs_t fs;
+
+	if(argc >= 2 && !strcmp(argv[1], "crashtest"))
+		return crashtest(argc >= 3 ? atoi(argv[2]) : 200);
+	if(argc < 3) {
+		fprintf(stderr, "usage: %s format|write|info|dump <image> ... (or crashtest [n])\n", argv[0]);
+		return 1;
+	}
+
+	if(!strcmp(argv[1], "format")) {
+		uint32_t sectors = argc >= 4 ? strtoul(argv[3], NULL, 0) : 2048;
+		if(file_open(&dev, &f, argv[2], 1, sectors, 0) || logfs_format(&fs, &dev)) return 1;
+		printf("%s: %u sectors, %u data sectors\n", argv[2], dev.sectors, fs.data_sectors);
+		return 0;
+	}
+
+	// info and dump only read: a card pulled from a rig is left as it was
+	int read_only = strcmp(argv[1], "write") != 0;
+	if(file_open(&dev, &f, argv[2], 0, 0, read_only) || mount_or_complain(&fs, &dev, argv[2], read_only)) return 1;
+
+	if(!strcmp(argv[1], "write")) {
+		static batch_t b;
+		uint8_t buf[4096];
+		ssize_t n;
+		if(argc >= 5 && !strcmp(argv[3], "-c")) f.crash_after = atol(argv[4]);
+		while((n = read(0, buf, sizeof(buf))) > 0) {
+			if(batch_append(&fs, &b, buf, n)) {
+				fprintf(stderr, "write failed%s\n", f.crashed ? " (simulated power loss)" : "");
+				return 1;
+			}
+		}
+		return batch_flush(&fs, &b) ? 1 : 0;
+	}
+	if(!strcmp(argv[1], "info")) {
+		printf("data sectors %u, boots %u, superblock gen %u\n", fs.data_sectors, fs.boot_count, fs.super_gen);
+		printf("log holds seq %u..%u (%u sectors)\n", logfs_oldest_seq(&fs), fs.next_seq,
+				fs.next_seq - logfs_oldest_seq(&fs));
+		return 0;
+	}
+	if(!strcmp(argv[1], "dump")) {
+		static uint8_t sector[BLOCKDEV_SECTOR_SIZE];
+		for(uint32_t seq = logfs_oldest_seq(&fs); seq < fs.next_seq; seq++) {
+			int used = logfs_read(&fs, seq, sector);
+			if(used < 0) {
+				fprintf(stderr, "seq %u: invalid sector skipped\n", seq);
+				continue;
+			}
+			fwrite(logfs_payload(sector), 1, used, stdout);
+		}
+		return 0;
+	}
+	fprintf(stderr, "unknown command %s\n", argv[1]);
+	return 1;
+}
@@ -0,0 +1,146 @@
+// Tool: queue_model.h
+//
+// Host model of the two logger queue engines (LOG_ENGINE in Core/Src/log.h), shared by
+// Tools/engine_bench.c and Tools/logplan.c so the benchmark and the planner replay the same policy:
+//   circular : one circular queue, each DMA transfer sends head..tail, or head..end of buffer when wrapped
+//   pingpong : two half buffers, the DMA completion swaps halves and sends the whole fill half
+// An item that doesn't fit is dropped whole (log_enqueue()).  The UART drains one byte per byte_us,
+// every DMA (re)start costs gap_us; both are set by the including tool.
+//
+// Header only, static functions: each tool is a single translation unit.
+
+#ifndef QUEUE_MODEL_H
+#define QUEUE_MODEL_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum { ENGINE_CIRCULAR, ENGINE_PINGPONG } engine_t;
+
+//=============================================================================
+// Queue model, byte counters only: data order is FIFO in both engines, so an item is done when the link
+// has sent all bytes up to its end offset.
+//=============================================================================
+typedef struct {
+	engine_t engine;
+	uint32_t size;          // buffer bytes
+	uint64_t queued;        // total bytes accepted
+	uint64_t sent_start;    // total bytes handed to DMA transfers before the one in progress
+	uint32_t dma_count;     // bytes in the DMA transfer in progress, 0: idle
+	double dma_done;        // time the transfer in progress completes
+	// circular
+	uint32_t head, tail;
+	// pingpong
+	uint32_t fill_len;
+	// item completion tracking
+	uint64_t *msg_end;      // end offset of every accepted item
+	double *msg_time;       // enqueue time
+	size_t msgs, msg_next, msg_cap;
+	double *latency;        // enqueue to last byte on the wire, us
+	size_t latencies;
+	// results
+	uint64_t dropped, offered_msgs, offered_bytes;
+	uint32_t peak_used, dma_starts;
+} sim_t;
+
+static double byte_us;    // UART byte time
+static double gap_us;     // ISR + DMA restart gap
+
+//=============================================================================
+static void sim_init(sim_t *s, engine_t engine, uint32_t size) {
+//=============================================================================
+	memset(s, 0, sizeof(*s));
+	s->engine = engine;
+	s->size = size;
+}
+
+//=============================================================================
+static void sim_free(sim_t *s) {
+//=============================================================================
+	free(s->msg_end);
+	free(s->msg_time);
+	free(s->latency);
+}
+
+//=============================================================================
+static uint32_t used_bytes(const sim_t *s) {
+//=============================================================================
+	if(s->engine == ENGINE_CIRCULAR) return (uint32_t)(s->queued - s->sent_start);
+	return s->fill_len + s->dma_count;
+}
+
+//=============================================================================
+// Start a DMA transfer if idle and data is waiting (restart_dma())
+static void restart(sim_t *s, double now) {
+//=============================================================================
+	if(s->dma_count) return;
+	uint32_t count;
+	if(s->engine == ENGINE_CIRCULAR) {
+		uint32_t avail = (uint32_t)(s->queued - s->sent_start);
+		count = avail > s->size - s->head ? s->size - s->head : avail;
+	} else {
+		count = s->fill_len;
+		s->fill_len = 0;
+	}
+	if(!count) return;
+	s->dma_count = count;
+	s->dma_starts++;
+	double start = now + gap_us;
+	s->dma_done = start + count * byte_us;
+	// Items ending inside this transfer complete when their last byte is sent
+	uint64_t end = s->sent_start + count;
+	while(s->msg_next < s->msgs && s->msg_end[s->msg_next] <= end) {
+		double done = start + (s->msg_end[s->msg_next] - s->sent_start) * byte_us;
+		s->latency[s->latencies++] = done - s->msg_time[s->msg_next];
+		s->msg_next++;
+	}
+}
+
+//=============================================================================
+// DMA completion (HAL_UART_TxCpltCallback())
+static void complete(sim_t *s) {
+//=============================================================================
+	double now = s->dma_done;
+	s->sent_start += s->dma_count;
+	if(s->engine == ENGINE_CIRCULAR) s->head = (s->head + s->dma_count) % s->size;
+	s->dma_count = 0;
+	restart(s, now);
+}
+
+//=============================================================================
+// logmsg()
+static void enqueue(sim_t *s, double now, uint32_t len) {
+//=============================================================================
+	s->offered_msgs++;
+	s->offered_bytes += len;
+	int fits;
+	if(s->engine == ENGINE_CIRCULAR) fits = used_bytes(s) + len <= s->size - 1;
+	else fits = s->fill_len + len <= s->size / 2;
+	if(!fits) {
+		s->dropped++;
+		return;
+	}
+	if(s->engine == ENGINE_CIRCULAR) s->tail = (s->tail + len) % s->size;
+	else s->fill_len += len;
+	s->queued += len;
+	if(s->msgs == s->msg_cap) {
+		s->msg_cap = s->msg_cap ? s->msg_cap * 2 : 4096;
+		s->msg_end = realloc(s->msg_end, s->msg_cap * sizeof(*s->msg_end));
+		s->msg_time = realloc(s->msg_time, s->msg_cap * sizeof(*s->msg_time));
+		s->latency = realloc(s->latency, s->msg_cap * sizeof(*s->latency));
+		if(!s->msg_end || !s->msg_time || !s->latency) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+	}
+	s->msg_end[s->msgs] = s->queued;
+	s->msg_time[s->msgs] = now;
+	s->msgs++;
+	uint32_t used = used_bytes(s);
+	if(used > s->peak_used) s->peak_used = used;
+	restart(s, now);
+}
+
+#endif // QUEUE_MODEL_H
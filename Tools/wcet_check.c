@@ -0,0 +1,333 @@
+// Tool: wcet_check.c
+//
+// Checks the bounded time log calls (logmsg_wcet() / logtag_wcet(), see log.h) of the target sources.
+//
+// Build: cc -O2 -Wall -I../Core/Src -o wcet_check wcet_check.c ../Core/Src/log_format.c
+// Usage: wcet_check [-b cycles] [-v] file.c...
+//
+// Every call with a string literal format is listed with its worst case: the longest output, and the
+// cycle bound LOG_WCET_CYC_ITEM + log_wcet_bound(format) from the cost model in log_format.h.
+// A call fails the check when its format is outside the restricted subset, when its bound is over the
+// budget (-b), or when the formatter, run here with extreme arguments (INT32_MIN, UINT32_MAX, %s longer
+// than LOG_WCET_MAX_STR, ...) and random ones, writes more than the bound's character count.
+// Formats that can't fit a log item are reported, the target truncates them.  A format taken from a table,
+// ex: logmsg_wcet(formats[f], ...), is checked entry by entry when the table is a string literal array
+// initialised in the same file (static const char * const formats[] = { "...", ... }).  -v also lists the
+// calls whose format can't be found (those can't be checked).
+// Comments and the functions' own declarations are skipped.  The exit status is 1 if any call failed.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include "log_format.h"
+
+#define ITEM_TEXT    128    // LOG_MAX_TEXT (log.h)
+#define TIMESTAMP    13     // "(4294967295) "
+#define CORE_MHZ     72
+#define MAX_ARGS     16
+#define RANDOM_RUNS  1000
+
+static long budget = -1;
+static int verbose;
+static unsigned calls, failures;
+
+//=============================================================================
+// String literal(s) at p, adjacent ones joined, escapes resolved.  Returns the position after the
+// last one, NULL if p isn't a literal or a macro sits between literals (ex: COLOR_RED "text").
+static const char *read_literal(const char *p, char *out, size_t size) {
+//=============================================================================
+	size_t n = 0;
+	int count = 0;
+	for(;;) {
+		while(isspace((unsigned char)*p)) p++;
+		if(*p != '"') break;
+		for(p++; *p && *p != '"'; p++) {
+			char c = *p;
+			if(c == '\\') {
+				c = *++p;
+				switch(c) {
+				case 'n': c = '\n'; break;
+				case 't': c = '\t'; break;
+				case 'r': c = '\r'; break;
+				case '0': c = 0; break;
+				case 'x': c = (char)strtol(p + 1, (char **)&p, 16); p--; break;
+				case '\0': return NULL;
+				}
+			}
+			if(n + 1 < size) out[n++] = c;
+		}
+		if(!*p) return NULL;
+		p++;
+		count++;
+	}
+	out[n] = 0;
+	if(!count || (*p != ',' && *p != ')' && *p != '}')) return NULL;
+	return p;
+}
+
+//=============================================================================
+static unsigned line_of(const char *text, const char *p) {
+//=============================================================================
+	unsigned line = 1;
+	for(; text < p; text++) if(*text == '\n') line++;
+	return line;
+}
+
+//=============================================================================
+// Conversion characters of the format, in argument order ("%%" left out)
+static int conversions(const char *format, char *conv) {
+//=============================================================================
+	int n = 0;
+	for(const char *p = format; *p; p++) {
+		if(*p != '%') continue;
+		p += strspn(p + 1, "-0123456789.hl") + 1;
+		if(!*p) break;
+		if(*p != '%' && n < MAX_ARGS) conv[n++] = *p;
+	}
+	return n;
+}
+
+//=============================================================================
+// Format with arguments picked by pick() for each conversion, return the output length
+// (all passed as intptr_t: an int or a pointer each take one argument slot on x86-64 and AArch64)
+static int run(const char *format, const char *conv, int nconv, intptr_t (*pick)(char c, int i)) {
+//=============================================================================
+	static char out[4096];
+	intptr_t a[MAX_ARGS] = { 0 };
+	for(int i = 0; i < nconv; i++) a[i] = pick(conv[i], i);
+	return log_wcet_snprintf(out, sizeof(out), format, a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7],
+			a[8], a[9], a[10], a[11], a[12], a[13], a[14], a[15]);
+}
+
+static const char long_text[] = "0123456789abcdefghijklmnopqrstuvwxyz0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+static intptr_t pick_extreme(char c, int i) {
+	(void)i;
+	switch(c) {
+	case 'd': case 'i': return INT32_MIN;
+	case 's': return (intptr_t)long_text;
+	case 'c': return 'x';
+	default: return UINT32_MAX;
+	}
+}
+
+static intptr_t pick_random(char c, int i) {
+	(void)i;
+	switch(c) {
+	case 's': return (intptr_t)&long_text[rand() % sizeof(long_text)];
+	case 'd': case 'i': return (int32_t)((uint32_t)rand() << 16 ^ (uint32_t)rand()) >> (rand() % 32);
+	default: return ((uint32_t)rand() << 16 ^ (uint32_t)rand()) >> (rand() % 32);
+	}
+}
+
+//=============================================================================
+static void check_call(const char *file, unsigned line, const char *format) {
+//=============================================================================
+	uint16_t chars;
+	int32_t bound = log_wcet_bound(format, &chars);
+	const char *problem = NULL;
+	calls++;
+
+	if(bound < 0) {
+		problem = "conversion outside the subset";
+	} else {
+		bound += LOG_WCET_CYC_ITEM;
+		char conv[MAX_ARGS];
+		int nconv = conversions(format, conv);
+		int longest = run(format, conv, nconv, pick_extreme);
+		for(int r = 0; r < RANDOM_RUNS; r++) {
+			int len = run(format, conv, nconv, pick_random);
+			if(len > longest) longest = len;
+		}
+		if(nconv >= MAX_ARGS) problem = "too many arguments to test";
+		else if(longest > chars) problem = "output longer than the bound";
+		else if(budget >= 0 && bound > budget) problem = "over budget";
+	}
+
+	printf("%s:%u: ", file, line);
+	if(bound < 0) printf("-");
+	else printf("%u chars, %ld cycles (%.1f us)", chars, (long)bound, (double)bound / CORE_MHZ);
+	if(bound >= 0 && chars + TIMESTAMP + 1 > ITEM_TEXT) printf(", truncated to %u chars", ITEM_TEXT - TIMESTAMP - 1);
+	printf("  \"");
+	for(const char *p = format; *p; p++) {
+		if(*p == '\n') printf("\\n");
+		else if(isprint((unsigned char)*p)) putchar(*p);
+		else printf("\\x%02x", (unsigned char)*p);
+	}
+	printf("\"");
+	if(problem) {
+		printf("  FAIL: %s", problem);
+		failures++;
+	}
+	printf("\n");
+}
+
+//=============================================================================
+// Format argument "name[index]": check every literal of the table "name[] = { ... }" of the file, once.
+// The table is the last one of that name ahead of the call (the enclosing scope), else the first after it.
+// Returns 0 if there is no such table.
+static int check_table(const char *file, const char *text, const char *arg) {
+//=============================================================================
+	static const char *checked[64];
+	static unsigned nchecked;
+	char name[64];
+	size_t n = 0;
+	while(isspace((unsigned char)*arg)) arg++;
+	while((isalnum((unsigned char)arg[n]) || arg[n] == '_') && n + 1 < sizeof(name)) { name[n] = arg[n]; n++; }
+	name[n] = 0;
+	const char *p = arg + n;
+	while(isspace((unsigned char)*p)) p++;
+	if(!n || *p != '[') return 0;
+
+	const char *table = NULL, *body = NULL;
+	for(const char *t = strstr(text, name); t; t = strstr(t + 1, name)) {
+		if((t > text && (isalnum((unsigned char)t[-1]) || t[-1] == '_')) || t == arg) continue;
+		const char *q = t + n;
+		if(*q++ != '[') continue;
+		while(*q && *q != ']' && *q != '\n') q++;
+		if(*q++ != ']') continue;
+		while(isspace((unsigned char)*q)) q++;
+		if(*q++ != '=') continue;
+		while(isspace((unsigned char)*q)) q++;
+		if(*q++ != '{') continue;
+		if(table && t > arg) break;
+		table = t;
+		body = q;
+		if(t > arg) break;
+	}
+	if(!table) return 0;
+
+	for(unsigned i = 0; i < nchecked; i++) if(checked[i] == table) return 1;
+	if(nchecked < sizeof(checked) / sizeof(checked[0])) checked[nchecked++] = table;
+	for(const char *q = body;;) {
+		char format[1024];
+		while(isspace((unsigned char)*q)) q++;
+		const char *end = read_literal(q, format, sizeof(format));
+		if(!end) return 1; // not a literal table, or its end
+		check_call(file, line_of(text, q), format);
+		q = end;
+		if(*q == ',') q++;
+	}
+}
+
+//=============================================================================
+// Blank out // and /* */ comments (newlines kept, for the line numbers), string and character
+// literals are skipped so "//" inside a format stays
+static void strip_comments(char *p) {
+//=============================================================================
+	while(*p) {
+		if(*p == '"' || *p == '\'') {
+			char quote = *p++;
+			for(; *p && *p != quote && *p != '\n'; p++) if(*p == '\\' && p[1]) p++;
+			if(*p == quote) p++;
+		} else if(p[0] == '/' && p[1] == '/') {
+			for(; *p && *p != '\n'; p++) *p = ' ';
+		} else if(p[0] == '/' && p[1] == '*') {
+			*p++ = ' ';
+			*p++ = ' ';
+			for(; *p && !(p[0] == '*' && p[1] == '/'); p++) if(*p != '\n') *p = ' ';
+			if(*p) {
+				*p++ = ' ';
+				*p++ = ' ';
+			}
+		} else {
+			p++;
+		}
+	}
+}
+
+//=============================================================================
+// Is the name at p declared or defined (after a type: "int logmsg_wcet(") rather than called?
+static int is_declaration(const char *text, const char *p) {
+//=============================================================================
+	while(p > text && isspace((unsigned char)p[-1])) p--;
+	if(p > text && p[-1] == '*') return 1;
+	const char *end = p;
+	while(p > text && (isalnum((unsigned char)p[-1]) || p[-1] == '_')) p--;
+	return p != end && !(end - p == 6 && !strncmp(p, "return", 6));
+}
+
+//=============================================================================
+// Find the calls in a source file
+static void scan_file(const char *file) {
+//=============================================================================
+	static const char * const names[] = { "logmsg_wcet", "logtag_wcet" };
+	FILE *in = fopen(file, "rb");
+	if(!in) {
+		perror(file);
+		failures++;
+		return;
+	}
+	fseek(in, 0, SEEK_END);
+	long size = ftell(in);
+	rewind(in);
+	char *text = malloc(size + 1);
+	if(!text || fread(text, 1, size, in) != (size_t)size) {
+		fprintf(stderr, "%s: read error\n", file);
+		failures++;
+		free(text);
+		fclose(in);
+		return;
+	}
+	text[size] = 0;
+	fclose(in);
+	strip_comments(text);
+
+	unsigned line = 1;
+	const char *counted = text;
+	for(const char *p = text; *p; p++) {
+		for(unsigned k = 0; k < 2; k++) {
+			size_t n = strlen(names[k]);
+			if(strncmp(p, names[k], n) || (p > text && (isalnum((unsigned char)p[-1]) || p[-1] == '_')))
+				continue;
+			const char *q = p + n;
+			while(isspace((unsigned char)*q)) q++;
+			if(*q++ != '(') continue;
+			if(is_declaration(text, p)) continue;
+			for(; counted < p; counted++) if(*counted == '\n') line++;
+			if(k == 1) { // logtag_wcet(tag, format, ...)
+				int depth = 0;
+				for(; *q && (depth || *q != ','); q++) {
+					if(*q == '(') depth++;
+					if(*q == ')') depth--;
+					if(depth < 0) break;
+				}
+				if(*q != ',') continue;
+				q++;
+			}
+			char format[1024];
+			if(read_literal(q, format, sizeof(format))) check_call(file, line, format);
+			else if(!check_table(file, text, q) && verbose)
+				printf("%s:%u: format not a literal, not checked\n", file, line);
+			p = q - 1;
+			break;
+		}
+	}
+	free(text);
+}
+
+//=============================================================================
+int main(int argc, char *argv[]) {
+//=============================================================================
+	int opt;
+	while((opt = getopt(argc, argv, "b:v")) != -1) {
+		switch(opt) {
+		case 'b': budget = strtol(optarg, NULL, 0); break;
+		case 'v': verbose = 1; break;
+		default:
+			fprintf(stderr, "usage: %s [-b cycles] [-v] file.c...\n", argv[0]);
+			return 2;
+		}
+	}
+	if(optind >= argc) {
+		fprintf(stderr, "usage: %s [-b cycles] [-v] file.c...\n", argv[0]);
+		return 2;
+	}
+	srand(1);
+	for(int i = optind; i < argc; i++) scan_file(argv[i]);
+	printf("%u calls, %u failed\n", calls, failures);
+	return failures ? 1 : 0;
+}